@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include "driver/gpio.h"
 #include "driver/timer.h"
+#include "driver/rmt.h"
+#include "driver/i2s.h"
 
 typedef enum {
   PULSE_LOW = 0,
@@ -12,25 +14,199 @@ typedef enum {
 
 typedef uint64_t pulse_duration_t;
 
+// Produces the pulses of a generated train one by one, from the transmit
+// interrupt. Returns false once the train is over. Must live in IRAM.
+typedef bool (*pulse_generator_t) (void * state, pulse_duration_t * duration, pulse_level_t * level);
+
+#define PULSE_GENERATOR_STATE_SIZE 16
+
+#define PULSE_LOOP_FOREVER 0xffff
+
+#define PULSE_DEFAULT_MAX_SEGMENTS 16
+
+#define PULSE_MAX_CHANNELS 8
+
+// Lets the controller place the train on whichever channel frees up first.
+#define PULSE_CHANNEL_ANY 0xff
+
+typedef enum {
+  // One timer interrupt per edge, GPIO toggled by the alarm handler.
+  PULSE_BACKEND_TIMER = 0,
+  // Whole train converted to RMT items and played by the peripheral.
+  PULSE_BACKEND_RMT = 1,
+  // Train rendered to a fixed rate bitstream streamed by the I2S DMA.
+  PULSE_BACKEND_I2S = 2
+} pulse_backend_type_t;
+
+typedef enum {
+  PULSE_PRIORITY_NORMAL = 0,
+  // Jumps ahead of queued trains and cuts a normal train on air short at
+  // its next boundary.
+  PULSE_PRIORITY_URGENT = 1
+} pulse_priority_t;
+
+// One output of the controller and the peripheral driving it, depending on
+// the backend.
+typedef struct {
+  gpio_num_t gpio;
+  timer_group_t timer_group;
+  timer_idx_t timer_idx;
+  rmt_channel_t rmt_channel;
+  i2s_port_t i2s_port;
+} pulse_channel_config_t;
+
 typedef struct {
   timer_group_t timer_group;
   timer_idx_t timer_idx;
   gpio_num_t gpio;
+  // Trains queued per channel, on top of the one on air.
   uint8_t max_queue_size;
+  pulse_backend_type_t backend;
+  rmt_channel_t rmt_channel;
+  uint8_t rmt_mem_block_num;
+  i2s_port_t i2s_port;
+  // Duration of one bitstream sample in µs, 10 when left to 0.
+  uint8_t i2s_sample_us;
+  // Capacity of each pooled train buffer. Generated trains need none, so
+  // a controller only fed by generators can leave it to 0.
+  uint16_t max_pulses;
+  // Number of pulse runs, shared segments and generators a train can
+  // chain, 16 when left to 0.
+  uint8_t max_segments;
+  // How long pulse_train_init waits for a free buffer before giving up.
+  uint32_t pool_wait_ms;
+  // Outputs played in parallel, all on the same backend. When channel_count
+  // is 0 the controller has a single channel made of the gpio, timer_group,
+  // timer_idx, rmt_channel and i2s_port fields above.
+  uint8_t channel_count;
+  pulse_channel_config_t channels[PULSE_MAX_CHANNELS];
+  // Airtime budget shared by all channels: trains are held back so that
+  // the transmitter stays on air duty_permille of the time, with bursts of
+  // up to duty_window_ms worth of budget. 0 disables it.
+  uint16_t duty_permille;
+  uint32_t duty_window_ms;
 } pulse_ctl_config_t;
 
+typedef struct {
+  // Train buffers are allocated once: per channel one on air,
+  // max_queue_size queued and a few urgent ones, plus one being built.
+  uint16_t pool_size;
+  uint16_t pool_in_use;
+  uint16_t pool_high_water;
+  uint32_t pool_acquired;
+  // pulse_train_init calls that had to wait for a buffer, and those that
+  // got none within pool_wait_ms.
+  uint32_t pool_waits;
+  uint32_t pool_exhausted;
+  // Delay between a train origin and its first edge, for the last train
+  // started and the worst so far.
+  int64_t last_start_latency_us;
+  int64_t max_start_latency_us;
+  // Trains dropped by pulse_train_send because they outgrew their buffer
+  // or segment chain.
+  uint32_t train_overflows;
+  // Normal trains told to stop at their next boundary to make way for an
+  // urgent one.
+  uint32_t trains_preempted;
+  // Times the controller task woke up, once per event batch.
+  uint32_t task_wakeups;
+  // Airtime of the trains started, less what preempted ones never sent,
+  // and trains held back by the airtime budget.
+  int64_t airtime_us;
+  uint32_t trains_deferred;
+} pulse_ctl_stats_t;
+
+typedef struct {
+  // Trains waiting for this channel, urgent ones included.
+  uint8_t queued;
+  uint32_t trains;
+  // Time spent playing trains, and its share of the controller lifetime
+  // in percent.
+  int64_t busy_us;
+  uint8_t utilization;
+} pulse_channel_stats_t;
+
 typedef void * pulse_ctl_handle_t;
 
 typedef void * pulse_train_handle_t;
 
+typedef void * pulse_segment_handle_t;
+
 pulse_ctl_handle_t pulse_ctl_new (pulse_ctl_config_t * cfg);
 
 esp_err_t pulse_ctl_free (pulse_ctl_handle_t handle);
 
+esp_err_t pulse_ctl_get_stats (pulse_ctl_handle_t handle, pulse_ctl_stats_t * stats);
+
+esp_err_t pulse_ctl_get_channel_stats (pulse_ctl_handle_t handle, uint8_t channel, pulse_channel_stats_t * stats);
+
+// Estimates when a train of airtime_us sent now would start, in
+// esp_timer_get_time time, after the trains on air and queued on channel,
+// or on the soonest free one with PULSE_CHANNEL_ANY, and the airtime budget.
+esp_err_t pulse_ctl_estimate_start (pulse_ctl_handle_t handle, uint8_t channel, int64_t airtime_us, int64_t * start_us);
+
+// Takes a train buffer from the controller pool. Returns ESP_ERR_NO_MEM
+// when none was released within pool_wait_ms.
 esp_err_t pulse_train_init (pulse_ctl_handle_t handle, pulse_train_handle_t * message);
 
 esp_err_t pulse_train_add_pulse (pulse_train_handle_t handle, pulse_duration_t duration, pulse_level_t pulse);
 
+// Appends pulses produced on the fly by generator. state is copied into the
+// train and restored each time the train is replayed from the start.
+esp_err_t pulse_train_add_generator (pulse_train_handle_t handle, pulse_generator_t generator,
+  const void * state, size_t state_size);
+
+// Appends a reference to a shared segment, which must outlive the train.
+esp_err_t pulse_train_add_segment (pulse_train_handle_t handle, pulse_segment_handle_t segment);
+
+// Entries appended between pulse_train_loop_begin and pulse_train_loop_end
+// are played count times in a row without being rebuilt, or until
+// pulse_ctl_cancel_loops when count is PULSE_LOOP_FOREVER. A train has at
+// most one loop; entries appended after it play once the loop is over.
+esp_err_t pulse_train_loop_begin (pulse_train_handle_t handle);
+
+esp_err_t pulse_train_loop_end (pulse_train_handle_t handle, uint16_t count);
+
+// Ends the loops of every train sent so far at the end of their current
+// iteration, whether they are on air or still queued.
+esp_err_t pulse_ctl_cancel_loops (pulse_ctl_handle_t handle);
+
+// Ends the loops of the trains tagged tag the same way, leaving the others
+// alone. Trains being built count as well, so that one sent right after is
+// not left looping. Untagged trains have tag 0.
+esp_err_t pulse_ctl_cancel_loop (pulse_ctl_handle_t handle, uint32_t tag);
+
+// Marks a point where the train may be cut short, before the next entry
+// appended. Protocols mark the start of each frame so that a preempted
+// train never stops in the middle of one. The start of a loop is always
+// such a point.
+esp_err_t pulse_train_add_boundary (pulse_train_handle_t handle);
+
+esp_err_t pulse_train_set_priority (pulse_train_handle_t handle, pulse_priority_t priority);
+
+// Pins the train to one channel. Trains are placed on the least busy
+// channel when sent otherwise.
+esp_err_t pulse_train_set_channel (pulse_train_handle_t handle, uint8_t channel);
+
+// Marks when the event that caused this train happened, in esp_timer_get_time
+// time. The controller measures the delay from there to the first edge.
+esp_err_t pulse_train_set_origin (pulse_train_handle_t handle, int64_t origin_us);
+
+// Tags the train with what it is sent for, so that pulse_ctl_cancel_loop
+// can end its loop alone.
+esp_err_t pulse_train_set_tag (pulse_train_handle_t handle, uint32_t tag);
+
+// Queues the train for transmission. The handle belongs to the controller
+// afterwards, even on failure, when the buffer goes straight back to the pool.
+// Urgent trains never wait for room in the queue, they fail at once.
 esp_err_t pulse_train_send (pulse_train_handle_t handle);
 
+// Segments are immutable runs of pulses built once and referenced by any
+// number of trains, for the parts every transmission has in common.
+esp_err_t pulse_segment_new (uint16_t capacity, pulse_segment_handle_t * segment);
+
+esp_err_t pulse_segment_add_pulse (pulse_segment_handle_t segment, pulse_duration_t duration, pulse_level_t level);
+
+esp_err_t pulse_segment_free (pulse_segment_handle_t segment);
+
 #endif //__pulse_h
\ No newline at end of file
@@ -11,11 +11,69 @@
 
 typedef void * somfy_ctl_handle_t;
 
+#define SOMFY_HOLD_UNTIL_RELEASE PULSE_LOOP_FOREVER
+
+// How long the request ID of a command suppresses its duplicates.
+#define SOMFY_REQUEST_WINDOW_US (10 * 1000000LL)
+
+typedef struct {
+  // Presses served from a precomputed frame, and those that had to allocate
+  // a rolling code and build the frame first.
+  uint32_t cache_hits;
+  uint32_t cache_misses;
+  // Press, when the command is queued, to train queued, for the last hit
+  // and the last miss. The wait for the scheduler task counts.
+  int64_t hit_latency_us;
+  int64_t miss_latency_us;
+  // Commands replaced by a newer one for the same remote before being sent,
+  // refused because every remote slot was taken, sent, and taken but not
+  // sent because building or queuing the train failed.
+  uint32_t commands_coalesced;
+  uint32_t commands_dropped;
+  uint32_t commands_executed;
+  uint32_t commands_failed;
+  // Commands acknowledged without being sent, their request ID was seen
+  // within SOMFY_REQUEST_WINDOW_US.
+  uint32_t commands_duplicate;
+  // Press to rolling code allocated for the last miss, and reservation to
+  // durable for the last save. Saves overlap with transmission.
+  int64_t allocate_latency_us;
+  int64_t persist_latency_us;
+  // Config saves to NVS, flash bytes used by the last one and by all.
+  uint32_t persist_count;
+  size_t persist_last_bytes;
+  uint64_t persist_total_bytes;
+  // Background posts of the config to the server.
+  somfy_config_replicator_stats_t replication;
+} somfy_ctl_stats_t;
+
 esp_err_t somfy_ctl_init (somfy_config_handle_t config, pulse_ctl_config_t * pulse_cfg, somfy_ctl_handle_t * ctl);
 
 esp_err_t somfy_ctl_free (somfy_ctl_handle_t ctl);
 
+// Schedules command and returns without waiting. Each remote has a single
+// pending slot: a command not sent yet is replaced by a newer one for the
+// same remote. STOP commands are sent before any other. Returns
+// ESP_ERR_NO_MEM when every slot is taken by other remotes. A command
+// whose request_id was accepted within SOMFY_REQUEST_WINDOW_US is a retry
+// of that one: it returns ESP_OK without being sent again.
 esp_err_t somfy_ctl_send_command(somfy_ctl_handle_t ctl, somfy_command_t *command);
 
+// Sends a scene: the rolling codes of all count remotes are allocated and
+// persisted at once, and their frames go out back to back in as few trains
+// as the controller max_segments allows. Blocks until the trains are queued.
+esp_err_t somfy_ctl_send_group(somfy_ctl_handle_t ctl, somfy_command_t *commands, size_t count);
+
+// Sends command as a held button, the way a real remote does: the frame is
+// repeated repeats more times, or until somfy_ctl_release with
+// SOMFY_HOLD_UNTIL_RELEASE. The whole press uses a single rolling code.
+esp_err_t somfy_ctl_hold_command(somfy_ctl_handle_t ctl, somfy_command_t *command, uint16_t repeats);
+
+// Ends the held command of remote on air, or drops it if it is still
+// pending. The holds of other remotes go on.
+esp_err_t somfy_ctl_release(somfy_ctl_handle_t ctl, somfy_remote_t remote);
+
+esp_err_t somfy_ctl_get_stats(somfy_ctl_handle_t ctl, somfy_ctl_stats_t *stats);
+
 
 #endif //__somfy_h
@@ -2,6 +2,7 @@
 #define __somfy_config_h
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <esp_err.h>
 
 
@@ -19,14 +20,61 @@ typedef enum {
 typedef struct {
   somfy_remote_t remote;
   somfy_button_t button;
+  // Set by callers that may submit the same command again, 0 otherwise.
+  uint32_t request_id;
 } somfy_command_t;
 
+// How the commands of a remote are put on air: frames sent per command,
+// hardware syncs before the first and the repeated frames, symbol length
+// and gap between frames. Motors close to the antenna react to a single
+// frame, distant ones need more repeats.
+typedef struct {
+  uint8_t frames;
+  uint8_t first_syncs;
+  uint8_t repeat_syncs;
+  uint16_t symbol_us;
+  uint32_t gap_us;
+} somfy_profile_t;
+
+// How a code handed out relates to the persisted reservation of its remote.
+typedef enum {
+  // Covered by the reservation already persisted.
+  SOMFY_CONFIG_RESERVE_NONE = 0,
+  // Covered by the persisted reservation, which moved one block ahead: the
+  // new one may be saved while the code is on air.
+  SOMFY_CONFIG_RESERVE_AHEAD,
+  // Past the persisted reservation: the new one must be durable before the
+  // code is sent.
+  SOMFY_CONFIG_RESERVE_NOW
+} somfy_config_reserve_t;
+
+#define SOMFY_PROFILE_DEFAULT { .frames = 3, .first_syncs = 2, .repeat_syncs = 7, .symbol_us = 640, .gap_us = 30415 }
+
 typedef struct  {
   char *remote_name;
   somfy_remote_t remote;
   somfy_rolling_code_t rolling_code;
+  // Highest code that may be handed out without persisting the config
+  // again. This is the code serialized, so a restart resumes past every
+  // code that could have been sent.
+  somfy_rolling_code_t reserved_code;
+  // Next block leased from the config server, [lease_first, lease_last],
+  // used once the current one runs out. Not persisted.
+  somfy_rolling_code_t lease_first;
+  somfy_rolling_code_t lease_last;
+  bool lease_ready;
+  somfy_profile_t profile;
+  // SOMFY_CONFIG_DIRTY_* parts changed since last persisted.
+  uint8_t dirty;
 } somfy_config_remote_t;
 
+// Name and profile, rarely changed.
+#define SOMFY_CONFIG_DIRTY_META (1 << 0)
+// Reserved rolling code.
+#define SOMFY_CONFIG_DIRTY_CODE (1 << 1)
+// Presence in the list of remotes, set when the remote is added.
+#define SOMFY_CONFIG_DIRTY_LISTED (1 << 2)
+
 
 typedef void * somfy_config_handle_t;
 
@@ -34,22 +82,117 @@ typedef void * somfy_config_remote_handle_t;
 
 typedef void * somfy_config_blob_handle_t;
 
+typedef void (* somfy_config_lease_hook_t) (void * arg);
+
 esp_err_t somfy_config_new(somfy_config_handle_t * handle);
 
 esp_err_t somfy_config_free(somfy_config_handle_t handle);
 
+// Longest remote name, in bytes. Names are stored with an 8-bit length.
+#define SOMFY_CONFIG_NAME_MAX 255
+
+// ESP_ERR_INVALID_ARG when remote_name is longer than SOMFY_CONFIG_NAME_MAX.
 esp_err_t somfy_config_remote_new(const char * remote_name, somfy_remote_t remote, somfy_rolling_code_t code, somfy_config_remote_handle_t * handle);
 
 esp_err_t somfy_config_remote_free (somfy_config_remote_handle_t handle);
 
 esp_err_t somfy_config_add_remote(somfy_config_handle_t cfg, somfy_config_remote_handle_t remote_cfg);
 
-esp_err_t somfy_config_increment_rolling_code (somfy_config_handle_t cfg, somfy_remote_t remote, somfy_rolling_code_t * rolling_code);
+bool somfy_profile_equal (const somfy_profile_t * a, const somfy_profile_t * b);
+
+esp_err_t somfy_config_get_profile (somfy_config_handle_t cfg, somfy_remote_t remote, somfy_profile_t * profile);
+
+esp_err_t somfy_config_set_profile (somfy_config_handle_t cfg, somfy_remote_t remote, const somfy_profile_t * profile);
+
+esp_err_t somfy_config_get_rolling_code (somfy_config_handle_t cfg, somfy_remote_t remote, somfy_rolling_code_t * rolling_code);
+
+// The code a restart would resume from, the one persisted and replicated.
+esp_err_t somfy_config_get_reserved_code (somfy_config_handle_t cfg, somfy_remote_t remote, somfy_rolling_code_t * reserved_code);
+
+// Copies up to max remote ids into remotes, count is the total number of remotes.
+esp_err_t somfy_config_list_remotes (somfy_config_handle_t cfg, somfy_remote_t * remotes, size_t max, size_t * count);
+
+// Id of the first remote added with that name.
+esp_err_t somfy_config_find_remote_by_name (somfy_config_handle_t cfg, const char * name, somfy_remote_t * remote);
+
+// Hands out the next rolling code from RAM. The reservation of a remote is
+// kept a whole block ahead of the code handed out, so the persisted one
+// covers the codes on air while the next is being saved. reserved tells
+// whether the caller owes a persisted copy of the config, and whether it is
+// owed before sending. Each reservation must be durable before the next code
+// of the remote is handed out. reserved may be NULL.
+esp_err_t somfy_config_increment_rolling_code (somfy_config_handle_t cfg, somfy_remote_t remote, somfy_rolling_code_t * rolling_code, somfy_config_reserve_t * reserved);
+
+// Increments the rolling code of count remotes under a single lock, storing
+// the new codes in rolling_codes and, unless NULL, how each one moved its
+// reservation in reserved. A remote listed several times gets a code per
+// entry. Nothing changes unless all remotes exist and have that many codes.
+esp_err_t somfy_config_increment_rolling_codes (somfy_config_handle_t cfg, const somfy_remote_t * remotes, size_t count, somfy_rolling_code_t * rolling_codes, somfy_config_reserve_t * reserved);
+
+// Switches cfg to leased blocks: several bridges emulating the same remotes
+// get disjoint blocks of codes from the config server instead of reserving
+// them locally. hook is called when a remote runs low on leased codes, with
+// the config locked, so it must only wake up whoever renews leases.
+// Allocations fail with ESP_ERR_INVALID_STATE while a remote has no code
+// left.
+esp_err_t somfy_config_set_leased (somfy_config_handle_t cfg, somfy_config_lease_hook_t hook, void * arg);
 
+// Whether remote runs low on leased codes without a next block yet, and
+// the last code it may have used, which the next block must start after.
+esp_err_t somfy_config_lease_needed (somfy_config_handle_t cfg, somfy_remote_t remote, bool * needed, somfy_rolling_code_t * reserved_code);
+
+// Installs [first, last] as the next block of remote. The block must start
+// after the reserved code.
+esp_err_t somfy_config_set_lease (somfy_config_handle_t cfg, somfy_remote_t remote, somfy_rolling_code_t first, somfy_rolling_code_t last);
+
+// Copies up to max remotes with unsaved changes into remotes and marks them
+// clean, count is the number copied. Names are shared with the config,
+// remotes are never removed from it. Callers that fail to save a remote
+// mark it dirty again.
+esp_err_t somfy_config_take_dirty (somfy_config_handle_t cfg, somfy_config_remote_t * remotes, size_t max, size_t * count);
+
+esp_err_t somfy_config_mark_dirty (somfy_config_handle_t cfg, somfy_remote_t remote, uint8_t dirty);
+
+// Writes the v2 format: a header with a CRC32, fixed size records and a
+// table of names.
 esp_err_t somfy_config_serialize (somfy_config_handle_t cfg, somfy_config_blob_handle_t * blob);
 
+// Reads v2 and older blobs, checking every length against the blob size.
+// A v2 blob is checked as a whole first, then the config keeps a copy of
+// its table of names and frees the rest: the blob is left empty, still to be
+// freed. cfg is NULL on error.
 esp_err_t somfy_config_deserialize (somfy_config_blob_handle_t blob, somfy_config_handle_t * cfg);
 
 esp_err_t somfy_config_blob_free (somfy_config_blob_handle_t blob);
 
+typedef void * somfy_config_serializer_handle_t;
+
+typedef void * somfy_config_parser_handle_t;
+
+// Writes the v2 format of cfg a few bytes at a time, for bodies sent in
+// chunks, with a fixed amount of memory. The remotes are those of cfg when
+// the serializer is created, each record is read from cfg when reached.
+esp_err_t somfy_config_serializer_new (somfy_config_handle_t cfg, somfy_config_serializer_handle_t * serializer);
+
+// Bytes of the whole blob, known up front for Content-Length.
+size_t somfy_config_serializer_size (somfy_config_serializer_handle_t serializer);
+
+// Copies up to size next bytes of the blob to buffer. length is below size
+// only at the end of the blob.
+esp_err_t somfy_config_serializer_read (somfy_config_serializer_handle_t serializer, void * buffer, size_t size, size_t * length);
+
+esp_err_t somfy_config_serializer_free (somfy_config_serializer_handle_t serializer);
+
+// Reads a v2 blob fed in pieces of any size, as they come off the network.
+// Records and names are kept as they arrive, nothing else of the blob is.
+esp_err_t somfy_config_parser_new (somfy_config_parser_handle_t * parser);
+
+// Returns the first error met, every later feed returns it again.
+esp_err_t somfy_config_parser_feed (somfy_config_parser_handle_t parser, const void * data, size_t size);
+
+// Checks the blob was fed whole and builds cfg from it.
+esp_err_t somfy_config_parser_finish (somfy_config_parser_handle_t parser, somfy_config_handle_t * cfg);
+
+esp_err_t somfy_config_parser_free (somfy_config_parser_handle_t parser);
+
 #endif//__somfy_config_h
\ No newline at end of file
@@ -5,6 +5,56 @@
 
 esp_err_t somfy_config_blob_http_write(somfy_config_blob_handle_t config, char *url);
 
+// Reads the whole body into a new blob.
 esp_err_t somfy_config_blob_http_read(somfy_config_blob_handle_t *config, char *url);
 
+// Reads a v2 config from url, parsed as the body comes in rather than
+// gathered first.
+esp_err_t somfy_config_http_read(const char *url, somfy_config_handle_t *cfg);
+
+typedef void * somfy_config_replicator_handle_t;
+
+typedef struct {
+  // Changed remotes reported, and reported again before being sent.
+  uint32_t marked;
+  uint32_t coalesced;
+  // Posts of deltas and of full snapshots, and failed attempts.
+  uint32_t deltas;
+  uint32_t snapshots;
+  uint32_t failed;
+  // Connections opened and request body bytes sent.
+  uint32_t connections;
+  uint64_t bytes_sent;
+  // Duration of the last successful post.
+  int64_t last_latency_us;
+} somfy_config_replicator_stats_t;
+
+// Replicates cfg to url from a background task. Changes go as deltas of
+// (remote, reserved code) records over a single keep-alive connection. The
+// whole config is posted on each new connection and when the server answers
+// a delta with 409 Conflict, on a connection of its own and serialized while
+// written. Failed posts are retried with an exponential backoff.
+esp_err_t somfy_config_replicator_new(somfy_config_handle_t cfg, const char *url, somfy_config_replicator_handle_t *replicator);
+
+esp_err_t somfy_config_replicator_free(somfy_config_replicator_handle_t replicator);
+
+// Reports that the reserved code of remote changed. Returns without
+// touching the network, all changes waiting are sent in one post.
+esp_err_t somfy_config_replicator_mark(somfy_config_replicator_handle_t replicator, somfy_remote_t remote);
+
+esp_err_t somfy_config_replicator_get_stats(somfy_config_replicator_handle_t replicator, somfy_config_replicator_stats_t *stats);
+
+typedef void * somfy_config_lease_handle_t;
+
+// Leases blocks of rolling codes for the remotes of cfg from url, so that
+// bridges sharing remotes never send the same code. Each request posts
+// bridge (4 bytes), remote (4 bytes) and the last code the bridge may have
+// used (2 bytes). The server answers with the first and last code (2 bytes
+// each) of a block that starts past it and was given to no other bridge.
+// The next block is asked for in the background while the current one
+// still has a few codes left.
+esp_err_t somfy_config_lease_new(somfy_config_handle_t cfg, const char *url, uint32_t bridge, somfy_config_lease_handle_t *lease);
+
+esp_err_t somfy_config_lease_free(somfy_config_lease_handle_t lease);
+
 #endif//__somfy_config_http
\ No newline at end of file
@@ -7,4 +7,17 @@ esp_err_t somfy_config_blob_nvs_write (somfy_config_blob_handle_t blob);
 
 esp_err_t somfy_config_blob_nvs_read (somfy_config_blob_handle_t * blob);
 
+// Keyed layout: the list of remotes, then per remote its name and profile
+// under one key and its reserved rolling code under another, so a new
+// reservation only rewrites two bytes.
+
+// Writes the remotes with unsaved changes, and the list of remotes when one
+// was added. written is the estimated flash bytes used, whole NVS entries.
+esp_err_t somfy_config_nvs_save (somfy_config_handle_t cfg, size_t * written);
+
+// Loads the keyed layout. A config still stored as a single config_data blob
+// is migrated to it once. ESP_ERR_NOT_FOUND when there is neither. cfg is
+// NULL on any error, and a config_data blob that fails to migrate is kept.
+esp_err_t somfy_config_nvs_load (somfy_config_handle_t * cfg);
+
 #endif//__somfy_config_nvs
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <string.h>
 #include "buttons.h"
 #include "osi/list.h"
@@ -6,13 +7,22 @@
 #include "freertos/queue.h"
 #include "freertos/task.h"
 #include "esp_err.h"
+#include "esp_log.h"
 #include "mutex.h"
+#include "spsc_ring.h"
+
+static const char* TAG = "buttons";
+
+// Edges buffered between two runs of the button task.
+#define BUTTON_EVENTS 16
 
 typedef struct {
   list_t* buttons;
   uint64_t pins;
   SemaphoreHandle_t buttons_mutex;
-  QueueHandle_t event_queue;
+  // Filled by the GPIO interrupt, the single producer since all the pins
+  // share the GPIO ISR service, and drained by the button task.
+  spsc_ring_t events;
   TaskHandle_t event_task;
   uint8_t pressed;
 } buttons_ctl_t;
@@ -41,7 +51,7 @@ esp_err_t buttons_ctl_init(buttons_ctl_handle_t* handle_ctl) {
   ctl->pins = 0;
   ESP_ERROR_CHECK_NOTNULL(ctl->buttons = list_new(NULL));
   ESP_ERROR_CHECK_NOTNULL(ctl->buttons_mutex = xSemaphoreCreateMutex());
-  ESP_ERROR_CHECK_NOTNULL(ctl->event_queue = xQueueCreate(5, sizeof(button_t*)));
+  ESP_ERROR_CHECK(spsc_ring_init(&ctl->events, BUTTON_EVENTS));
   ESP_ERROR_CHECK(xTaskCreate(&button_ctl_task, "buttons_ctl", 2048, ctl, 5, &ctl->event_task));
   *handle_ctl = ctl;
   return ESP_OK;
@@ -59,8 +69,8 @@ esp_err_t buttons_ctl_deinit(buttons_ctl_handle_t handle_ctl) {
   list_free(ctl->buttons);
   MUTEX_GIVE(ctl->buttons_mutex);
   vSemaphoreDelete(ctl->buttons_mutex);
-  vQueueDelete(ctl->event_queue);
   vTaskDelete(ctl->event_task);
+  spsc_ring_free(&ctl->events);
   free(ctl);
   return ESP_OK;
 }
@@ -113,12 +123,20 @@ int64_t millis() {
 
 void button_ctl_task(void* data) {
   buttons_ctl_t* ctl = (buttons_ctl_t*)data;
+  uint32_t overflows = 0;
   for (;;) {
     button_t* btn;
-    TickType_t idle = (ctl->pressed > 0 ? 10 : 1000) / portTICK_PERIOD_MS;
-    BaseType_t received = xQueueReceive(ctl->event_queue, &btn, idle);
-    if (received != pdTRUE)
+    if (!spsc_ring_pop(&ctl->events, (void**)&btn)) {
+      TickType_t idle = (ctl->pressed > 0 ? 10 : 1000) / portTICK_PERIOD_MS;
+      ulTaskNotifyTake(pdTRUE, idle);
       continue;
+    }
+
+    uint32_t dropped = atomic_load(&ctl->events.overflows);
+    if (dropped != overflows) {
+      ESP_LOGW(TAG, "%" PRIu32 " button events dropped, ring full.", dropped - overflows);
+      overflows = dropped;
+    }
 
     int64_t now = millis();
     bool pressed = (gpio_get_level(btn->config.gpio) != false) ^ btn->config.inverted;
@@ -170,5 +188,11 @@ void invoke_callback_and_reset_button(button_t* btn, button_event_type_t event_t
 
 IRAM_ATTR void button_isr_handler(void* data) {
   button_t* btn = (button_t*)data;
-  xQueueGenericSendFromISR(btn->ctl->event_queue, &btn, NULL, queueSEND_TO_BACK);
+  if (!spsc_ring_push(&btn->ctl->events, btn))
+    return;
+
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(btn->ctl->event_task, &woken);
+  if (woken == pdTRUE)
+    portYIELD_FROM_ISR();
 }
\ No newline at end of file
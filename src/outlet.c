@@ -24,30 +24,35 @@ void button_pressed (button_event_t* event);
 
 void outlet_init() {
   
-  somfy_config_blob_handle_t blob;
-  if (somfy_config_blob_nvs_read(&blob) == ESP_OK) {
+  size_t written;
+  esp_err_t loaded = somfy_config_nvs_load(&config);
+  if (loaded == ESP_OK) {
     ESP_LOGI(TAG, "Found somfy config.");
-    somfy_config_deserialize(blob, &config);
   } else {
+    // Any other error leaves a stored config behind, saving a new one
+    // would replace its rolling codes by lower ones.
+    if (loaded != ESP_ERR_NOT_FOUND)
+      ESP_ERROR_CHECK(loaded);
+
     ESP_LOGI(TAG, "No somfy config found. Creating a new one.");
     somfy_config_new(&config);
     somfy_config_remote_handle_t remote1;
     somfy_config_remote_new("Bureau", 0x100000, 126, &remote1);
 
     somfy_config_add_remote (config, remote1);
-    somfy_config_serialize (config, &blob);
-    somfy_config_blob_nvs_write (blob);
+    somfy_config_nvs_save (config, &written);
   }
 
-  somfy_config_blob_http_write (blob, "http://blav.ngrok.io/config");
-  somfy_config_blob_free (blob);
-  ESP_LOGI(TAG, "config sent");
-
   pulse_ctl_config_t pulse_cfg = {
     .gpio = SOMFY_GPIO,
     .timer_group = TIMER_GROUP_0,
     .timer_idx = TIMER_0,
-    .max_queue_size = 3
+    .max_queue_size = 3,
+    .backend = PULSE_BACKEND_RMT,
+    .rmt_channel = RMT_CHANNEL_0,
+    .rmt_mem_block_num = 1,
+    // Room for scenes of up to 7 remotes of the default profile in a single train.
+    .max_segments = 64
   };
 
   somfy_ctl_init (config, &pulse_cfg, &ctl); 
@@ -68,16 +73,22 @@ void outlet_init() {
   */
 }
 
+// Every HomeKit write is a press of its own, even of the state already
+// written: the blind may have been stopped or moved by its own remote
+// since. Each one gets a new request ID, so that the scheduler never takes
+// it for a retry of the one before.
+static uint32_t outlet_request_id;
+
 void outlet_set_state(bool state) {
+  outlet_request_id = outlet_request_id == UINT32_MAX ? 1 : outlet_request_id + 1;
+
   somfy_command_t command = {
     .button = state ? BUTTON_UP : BUTTON_DOWN,
     .remote = 0x100000,
+    .request_id = outlet_request_id,
   };
 
-  somfy_config_blob_handle_t blob;
-  somfy_config_serialize (config, &blob);
-  somfy_config_blob_http_write (blob, "http://blav.ngrok.io/config");
-  somfy_config_blob_free (blob);
+  // The config is posted by the background save of somfy_ctl.
   somfy_ctl_send_command (ctl, &command); 
 }
 
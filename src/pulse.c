@@ -3,221 +3,817 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
-#include "osi/list.h"
-#include "soc/rtc.h"
+#include "esp_timer.h"
 #include "pulse.h"
+#include "pulse_backend.h"
+#include "mutex.h"
 
 static const char* DRAM_ATTR TAG = "pulse_ctl";
 
-static bool IRAM_ATTR pulse_ctl_alarm_handler(void* args);
+void pulse_ctl_task(void*);
 
-struct pulse_train_t;
+void pulse_ctl_kill(pulse_ctl_t* ctl);
 
-typedef struct {
-  QueueHandle_t work_queue;
-  QueueHandle_t control_queue;
-  TaskHandle_t task;
-  pulse_ctl_config_t config;
-  struct pulse_train_t* current;
-} pulse_ctl_t;
+#define PULSE_URGENT_QUEUE_SIZE 2
 
-typedef enum {
-  MESSAGE_TRAIN_DONE,
-  MESSAGE_KILL,
-} message_type_t;
+static inline IRAM_ATTR void pulse_decode(pulse_t pulse, pulse_duration_t* duration, pulse_level_t* level) {
+  *level = (pulse & PULSE_LEVEL_BIT) ? PULSE_HIGH : PULSE_LOW;
+  *duration = pulse & PULSE_MAX_DURATION;
+}
 
-typedef struct pulse_train_t {
-  pulse_ctl_t* ctl;
-  list_t* pulses;
-  list_node_t* current;
-} pulse_train_t;
+static inline esp_err_t pulse_encode(pulse_duration_t duration, pulse_level_t level, pulse_t* pulse) {
+  if (duration > PULSE_MAX_DURATION)
+    return ESP_ERR_INVALID_ARG;
 
-void pulse_ctl_task(void*);
+  *pulse = (pulse_t)duration | (level == PULSE_HIGH ? PULSE_LEVEL_BIT : 0);
+  return ESP_OK;
+}
 
-void pulse_ctl_kill(pulse_ctl_t* ctl);
+static const pulse_backend_t* pulse_ctl_backend(pulse_backend_type_t type) {
+  switch (type) {
+    case PULSE_BACKEND_RMT:
+      return &pulse_backend_rmt;
+    case PULSE_BACKEND_I2S:
+      return &pulse_backend_i2s;
+    default:
+      return &pulse_backend_timer;
+  }
+}
 
-void timer_pulse_init(pulse_ctl_t* ctl);
+static esp_err_t pulse_ctl_pool_new(pulse_ctl_t* ctl) {
+  pulse_ctl_config_t* cfg = &ctl->config;
+  if (cfg->max_segments == 0)
+    cfg->max_segments = PULSE_DEFAULT_MAX_SEGMENTS;
+
+  uint16_t size = ctl->channel_count * (cfg->max_queue_size + PULSE_URGENT_QUEUE_SIZE + 1) + 1;
+  ESP_ERROR_CHECK_NOTNULL(ctl->free_queue = xQueueCreate(size, sizeof(pulse_train_t*)));
+  ESP_ERROR_CHECK_NOTNULL(ctl->pool = calloc(size, sizeof(pulse_train_t)));
+  ESP_ERROR_CHECK_NOTNULL(ctl->pool_entries = calloc(size * cfg->max_segments, sizeof(pulse_entry_t)));
+  if (cfg->max_pulses > 0)
+    ESP_ERROR_CHECK_NOTNULL(ctl->pool_pulses = calloc(size * cfg->max_pulses, sizeof(pulse_t)));
+
+  for (uint16_t i = 0; i < size; i++) {
+    pulse_train_t* train = &ctl->pool[i];
+    train->ctl = ctl;
+    train->pulses = cfg->max_pulses > 0 ? &ctl->pool_pulses[i * cfg->max_pulses] : NULL;
+    train->capacity = cfg->max_pulses;
+    train->entries = &ctl->pool_entries[i * cfg->max_segments];
+    train->max_entries = cfg->max_segments;
+    xQueueGenericSend(ctl->free_queue, &train, 0, queueSEND_TO_BACK);
+  }
 
-inline void pulse_decode(int64_t pulse, pulse_duration_t* duration, pulse_level_t* level) {
-  *level = pulse >= 0 ? PULSE_HIGH : PULSE_LOW;
-  *duration = abs(pulse);
+  ctl->stats.pool_size = size;
+  return ESP_OK;
 }
 
-inline esp_err_t pulse_encode(pulse_duration_t duration, pulse_level_t level, int64_t* pulse) {
-  if (duration >> 63 == 1)
-    return ESP_ERR_INVALID_ARG;
+static void pulse_ctl_pool_free(pulse_ctl_t* ctl) {
+  vQueueDelete(ctl->free_queue);
+  free(ctl->pool_pulses);
+  free(ctl->pool_entries);
+  free(ctl->pool);
+}
 
-  *pulse = ((int64_t)duration) * (level == PULSE_LOW ? -1LL : 1LL);
-  return ESP_OK;
+static inline void pulse_ctl_notify(pulse_ctl_t* ctl, uint32_t events) {
+  xTaskNotify(ctl->task, events, eSetBits);
+}
+
+static void pulse_ctl_channels_new(pulse_ctl_t* ctl) {
+  pulse_ctl_config_t* cfg = &ctl->config;
+  if (cfg->channel_count == 0) {
+    pulse_channel_config_t single = {
+      .gpio = cfg->gpio,
+      .timer_group = cfg->timer_group,
+      .timer_idx = cfg->timer_idx,
+      .rmt_channel = cfg->rmt_channel,
+      .i2s_port = cfg->i2s_port,
+    };
+    memcpy(&cfg->channels[0], &single, sizeof(pulse_channel_config_t));
+    cfg->channel_count = 1;
+  }
+
+  ctl->channel_count = cfg->channel_count > PULSE_MAX_CHANNELS ? PULSE_MAX_CHANNELS : cfg->channel_count;
+  for (uint8_t i = 0; i < ctl->channel_count; i++) {
+    pulse_channel_t* channel = &ctl->channels[i];
+    channel->ctl = ctl;
+    channel->index = i;
+    memcpy(&channel->config, &cfg->channels[i], sizeof(pulse_channel_config_t));
+    ESP_ERROR_CHECK_NOTNULL(channel->work_queue = xQueueCreate(cfg->max_queue_size, sizeof(pulse_train_t*)));
+    ESP_ERROR_CHECK_NOTNULL(channel->urgent_queue = xQueueCreate(PULSE_URGENT_QUEUE_SIZE, sizeof(pulse_train_t*)));
+  }
+}
+
+static void pulse_ctl_airtime_wake(void* data) {
+  pulse_ctl_notify(data, PULSE_EVENT_WORK);
 }
 
 pulse_ctl_handle_t pulse_ctl_new(pulse_ctl_config_t* cfg) {
   pulse_ctl_t* handle = calloc(1, sizeof(pulse_ctl_t));
-  handle->current = NULL;
-  handle->work_queue = xQueueCreate(cfg->max_queue_size, sizeof(pulse_train_t));
-  handle->control_queue = xQueueCreate(2, sizeof(message_type_t));
+  handle->backend = pulse_ctl_backend(cfg->backend);
+  handle->created_us = esp_timer_get_time();
   memcpy(&handle->config, cfg, sizeof(pulse_ctl_config_t));
+  pulse_ctl_channels_new(handle);
+  pulse_airtime_init(&handle->airtime, cfg->duty_permille, cfg->duty_window_ms, handle->created_us);
+  esp_timer_create_args_t wake = {
+    .callback = &pulse_ctl_airtime_wake,
+    .arg = handle,
+    .name = "pulse_airtime",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&wake, &handle->airtime_timer));
+  vPortCPUInitializeMutex(&handle->stats_lock);
+  pulse_ctl_pool_new(handle);
   xTaskCreate(&pulse_ctl_task, "pulse_ctl_task", 2048, handle, 5, &handle->task);
   return handle;
 }
 
+esp_err_t pulse_ctl_get_stats(pulse_ctl_handle_t handle, pulse_ctl_stats_t* stats) {
+  pulse_ctl_t* ctl = handle;
+  portENTER_CRITICAL(&ctl->stats_lock);
+  memcpy(stats, &ctl->stats, sizeof(pulse_ctl_stats_t));
+  portEXIT_CRITICAL(&ctl->stats_lock);
+  return ESP_OK;
+}
+
+esp_err_t pulse_ctl_get_channel_stats(pulse_ctl_handle_t handle, uint8_t index, pulse_channel_stats_t* stats) {
+  pulse_ctl_t* ctl = handle;
+  if (index >= ctl->channel_count)
+    return ESP_ERR_INVALID_ARG;
+
+  pulse_channel_t* channel = &ctl->channels[index];
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&ctl->stats_lock);
+  stats->trains = channel->trains;
+  stats->busy_us = channel->busy_us;
+  if (channel->current != NULL)
+    stats->busy_us += now - channel->started_us;
+  portEXIT_CRITICAL(&ctl->stats_lock);
+
+  stats->queued = uxQueueMessagesWaiting(channel->work_queue) + uxQueueMessagesWaiting(channel->urgent_queue);
+  int64_t lifetime = now - ctl->created_us;
+  stats->utilization = lifetime > 0 ? stats->busy_us * 100 / lifetime : 0;
+  return ESP_OK;
+}
+
+// When the channel is done with the train on air and those queued.
+static int64_t pulse_channel_free_at(pulse_channel_t* channel, int64_t now) {
+  int64_t free_at = now;
+  pulse_train_t* current = channel->current;
+  if (current != NULL && channel->started_us + current->airtime_us > now)
+    free_at = channel->started_us + current->airtime_us;
+
+  return free_at + channel->queued_airtime_us;
+}
+
+esp_err_t pulse_ctl_estimate_start(pulse_ctl_handle_t handle, uint8_t index, int64_t airtime_us, int64_t* start_us) {
+  pulse_ctl_t* ctl = handle;
+  if (index != PULSE_CHANNEL_ANY && index >= ctl->channel_count)
+    return ESP_ERR_INVALID_ARG;
+
+  int64_t now = esp_timer_get_time();
+  int64_t free_at = INT64_MAX;
+  portENTER_CRITICAL(&ctl->stats_lock);
+  for (uint8_t i = 0; i < ctl->channel_count; i++) {
+    if (index != PULSE_CHANNEL_ANY && index != i)
+      continue;
+
+    int64_t channel_free_at = pulse_channel_free_at(&ctl->channels[i], now);
+    if (channel_free_at < free_at)
+      free_at = channel_free_at;
+  }
+
+  int64_t ready_at = pulse_airtime_ready_at(&ctl->airtime, ctl->pending_airtime_us, airtime_us, now);
+  portEXIT_CRITICAL(&ctl->stats_lock);
+
+  *start_us = ready_at > free_at ? ready_at : free_at;
+  return ESP_OK;
+}
+
 esp_err_t pulse_train_init(pulse_ctl_handle_t ctl_handle, pulse_train_handle_t* train_handle) {
-  pulse_train_t* train = calloc(1, sizeof(pulse_train_t));
-  *train_handle = train;
+  pulse_ctl_t* ctl = (pulse_ctl_t*)ctl_handle;
+  pulse_train_t* train;
+  bool waited = false;
+  if (xQueueReceive(ctl->free_queue, &train, 0) != pdTRUE) {
+    waited = true;
+    if (xQueueReceive(ctl->free_queue, &train, ctl->config.pool_wait_ms / portTICK_PERIOD_MS) != pdTRUE) {
+      portENTER_CRITICAL(&ctl->stats_lock);
+      ctl->stats.pool_waits++;
+      ctl->stats.pool_exhausted++;
+      portEXIT_CRITICAL(&ctl->stats_lock);
+      *train_handle = NULL;
+      return ESP_ERR_NO_MEM;
+    }
+  }
 
-  train->ctl = (pulse_ctl_t*)ctl_handle;
-  train->current = NULL;
-  train->pulses = list_new(&free);
+  train->count = 0;
+  train->entry_count = 0;
+  train->overflow = false;
+  train->origin_us = 0;
+  train->loop_first = 0;
+  train->loop_end = 0;
+  train->loop_count = 0;
+  train->priority = PULSE_PRIORITY_NORMAL;
+  train->channel = PULSE_CHANNEL_ANY;
+  train->boundary_pending = false;
+  train->preempted = false;
+  train->tag = 0;
+  pulse_train_rewind(train);
+
+  portENTER_CRITICAL(&ctl->stats_lock);
+  train->in_use = true;
+  train->loop_cancelled = false;
+  ctl->stats.pool_acquired++;
+  ctl->stats.pool_waits += waited ? 1 : 0;
+  ctl->stats.pool_in_use++;
+  if (ctl->stats.pool_in_use > ctl->stats.pool_high_water)
+    ctl->stats.pool_high_water = ctl->stats.pool_in_use;
+  portEXIT_CRITICAL(&ctl->stats_lock);
 
+  *train_handle = train;
   return ESP_OK;
 }
 
 void pulse_train_free(pulse_train_t* train) {
-  list_free(train->pulses);
-  free(train);
+  pulse_ctl_t* ctl = train->ctl;
+  portENTER_CRITICAL(&ctl->stats_lock);
+  train->in_use = false;
+  ctl->stats.pool_in_use--;
+  portEXIT_CRITICAL(&ctl->stats_lock);
+  xQueueGenericSend(ctl->free_queue, &train, 0, queueSEND_TO_BACK);
+}
+
+static pulse_entry_t* pulse_train_add_entry(pulse_train_t* train) {
+  if (train->entry_count == train->max_entries) {
+    train->overflow = true;
+    return NULL;
+  }
+
+  pulse_entry_t* entry = &train->entries[train->entry_count++];
+  memset(entry, 0, sizeof(pulse_entry_t));
+  entry->boundary = train->boundary_pending;
+  train->boundary_pending = false;
+  return entry;
 }
 
 esp_err_t pulse_train_add_pulse(pulse_train_handle_t handle, pulse_duration_t duration, pulse_level_t pulse) {
   pulse_train_t* message = handle;
-  int64_t* value = calloc(1, sizeof(int64_t));
+  if (message->count == message->capacity) {
+    message->overflow = true;
+    return ESP_ERR_NO_MEM;
+  }
+
+  pulse_t* value = &message->pulses[message->count];
   esp_err_t result = pulse_encode(duration, pulse, value);
   if (result != ESP_OK)
     return result;
 
-  list_append(message->pulses, value);
+  // Consecutive pulses share one entry pointing into the train buffer,
+  // unless a boundary lies between them.
+  bool boundary = message->boundary_pending || message->entry_count == message->loop_first ||
+    (message->loop_count > 0 && message->entry_count == message->loop_end);
+  pulse_entry_t* last = message->entry_count > 0 ? &message->entries[message->entry_count - 1] : NULL;
+  if (last == NULL || boundary || last->generator != NULL || last->pulses + last->count != value) {
+    last = pulse_train_add_entry(message);
+    if (last == NULL)
+      return ESP_ERR_NO_MEM;
+
+    last->pulses = value;
+  }
+
+  last->count++;
+  message->count++;
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_add_generator(pulse_train_handle_t handle, pulse_generator_t generator,
+  const void* state, size_t state_size) {
+  pulse_train_t* train = handle;
+  if (state_size > PULSE_GENERATOR_STATE_SIZE)
+    return ESP_ERR_INVALID_SIZE;
+
+  pulse_entry_t* entry = pulse_train_add_entry(train);
+  if (entry == NULL)
+    return ESP_ERR_NO_MEM;
+
+  entry->generator = generator;
+  memcpy(entry->state, state, state_size);
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_add_segment(pulse_train_handle_t handle, pulse_segment_handle_t segment_handle) {
+  pulse_train_t* train = handle;
+  pulse_segment_t* segment = segment_handle;
+  pulse_entry_t* entry = pulse_train_add_entry(train);
+  if (entry == NULL)
+    return ESP_ERR_NO_MEM;
+
+  entry->pulses = segment->pulses;
+  entry->count = segment->count;
+  return ESP_OK;
+}
+
+esp_err_t pulse_segment_new(uint16_t capacity, pulse_segment_handle_t* handle) {
+  pulse_segment_t* segment = calloc(1, sizeof(pulse_segment_t));
+  if (segment == NULL)
+    return ESP_ERR_NO_MEM;
+
+  segment->pulses = calloc(capacity, sizeof(pulse_t));
+  if (segment->pulses == NULL) {
+    free(segment);
+    return ESP_ERR_NO_MEM;
+  }
+
+  segment->capacity = capacity;
+  *handle = segment;
+  return ESP_OK;
+}
+
+esp_err_t pulse_segment_add_pulse(pulse_segment_handle_t handle, pulse_duration_t duration, pulse_level_t level) {
+  pulse_segment_t* segment = handle;
+  if (segment->count == segment->capacity)
+    return ESP_ERR_NO_MEM;
+
+  esp_err_t result = pulse_encode(duration, level, &segment->pulses[segment->count]);
+  if (result != ESP_OK)
+    return result;
+
+  segment->count++;
+  return ESP_OK;
+}
+
+esp_err_t pulse_segment_free(pulse_segment_handle_t handle) {
+  pulse_segment_t* segment = handle;
+  free(segment->pulses);
+  free(segment);
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_loop_begin(pulse_train_handle_t handle) {
+  pulse_train_t* train = handle;
+  if (train->loop_count > 0)
+    return ESP_ERR_INVALID_STATE;
+
+  train->loop_first = train->entry_count;
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_loop_end(pulse_train_handle_t handle, uint16_t count) {
+  pulse_train_t* train = handle;
+  if (train->loop_count > 0)
+    return ESP_ERR_INVALID_STATE;
+
+  if (count == 0 || train->entry_count <= train->loop_first)
+    return ESP_ERR_INVALID_ARG;
+
+  train->loop_end = train->entry_count;
+  train->loop_count = count;
+  return ESP_OK;
+}
+
+esp_err_t pulse_ctl_cancel_loops(pulse_ctl_handle_t handle) {
+  pulse_ctl_t* ctl = handle;
+  ctl->cancel_seq++;
+  return ESP_OK;
+}
+
+esp_err_t pulse_ctl_cancel_loop(pulse_ctl_handle_t handle, uint32_t tag) {
+  pulse_ctl_t* ctl = handle;
+  portENTER_CRITICAL(&ctl->stats_lock);
+  for (uint16_t i = 0; i < ctl->stats.pool_size; i++) {
+    pulse_train_t* train = &ctl->pool[i];
+    if (train->in_use && train->tag == tag)
+      train->loop_cancelled = true;
+  }
+  portEXIT_CRITICAL(&ctl->stats_lock);
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_add_boundary(pulse_train_handle_t handle) {
+  pulse_train_t* train = handle;
+  train->boundary_pending = true;
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_set_priority(pulse_train_handle_t handle, pulse_priority_t priority) {
+  pulse_train_t* train = handle;
+  train->priority = priority;
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_set_channel(pulse_train_handle_t handle, uint8_t channel) {
+  pulse_train_t* train = handle;
+  if (channel != PULSE_CHANNEL_ANY && channel >= train->ctl->channel_count)
+    return ESP_ERR_INVALID_ARG;
+
+  train->channel = channel;
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_set_origin(pulse_train_handle_t handle, int64_t origin_us) {
+  pulse_train_t* train = handle;
+  train->origin_us = origin_us;
+  return ESP_OK;
+}
+
+esp_err_t pulse_train_set_tag(pulse_train_handle_t handle, uint32_t tag) {
+  pulse_train_t* train = handle;
+  portENTER_CRITICAL(&train->ctl->stats_lock);
+  train->tag = tag;
+  portEXIT_CRITICAL(&train->ctl->stats_lock);
+  return ESP_OK;
+}
+
+static int64_t pulse_entry_airtime(const pulse_entry_t* entry) {
+  pulse_duration_t duration;
+  pulse_level_t level;
+  int64_t airtime = 0;
+  if (entry->generator != NULL) {
+    uint8_t state[PULSE_GENERATOR_STATE_SIZE];
+    memcpy(state, entry->state, PULSE_GENERATOR_STATE_SIZE);
+    while (entry->generator(state, &duration, &level))
+      airtime += duration;
+
+    return airtime;
+  }
+
+  for (uint16_t i = 0; i < entry->count; i++) {
+    pulse_decode(entry->pulses[i], &duration, &level);
+    airtime += duration;
+  }
+
+  return airtime;
+}
+
+// Sums the train durations once, so that the airtime accounting costs the
+// same for every train whatever its length.
+static void pulse_train_measure(pulse_train_t* train) {
+  int64_t once = 0;
+  int64_t loop = 0;
+  for (uint8_t i = 0; i < train->entry_count; i++) {
+    int64_t airtime = pulse_entry_airtime(&train->entries[i]);
+    if (train->loop_count > 0 && i >= train->loop_first && i < train->loop_end)
+      loop += airtime;
+    else
+      once += airtime;
+  }
+
+  uint16_t iterations = train->loop_count == PULSE_LOOP_FOREVER ? 1 : train->loop_count;
+  train->loop_airtime_us = loop;
+  train->airtime_us = once + loop * iterations;
+}
+
+static void pulse_channel_queue_airtime(pulse_channel_t* channel, int64_t airtime_us) {
+  pulse_ctl_t* ctl = channel->ctl;
+  portENTER_CRITICAL(&ctl->stats_lock);
+  channel->queued_airtime_us += airtime_us;
+  ctl->pending_airtime_us += airtime_us;
+  portEXIT_CRITICAL(&ctl->stats_lock);
+}
+
+// Picks the channel a train will wait the least on: the one with the fewest
+// trains ahead of it. Normal trains on air do not count for urgent ones,
+// which preempt them. This only reads what the controller task writes, so
+// the choice may be slightly off, never wrong.
+static pulse_channel_t* pulse_ctl_place(pulse_ctl_t* ctl, pulse_train_t* train) {
+  if (train->channel != PULSE_CHANNEL_ANY)
+    return &ctl->channels[train->channel];
+
+  pulse_channel_t* best = NULL;
+  UBaseType_t best_load = 0;
+  for (uint8_t i = 0; i < ctl->channel_count; i++) {
+    pulse_channel_t* channel = &ctl->channels[i];
+    pulse_train_t* current = channel->current;
+    UBaseType_t load = uxQueueMessagesWaiting(channel->urgent_queue);
+    if (train->priority == PULSE_PRIORITY_URGENT)
+      load += current != NULL && current->priority == PULSE_PRIORITY_URGENT ? 1 : 0;
+    else
+      load += uxQueueMessagesWaiting(channel->work_queue) + (current != NULL ? 1 : 0);
+
+    if (best == NULL || load < best_load) {
+      best = channel;
+      best_load = load;
+    }
+  }
+
+  return best;
+}
+
+// Urgent trains have their own queue, checked first by the controller task.
+static esp_err_t pulse_train_send_urgent(pulse_ctl_t* ctl, pulse_channel_t* channel, pulse_train_t* train) {
+  pulse_channel_queue_airtime(channel, train->airtime_us);
+  if (xQueueGenericSend(channel->urgent_queue, &train, 0, queueSEND_TO_BACK) != pdTRUE) {
+    pulse_channel_queue_airtime(channel, -train->airtime_us);
+    pulse_train_free(train);
+    return ESP_ERR_TIMEOUT;
+  }
+
+  pulse_ctl_notify(ctl, PULSE_EVENT_WORK | PULSE_EVENT_PREEMPT);
   return ESP_OK;
 }
 
 esp_err_t pulse_train_send(pulse_train_handle_t handle) {
   pulse_train_t* train = handle;
-  if (list_is_empty(train->pulses))
+  pulse_ctl_t* ctl = train->ctl;
+  if (train->overflow) {
+    ESP_LOGE(TAG, "Pulse train exceeds %d pulses or %d segments, dropped.", train->capacity, train->max_entries);
+    portENTER_CRITICAL(&ctl->stats_lock);
+    ctl->stats.train_overflows++;
+    portEXIT_CRITICAL(&ctl->stats_lock);
+    pulse_train_free(train);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  if (train->entry_count == 0) {
+    pulse_train_free(train);
     return ESP_ERR_INVALID_ARG;
+  }
+
+  train->cancel_seq = ctl->cancel_seq;
+  pulse_train_measure(train);
+  pulse_channel_t* channel = pulse_ctl_place(ctl, train);
+  if (train->priority == PULSE_PRIORITY_URGENT)
+    return pulse_train_send_urgent(ctl, channel, train);
 
+  pulse_channel_queue_airtime(channel, train->airtime_us);
   BaseType_t result = xQueueGenericSend(
-    train->ctl->work_queue, &train, 1000 / portTICK_PERIOD_MS, queueSEND_TO_BACK);
+    channel->work_queue, &train, 1000 / portTICK_PERIOD_MS, queueSEND_TO_BACK);
 
-  if (result == pdTRUE)
+  if (result == pdTRUE) {
+    pulse_ctl_notify(ctl, PULSE_EVENT_WORK);
     return ESP_OK;
+  }
 
+  pulse_channel_queue_airtime(channel, -train->airtime_us);
+  pulse_train_free(train);
   return ESP_ERR_TIMEOUT;
 }
 
-esp_err_t pulse_ctl_free(pulse_ctl_handle_t handle) {
-  pulse_ctl_t* ctl = handle;
-  message_type_t kill = MESSAGE_KILL;
-  return xQueueGenericSend(ctl->control_queue, &kill, 1000 / portTICK_PERIOD_MS, queueSEND_TO_FRONT);
+void pulse_train_rewind(pulse_train_t* train) {
+  train->cursor.entry = 0;
+  train->cursor.next = 0;
+  train->cursor.iterations = 0;
+  train->cursor.split = true;
+  train->cursor.finished = false;
 }
 
-void pulse_ctl_task(void* data) {
-  pulse_ctl_t* ctl = data;
-  pulse_ctl_config_t* cfg = &ctl->config;
-  gpio_config_t gpio = {
-    .mode = GPIO_MODE_OUTPUT,
-    .pin_bit_mask = BIT(cfg->gpio),
-    .intr_type = GPIO_INTR_DISABLE,
-    .pull_up_en = GPIO_PULLUP_DISABLE,
-    .pull_down_en = GPIO_PULLDOWN_ENABLE
-  };
+static inline IRAM_ATTR bool pulse_train_loop_again(pulse_train_t* train) {
+  if (train->ctl->cancel_seq != train->cancel_seq || train->loop_cancelled)
+    return false;
 
-  gpio_config(&gpio);
-
-  uint32_t divider = rtc_clk_apb_freq_get () / 1000000;
-  ESP_LOGI(TAG, "Initializing timer with divider %d.", divider);
-  timer_config_t timer = {
-    .divider = divider,
-    .alarm_en = TIMER_ALARM_DIS,
-    .auto_reload = TIMER_AUTORELOAD_EN,
-    .counter_dir = TIMER_COUNT_UP,
-    .counter_en = TIMER_PAUSE
-  };
+  return train->loop_count == PULSE_LOOP_FOREVER || train->cursor.iterations + 1 < train->loop_count;
+}
 
-  timer_init(cfg->timer_group, cfg->timer_idx, &timer);
-  timer_isr_callback_add(cfg->timer_group, cfg->timer_idx, pulse_ctl_alarm_handler, ctl, 0);
-  timer_set_alarm_value(cfg->timer_group, cfg->timer_idx, 500 * 1000);
+static inline IRAM_ATTR bool pulse_train_at_boundary(pulse_train_t* train, pulse_entry_t* entry) {
+  if (train->cursor.next != 0)
+    return false;
 
-  ESP_LOGI(TAG, "Pulse Controller Task started. GPIO = %d, Timer group= %d, Timer = %d",
-    cfg->gpio, cfg->timer_group, cfg->timer_idx);
+  return entry->boundary || (train->loop_count > 0 && train->cursor.entry == train->loop_first);
+}
 
-  int wait = 0;
+IRAM_ATTR bool pulse_train_next(pulse_train_t* train, pulse_duration_t* duration, pulse_level_t* level) {
+  pulse_cursor_t* cursor = &train->cursor;
   while (1) {
-    message_type_t control;
-    BaseType_t result = xQueueReceive(ctl->control_queue, &control, wait / portTICK_PERIOD_MS);
-    if (result == pdTRUE) {
-      if (control == MESSAGE_KILL) {
-        ESP_LOGI(TAG, "Killing controller.");
-        pulse_ctl_kill(ctl);
-        return;
-      }
-      else if (control == MESSAGE_TRAIN_DONE) {
-        ESP_LOGI(TAG, "Pulse train completed.");
-        pulse_train_free(ctl->current);
-        ctl->current = NULL;
+    if (train->loop_count > 0 && cursor->entry == train->loop_end && pulse_train_loop_again(train)) {
+      cursor->iterations++;
+      cursor->entry = train->loop_first;
+      cursor->next = 0;
+    }
+
+    if (cursor->entry >= train->entry_count) {
+      cursor->finished = true;
+      return false;
+    }
+
+    pulse_entry_t* entry = &train->entries[cursor->entry];
+    if (pulse_train_at_boundary(train, entry)) {
+      if (train->preempted) {
+        cursor->finished = true;
+        return false;
       }
-      else {
-        ESP_LOGE(TAG, "Unknown control message %d.", control);
+
+      if (train->split && !cursor->split) {
+        cursor->split = true;
+        return false;
       }
     }
 
-    if (ctl->current != NULL) {
-      wait = 1000;
-      continue;
+    cursor->split = false;
+    if (entry->generator != NULL) {
+      if (cursor->next == 0) {
+        memcpy(cursor->state, entry->state, PULSE_GENERATOR_STATE_SIZE);
+        cursor->next = 1;
+      }
+
+      if (entry->generator(cursor->state, duration, level))
+        return true;
     }
-    else {
-      wait = 0;
+    else if (cursor->next < entry->count) {
+      pulse_decode(entry->pulses[cursor->next++], duration, level);
+      return true;
     }
 
-    pulse_train_t* train;
-    result = xQueueReceive(ctl->work_queue, &train, 1000 / portTICK_PERIOD_MS);
-    if (result != pdTRUE)
-      continue;
+    cursor->entry++;
+    cursor->next = 0;
+  }
+}
+
+void pulse_channel_done(pulse_channel_t* channel) {
+  pulse_ctl_notify(channel->ctl, PULSE_EVENT_TRAIN_DONE(channel->index));
+}
+
+IRAM_ATTR void pulse_channel_done_from_isr(pulse_channel_t* channel, BaseType_t* woken) {
+  xTaskNotifyFromISR(channel->ctl->task, PULSE_EVENT_TRAIN_DONE(channel->index), eSetBits, woken);
+}
+
+IRAM_ATTR void pulse_channel_pass_done_from_isr(pulse_channel_t* channel, BaseType_t* woken) {
+  xTaskNotifyFromISR(channel->ctl->task, PULSE_EVENT_PASS_DONE(channel->index), eSetBits, woken);
+}
+
+esp_err_t pulse_ctl_free(pulse_ctl_handle_t handle) {
+  pulse_ctl_t* ctl = handle;
+  pulse_ctl_notify(ctl, PULSE_EVENT_KILL);
+  return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "Pulse train received (%d pulses).", list_length(train->pulses));
-    ctl->current = train;
-    timer_pulse_init(ctl);
+static void pulse_ctl_record_start(pulse_ctl_t* ctl, pulse_train_t* train) {
+  if (train->origin_us == 0)
+    return;
+
+  int64_t latency = esp_timer_get_time() - train->origin_us;
+  portENTER_CRITICAL(&ctl->stats_lock);
+  ctl->stats.last_start_latency_us = latency;
+  if (latency > ctl->stats.max_start_latency_us)
+    ctl->stats.max_start_latency_us = latency;
+  portEXIT_CRITICAL(&ctl->stats_lock);
+  ESP_LOGI(TAG, "Pulse train starting %lld us after its origin.", latency);
+}
+
+// Ends a normal train on air at its next boundary when an urgent one is
+// waiting for its channel. The backend then reports it done as usual and
+// it is freed.
+static void pulse_channel_preempt(pulse_channel_t* channel) {
+  pulse_ctl_t* ctl = channel->ctl;
+  pulse_train_t* current = channel->current;
+  if (current == NULL || current->priority >= PULSE_PRIORITY_URGENT || current->preempted)
+    return;
+
+  if (uxQueueMessagesWaiting(channel->urgent_queue) == 0)
+    return;
+
+  current->preempted = true;
+  portENTER_CRITICAL(&ctl->stats_lock);
+  ctl->stats.trains_preempted++;
+  portEXIT_CRITICAL(&ctl->stats_lock);
+}
+
+static void pulse_channel_finish(pulse_channel_t* channel) {
+  pulse_ctl_t* ctl = channel->ctl;
+  pulse_train_t* train = channel->current;
+  ESP_LOGI(TAG, "Pulse train %s on channel %d.", train->preempted ? "preempted" : "completed", channel->index);
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&ctl->stats_lock);
+  // Only the first iteration of an endless loop was charged at start.
+  int64_t extra = 0;
+  if (train->loop_count == PULSE_LOOP_FOREVER)
+    extra = train->loop_airtime_us * train->cursor.iterations;
+  // A preempted train was charged for the frames it never sent.
+  if (train->preempted) {
+    int64_t unsent = train->airtime_us + extra - (now - channel->started_us);
+    if (unsent > 0)
+      extra -= unsent;
   }
+  if (extra != 0) {
+    pulse_airtime_charge(&ctl->airtime, extra, now);
+    ctl->stats.airtime_us += extra;
+  }
+
+  channel->busy_us += now - channel->started_us;
+  channel->trains++;
+  channel->current = NULL;
+  portEXIT_CRITICAL(&ctl->stats_lock);
+  pulse_train_free(train);
 }
 
-void pulse_ctl_kill(pulse_ctl_t* ctl) {
-  ESP_LOGI(TAG, "Pulse Controller Task killed.");
-  vQueueDelete(ctl->work_queue);
-  vQueueDelete(ctl->control_queue);
-  vTaskDelete(ctl->task);
-  free(ctl);
+// Arms the airtime timer to wake the task at ready_us, unless it already
+// wakes it sooner.
+static void pulse_ctl_defer(pulse_ctl_t* ctl, int64_t ready_us, int64_t now) {
+  if (ctl->airtime_wake_us != 0 && ctl->airtime_wake_us <= ready_us)
+    return;
+
+  esp_timer_stop(ctl->airtime_timer);
+  esp_timer_start_once(ctl->airtime_timer, ready_us - now);
+  ctl->airtime_wake_us = ready_us;
 }
 
-void timer_pulse_init(pulse_ctl_t* ctl) {
-  pulse_train_t* train = ctl->current;
-  pulse_ctl_config_t* cfg = &ctl->config;
-  train->current = list_begin(train->pulses);
-  int64_t pulse = *(int64_t*)list_node(train->current);
-  pulse_duration_t alarm;
-  pulse_level_t level;
-  pulse_decode(pulse, &alarm, &level);
-  timer_set_alarm_value(cfg->timer_group, cfg->timer_idx, alarm);
-  timer_set_alarm(cfg->timer_group, cfg->timer_idx, TIMER_ALARM_EN);
-  gpio_set_level(cfg->gpio, level);
-  timer_start(cfg->timer_group, cfg->timer_idx);
+// Takes the next train for the channel, urgent ones first, and puts it on
+// air.
+static void pulse_channel_start_next(pulse_channel_t* channel) {
+  pulse_ctl_t* ctl = channel->ctl;
+  pulse_train_t* train;
+  QueueHandle_t queue = channel->urgent_queue;
+  if (xQueuePeek(queue, &train, 0) != pdTRUE) {
+    queue = channel->work_queue;
+    if (xQueuePeek(queue, &train, 0) != pdTRUE)
+      return;
+  }
+
+  // The train stays queued until the airtime budget allows it.
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&ctl->stats_lock);
+  int64_t ready_us = pulse_airtime_ready_at(&ctl->airtime, 0, train->airtime_us, now);
+  if (ready_us > now) {
+    ctl->stats.trains_deferred += ctl->airtime_wake_us == 0 ? 1 : 0;
+    portEXIT_CRITICAL(&ctl->stats_lock);
+    pulse_ctl_defer(ctl, ready_us, now);
+    return;
+  }
+
+  pulse_airtime_charge(&ctl->airtime, train->airtime_us, now);
+  ctl->stats.airtime_us += train->airtime_us;
+  channel->queued_airtime_us -= train->airtime_us;
+  ctl->pending_airtime_us -= train->airtime_us;
+  channel->current = train;
+  channel->started_us = now;
+  portEXIT_CRITICAL(&ctl->stats_lock);
+
+  xQueueReceive(queue, &train, 0);
+  ESP_LOGI(TAG, "Pulse train received on channel %d (%d segments, %lld us).", channel->index, train->entry_count, train->airtime_us);
+  train->split = ctl->backend->split;
+  pulse_train_rewind(train);
+  pulse_ctl_record_start(ctl, train);
+  ctl->backend->start(channel);
+}
+
+static void pulse_ctl_deinit_channels(pulse_ctl_t* ctl, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++)
+    ctl->backend->deinit(&ctl->channels[i]);
 }
 
-static bool IRAM_ATTR pulse_ctl_alarm_handler(void* args) {
-  pulse_ctl_t* ctl = (pulse_ctl_t*)args;
-  pulse_train_t* train = ctl->current;
+// The task sleeps until an event bit is set: it wakes up once per train
+// queued or finished and per RMT pass, and never while idle.
+void pulse_ctl_task(void* data) {
+  pulse_ctl_t* ctl = data;
   pulse_ctl_config_t* cfg = &ctl->config;
-  train->current = list_next(train->current);
-  if (train->current == NULL) {
-    gpio_set_level(cfg->gpio, PULSE_LOW);
-    timer_group_set_counter_enable_in_isr(cfg->timer_group, cfg->timer_idx, TIMER_PAUSE);
-    BaseType_t priority;
-    message_type_t done = MESSAGE_TRAIN_DONE;
-    xQueueGenericSendFromISR(ctl->control_queue, &done, &priority, queueSEND_TO_FRONT);
-    return true;
-  }
-
-  int64_t pulse = *(int64_t*)list_node(train->current);
-  pulse_duration_t alarm;
-  pulse_level_t level;
-  pulse_decode(pulse, &alarm, &level);
-  timer_group_set_alarm_value_in_isr(cfg->timer_group, cfg->timer_idx, alarm);
-  gpio_set_level(cfg->gpio, level);
+  for (uint8_t i = 0; i < ctl->channel_count; i++) {
+    if (ctl->backend->init(&ctl->channels[i]) != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to initialize pulse backend %d on channel %d.", cfg->backend, i);
+      pulse_ctl_deinit_channels(ctl, i);
+      pulse_ctl_kill(ctl);
+      return;
+    }
+  }
+
+  ESP_LOGI(TAG, "Pulse Controller Task started. Channels = %d, backend = %d", ctl->channel_count, cfg->backend);
+
+  while (1) {
+    uint32_t events;
+    xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+    if (!pulse_ctl_handle(ctl, events))
+      return;
+  }
+}
+
+bool pulse_ctl_handle(pulse_ctl_t* ctl, uint32_t events) {
+  portENTER_CRITICAL(&ctl->stats_lock);
+  ctl->stats.task_wakeups++;
+  portEXIT_CRITICAL(&ctl->stats_lock);
+  if (ctl->airtime_wake_us != 0 && esp_timer_get_time() >= ctl->airtime_wake_us)
+    ctl->airtime_wake_us = 0;
+
+  if (events & PULSE_EVENT_KILL) {
+    ESP_LOGI(TAG, "Killing controller.");
+    pulse_ctl_deinit_channels(ctl, ctl->channel_count);
+    pulse_ctl_kill(ctl);
+    return false;
+  }
+
+  for (uint8_t i = 0; i < ctl->channel_count; i++) {
+    pulse_channel_t* channel = &ctl->channels[i];
+    if ((events & PULSE_EVENT_TRAIN_DONE(i)) && channel->current != NULL)
+      pulse_channel_finish(channel);
+    else if ((events & PULSE_EVENT_PASS_DONE(i)) && channel->current != NULL && ctl->backend->resume != NULL)
+      ctl->backend->resume(channel);
+
+    if (events & PULSE_EVENT_PREEMPT)
+      pulse_channel_preempt(channel);
+
+    // Trains queued while another was on air have had their work event
+    // consumed already, so the queues are checked after every event.
+    if (channel->current == NULL)
+      pulse_channel_start_next(channel);
+  }
+
   return true;
 }
+
+void pulse_ctl_kill(pulse_ctl_t* ctl) {
+  ESP_LOGI(TAG, "Pulse Controller Task killed.");
+  esp_timer_stop(ctl->airtime_timer);
+  esp_timer_delete(ctl->airtime_timer);
+  for (uint8_t i = 0; i < ctl->channel_count; i++) {
+    vQueueDelete(ctl->channels[i].work_queue);
+    vQueueDelete(ctl->channels[i].urgent_queue);
+  }
+
+  pulse_ctl_pool_free(ctl);
+  vTaskDelete(ctl->task);
+  free(ctl);
+}
@@ -0,0 +1,51 @@
+#include "pulse_airtime.h"
+
+void pulse_airtime_init(pulse_airtime_t* airtime, uint16_t duty_permille, uint32_t window_ms, int64_t now_us) {
+  airtime->enabled = duty_permille > 0 && duty_permille < 1000;
+  airtime->duty_permille = duty_permille;
+  airtime->capacity_us = (int64_t)window_ms * 1000 * duty_permille / 1000;
+  airtime->tokens_us = airtime->capacity_us;
+  airtime->fraction = 0;
+  airtime->updated_us = now_us;
+}
+
+static void pulse_airtime_refill(pulse_airtime_t* airtime, int64_t now_us) {
+  if (now_us <= airtime->updated_us)
+    return;
+
+  // Checks closer than 1000 / duty_permille us apart earn less than a
+  // microsecond, carried over instead of lost.
+  int64_t earned = (now_us - airtime->updated_us) * airtime->duty_permille + airtime->fraction;
+  airtime->tokens_us += earned / 1000;
+  airtime->fraction = earned % 1000;
+  if (airtime->tokens_us >= airtime->capacity_us) {
+    airtime->tokens_us = airtime->capacity_us;
+    airtime->fraction = 0;
+  }
+  airtime->updated_us = now_us;
+}
+
+int64_t pulse_airtime_ready_at(pulse_airtime_t* airtime, int64_t pending_us, int64_t airtime_us, int64_t now_us) {
+  if (!airtime->enabled)
+    return now_us;
+
+  pulse_airtime_refill(airtime, now_us);
+  int64_t needed = airtime_us < airtime->capacity_us ? airtime_us : airtime->capacity_us;
+  int64_t missing = pending_us + needed - airtime->tokens_us;
+  if (missing <= 0)
+    return now_us;
+
+  // Rounded up, so that the budget is there when the time comes. The
+  // fraction already earned shortens the wait.
+  return now_us + (missing * 1000 - airtime->fraction + airtime->duty_permille - 1) / airtime->duty_permille;
+}
+
+void pulse_airtime_charge(pulse_airtime_t* airtime, int64_t airtime_us, int64_t now_us) {
+  if (!airtime->enabled)
+    return;
+
+  pulse_airtime_refill(airtime, now_us);
+  airtime->tokens_us -= airtime_us;
+  if (airtime->tokens_us > airtime->capacity_us)
+    airtime->tokens_us = airtime->capacity_us;
+}
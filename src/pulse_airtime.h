@@ -0,0 +1,35 @@
+#ifndef __pulse_airtime_h
+#define __pulse_airtime_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Duty-cycle governor, as a token bucket of airtime: it fills at
+// duty_permille of the elapsed time, up to a window's worth of budget, and
+// each train takes its airtime out of it before starting. Over any span of
+// time the transmitter stays on air at most a window's budget more than
+// the duty cycle allows. Every call is O(1) and takes the current time as
+// an argument, so the governor has no dependency on the clock.
+typedef struct {
+  bool enabled;
+  uint16_t duty_permille;
+  int64_t capacity_us;
+  int64_t tokens_us;
+  // Budget earned below a microsecond, in thousandths of one.
+  uint16_t fraction;
+  int64_t updated_us;
+} pulse_airtime_t;
+
+// A duty_permille of 0 disables the governor, every train is then ready
+// at once.
+void pulse_airtime_init (pulse_airtime_t* airtime, uint16_t duty_permille, uint32_t window_ms, int64_t now_us);
+
+// Earliest time a train of airtime_us can start once pending_us of airtime
+// ahead of it has been charged. Trains longer than the whole budget wait
+// for a full bucket.
+int64_t pulse_airtime_ready_at (pulse_airtime_t* airtime, int64_t pending_us, int64_t airtime_us, int64_t now_us);
+
+// Takes airtime_us out of the budget, or gives it back when negative.
+void pulse_airtime_charge (pulse_airtime_t* airtime, int64_t airtime_us, int64_t now_us);
+
+#endif//__pulse_airtime_h
@@ -0,0 +1,180 @@
+#ifndef __pulse_backend_h
+#define __pulse_backend_h
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "pulse.h"
+#include "pulse_airtime.h"
+
+struct pulse_train_t;
+
+struct pulse_ctl_t;
+
+struct pulse_backend_t;
+
+// A pulse packs its level in the top bit and its duration in µs below.
+typedef uint32_t pulse_t;
+
+#define PULSE_LEVEL_BIT (1UL << 31)
+
+#define PULSE_MAX_DURATION (PULSE_LEVEL_BIT - 1)
+
+// One output of the controller. Its queues hold the trains sent to it,
+// current is the one on air, only ever changed by the controller task.
+typedef struct {
+  struct pulse_ctl_t* ctl;
+  uint8_t index;
+  pulse_channel_config_t config;
+  QueueHandle_t work_queue;
+  QueueHandle_t urgent_queue;
+  void* backend_data;
+  struct pulse_train_t* current;
+  int64_t started_us;
+  uint32_t trains;
+  int64_t busy_us;
+  // Airtime of the trains in the queues.
+  int64_t queued_airtime_us;
+} pulse_channel_t;
+
+typedef struct pulse_ctl_t {
+  pulse_channel_t channels[PULSE_MAX_CHANNELS];
+  uint8_t channel_count;
+  int64_t created_us;
+  QueueHandle_t free_queue;
+  struct pulse_train_t* pool;
+  pulse_t* pool_pulses;
+  struct pulse_entry_t* pool_entries;
+  portMUX_TYPE stats_lock;
+  pulse_ctl_stats_t stats;
+  TaskHandle_t task;
+  pulse_ctl_config_t config;
+  const struct pulse_backend_t* backend;
+  volatile uint32_t cancel_seq;
+  // Guarded by stats_lock. pending_airtime_us sums the queues of every
+  // channel, airtime_wake_us is when airtime_timer wakes the task, 0 when
+  // it is not armed.
+  pulse_airtime_t airtime;
+  int64_t pending_airtime_us;
+  esp_timer_handle_t airtime_timer;
+  int64_t airtime_wake_us;
+} pulse_ctl_t;
+
+// Events are notification bits of the controller task, so that any number
+// of them is delivered by a single wake-up. Completions have one bit per
+// channel.
+#define PULSE_EVENT_WORK (1UL << 0)
+#define PULSE_EVENT_PREEMPT (1UL << 1)
+#define PULSE_EVENT_KILL (1UL << 2)
+#define PULSE_EVENT_TRAIN_DONE(channel) (1UL << (8 + (channel)))
+#define PULSE_EVENT_PASS_DONE(channel) (1UL << (16 + (channel)))
+
+typedef struct {
+  pulse_t* pulses;
+  uint16_t capacity;
+  uint16_t count;
+} pulse_segment_t;
+
+// One link of a train: either a run of stored pulses, shared or owned by
+// the train, or a generator with its initial state. The train may be cut
+// before entries starting at a boundary.
+typedef struct pulse_entry_t {
+  const pulse_t* pulses;
+  uint16_t count;
+  bool boundary;
+  pulse_generator_t generator;
+  uint8_t state[PULSE_GENERATOR_STATE_SIZE];
+} pulse_entry_t;
+
+// Walk position: current entry, pulse index in it or, for a generator,
+// whether its state was loaded, and loop iterations already played.
+// split is set while stopped at a boundary for a split backend, so that
+// the next pass gets past it.
+typedef struct {
+  uint8_t entry;
+  uint16_t next;
+  uint16_t iterations;
+  bool split;
+  bool finished;
+  uint8_t state[PULSE_GENERATOR_STATE_SIZE];
+} pulse_cursor_t;
+
+typedef struct pulse_train_t {
+  pulse_ctl_t* ctl;
+  pulse_t* pulses;
+  uint16_t capacity;
+  uint16_t count;
+  pulse_entry_t* entries;
+  uint8_t max_entries;
+  uint8_t entry_count;
+  bool overflow;
+  int64_t origin_us;
+  // Time on air, measured when sent: a loop forever counts once and the
+  // iterations actually played are charged when the train ends.
+  int64_t airtime_us;
+  int64_t loop_airtime_us;
+  // Entries [loop_first, loop_end) are played loop_count times, or until
+  // the controller cancel_seq moves past the one seen at send time or the
+  // loop of the train tag is cancelled. in_use and loop_cancelled are
+  // guarded by the controller stats_lock.
+  uint8_t loop_first;
+  uint8_t loop_end;
+  uint16_t loop_count;
+  uint32_t cancel_seq;
+  uint32_t tag;
+  bool in_use;
+  volatile bool loop_cancelled;
+  pulse_priority_t priority;
+  uint8_t channel;
+  bool boundary_pending;
+  // Set by the controller task to end the train at its next boundary.
+  volatile bool preempted;
+  bool split;
+  pulse_cursor_t cursor;
+} pulse_train_t;
+
+// A backend plays channel->current on the channel output and reports the
+// end of the train with pulse_channel_done_from_isr, or pulse_channel_done
+// when it gives up on the train from task context. init and deinit run on
+// the controller task once per channel, so interrupts end up on the task's
+// core.
+//
+// Backends that need a bounded amount of pulses up front set split:
+// pulse_train_next then also stops at each boundary, including loop
+// iterations, leaving cursor.finished unset. The backend reports the end of
+// such a pass with pulse_channel_pass_done_from_isr and is resumed from the
+// controller task. Passes are one frame long, which bounds how long a
+// preempted train stays on air.
+typedef struct pulse_backend_t {
+  esp_err_t (*init) (pulse_channel_t* channel);
+  void (*start) (pulse_channel_t* channel);
+  void (*resume) (pulse_channel_t* channel);
+  void (*deinit) (pulse_channel_t* channel);
+  bool split;
+} pulse_backend_t;
+
+extern const pulse_backend_t pulse_backend_timer;
+
+extern const pulse_backend_t pulse_backend_rmt;
+
+extern const pulse_backend_t pulse_backend_i2s;
+
+void pulse_train_rewind (pulse_train_t* train);
+
+// Returns train to the pool of the controller.
+void pulse_train_free (pulse_train_t* train);
+
+bool pulse_train_next (pulse_train_t* train, pulse_duration_t* duration, pulse_level_t* level);
+
+void pulse_channel_done (pulse_channel_t* channel);
+
+void pulse_channel_done_from_isr (pulse_channel_t* channel, BaseType_t* woken);
+
+void pulse_channel_pass_done_from_isr (pulse_channel_t* channel, BaseType_t* woken);
+
+// Handles the events of one wake-up of the controller task. Returns false
+// once the controller is killed, and freed.
+bool pulse_ctl_handle (pulse_ctl_t* ctl, uint32_t events);
+
+#endif//__pulse_backend_h
@@ -0,0 +1,199 @@
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "pulse_backend.h"
+#include "pulse_i2s.h"
+
+static const char* DRAM_ATTR TAG = "pulse_i2s";
+
+#define PULSE_I2S_DEFAULT_SAMPLE_US 10
+
+#define PULSE_I2S_DMA_BUF_COUNT 4
+
+// In stereo frames, one frame carries two 16 bit words.
+#define PULSE_I2S_DMA_BUF_LEN 128
+
+// Words of one DMA buffer, and of the render buffer.
+#define PULSE_I2S_BUFFER_WORDS (PULSE_I2S_DMA_BUF_LEN * 2)
+
+typedef struct {
+  TaskHandle_t task;
+  uint16_t buffer[PULSE_I2S_BUFFER_WORDS];
+} pulse_i2s_t;
+
+static void pulse_i2s_task(void* data);
+
+void pulse_i2s_renderer_init(pulse_i2s_renderer_t* renderer, pulse_train_t* train, uint32_t sample_us) {
+  memset(renderer, 0, sizeof(pulse_i2s_renderer_t));
+  renderer->train = train;
+  renderer->sample_us = sample_us;
+  renderer->level = PULSE_LOW;
+  pulse_train_rewind(train);
+}
+
+static bool pulse_i2s_renderer_advance(pulse_i2s_renderer_t* renderer) {
+  pulse_duration_t duration;
+  pulse_level_t level;
+  while (pulse_train_next(renderer->train, &duration, &level)) {
+    renderer->edge_us += duration;
+    uint64_t edge = (renderer->edge_us + renderer->sample_us / 2) / renderer->sample_us;
+    // A pulse shorter than half a sample may round away entirely.
+    if (edge <= renderer->position)
+      continue;
+
+    renderer->remaining = edge - renderer->position;
+    renderer->position = edge;
+    renderer->level = level;
+    return true;
+  }
+
+  renderer->done = true;
+  return false;
+}
+
+size_t pulse_i2s_render(pulse_i2s_renderer_t* renderer, uint16_t* buffer, size_t words) {
+  size_t count = 0;
+  while (count < words && !renderer->done) {
+    uint32_t word = 0;
+    uint32_t bits = 16;
+    while (bits > 0) {
+      if (renderer->remaining == 0 && !pulse_i2s_renderer_advance(renderer))
+        break;
+
+      uint32_t run = renderer->remaining < bits ? renderer->remaining : bits;
+      if (renderer->level == PULSE_HIGH)
+        word |= ((1u << run) - 1) << (bits - run);
+
+      bits -= run;
+      renderer->remaining -= run;
+    }
+
+    // Once the train ended on a word boundary there is nothing left to emit,
+    // otherwise the tail of the last word stays low.
+    if (bits == 16)
+      break;
+
+    buffer[count++] = word;
+  }
+
+  return count;
+}
+
+static esp_err_t pulse_i2s_init(pulse_channel_t* channel) {
+  pulse_ctl_config_t* ctl_cfg = &channel->ctl->config;
+  pulse_channel_config_t* cfg = &channel->config;
+  if (ctl_cfg->i2s_sample_us == 0)
+    ctl_cfg->i2s_sample_us = PULSE_I2S_DEFAULT_SAMPLE_US;
+
+  // The bit clock runs at one bit per sample, 32 bits per stereo frame.
+  uint32_t sample_rate = 1000000 / (ctl_cfg->i2s_sample_us * 32);
+  ESP_LOGI(TAG, "Initializing I2S port %d, %d µs per sample (%d Hz frames).",
+    cfg->i2s_port, ctl_cfg->i2s_sample_us, sample_rate);
+
+  i2s_config_t i2s = {
+    .mode = I2S_MODE_MASTER | I2S_MODE_TX,
+    .sample_rate = sample_rate,
+    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+    .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
+    .communication_format = I2S_COMM_FORMAT_STAND_MSB,
+    .intr_alloc_flags = 0,
+    .dma_buf_count = PULSE_I2S_DMA_BUF_COUNT,
+    .dma_buf_len = PULSE_I2S_DMA_BUF_LEN,
+    .use_apll = false,
+    .tx_desc_auto_clear = true,
+  };
+
+  esp_err_t result = i2s_driver_install(cfg->i2s_port, &i2s, 0, NULL);
+  if (result != ESP_OK)
+    return result;
+
+  i2s_pin_config_t pins = {
+    .bck_io_num = I2S_PIN_NO_CHANGE,
+    .ws_io_num = I2S_PIN_NO_CHANGE,
+    .data_out_num = cfg->gpio,
+    .data_in_num = I2S_PIN_NO_CHANGE,
+  };
+
+  result = i2s_set_pin(cfg->i2s_port, &pins);
+  if (result != ESP_OK) {
+    i2s_driver_uninstall(cfg->i2s_port);
+    return result;
+  }
+
+  pulse_i2s_t* i2s_data = calloc(1, sizeof(pulse_i2s_t));
+  if (i2s_data == NULL) {
+    i2s_driver_uninstall(cfg->i2s_port);
+    return ESP_ERR_NO_MEM;
+  }
+
+  channel->backend_data = i2s_data;
+  xTaskCreate(&pulse_i2s_task, "pulse_i2s_task", 2048, channel, 6, &i2s_data->task);
+  return ESP_OK;
+}
+
+static void pulse_i2s_start(pulse_channel_t* channel) {
+  pulse_i2s_t* i2s = channel->backend_data;
+  xTaskNotifyGive(i2s->task);
+}
+
+static void pulse_i2s_deinit(pulse_channel_t* channel) {
+  pulse_i2s_t* i2s = channel->backend_data;
+  vTaskDelete(i2s->task);
+  i2s_driver_uninstall(channel->config.i2s_port);
+  free(i2s);
+  channel->backend_data = NULL;
+}
+
+// Returns the words written, padding included.
+static size_t pulse_i2s_write(pulse_channel_t* channel, uint16_t* buffer, size_t words) {
+  // The ESP32 sends the second half of each 32 bit frame first in 16 bit
+  // stereo mode, so words are swapped pairwise and padded to full frames.
+  if (words % 2 == 1)
+    buffer[words++] = 0;
+
+  for (size_t i = 0; i < words; i += 2) {
+    uint16_t word = buffer[i];
+    buffer[i] = buffer[i + 1];
+    buffer[i + 1] = word;
+  }
+
+  size_t written;
+  i2s_write(channel->config.i2s_port, buffer, words * sizeof(uint16_t), &written, portMAX_DELAY);
+  return words;
+}
+
+static void pulse_i2s_task(void* data) {
+  pulse_channel_t* channel = data;
+  pulse_i2s_t* i2s = channel->backend_data;
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // i2s_write copies into the DMA buffers before returning, so a single
+    // buffer is rendered and written in turn; long silences are produced
+    // a buffer at a time.
+    pulse_i2s_renderer_t renderer;
+    pulse_i2s_renderer_init(&renderer, channel->current, channel->ctl->config.i2s_sample_us);
+    size_t words;
+    size_t written = 0;
+    while ((words = pulse_i2s_render(&renderer, i2s->buffer, PULSE_I2S_BUFFER_WORDS - 1)) > 0)
+      written += pulse_i2s_write(channel, i2s->buffer, words);
+
+    // Only the rest of the DMA buffer holding the last edge is filled with
+    // silence. The train is done once it is all in the DMA ring, which
+    // plays it out in order ahead of the next train.
+    size_t padding = (PULSE_I2S_BUFFER_WORDS - written % PULSE_I2S_BUFFER_WORDS) % PULSE_I2S_BUFFER_WORDS;
+    if (padding > 0) {
+      memset(i2s->buffer, 0, padding * sizeof(uint16_t));
+      pulse_i2s_write(channel, i2s->buffer, padding);
+    }
+
+    pulse_channel_done(channel);
+  }
+}
+
+const pulse_backend_t pulse_backend_i2s = {
+  .init = pulse_i2s_init,
+  .start = pulse_i2s_start,
+  .deinit = pulse_i2s_deinit,
+};
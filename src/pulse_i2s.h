@@ -0,0 +1,23 @@
+#ifndef __pulse_i2s_h
+#define __pulse_i2s_h
+
+#include "pulse_backend.h"
+
+// Renders a pulse train to a bitstream, one bit per sample, MSB first in
+// each 16 bit word. Edges are placed on the sample nearest to their exact
+// time so rounding does not accumulate along the train.
+typedef struct {
+  pulse_train_t* train;
+  uint32_t sample_us;
+  uint64_t edge_us;
+  uint64_t position;
+  uint64_t remaining;
+  pulse_level_t level;
+  bool done;
+} pulse_i2s_renderer_t;
+
+void pulse_i2s_renderer_init (pulse_i2s_renderer_t* renderer, pulse_train_t* train, uint32_t sample_us);
+
+size_t pulse_i2s_render (pulse_i2s_renderer_t* renderer, uint16_t* buffer, size_t words);
+
+#endif//__pulse_i2s_h
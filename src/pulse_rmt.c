@@ -0,0 +1,223 @@
+#include <string.h>
+#include "esp_log.h"
+#include "soc/rtc.h"
+#include "pulse_backend.h"
+#include "pulse_rmt.h"
+
+static const char* DRAM_ATTR TAG = "pulse_rmt";
+
+typedef struct {
+  rmt_item32_t* items;
+  size_t capacity;
+} pulse_rmt_t;
+
+// The tx end callback is registered once for the whole RMT driver, so the
+// controller channel owning each RMT channel is looked up here.
+static pulse_channel_t* DRAM_ATTR pulse_rmt_channels[RMT_CHANNEL_MAX];
+
+static void IRAM_ATTR pulse_rmt_tx_end(rmt_channel_t channel, void* arg);
+
+void pulse_rmt_encoder_init(pulse_rmt_encoder_t* encoder, rmt_item32_t* items, size_t capacity) {
+  encoder->items = items;
+  encoder->capacity = capacity;
+  encoder->count = 0;
+  encoder->half = false;
+}
+
+esp_err_t pulse_rmt_encoder_add(pulse_rmt_encoder_t* encoder, pulse_duration_t duration, pulse_level_t level) {
+  // Pulses longer than a single item half can hold are split in several
+  // halves of the same level, the output does not change between them.
+  while (duration > 0) {
+    uint32_t chunk = duration > PULSE_RMT_MAX_DURATION ? PULSE_RMT_MAX_DURATION : duration;
+    duration -= chunk;
+
+    if (encoder->half) {
+      rmt_item32_t* item = &encoder->items[encoder->count - 1];
+      item->duration1 = chunk;
+      item->level1 = level;
+      encoder->half = false;
+      continue;
+    }
+
+    if (encoder->count == encoder->capacity)
+      return ESP_ERR_INVALID_SIZE;
+
+    rmt_item32_t* item = &encoder->items[encoder->count++];
+    item->val = 0;
+    item->duration0 = chunk;
+    item->level0 = level;
+    encoder->half = true;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t pulse_rmt_encoder_end(pulse_rmt_encoder_t* encoder) {
+  // A zero duration half marks the end of the transmission. When the last
+  // item is already full, a dedicated end marker item is appended.
+  if (encoder->half) {
+    rmt_item32_t* item = &encoder->items[encoder->count - 1];
+    item->duration1 = 0;
+    item->level1 = PULSE_LOW;
+    encoder->half = false;
+    return ESP_OK;
+  }
+
+  if (encoder->count == encoder->capacity)
+    return ESP_ERR_INVALID_SIZE;
+
+  encoder->items[encoder->count++].val = 0;
+  return ESP_OK;
+}
+
+size_t pulse_rmt_items_needed(pulse_train_t* train) {
+  size_t halves = 0;
+  pulse_duration_t duration;
+  pulse_level_t level;
+  pulse_cursor_t cursor = train->cursor;
+  while (pulse_train_next(train, &duration, &level))
+    halves += (duration + PULSE_RMT_MAX_DURATION - 1) / PULSE_RMT_MAX_DURATION;
+
+  train->cursor = cursor;
+  // Round up to full items, plus room for the end marker.
+  return halves / 2 + 1;
+}
+
+esp_err_t pulse_rmt_encode(pulse_train_t* train, pulse_rmt_encoder_t* encoder) {
+  pulse_duration_t duration;
+  pulse_level_t level;
+  while (pulse_train_next(train, &duration, &level)) {
+    esp_err_t result = pulse_rmt_encoder_add(encoder, duration, level);
+    if (result != ESP_OK)
+      return result;
+  }
+
+  return pulse_rmt_encoder_end(encoder);
+}
+
+static esp_err_t pulse_rmt_init(pulse_channel_t* channel) {
+  pulse_channel_config_t* cfg = &channel->config;
+  uint8_t mem_blocks = channel->ctl->config.rmt_mem_block_num;
+  if (cfg->rmt_channel >= RMT_CHANNEL_MAX || pulse_rmt_channels[cfg->rmt_channel] != NULL)
+    return ESP_ERR_INVALID_ARG;
+
+  uint32_t divider = rtc_clk_apb_freq_get () / 1000000;
+  ESP_LOGI(TAG, "Initializing RMT channel %d with divider %d.", cfg->rmt_channel, divider);
+  rmt_config_t rmt = {
+    .rmt_mode = RMT_MODE_TX,
+    .channel = cfg->rmt_channel,
+    .gpio_num = cfg->gpio,
+    .clk_div = divider,
+    .mem_block_num = mem_blocks > 0 ? mem_blocks : 1,
+    .tx_config = {
+      .carrier_en = false,
+      .loop_en = false,
+      .idle_level = RMT_IDLE_LEVEL_LOW,
+      .idle_output_en = true,
+    }
+  };
+
+  esp_err_t result = rmt_config(&rmt);
+  if (result != ESP_OK)
+    return result;
+
+  result = rmt_driver_install(cfg->rmt_channel, 0, 0);
+  if (result != ESP_OK)
+    return result;
+
+  pulse_rmt_t* rmt_data = calloc(1, sizeof(pulse_rmt_t));
+  if (rmt_data == NULL) {
+    rmt_driver_uninstall(cfg->rmt_channel);
+    return ESP_ERR_NO_MEM;
+  }
+
+  channel->backend_data = rmt_data;
+  pulse_rmt_channels[cfg->rmt_channel] = channel;
+  rmt_register_tx_end_callback(&pulse_rmt_tx_end, NULL);
+  return ESP_OK;
+}
+
+// Sends the train from its cursor up to its end or its next boundary. The
+// next pass is sent when the RMT reports this one done, which only
+// stretches the low level gap that ends every frame by the time it takes
+// to encode it.
+static void pulse_rmt_send_pass(pulse_channel_t* channel) {
+  pulse_rmt_t* rmt = channel->backend_data;
+  pulse_channel_config_t* cfg = &channel->config;
+  size_t needed = pulse_rmt_items_needed(channel->current);
+
+  // The item buffer only grows, a controller sending the same kind of train
+  // over and over allocates it once.
+  if (needed > rmt->capacity) {
+    rmt_item32_t* items = realloc(rmt->items, needed * sizeof(rmt_item32_t));
+    if (items == NULL) {
+      ESP_LOGE(TAG, "Cannot allocate %d RMT items.", needed);
+      pulse_channel_done(channel);
+      return;
+    }
+
+    rmt->items = items;
+    rmt->capacity = needed;
+  }
+
+  pulse_rmt_encoder_t encoder;
+  pulse_rmt_encoder_init(&encoder, rmt->items, rmt->capacity);
+  if (pulse_rmt_encode(channel->current, &encoder) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to encode pulse train for RMT channel %d.", cfg->rmt_channel);
+    pulse_channel_done(channel);
+    return;
+  }
+
+  // A train preempted at this boundary leaves nothing but the end marker.
+  if (encoder.count == 1 && rmt->items[0].duration0 == 0) {
+    pulse_channel_done(channel);
+    return;
+  }
+
+  if (rmt_write_items(cfg->rmt_channel, rmt->items, encoder.count, false) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to send pulse train on RMT channel %d.", cfg->rmt_channel);
+    pulse_channel_done(channel);
+  }
+}
+
+static void pulse_rmt_start(pulse_channel_t* channel) {
+  pulse_rmt_send_pass(channel);
+}
+
+static void pulse_rmt_resume(pulse_channel_t* channel) {
+  pulse_rmt_send_pass(channel);
+}
+
+static void pulse_rmt_deinit(pulse_channel_t* channel) {
+  pulse_rmt_t* rmt = channel->backend_data;
+  pulse_channel_config_t* cfg = &channel->config;
+  rmt_tx_stop(cfg->rmt_channel);
+  rmt_driver_uninstall(cfg->rmt_channel);
+  pulse_rmt_channels[cfg->rmt_channel] = NULL;
+  free(rmt->items);
+  free(rmt);
+  channel->backend_data = NULL;
+}
+
+static void IRAM_ATTR pulse_rmt_tx_end(rmt_channel_t rmt_channel, void* arg) {
+  (void) arg;
+  pulse_channel_t* channel = pulse_rmt_channels[rmt_channel];
+  if (channel == NULL)
+    return;
+
+  BaseType_t woken = pdFALSE;
+  if (channel->current->cursor.finished)
+    pulse_channel_done_from_isr(channel, &woken);
+  else
+    pulse_channel_pass_done_from_isr(channel, &woken);
+  if (woken == pdTRUE)
+    portYIELD_FROM_ISR();
+}
+
+const pulse_backend_t pulse_backend_rmt = {
+  .init = pulse_rmt_init,
+  .start = pulse_rmt_start,
+  .resume = pulse_rmt_resume,
+  .deinit = pulse_rmt_deinit,
+  .split = true,
+};
@@ -0,0 +1,27 @@
+#ifndef __pulse_rmt_h
+#define __pulse_rmt_h
+
+#include "driver/rmt.h"
+#include "pulse_backend.h"
+
+// Largest duration, in ticks, a single RMT item half can hold.
+#define PULSE_RMT_MAX_DURATION 0x7fff
+
+typedef struct {
+  rmt_item32_t* items;
+  size_t capacity;
+  size_t count;
+  bool half;
+} pulse_rmt_encoder_t;
+
+void pulse_rmt_encoder_init (pulse_rmt_encoder_t* encoder, rmt_item32_t* items, size_t capacity);
+
+esp_err_t pulse_rmt_encoder_add (pulse_rmt_encoder_t* encoder, pulse_duration_t duration, pulse_level_t level);
+
+esp_err_t pulse_rmt_encoder_end (pulse_rmt_encoder_t* encoder);
+
+size_t pulse_rmt_items_needed (pulse_train_t* train);
+
+esp_err_t pulse_rmt_encode (pulse_train_t* train, pulse_rmt_encoder_t* encoder);
+
+#endif//__pulse_rmt_h
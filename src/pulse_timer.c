@@ -0,0 +1,85 @@
+#include "esp_log.h"
+#include "soc/rtc.h"
+#include "pulse_backend.h"
+
+static const char* DRAM_ATTR TAG = "pulse_timer";
+
+static bool IRAM_ATTR pulse_timer_alarm_handler(void* args);
+
+static esp_err_t pulse_timer_init(pulse_channel_t* channel) {
+  pulse_channel_config_t* cfg = &channel->config;
+  gpio_config_t gpio = {
+    .mode = GPIO_MODE_OUTPUT,
+    .pin_bit_mask = BIT(cfg->gpio),
+    .intr_type = GPIO_INTR_DISABLE,
+    .pull_up_en = GPIO_PULLUP_DISABLE,
+    .pull_down_en = GPIO_PULLDOWN_ENABLE
+  };
+
+  gpio_config(&gpio);
+
+  uint32_t divider = rtc_clk_apb_freq_get () / 1000000;
+  ESP_LOGI(TAG, "Initializing timer with divider %d.", divider);
+  timer_config_t timer = {
+    .divider = divider,
+    .alarm_en = TIMER_ALARM_DIS,
+    .auto_reload = TIMER_AUTORELOAD_EN,
+    .counter_dir = TIMER_COUNT_UP,
+    .counter_en = TIMER_PAUSE
+  };
+
+  timer_init(cfg->timer_group, cfg->timer_idx, &timer);
+  timer_isr_callback_add(cfg->timer_group, cfg->timer_idx, pulse_timer_alarm_handler, channel, 0);
+  timer_set_alarm_value(cfg->timer_group, cfg->timer_idx, 500 * 1000);
+
+  ESP_LOGI(TAG, "Timer backend ready. Timer group= %d, Timer = %d", cfg->timer_group, cfg->timer_idx);
+  return ESP_OK;
+}
+
+static void pulse_timer_start(pulse_channel_t* channel) {
+  pulse_train_t* train = channel->current;
+  pulse_channel_config_t* cfg = &channel->config;
+  pulse_duration_t alarm;
+  pulse_level_t level;
+  if (!pulse_train_next(train, &alarm, &level)) {
+    // Nothing to put on air, the train is done without arming the timer.
+    pulse_channel_done(channel);
+    return;
+  }
+
+  timer_set_alarm_value(cfg->timer_group, cfg->timer_idx, alarm);
+  timer_set_alarm(cfg->timer_group, cfg->timer_idx, TIMER_ALARM_EN);
+  gpio_set_level(cfg->gpio, level);
+  timer_start(cfg->timer_group, cfg->timer_idx);
+}
+
+static void pulse_timer_deinit(pulse_channel_t* channel) {
+  pulse_channel_config_t* cfg = &channel->config;
+  timer_pause(cfg->timer_group, cfg->timer_idx);
+  timer_isr_callback_remove(cfg->timer_group, cfg->timer_idx);
+  timer_deinit(cfg->timer_group, cfg->timer_idx);
+}
+
+static bool IRAM_ATTR pulse_timer_alarm_handler(void* args) {
+  pulse_channel_t* channel = (pulse_channel_t*)args;
+  pulse_channel_config_t* cfg = &channel->config;
+  pulse_duration_t alarm;
+  pulse_level_t level;
+  if (!pulse_train_next(channel->current, &alarm, &level)) {
+    gpio_set_level(cfg->gpio, PULSE_LOW);
+    timer_group_set_counter_enable_in_isr(cfg->timer_group, cfg->timer_idx, TIMER_PAUSE);
+    BaseType_t woken = pdFALSE;
+    pulse_channel_done_from_isr(channel, &woken);
+    return woken == pdTRUE;
+  }
+
+  timer_group_set_alarm_value_in_isr(cfg->timer_group, cfg->timer_idx, alarm);
+  gpio_set_level(cfg->gpio, level);
+  return false;
+}
+
+const pulse_backend_t pulse_backend_timer = {
+  .init = pulse_timer_init,
+  .start = pulse_timer_start,
+  .deinit = pulse_timer_deinit,
+};
@@ -1,70 +1,671 @@
 #include <esp_log.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
 #include "somfy.h"
 #include "nvs.h"
 #include "pulse.h"
+#include "somfy_encoder.h"
+#include "mutex.h"
 
 static const char* TAG = "somfy";
 
+// Most recently pressed remotes whose next UP, DOWN and STOP frames are
+// kept ready.
+#define SOMFY_FRAME_CACHE_SIZE 8
+
+#define SOMFY_CACHED_BUTTONS 3
+
+// Remotes that can have a command waiting for the transmitter at once.
+#define SOMFY_SCHEDULER_SLOTS 16
+
+// Request IDs remembered to suppress retries, the oldest one is forgotten
+// first.
+#define SOMFY_RECENT_REQUESTS 16
+
+#define SOMFY_CONFIG_URL "http://blav.ngrok.io/config"
+
+// Remotes that can wait for their reservation to be saved at once. Beyond
+// that, reservations are saved before the code is used.
+#define SOMFY_PERSIST_SLOTS 16
+
+// Distinct transmission profiles with their segments built. Remotes with a
+// profile beyond these are sent with the default one, in slot 0.
+#define SOMFY_PROFILE_SLOTS 4
+
 typedef struct {
-  uint8_t frame[7];
+  uint8_t frame[SOMFY_FRAME_SIZE];
   somfy_ctl_handle_t ctl;
 } somfy_frame_t;
 
+// Next frames of a remote, built with a rolling code already allocated and
+// persisted. Only valid while the remote's rolling code is still that one.
+// An entry stays with its remote once consumed, to be built again, until
+// a remote pressed more recently takes it.
+typedef struct {
+  bool used;
+  bool valid;
+  somfy_remote_t remote;
+  int64_t pressed_us;
+  somfy_rolling_code_t rolling_code;
+  somfy_frame_t frames[SOMFY_CACHED_BUTTONS];
+} somfy_frame_cache_entry_t;
+
+// Latest command not sent yet for a remote. seq orders slots by arrival.
+typedef struct {
+  bool pending;
+  somfy_command_t command;
+  bool hold;
+  uint16_t repeats;
+  uint32_t seq;
+  int64_t pressed_us;
+} somfy_scheduler_slot_t;
+
+// Segments of a profile, built the first time a remote uses it and kept
+// until the controller is freed, so trains may share them.
+typedef struct {
+  bool used;
+  somfy_profile_t profile;
+  somfy_segments_t segments;
+} somfy_profile_slot_t;
+
+typedef struct {
+  uint32_t request_id;
+  int64_t accepted_us;
+} somfy_recent_request_t;
+
+typedef struct {
+  portMUX_TYPE lock;
+  somfy_scheduler_slot_t slots[SOMFY_SCHEDULER_SLOTS];
+  uint32_t seq;
+  uint32_t coalesced;
+  uint32_t dropped;
+  uint32_t executed;
+  uint32_t failed;
+  uint32_t duplicates;
+  somfy_recent_request_t recent[SOMFY_RECENT_REQUESTS];
+  uint8_t recent_next;
+  TaskHandle_t task;
+} somfy_scheduler_t;
+
+// Remote whose latest reservation may not be durable yet. seq orders it
+// against the saves.
+typedef struct {
+  bool pending;
+  somfy_remote_t remote;
+  uint32_t seq;
+  int64_t requested_us;
+} somfy_persist_slot_t;
+
+// Saves the config in the background while frames are on air. Only one
+// save runs at a time, under mutex.
+typedef struct {
+  portMUX_TYPE lock;
+  somfy_persist_slot_t slots[SOMFY_PERSIST_SLOTS];
+  uint32_t seq;
+  SemaphoreHandle_t mutex;
+  TaskHandle_t task;
+} somfy_persist_t;
+
 typedef struct {
   pulse_train_handle_t pulse_ctl;
   somfy_config_handle_t config;
+  SemaphoreHandle_t profiles_mutex;
+  somfy_profile_slot_t profiles[SOMFY_PROFILE_SLOTS];
+  uint8_t max_segments;
+  SemaphoreHandle_t cache_mutex;
+  somfy_frame_cache_entry_t cache[SOMFY_FRAME_CACHE_SIZE];
+  TaskHandle_t precompute_task;
+  somfy_scheduler_t scheduler;
+  somfy_persist_t persist;
+  somfy_config_replicator_handle_t replicator;
+  somfy_ctl_stats_t stats;
 } somfy_ctl_t;
 
+static const somfy_button_t somfy_cached_buttons[SOMFY_CACHED_BUTTONS] = { BUTTON_UP, BUTTON_DOWN, BUTTON_STOP };
+
+void somfy_ctl_precompute_task(void* data);
+
+void somfy_ctl_scheduler_task(void* data);
+
+void somfy_ctl_persist_task(void* data);
+
+esp_err_t somfy_frame_init(somfy_frame_t* frame, somfy_ctl_handle_t ctl, somfy_command_t* command);
+
+void somfy_frame_build(somfy_frame_t* frame, somfy_ctl_handle_t ctl, somfy_command_t* command, somfy_rolling_code_t rolling_code);
+
+void somfy_frame_debug(somfy_frame_t* frame, somfy_command_t * command, somfy_rolling_code_t code);
+
+void somfy_remote_rolling_code_get_and_inc (somfy_remote_t remote, somfy_rolling_code_t * code);
+
+esp_err_t somfy_ctl_allocate_rolling_code (somfy_ctl_handle_t cfg, somfy_remote_t remote, somfy_rolling_code_t * rolling_code);
+
+static esp_err_t somfy_persist_wait (somfy_ctl_t * ctl, somfy_remote_t remote);
+
+static void somfy_persist_request (somfy_ctl_t * ctl, somfy_remote_t remote);
+
+static esp_err_t somfy_ctl_persist (somfy_ctl_t * ctl);
+
 esp_err_t somfy_ctl_init (somfy_config_handle_t ctl_cfg, pulse_ctl_config_t * pulse_cfg, somfy_ctl_handle_t * handle) {
   somfy_ctl_t * ctl = calloc(1, sizeof(somfy_ctl_t));
   ctl->pulse_ctl = pulse_ctl_new (pulse_cfg);
   ctl->config = ctl_cfg;
+  ctl->max_segments = pulse_cfg->max_segments > 0 ? pulse_cfg->max_segments : PULSE_DEFAULT_MAX_SEGMENTS;
+  const somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+  ctl->profiles[0].used = true;
+  ctl->profiles[0].profile = profile;
+  ESP_ERROR_CHECK (somfy_segments_new (&ctl->profiles[0].segments, &profile));
+  ESP_ERROR_CHECK_NOTNULL (ctl->profiles_mutex = xSemaphoreCreateMutex());
+  ESP_ERROR_CHECK_NOTNULL (ctl->cache_mutex = xSemaphoreCreateMutex());
+  ESP_ERROR_CHECK (somfy_config_replicator_new (ctl->config, SOMFY_CONFIG_URL, &ctl->replicator));
+  vPortCPUInitializeMutex(&ctl->persist.lock);
+  ESP_ERROR_CHECK_NOTNULL (ctl->persist.mutex = xSemaphoreCreateMutex());
+  xTaskCreate(&somfy_ctl_persist_task, "somfy_persist", 4096, ctl, tskIDLE_PRIORITY + 2, &ctl->persist.task);
+  xTaskCreate(&somfy_ctl_precompute_task, "somfy_precompute", 3072, ctl, tskIDLE_PRIORITY + 1, &ctl->precompute_task);
+  vPortCPUInitializeMutex(&ctl->scheduler.lock);
+  xTaskCreate(&somfy_ctl_scheduler_task, "somfy_scheduler", 4096, ctl, 5, &ctl->scheduler.task);
   *handle = ctl;
   return ESP_OK;
 }
 
 esp_err_t somfy_ctl_free (somfy_ctl_handle_t handle) {
   somfy_ctl_t * ctl = (somfy_ctl_t *) handle;
+  vTaskDelete(ctl->scheduler.task);
+  vTaskDelete(ctl->precompute_task);
+  vTaskDelete(ctl->persist.task);
+  somfy_config_replicator_free(ctl->replicator);
   pulse_ctl_free(ctl->pulse_ctl);
+  for (int i = 0; i < SOMFY_PROFILE_SLOTS; i++) {
+    if (ctl->profiles[i].used)
+      somfy_segments_free(&ctl->profiles[i].segments);
+  }
+  vSemaphoreDelete(ctl->profiles_mutex);
+  vSemaphoreDelete(ctl->cache_mutex);
+  vSemaphoreDelete(ctl->persist.mutex);
   free(ctl);
   return ESP_OK;
 }
 
+esp_err_t somfy_ctl_get_stats (somfy_ctl_handle_t handle, somfy_ctl_stats_t * stats) {
+  somfy_ctl_t * ctl = (somfy_ctl_t *) handle;
+  MUTEX_TAKE(ctl->cache_mutex);
+  memcpy(stats, &ctl->stats, sizeof(somfy_ctl_stats_t));
+  MUTEX_GIVE(ctl->cache_mutex);
 
-typedef uint8_t somfy_sync_t;
+  somfy_scheduler_t * scheduler = &ctl->scheduler;
+  portENTER_CRITICAL(&scheduler->lock);
+  stats->commands_coalesced = scheduler->coalesced;
+  stats->commands_dropped = scheduler->dropped;
+  stats->commands_executed = scheduler->executed;
+  stats->commands_failed = scheduler->failed;
+  stats->commands_duplicate = scheduler->duplicates;
+  portEXIT_CRITICAL(&scheduler->lock);
 
-void somfy_frame_init(somfy_frame_t* frame, somfy_ctl_handle_t ctl, somfy_command_t* command);
+  somfy_config_replicator_get_stats(ctl->replicator, &stats->replication);
+  return ESP_OK;
+}
 
-void somfy_frame_write(somfy_frame_t* frame, pulse_train_handle_t train, somfy_sync_t sync);
+static int somfy_cached_button_index (somfy_button_t button) {
+  for (int i = 0; i < SOMFY_CACHED_BUTTONS; i++) {
+    if (somfy_cached_buttons[i] == button)
+      return i;
+  }
 
-void somfy_frame_debug(somfy_frame_t* frame, somfy_command_t * command, somfy_rolling_code_t code);
+  return -1;
+}
 
-void somfy_remote_rolling_code_get_and_inc (somfy_remote_t remote, somfy_rolling_code_t * code);
+// Takes the precomputed frame for command out of the cache. The entry is
+// consumed whatever the outcome: its rolling code is either used now or
+// found stale.
+static bool somfy_frame_cache_take (somfy_ctl_t * ctl, somfy_command_t * command, somfy_frame_t * frame) {
+  int button = somfy_cached_button_index(command->button);
+  somfy_rolling_code_t current;
+  bool found = false;
+  MUTEX_TAKE(ctl->cache_mutex);
+  for (int i = 0; i < SOMFY_FRAME_CACHE_SIZE; i++) {
+    somfy_frame_cache_entry_t * entry = &ctl->cache[i];
+    if (!entry->valid || entry->remote != command->remote)
+      continue;
+
+    entry->valid = false;
+    found = button >= 0 &&
+      somfy_config_get_rolling_code(ctl->config, command->remote, &current) == ESP_OK &&
+      current == entry->rolling_code;
+    if (found)
+      memcpy(frame, &entry->frames[button], sizeof(somfy_frame_t));
+    break;
+  }
 
-esp_err_t somfy_ctl_increment_rolling_code_and_write_nvs (somfy_ctl_handle_t cfg, somfy_remote_t remote, somfy_rolling_code_t * rolling_code);
+  MUTEX_GIVE(ctl->cache_mutex);
+  return found;
+}
 
-esp_err_t somfy_ctl_send_command (somfy_ctl_handle_t handle, somfy_command_t* command) {
+static void somfy_frame_cache_drop (somfy_ctl_t * ctl, somfy_remote_t remote) {
+  MUTEX_TAKE(ctl->cache_mutex);
+  for (int i = 0; i < SOMFY_FRAME_CACHE_SIZE; i++) {
+    if (ctl->cache[i].remote == remote)
+      ctl->cache[i].valid = false;
+  }
+  MUTEX_GIVE(ctl->cache_mutex);
+}
+
+// Gives remote an entry of the cache, the one of the remote pressed the
+// longest ago if none is left, so that the precompute task builds its next
+// frames. The code of the frames evicted is never sent.
+static void somfy_frame_cache_touch (somfy_ctl_t * ctl, somfy_remote_t remote, int64_t pressed) {
+  MUTEX_TAKE(ctl->cache_mutex);
+  somfy_frame_cache_entry_t * slot = NULL;
+  for (int i = 0; i < SOMFY_FRAME_CACHE_SIZE; i++) {
+    somfy_frame_cache_entry_t * entry = &ctl->cache[i];
+    if (entry->used && entry->remote == remote) {
+      slot = entry;
+      break;
+    }
+
+    if (slot == NULL || (slot->used && (!entry->used || entry->pressed_us < slot->pressed_us)))
+      slot = entry;
+  }
+
+  if (!slot->used || slot->remote != remote) {
+    slot->valid = false;
+    slot->used = true;
+    slot->remote = remote;
+  }
+  slot->pressed_us = pressed;
+  MUTEX_GIVE(ctl->cache_mutex);
+}
+
+static void somfy_frame_cache_precompute (somfy_ctl_t * ctl, somfy_frame_cache_entry_t * slot) {
+  MUTEX_TAKE(ctl->cache_mutex);
+  somfy_remote_t remote = slot->remote;
+  bool needed = slot->used && !slot->valid;
+  MUTEX_GIVE(ctl->cache_mutex);
+  if (!needed)
+    return;
+
+  // The rolling code is allocated and persisted now, off the press path.
+  // Receivers accept forward jumps, so a code that is never sent only
+  // skips one value.
+  somfy_frame_cache_entry_t entry = { .used = true, .valid = true, .remote = remote };
+  if (somfy_ctl_allocate_rolling_code(ctl, remote, &entry.rolling_code) != ESP_OK)
+    return;
+
+  for (int i = 0; i < SOMFY_CACHED_BUTTONS; i++) {
+    somfy_command_t command = { .remote = remote, .button = somfy_cached_buttons[i] };
+    somfy_frame_build(&entry.frames[i], ctl, &command, entry.rolling_code);
+  }
+
+  // The entry may have gone to another remote meanwhile.
+  MUTEX_TAKE(ctl->cache_mutex);
+  bool kept = slot->used && !slot->valid && slot->remote == remote;
+  if (kept) {
+    entry.pressed_us = slot->pressed_us;
+    memcpy(slot, &entry, sizeof(somfy_frame_cache_entry_t));
+  }
+  MUTEX_GIVE(ctl->cache_mutex);
+  if (kept)
+    ESP_LOGI(TAG, "Precomputed frames for remote %06x (code = %d).", remote & 0xffffff, entry.rolling_code);
+}
+
+// Builds the frames of every entry given to a remote and consumed since.
+static void somfy_frame_cache_fill (somfy_ctl_t * ctl) {
+  for (int i = 0; i < SOMFY_FRAME_CACHE_SIZE; i++)
+    somfy_frame_cache_precompute(ctl, &ctl->cache[i]);
+}
+
+void somfy_ctl_precompute_task (void * data) {
+  somfy_ctl_t * ctl = (somfy_ctl_t *) data;
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    somfy_frame_cache_fill(ctl);
+  }
+}
+
+// Segments of the profile of remote, built on first use.
+static somfy_segments_t * somfy_ctl_segments (somfy_ctl_t * ctl, somfy_remote_t remote) {
+  somfy_profile_t profile;
+  if (somfy_config_get_profile(ctl->config, remote, &profile) != ESP_OK)
+    return &ctl->profiles[0].segments;
+
+  somfy_segments_t * segments = NULL;
+  MUTEX_TAKE(ctl->profiles_mutex);
+  for (int i = 0; i < SOMFY_PROFILE_SLOTS && segments == NULL; i++) {
+    somfy_profile_slot_t * slot = &ctl->profiles[i];
+    if (slot->used && somfy_profile_equal(&slot->profile, &profile))
+      segments = &slot->segments;
+    else if (!slot->used && somfy_segments_new(&slot->segments, &profile) == ESP_OK) {
+      slot->used = true;
+      slot->profile = profile;
+      segments = &slot->segments;
+    }
+  }
+  MUTEX_GIVE(ctl->profiles_mutex);
+
+  if (segments == NULL) {
+    ESP_LOGW(TAG, "No room for the profile of remote %06x, sending with the default one.", remote & 0xffffff);
+    return &ctl->profiles[0].segments;
+  }
+
+  return segments;
+}
+
+// Sends command, pressed when it was queued.
+static esp_err_t somfy_ctl_transmit (somfy_ctl_handle_t handle, somfy_command_t* command, bool hold, uint16_t repeats, int64_t pressed) {
   somfy_ctl_t * c = (somfy_ctl_t *) handle;
   pulse_ctl_handle_t ctl = c->pulse_ctl;
+  somfy_frame_t frame;
+  bool hit = somfy_frame_cache_take(c, command, &frame);
+  esp_err_t result = ESP_OK;
+  if (!hit)
+    result = somfy_frame_init(&frame, handle, command);
+  int64_t allocated = esp_timer_get_time();
+  if (result != ESP_OK) {
+    ESP_LOGE(TAG, "No rolling code for remote %06x: %s", command->remote & 0xffffff, esp_err_to_name(result));
+    return result;
+  }
+
+  somfy_segments_t * segments = somfy_ctl_segments(c, command->remote);
   pulse_train_handle_t train;
-  pulse_train_init(ctl, &train);
+  result = pulse_train_init(ctl, &train);
+  if (result != ESP_OK) {
+    ESP_LOGE(TAG, "No pulse train available: %s", esp_err_to_name(result));
+    return result;
+  }
 
-  somfy_frame_t frame;
-  somfy_frame_init(&frame, handle, command);
-  somfy_frame_write(&frame, train, 2);
-  somfy_frame_write(&frame, train, 7);
-  somfy_frame_write(&frame, train, 7);
+  // Syncs and gaps are segments shared by the remotes of a profile, only the
+  // frame bytes are queued and the data bits are encoded on the fly while
+  // the train is on air.
+  if (hold)
+    somfy_encoder_write_hold(segments, train, frame.frame, repeats);
+  else
+    somfy_encoder_write(segments, train, frame.frame);
+  pulse_train_set_origin(train, pressed);
+  pulse_train_set_tag(train, command->remote);
+
+  // STOP must not wait for a burst still on air or queued before it.
+  if (command->button == BUTTON_STOP)
+    pulse_train_set_priority(train, PULSE_PRIORITY_URGENT);
+
+  result = pulse_train_send(train);
+  int64_t latency = esp_timer_get_time() - pressed;
+  MUTEX_TAKE(c->cache_mutex);
+  if (hit) {
+    c->stats.cache_hits++;
+    c->stats.hit_latency_us = latency;
+  }
+  else {
+    c->stats.cache_misses++;
+    c->stats.miss_latency_us = latency;
+    c->stats.allocate_latency_us = allocated - pressed;
+  }
+  MUTEX_GIVE(c->cache_mutex);
+
+  // Get the next frame of this remote ready while it is idle.
+  somfy_frame_cache_touch(c, command->remote, pressed);
+  xTaskNotifyGive(c->precompute_task);
+
+  if (result != ESP_OK) {
+    ESP_LOGE(TAG, "Frame not sent: %s", esp_err_to_name(result));
+    return result;
+  }
 
-  pulse_train_send(train);
-  ESP_LOGI(TAG, "Frame sent!");
+  ESP_LOGI(TAG, "Frame sent (%s, code allocated %lld us and train queued %lld us after press)!",
+    hit ? "precomputed" : "built", allocated - pressed, latency);
   return ESP_OK;
 }
 
-void somfy_frame_init(somfy_frame_t* frame, somfy_ctl_handle_t ctl, somfy_command_t* command) {
+// Whether request_id was accepted within the window. Called with the
+// scheduler lock held.
+static bool somfy_scheduler_seen (somfy_scheduler_t * scheduler, uint32_t request_id, int64_t now) {
+  for (int i = 0; i < SOMFY_RECENT_REQUESTS; i++) {
+    somfy_recent_request_t * recent = &scheduler->recent[i];
+    if (recent->request_id == request_id && now - recent->accepted_us < SOMFY_REQUEST_WINDOW_US)
+      return true;
+  }
+
+  return false;
+}
+
+// Puts command in its remote's slot, replacing the one still pending there.
+// Only takes a spinlock, callers never wait for the transmitter.
+static esp_err_t somfy_scheduler_post (somfy_ctl_t * ctl, somfy_command_t * command, bool hold, uint16_t repeats) {
+  somfy_scheduler_t * scheduler = &ctl->scheduler;
+  somfy_scheduler_slot_t * slot = NULL;
+  bool coalesced = false;
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&scheduler->lock);
+  if (command->request_id != 0 && somfy_scheduler_seen(scheduler, command->request_id, now)) {
+    scheduler->duplicates++;
+    portEXIT_CRITICAL(&scheduler->lock);
+    ESP_LOGI(TAG, "Request %u for remote %06x already accepted.", command->request_id, command->remote & 0xffffff);
+    return ESP_OK;
+  }
+
+  for (int i = 0; i < SOMFY_SCHEDULER_SLOTS; i++) {
+    somfy_scheduler_slot_t * candidate = &scheduler->slots[i];
+    if (candidate->pending && candidate->command.remote == command->remote) {
+      slot = candidate;
+      coalesced = true;
+      break;
+    }
+
+    if (!candidate->pending && slot == NULL)
+      slot = candidate;
+  }
+
+  if (slot == NULL) {
+    scheduler->dropped++;
+    portEXIT_CRITICAL(&scheduler->lock);
+    ESP_LOGE(TAG, "Command for remote %06x dropped, scheduler full.", command->remote & 0xffffff);
+    return ESP_ERR_NO_MEM;
+  }
+
+  scheduler->coalesced += coalesced ? 1 : 0;
+  slot->pending = true;
+  slot->command = *command;
+  slot->hold = hold;
+  slot->repeats = repeats;
+  slot->seq = scheduler->seq++;
+  slot->pressed_us = now;
+  // Only accepted commands are remembered, a dropped one may be retried.
+  if (command->request_id != 0) {
+    scheduler->recent[scheduler->recent_next].request_id = command->request_id;
+    scheduler->recent[scheduler->recent_next].accepted_us = now;
+    scheduler->recent_next = (scheduler->recent_next + 1) % SOMFY_RECENT_REQUESTS;
+  }
+  portEXIT_CRITICAL(&scheduler->lock);
+
+  xTaskNotifyGive(scheduler->task);
+  return ESP_OK;
+}
+
+// Takes the next command to send: the oldest pending STOP, otherwise the
+// oldest pending command.
+static bool somfy_scheduler_take (somfy_ctl_t * ctl, somfy_scheduler_slot_t * next) {
+  somfy_scheduler_t * scheduler = &ctl->scheduler;
+  somfy_scheduler_slot_t * best = NULL;
+  portENTER_CRITICAL(&scheduler->lock);
+  for (int i = 0; i < SOMFY_SCHEDULER_SLOTS; i++) {
+    somfy_scheduler_slot_t * slot = &scheduler->slots[i];
+    if (!slot->pending)
+      continue;
+
+    bool stop = slot->command.button == BUTTON_STOP;
+    bool best_stop = best != NULL && best->command.button == BUTTON_STOP;
+    if (best == NULL || (stop && !best_stop) ||
+      (stop == best_stop && (int32_t)(slot->seq - best->seq) < 0))
+      best = slot;
+  }
+
+  if (best != NULL) {
+    *next = *best;
+    best->pending = false;
+  }
+
+  portEXIT_CRITICAL(&scheduler->lock);
+  return best != NULL;
+}
+
+// Sends the next pending command. Returns false when there was none.
+static bool somfy_scheduler_step (somfy_ctl_t * ctl) {
+  somfy_scheduler_slot_t next;
+  if (!somfy_scheduler_take(ctl, &next))
+    return false;
+
+  esp_err_t result = somfy_ctl_transmit(ctl, &next.command, next.hold, next.repeats, next.pressed_us);
+  portENTER_CRITICAL(&ctl->scheduler.lock);
+  if (result == ESP_OK)
+    ctl->scheduler.executed++;
+  else
+    ctl->scheduler.failed++;
+  portEXIT_CRITICAL(&ctl->scheduler.lock);
+  return true;
+}
+
+// Sends every pending command, in the order somfy_scheduler_take gives.
+static void somfy_scheduler_run (somfy_ctl_t * ctl) {
+  while (somfy_scheduler_step(ctl));
+}
+
+void somfy_ctl_scheduler_task (void * data) {
+  somfy_ctl_t * ctl = (somfy_ctl_t *) data;
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    somfy_scheduler_run(ctl);
+  }
+}
+
+esp_err_t somfy_ctl_send_command (somfy_ctl_handle_t handle, somfy_command_t* command) {
+  return somfy_scheduler_post((somfy_ctl_t *) handle, command, false, 0);
+}
+
+esp_err_t somfy_ctl_hold_command (somfy_ctl_handle_t handle, somfy_command_t* command, uint16_t repeats) {
+  return somfy_scheduler_post((somfy_ctl_t *) handle, command, true, repeats);
+}
+
+esp_err_t somfy_ctl_release (somfy_ctl_handle_t handle, somfy_remote_t remote) {
+  somfy_ctl_t * ctl = (somfy_ctl_t *) handle;
+  // A hold still pending would be sent after the cancel and never end.
+  somfy_scheduler_t * scheduler = &ctl->scheduler;
+  portENTER_CRITICAL(&scheduler->lock);
+  for (int i = 0; i < SOMFY_SCHEDULER_SLOTS; i++) {
+    somfy_scheduler_slot_t * slot = &scheduler->slots[i];
+    if (slot->pending && slot->hold && slot->command.remote == remote)
+      slot->pending = false;
+  }
+  portEXIT_CRITICAL(&scheduler->lock);
+
+  return pulse_ctl_cancel_loop(ctl->pulse_ctl, remote);
+}
+
+// Sends the frames of a group as few trains as the segment limit allows,
+// each one a single burst. Every remote keeps the frames and timing of its
+// own profile.
+static esp_err_t somfy_ctl_send_frames (somfy_ctl_t * ctl, const uint8_t (* frames)[SOMFY_FRAME_SIZE], somfy_segments_t ** segments, size_t count, int64_t pressed) {
+  size_t first = 0;
+  while (first < count) {
+    // The wake-up, then as many remotes as fit.
+    size_t entries = 1;
+    size_t end = first;
+    while (end < count && entries + segments[end]->frames * SOMFY_ENCODER_FRAME_ENTRIES <= ctl->max_segments)
+      entries += segments[end++]->frames * SOMFY_ENCODER_FRAME_ENTRIES;
+
+    if (end == first)
+      return ESP_ERR_INVALID_SIZE;
+
+    pulse_train_handle_t train;
+    esp_err_t result = pulse_train_init(ctl->pulse_ctl, &train);
+    if (result != ESP_OK)
+      return result;
+
+    somfy_encoder_write_wakeup(segments[first], train);
+    for (size_t i = first; i < end; i++)
+      somfy_encoder_write_frames(segments[i], train, frames[i], segments[i]->frames);
+    pulse_train_set_origin(train, pressed);
+    result = pulse_train_send(train);
+    if (result != ESP_OK)
+      return result;
+
+    first = end;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t somfy_ctl_send_group (somfy_ctl_handle_t handle, somfy_command_t * commands, size_t count) {
+  somfy_ctl_t * ctl = (somfy_ctl_t *) handle;
+  if (count == 0)
+    return ESP_ERR_INVALID_ARG;
+
+  int64_t pressed = esp_timer_get_time();
+  somfy_remote_t * remotes = calloc(count, sizeof(somfy_remote_t));
+  somfy_rolling_code_t * codes = calloc(count, sizeof(somfy_rolling_code_t));
+  somfy_config_reserve_t * reserved = calloc(count, sizeof(somfy_config_reserve_t));
+  uint8_t (* frames)[SOMFY_FRAME_SIZE] = calloc(count, SOMFY_FRAME_SIZE);
+  somfy_segments_t ** segments = calloc(count, sizeof(somfy_segments_t *));
+  esp_err_t result = ESP_ERR_NO_MEM;
+  if (remotes != NULL && codes != NULL && reserved != NULL && frames != NULL && segments != NULL) {
+    result = ESP_OK;
+    for (size_t i = 0; i < count && result == ESP_OK; i++) {
+      remotes[i] = commands[i].remote;
+      result = somfy_persist_wait(ctl, remotes[i]);
+    }
+
+    // Every code is allocated under one lock, new reservations are saved
+    // by a single background save while the group is on air, unless a code
+    // is past the persisted reservation of its remote.
+    if (result == ESP_OK)
+      result = somfy_config_increment_rolling_codes(ctl->config, remotes, count, codes, reserved);
+    for (size_t i = 0; i < count && result == ESP_OK; i++) {
+      if (reserved[i] != SOMFY_CONFIG_RESERVE_NONE)
+        somfy_persist_request(ctl, remotes[i]);
+    }
+    for (size_t i = 0; i < count && result == ESP_OK; i++) {
+      if (reserved[i] == SOMFY_CONFIG_RESERVE_NOW)
+        result = somfy_persist_wait(ctl, remotes[i]);
+    }
+  }
+
+  if (result == ESP_OK) {
+    for (size_t i = 0; i < count; i++) {
+      somfy_frame_t frame;
+      somfy_frame_build(&frame, ctl, &commands[i], codes[i]);
+      memcpy(frames[i], frame.frame, SOMFY_FRAME_SIZE);
+      segments[i] = somfy_ctl_segments(ctl, commands[i].remote);
+      somfy_frame_cache_drop(ctl, commands[i].remote);
+    }
+
+    result = somfy_ctl_send_frames(ctl, (const uint8_t (*)[SOMFY_FRAME_SIZE]) frames, segments, count, pressed);
+    xTaskNotifyGive(ctl->precompute_task);
+  }
+
+  free(remotes);
+  free(codes);
+  free(reserved);
+  free(frames);
+  free(segments);
+  if (result != ESP_OK) {
+    ESP_LOGE(TAG, "Group of %d commands not sent: %s", count, esp_err_to_name(result));
+    return result;
+  }
+
+  ESP_LOGI(TAG, "Group of %d commands queued %lld us after call.", count, esp_timer_get_time() - pressed);
+  return ESP_OK;
+}
+
+esp_err_t somfy_frame_init(somfy_frame_t* frame, somfy_ctl_handle_t ctl, somfy_command_t* command) {
   somfy_rolling_code_t rolling_code;
-  somfy_ctl_increment_rolling_code_and_write_nvs(ctl, command->remote, &rolling_code);
+  esp_err_t result = somfy_ctl_allocate_rolling_code(ctl, command->remote, &rolling_code);
+  if (result != ESP_OK)
+    return result;
 
+  somfy_frame_build(frame, ctl, command, rolling_code);
+  return ESP_OK;
+}
+
+void somfy_frame_build(somfy_frame_t* frame, somfy_ctl_handle_t ctl, somfy_command_t* command, somfy_rolling_code_t rolling_code) {
   frame->ctl = ctl;
   frame->frame[0] = 0xA7;
   frame->frame[1] = command->button << 4;
@@ -85,41 +686,6 @@ void somfy_frame_init(somfy_frame_t* frame, somfy_ctl_handle_t ctl, somfy_comman
   somfy_frame_debug(frame, command, rolling_code);
 }
 
-#define SYMBOL 640
-
-void somfy_frame_write(somfy_frame_t* frame, pulse_train_handle_t train, somfy_sync_t sync) {
-  // Only with the first frame.
-  if (sync == 2) { 
-    // Wake-up pulse & Silence
-    pulse_train_add_pulse(train, 9415, PULSE_HIGH);
-    pulse_train_add_pulse(train, 89565, PULSE_LOW);
-  }
-
-  // Hardware sync: two sync for the first frame, seven for the following ones.
-  for (int i = 0; i < sync; i++) {
-    pulse_train_add_pulse(train, 4 * SYMBOL, PULSE_HIGH);
-    pulse_train_add_pulse(train, 4 * SYMBOL, PULSE_LOW);
-  }
-
-  // Software sync
-  pulse_train_add_pulse(train, 4550, PULSE_HIGH);
-  pulse_train_add_pulse(train, SYMBOL, PULSE_LOW);
-
-  // Data: bits are sent one by one, starting with the MSB.
-  for (uint8_t i = 0; i < 56; i++) {
-    if (((frame->frame[i / 8] >> (7 - (i % 8))) & 1) == 1) {
-      pulse_train_add_pulse(train, SYMBOL, PULSE_LOW);
-      pulse_train_add_pulse(train, SYMBOL, PULSE_HIGH);
-    }
-    else {
-      pulse_train_add_pulse(train, SYMBOL, PULSE_HIGH);
-      pulse_train_add_pulse(train, SYMBOL, PULSE_LOW);
-    }
-  }
-
-  pulse_train_add_pulse(train, 30415, PULSE_LOW);
-}
-
 void somfy_frame_debug(somfy_frame_t * frame, somfy_command_t * command, somfy_rolling_code_t code) {
   ESP_LOGI(TAG, "Built frame %04x%04x%04x%02x (remote = %06x, button = %d, code = %d)",
     frame->frame[0] << 8 | frame->frame [1], 
@@ -131,14 +697,136 @@ void somfy_frame_debug(somfy_frame_t * frame, somfy_command_t * command, somfy_r
     code);
 }
 
-esp_err_t somfy_ctl_increment_rolling_code_and_write_nvs (somfy_ctl_handle_t handle, somfy_remote_t remote, somfy_rolling_code_t * rolling_code) {
-    somfy_ctl_t * ctl = (somfy_ctl_t *) handle;
-    somfy_config_increment_rolling_code(ctl->config, remote, rolling_code);
+static esp_err_t somfy_ctl_persist (somfy_ctl_t * ctl) {
+  // Only the remotes that changed are written to NVS.
+  size_t written = 0;
+  esp_err_t result = somfy_config_nvs_save(ctl->config, &written);
+  MUTEX_TAKE(ctl->cache_mutex);
+  ctl->stats.persist_count++;
+  ctl->stats.persist_last_bytes = written;
+  ctl->stats.persist_total_bytes += written;
+  MUTEX_GIVE(ctl->cache_mutex);
+  ESP_LOGI(TAG, "Config saved, %d bytes written.", written);
+  return result;
+}
+
+static bool somfy_persist_pending (somfy_ctl_t * ctl, somfy_remote_t remote) {
+  somfy_persist_t * persist = &ctl->persist;
+  bool pending = false;
+  portENTER_CRITICAL(&persist->lock);
+  for (int i = 0; i < SOMFY_PERSIST_SLOTS && !pending; i++)
+    pending = persist->slots[i].pending && persist->slots[i].remote == remote;
+  portEXIT_CRITICAL(&persist->lock);
+  return pending;
+}
+
+// Saves the config, then clears the reservations requested before the
+// save started: they were all taken by it. Their remotes are replicated once
+// durable.
+static esp_err_t somfy_persist_run (somfy_ctl_t * ctl) {
+  somfy_remote_t saved[SOMFY_PERSIST_SLOTS];
+  size_t count = 0;
+  somfy_persist_t * persist = &ctl->persist;
+  MUTEX_TAKE(persist->mutex);
+  portENTER_CRITICAL(&persist->lock);
+  uint32_t covered = persist->seq;
+  portEXIT_CRITICAL(&persist->lock);
 
-    somfy_config_blob_handle_t blob;
-    somfy_config_serialize (ctl->config, &blob);
-    somfy_config_blob_nvs_write(blob);
-    somfy_config_blob_http_write(blob, "http://blav.ngrok.io/config");
-    somfy_config_blob_free(blob);
+  esp_err_t result = somfy_ctl_persist(ctl);
+  int64_t now = esp_timer_get_time();
+  int64_t oldest = now;
+  portENTER_CRITICAL(&persist->lock);
+  for (int i = 0; i < SOMFY_PERSIST_SLOTS && result == ESP_OK; i++) {
+    somfy_persist_slot_t * slot = &persist->slots[i];
+    if (slot->pending && (int32_t)(slot->seq - covered) < 0) {
+      slot->pending = false;
+      saved[count++] = slot->remote;
+      oldest = slot->requested_us < oldest ? slot->requested_us : oldest;
+    }
+  }
+  portEXIT_CRITICAL(&persist->lock);
+  MUTEX_GIVE(persist->mutex);
+
+  for (size_t i = 0; i < count; i++)
+    somfy_config_replicator_mark(ctl->replicator, saved[i]);
+
+  if (result == ESP_OK && oldest != now) {
+    MUTEX_TAKE(ctl->cache_mutex);
+    ctl->stats.persist_latency_us = now - oldest;
+    MUTEX_GIVE(ctl->cache_mutex);
+  }
+
+  return result;
+}
+
+// Blocks until the latest reservation of remote is durable, saving it now
+// if the background save has not got to it yet.
+static esp_err_t somfy_persist_wait (somfy_ctl_t * ctl, somfy_remote_t remote) {
+  if (!somfy_persist_pending(ctl, remote))
     return ESP_OK;
+
+  esp_err_t result = somfy_persist_run(ctl);
+  if (result == ESP_OK && somfy_persist_pending(ctl, remote))
+    result = somfy_persist_run(ctl);
+  return result;
+}
+
+// Hands the save of the new reservation of remote to the persist task.
+// Without a free slot, it is saved right away.
+static void somfy_persist_request (somfy_ctl_t * ctl, somfy_remote_t remote) {
+  somfy_persist_t * persist = &ctl->persist;
+  somfy_persist_slot_t * slot = NULL;
+  portENTER_CRITICAL(&persist->lock);
+  for (int i = 0; i < SOMFY_PERSIST_SLOTS && slot == NULL; i++) {
+    if (!persist->slots[i].pending)
+      slot = &persist->slots[i];
+  }
+
+  if (slot != NULL) {
+    slot->pending = true;
+    slot->remote = remote;
+    slot->seq = persist->seq++;
+    slot->requested_us = esp_timer_get_time();
+  }
+  portEXIT_CRITICAL(&persist->lock);
+
+  if (slot == NULL) {
+    somfy_persist_run(ctl);
+    return;
+  }
+
+  xTaskNotifyGive(persist->task);
+}
+
+void somfy_ctl_persist_task (void * data) {
+  somfy_ctl_t * ctl = (somfy_ctl_t *) data;
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (somfy_persist_run(ctl) != ESP_OK)
+      ESP_LOGE(TAG, "Background config save failed, retried on next allocation.");
+  }
+}
+
+// Allocates the next rolling code of remote in RAM. Its previous
+// reservation is durable first, and it covers the new code unless the
+// remote just started from a loaded config or a new lease: that reservation
+// is saved before the code is returned. Otherwise the reservation one block
+// ahead is saved in the background while the frame is on air, so every code
+// sent stays below the persisted one.
+esp_err_t somfy_ctl_allocate_rolling_code (somfy_ctl_handle_t handle, somfy_remote_t remote, somfy_rolling_code_t * rolling_code) {
+  somfy_ctl_t * ctl = (somfy_ctl_t *) handle;
+  esp_err_t result = somfy_persist_wait(ctl, remote);
+  if (result != ESP_OK)
+    return result;
+
+  somfy_config_reserve_t reserved;
+  result = somfy_config_increment_rolling_code(ctl->config, remote, rolling_code, &reserved);
+  if (result != ESP_OK)
+    return result;
+
+  if (reserved != SOMFY_CONFIG_RESERVE_NONE)
+    somfy_persist_request(ctl, remote);
+  if (reserved == SOMFY_CONFIG_RESERVE_NOW)
+    result = somfy_persist_wait(ctl, remote);
+  return result;
 }
@@ -5,33 +5,134 @@
 #include "freertos/semphr.h"
 #include "somfy.h"
 #include "nvs.h"
-#include "osi/list.h"
 #include "somfy_config_blob.h"
+#include "somfy_remote_table.h"
 #include "mutex.h"
+#include "esp_crc.h"
+
+static const char * TAG = "somfy_config";
 
 typedef struct {
-  list_t * remotes;
+  somfy_remote_table_t remotes;
   SemaphoreHandle_t remotes_mutex;
+  // Set when blocks are leased from the config server rather than reserved
+  // locally. hook is called, with remotes_mutex held, when a remote runs
+  // low on leased codes.
+  bool leased;
+  somfy_config_lease_hook_t lease_hook;
+  void * lease_arg;
+  // Loaded from a v2 blob: the first loaded remotes of the table are the
+  // records array, their names point into loaded_blob, the table of names
+  // of the blob.
+  void * loaded_blob;
+  somfy_config_remote_t * loaded_records;
+  uint32_t loaded;
 } somfy_config_t;
 
-void somfy_config_remote_free_cb (void * data) {
-    somfy_config_remote_handle_t cfg = (somfy_config_remote_handle_t) data;
-    somfy_config_remote_free (cfg);
-}
+// Codes left in the current block when the next lease is asked for.
+#define SOMFY_CONFIG_LEASE_LOW_WATER 8
+
+// Rolling codes reserved per persisted write. The reservation runs up to two
+// blocks ahead, so a crash skips at most twice this many codes, well within
+// the forward window receivers accept.
+#define SOMFY_CONFIG_CODE_BLOCK 32
+
+// Marks the optional section of profiles following the remotes, one record
+// per remote in the same order. Readers that predate it stop at the end of
+// the remotes, and blobs without it get the default profile.
+#define SOMFY_CONFIG_PROFILES_SECTION 'P'
+
+#define SOMFY_CONFIG_PROFILE_SIZE 9
+
+static const somfy_profile_t somfy_profile_default = SOMFY_PROFILE_DEFAULT;
+
+// v2 blob, multi-byte fields in the byte order of the ESP32, little endian:
+//   header  magic 4, version 1, record size 1, flags 2, count 4,
+//           strings size 4
+//   records count * record size
+//   strings NUL terminated names, each referenced by one record
+//   CRC32 4 of all the bytes before it
+// The CRC comes last so that a blob is written and checked while streamed.
+// Records larger than SOMFY_CONFIG_RECORD_SIZE come from newer writers, the
+// extra bytes are skipped.
+#define SOMFY_CONFIG_MAGIC 0x43464d53 // "SMFC"
+#define SOMFY_CONFIG_VERSION 2
+#define SOMFY_CONFIG_HEADER_SIZE 16
+#define SOMFY_CONFIG_CRC_SIZE 4
+// remote 4, reserved code 2, name length 1, frames 1, name offset 4,
+// first syncs 1, repeat syncs 1, symbol 2, gap 4.
+#define SOMFY_CONFIG_RECORD_SIZE 20
+
+// Parts of a v2 blob, in order.
+typedef enum {
+    SOMFY_CONFIG_SECTION_HEADER,
+    SOMFY_CONFIG_SECTION_RECORDS,
+    SOMFY_CONFIG_SECTION_STRINGS,
+    SOMFY_CONFIG_SECTION_CRC,
+    SOMFY_CONFIG_SECTION_DONE,
+} somfy_config_section_t;
+
+typedef struct {
+    somfy_config_t * config;
+    // Remotes and size of their names, fixed when created. Records are read
+    // from the config when reached, one at a time.
+    uint32_t count;
+    uint32_t strings_size;
+    somfy_config_section_t section;
+    uint32_t index;
+    uint32_t name_offset;
+    uint32_t crc;
+    // Header, record, name or CRC being copied out.
+    uint8_t unit[SOMFY_CONFIG_NAME_MAX + 1];
+    size_t unit_size;
+    size_t copied;
+} somfy_config_serializer_t;
+
+typedef struct {
+    somfy_config_section_t section;
+    uint8_t record_size;
+    uint32_t count;
+    uint32_t strings_size;
+    uint32_t index;
+    uint32_t crc;
+    // Header, record or CRC being gathered. Names go to strings directly.
+    uint8_t unit[UINT8_MAX];
+    size_t unit_size;
+    size_t filled;
+    somfy_config_remote_t * records;
+    // Offset in strings of the NUL ending the name of each record.
+    uint32_t * name_ends;
+    char * strings;
+    esp_err_t error;
+} somfy_config_parser_t;
+
+// Counts up to this one fit the byte that always started the blob. Larger
+// ones follow it as a uint32, which readers that predate it cannot load.
+#define SOMFY_CONFIG_WIDE_COUNT 0xFF
 
 esp_err_t somfy_config_new(somfy_config_handle_t * handle) {
     somfy_config_t * cfg = calloc(1, sizeof(somfy_config_t));
-    cfg->remotes = list_new(&somfy_config_remote_free_cb);
+    if (cfg == NULL || somfy_remote_table_init(&cfg->remotes) != ESP_OK) {
+        free(cfg);
+        return ESP_ERR_NO_MEM;
+    }
+
     cfg->remotes_mutex = xSemaphoreCreateMutex();
     *handle = cfg;
     return ESP_OK;
 }
 
 esp_err_t somfy_config_remote_new(const char * remote_name, somfy_remote_t remote, somfy_rolling_code_t code, somfy_config_remote_handle_t * handle) {
+    if (remote_name != NULL && strlen(remote_name) > SOMFY_CONFIG_NAME_MAX)
+        return ESP_ERR_INVALID_ARG;
+
     somfy_config_remote_t * remote_cfg = calloc (1, sizeof (somfy_config_remote_t));
     *handle = remote_cfg;
     remote_cfg->remote = remote;
     remote_cfg->rolling_code = code;
+    remote_cfg->reserved_code = code;
+    remote_cfg->profile = somfy_profile_default;
+    remote_cfg->dirty = SOMFY_CONFIG_DIRTY_META | SOMFY_CONFIG_DIRTY_CODE | SOMFY_CONFIG_DIRTY_LISTED;
     if (remote_name != NULL) {
         remote_cfg->remote_name = calloc (strlen(remote_name) + 1, sizeof(char));
         memcpy (remote_cfg->remote_name, remote_name, strlen(remote_name));
@@ -42,7 +143,11 @@ esp_err_t somfy_config_remote_new(const char * remote_name, somfy_remote_t remot
 
 esp_err_t somfy_config_free (somfy_config_handle_t handle) {
     somfy_config_t * cfg = (somfy_config_t *) handle;
-    list_free(cfg->remotes);
+    for (uint32_t n = cfg->loaded; n < cfg->remotes.count; n++)
+        somfy_config_remote_free(cfg->remotes.remotes[n]);
+    somfy_remote_table_free(&cfg->remotes);
+    free(cfg->loaded_records);
+    free(cfg->loaded_blob);
     vSemaphoreDelete (cfg->remotes_mutex);
     free(cfg);
     return ESP_OK;
@@ -60,82 +165,522 @@ esp_err_t somfy_config_remote_free (somfy_config_remote_handle_t handle) {
 esp_err_t somfy_config_add_remote(somfy_config_handle_t handle, somfy_config_remote_handle_t config) {
     somfy_config_t * cfg = (somfy_config_t *) handle;
     MUTEX_TAKE(cfg->remotes_mutex);
-    list_append(cfg->remotes, config);
+    esp_err_t result = somfy_remote_table_add(&cfg->remotes, (somfy_config_remote_t *) config);
     MUTEX_GIVE(cfg->remotes_mutex);
+    return result;
+}
+
+
+static size_t somfy_config_name_len (const somfy_config_remote_t * remote) {
+    size_t len = remote->remote_name != NULL ? strlen(remote->remote_name) : 0;
+    return len < SOMFY_CONFIG_NAME_MAX ? len : SOMFY_CONFIG_NAME_MAX;
+}
+
+static void somfy_config_header_encode (uint8_t * header, uint32_t count, uint32_t strings_size) {
+    uint32_t magic = SOMFY_CONFIG_MAGIC;
+    memset (header, 0, SOMFY_CONFIG_HEADER_SIZE);
+    memcpy (header, &magic, sizeof(uint32_t));
+    header[4] = SOMFY_CONFIG_VERSION;
+    header[5] = SOMFY_CONFIG_RECORD_SIZE;
+    memcpy (header + 8, &count, sizeof(uint32_t));
+    memcpy (header + 12, &strings_size, sizeof(uint32_t));
+}
+
+static esp_err_t somfy_config_header_decode (const uint8_t * header, uint8_t * record_size, uint32_t * count, uint32_t * strings_size) {
+    uint32_t magic;
+    memcpy(&magic, header, sizeof(uint32_t));
+    if (magic != SOMFY_CONFIG_MAGIC || header[4] != SOMFY_CONFIG_VERSION)
+        return ESP_ERR_INVALID_VERSION;
+
+    *record_size = header[5];
+    memcpy(count, header + 8, sizeof(uint32_t));
+    memcpy(strings_size, header + 12, sizeof(uint32_t));
+    // The config built keeps the records and names, bound them before
+    // allocating anything: the records must fit in the 32 bit sizes of the
+    // format, blob readers then check them against the blob itself.
+    if (*record_size < SOMFY_CONFIG_RECORD_SIZE || *count > UINT32_MAX / *record_size
+            || (*count > 0 && *strings_size == 0))
+        return ESP_ERR_INVALID_SIZE;
     return ESP_OK;
 }
 
+static void somfy_config_record_encode (uint8_t * record, const somfy_config_remote_t * remote, uint32_t name_offset) {
+    memcpy (record, &remote->remote, sizeof(somfy_remote_t));
+    memcpy (record + 4, &remote->reserved_code, sizeof(somfy_rolling_code_t));
+    record[6] = somfy_config_name_len(remote);
+    record[7] = remote->profile.frames;
+    memcpy (record + 8, &name_offset, sizeof(uint32_t));
+    record[12] = remote->profile.first_syncs;
+    record[13] = remote->profile.repeat_syncs;
+    memcpy (record + 14, &remote->profile.symbol_us, sizeof(uint16_t));
+    memcpy (record + 16, &remote->profile.gap_us, sizeof(uint32_t));
+}
 
-esp_err_t somfy_config_serialize (somfy_config_handle_t cfg, somfy_config_blob_handle_t * handle) {
-    somfy_config_t * config = (somfy_config_t *) cfg;
+// Fills remote from record, its name pointing into strings. The name may be
+// read only once strings holds the whole section and its NUL is at name_end.
+static esp_err_t somfy_config_record_decode (const uint8_t * record, char * strings, uint32_t strings_size, somfy_config_remote_t * remote, uint32_t * name_end) {
+    uint8_t name_len = record[6];
+    uint32_t name_offset;
+    memcpy(&name_offset, record + 8, sizeof(uint32_t));
+    if (name_offset >= strings_size || name_len >= strings_size - name_offset)
+        return ESP_ERR_INVALID_SIZE;
+
+    *name_end = name_offset + name_len;
+    memset(remote, 0, sizeof(somfy_config_remote_t));
+    memcpy(&remote->remote, record, sizeof(somfy_remote_t));
+    memcpy(&remote->reserved_code, record + 4, sizeof(somfy_rolling_code_t));
+    remote->rolling_code = remote->reserved_code;
+    remote->remote_name = strings + name_offset;
+    remote->profile.frames = record[7];
+    remote->profile.first_syncs = record[12];
+    remote->profile.repeat_syncs = record[13];
+    memcpy(&remote->profile.symbol_us, record + 14, sizeof(uint16_t));
+    memcpy(&remote->profile.gap_us, record + 16, sizeof(uint32_t));
+    if (remote->profile.frames == 0 || remote->profile.symbol_us == 0)
+        remote->profile = somfy_profile_default;
+    remote->dirty = SOMFY_CONFIG_DIRTY_META | SOMFY_CONFIG_DIRTY_CODE | SOMFY_CONFIG_DIRTY_LISTED;
+    return ESP_OK;
+}
+
+// Adds the count records to the config, which takes them and buffer, the
+// memory their names point into.
+static void somfy_config_adopt (somfy_config_t * config, somfy_config_remote_t * records, uint32_t count, void * buffer) {
+    uint32_t loaded = 0;
+    for (uint32_t n = 0; n < count; n++) {
+        // Compacts the records so that the loaded ones come first.
+        records[loaded] = records[n];
+        if (somfy_remote_table_add(&config->remotes, &records[loaded]) == ESP_OK)
+            loaded++;
+        else
+            ESP_LOGW(TAG, "Skipping duplicate remote %08x", records[n].remote);
+    }
+
+    config->loaded_blob = buffer;
+    config->loaded_records = records;
+    config->loaded = loaded;
+}
+
+// Builds the next part of the blob into unit. Names are read under the
+// mutex as well, the array of remotes moves when the table grows.
+static void somfy_config_serializer_fill (somfy_config_serializer_t * serializer) {
+    somfy_config_t * config = serializer->config;
+    serializer->copied = 0;
+    switch (serializer->section) {
+        case SOMFY_CONFIG_SECTION_HEADER:
+            somfy_config_header_encode(serializer->unit, serializer->count, serializer->strings_size);
+            serializer->unit_size = SOMFY_CONFIG_HEADER_SIZE;
+            break;
+        case SOMFY_CONFIG_SECTION_RECORDS: {
+            MUTEX_TAKE(config->remotes_mutex);
+            somfy_config_remote_t * remote = config->remotes.remotes[serializer->index];
+            somfy_config_record_encode(serializer->unit, remote, serializer->name_offset);
+            serializer->name_offset += somfy_config_name_len(remote) + 1;
+            MUTEX_GIVE(config->remotes_mutex);
+            serializer->unit_size = SOMFY_CONFIG_RECORD_SIZE;
+            break;
+        }
+        case SOMFY_CONFIG_SECTION_STRINGS: {
+            MUTEX_TAKE(config->remotes_mutex);
+            somfy_config_remote_t * remote = config->remotes.remotes[serializer->index];
+            size_t name_len = somfy_config_name_len(remote);
+            // Unnamed remotes have no name to copy from.
+            if (name_len > 0)
+                memcpy(serializer->unit, remote->remote_name, name_len);
+            MUTEX_GIVE(config->remotes_mutex);
+            serializer->unit[name_len] = '\0';
+            serializer->unit_size = name_len + 1;
+            break;
+        }
+        case SOMFY_CONFIG_SECTION_CRC:
+            memcpy(serializer->unit, &serializer->crc, sizeof(uint32_t));
+            serializer->unit_size = SOMFY_CONFIG_CRC_SIZE;
+            break;
+        case SOMFY_CONFIG_SECTION_DONE:
+            serializer->unit_size = 0;
+            break;
+    }
+}
+
+static void somfy_config_serializer_next (somfy_config_serializer_t * serializer) {
+    bool per_remote = serializer->section == SOMFY_CONFIG_SECTION_RECORDS || serializer->section == SOMFY_CONFIG_SECTION_STRINGS;
+    if (per_remote && ++serializer->index < serializer->count) {
+        somfy_config_serializer_fill(serializer);
+        return;
+    }
+
+    serializer->index = 0;
+    serializer->section++;
+    // Records and names are skipped together when there are no remotes.
+    if (serializer->count == 0 && serializer->section == SOMFY_CONFIG_SECTION_RECORDS)
+        serializer->section = SOMFY_CONFIG_SECTION_CRC;
+    somfy_config_serializer_fill(serializer);
+}
+
+esp_err_t somfy_config_serializer_new (somfy_config_handle_t handle, somfy_config_serializer_handle_t * serializer_handle) {
+    somfy_config_t * config = (somfy_config_t *) handle;
+    somfy_config_serializer_t * serializer = calloc(1, sizeof(somfy_config_serializer_t));
+    if (serializer == NULL)
+        return ESP_ERR_NO_MEM;
+
+    serializer->config = config;
     MUTEX_TAKE(config->remotes_mutex);
-    size_t size = sizeof(uint8_t);
-    uint8_t count = 0;
-    for (list_node_t * node = list_begin (config->remotes); node != NULL; node = list_next (node)) {
-        somfy_config_remote_t * cur = list_node(node);
-        count ++;
-        size += sizeof (somfy_remote_t);
-        size += sizeof (somfy_rolling_code_t);
-        size += sizeof (uint8_t);
-        size += strlen (cur->remote_name);
-    }
-
-    void * buffer = calloc(size, sizeof(uint8_t));
+    serializer->count = config->remotes.count;
+    for (uint32_t n = 0; n < serializer->count; n++)
+        serializer->strings_size += somfy_config_name_len(config->remotes.remotes[n]) + 1;
+    MUTEX_GIVE(config->remotes_mutex);
+
+    somfy_config_serializer_fill(serializer);
+    *serializer_handle = serializer;
+    return ESP_OK;
+}
+
+size_t somfy_config_serializer_size (somfy_config_serializer_handle_t handle) {
+    somfy_config_serializer_t * serializer = (somfy_config_serializer_t *) handle;
+    return SOMFY_CONFIG_HEADER_SIZE + serializer->count * SOMFY_CONFIG_RECORD_SIZE + serializer->strings_size + SOMFY_CONFIG_CRC_SIZE;
+}
+
+esp_err_t somfy_config_serializer_read (somfy_config_serializer_handle_t handle, void * buffer, size_t size, size_t * length) {
+    somfy_config_serializer_t * serializer = (somfy_config_serializer_t *) handle;
+    uint8_t * out = (uint8_t *) buffer;
     size_t i = 0;
-    memcpy (buffer + i, &count, sizeof(uint8_t));
-    i += sizeof(uint8_t);
-    for (list_node_t * node = list_begin (config->remotes); node != NULL; node = list_next (node)) {
-        somfy_config_remote_t * cur = list_node(node);
-        memcpy (buffer + i, &cur->remote, sizeof(somfy_remote_t));
-        i += sizeof(somfy_remote_t);
-        memcpy (buffer + i, &cur->rolling_code, sizeof(somfy_rolling_code_t));
-        i += sizeof(somfy_rolling_code_t);
-        uint8_t name_len = strlen(cur->remote_name);
-        memcpy (buffer + i, &name_len, sizeof(uint8_t));
-        i += sizeof(uint8_t);
-        memcpy (buffer + i, cur->remote_name, name_len);
-        i += name_len;
+    while (i < size && serializer->section != SOMFY_CONFIG_SECTION_DONE) {
+        size_t chunk = serializer->unit_size - serializer->copied;
+        chunk = chunk < size - i ? chunk : size - i;
+        memcpy(out + i, serializer->unit + serializer->copied, chunk);
+        if (serializer->section != SOMFY_CONFIG_SECTION_CRC)
+            serializer->crc = esp_crc32_le(serializer->crc, out + i, chunk);
+        serializer->copied += chunk;
+        i += chunk;
+        if (serializer->copied == serializer->unit_size)
+            somfy_config_serializer_next(serializer);
     }
 
-    MUTEX_GIVE(config->remotes_mutex);
+    *length = i;
+    return ESP_OK;
+}
 
+esp_err_t somfy_config_serializer_free (somfy_config_serializer_handle_t handle) {
+    free(handle);
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_serialize (somfy_config_handle_t cfg, somfy_config_blob_handle_t * handle) {
+    somfy_config_serializer_handle_t serializer;
+    esp_err_t result = somfy_config_serializer_new(cfg, &serializer);
+    if (result != ESP_OK)
+        return result;
+
+    size_t size = somfy_config_serializer_size(serializer);
+    uint8_t * buffer = calloc(size, sizeof(uint8_t));
     somfy_config_blob_t * blob = calloc(1, sizeof(somfy_config_blob_t));
-    blob->size = size;
+    if (buffer == NULL || blob == NULL) {
+        somfy_config_serializer_free(serializer);
+        free(buffer);
+        free(blob);
+        return ESP_ERR_NO_MEM;
+    }
+
+    somfy_config_serializer_read(serializer, buffer, size, &blob->size);
+    somfy_config_serializer_free(serializer);
     blob->blob = buffer;
     *handle = blob;
     return ESP_OK;
 }
 
-esp_err_t somfy_config_deserialize (somfy_config_blob_handle_t handle, somfy_config_handle_t * cfg) {
-    somfy_config_new(cfg);
-    somfy_config_blob_t * blob = (somfy_config_blob_t *) handle;
-    size_t offset = 0;
-    uint8_t remote_count;
-    memcpy(&remote_count, blob->blob + offset, sizeof(uint8_t));
-    offset += sizeof(uint8_t);
-    for (int i = 0; i < remote_count; i ++) {
-        somfy_config_remote_handle_t remote_handle;
+// Copies size bytes at offset to out, false past the end of the blob.
+static bool somfy_config_read (const somfy_config_blob_t * blob, size_t * offset, void * out, size_t size) {
+    if (size > blob->size - *offset)
+        return false;
 
-        somfy_config_remote_new (NULL, 0, 0, &remote_handle);
-        somfy_config_remote_t * remote = (somfy_config_remote_t *) remote_handle;
+    memcpy(out, (const uint8_t *) blob->blob + *offset, size);
+    *offset += size;
+    return true;
+}
 
-        memcpy(&remote->remote, blob->blob + offset, sizeof(somfy_remote_t));
-        offset += sizeof(somfy_remote_t);
+// Format written before v2: count, then remote 4, reserved code 2, name
+// length 1 and name per remote, then optionally SOMFY_CONFIG_PROFILES_SECTION
+// and one profile per remote.
+static esp_err_t somfy_config_deserialize_v1 (const somfy_config_blob_t * blob, somfy_config_t * config) {
+    size_t offset = 0;
+    uint8_t short_count;
+    if (!somfy_config_read(blob, &offset, &short_count, sizeof(uint8_t)))
+        return ESP_ERR_INVALID_SIZE;
 
-        memcpy(&remote->rolling_code, blob->blob + offset, sizeof(somfy_rolling_code_t));
-        offset += sizeof(somfy_rolling_code_t);
+    uint32_t remote_count = short_count;
+    if (short_count == SOMFY_CONFIG_WIDE_COUNT && !somfy_config_read(blob, &offset, &remote_count, sizeof(uint32_t)))
+        return ESP_ERR_INVALID_SIZE;
 
+    for (uint32_t i = 0; i < remote_count; i ++) {
+        somfy_remote_t id;
+        somfy_rolling_code_t code;
         uint8_t name_len;
-        memcpy(&name_len, blob->blob + offset, sizeof(uint8_t));
-        offset += sizeof(uint8_t);
+        if (!somfy_config_read(blob, &offset, &id, sizeof(somfy_remote_t))
+                || !somfy_config_read(blob, &offset, &code, sizeof(somfy_rolling_code_t))
+                || !somfy_config_read(blob, &offset, &name_len, sizeof(uint8_t))
+                || name_len > blob->size - offset)
+            return ESP_ERR_INVALID_SIZE;
 
+        somfy_config_remote_handle_t remote_handle;
+        somfy_config_remote_new (NULL, id, code, &remote_handle);
+        somfy_config_remote_t * remote = (somfy_config_remote_t *) remote_handle;
         remote->remote_name = calloc(name_len + 1, sizeof(char));
-        memcpy(remote->remote_name, blob->blob + offset, name_len);
-        offset += name_len;
+        somfy_config_read(blob, &offset, remote->remote_name, name_len);
 
-        somfy_config_add_remote(*cfg, remote_handle);
+        if (somfy_config_add_remote(config, remote_handle) != ESP_OK) {
+            ESP_LOGW(TAG, "Skipping duplicate remote %08x", remote->remote);
+            somfy_config_remote_free(remote_handle);
+        }
     }
 
+    // Nothing else than the profiles may follow the remotes, which catches
+    // most corrupted blobs, including v2 ones with a damaged magic.
+    if (offset == blob->size)
+        return ESP_OK;
+
+    uint8_t section = 0;
+    somfy_config_read(blob, &offset, &section, sizeof(uint8_t));
+    if (section != SOMFY_CONFIG_PROFILES_SECTION || blob->size - offset != remote_count * SOMFY_CONFIG_PROFILE_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+
+    // Profiles follow the remotes by position, a skipped one would shift
+    // them all: those keep the default.
+    if (config->remotes.count != remote_count)
+        return ESP_OK;
+
+    for (uint32_t n = 0; n < config->remotes.count; n++) {
+        somfy_config_remote_t * remote = config->remotes.remotes[n];
+        somfy_config_read(blob, &offset, &remote->profile.frames, sizeof(uint8_t));
+        somfy_config_read(blob, &offset, &remote->profile.first_syncs, sizeof(uint8_t));
+        somfy_config_read(blob, &offset, &remote->profile.repeat_syncs, sizeof(uint8_t));
+        somfy_config_read(blob, &offset, &remote->profile.symbol_us, sizeof(uint16_t));
+        somfy_config_read(blob, &offset, &remote->profile.gap_us, sizeof(uint32_t));
+        if (remote->profile.frames == 0 || remote->profile.symbol_us == 0)
+            remote->profile = somfy_profile_default;
+    }
+
+    return ESP_OK;
+}
+
+// Checks the whole blob before building anything. Remotes are built in one
+// array and keep their names in a copy of the table of names, the only part
+// of the blob still needed once decoded.
+static esp_err_t somfy_config_deserialize_v2 (somfy_config_blob_t * blob, somfy_config_t * config) {
+    uint8_t * buffer = blob->blob;
+    uint8_t record_size;
+    uint32_t count, strings_size, crc;
+    esp_err_t result = somfy_config_header_decode(buffer, &record_size, &count, &strings_size);
+    if (result != ESP_OK)
+        return result;
+
+    size_t body = blob->size - SOMFY_CONFIG_HEADER_SIZE - SOMFY_CONFIG_CRC_SIZE;
+    if (count > body / record_size || strings_size != body - count * record_size)
+        return ESP_ERR_INVALID_SIZE;
+
+    memcpy(&crc, buffer + blob->size - SOMFY_CONFIG_CRC_SIZE, sizeof(uint32_t));
+    if (crc != esp_crc32_le(0, buffer, blob->size - SOMFY_CONFIG_CRC_SIZE))
+        return ESP_ERR_INVALID_CRC;
+
+    char * strings = (char *) buffer + SOMFY_CONFIG_HEADER_SIZE + count * record_size;
+    if (strings_size > 0 && strings[strings_size - 1] != '\0')
+        return ESP_ERR_INVALID_SIZE;
+
+    char * names = malloc(strings_size > 0 ? strings_size : 1);
+    somfy_config_remote_t * records = calloc(count > 0 ? count : 1, sizeof(somfy_config_remote_t));
+    if (names == NULL || records == NULL || somfy_remote_table_reserve(&config->remotes, count) != ESP_OK) {
+        free(names);
+        free(records);
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(names, strings, strings_size);
+    for (uint32_t n = 0; n < count && result == ESP_OK; n++) {
+        uint32_t name_end;
+        result = somfy_config_record_decode(buffer + SOMFY_CONFIG_HEADER_SIZE + n * record_size, names, strings_size, &records[n], &name_end);
+        if (result == ESP_OK && names[name_end] != '\0')
+            result = ESP_ERR_INVALID_SIZE;
+    }
+    if (result != ESP_OK) {
+        free(names);
+        free(records);
+        return result;
+    }
+
+    somfy_config_adopt(config, records, count, names);
+    free(blob->blob);
+    blob->blob = NULL;
+    blob->size = 0;
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_deserialize (somfy_config_blob_handle_t handle, somfy_config_handle_t * cfg) {
+    somfy_config_blob_t * blob = (somfy_config_blob_t *) handle;
+    esp_err_t result = somfy_config_new(cfg);
+    if (result != ESP_OK)
+        return result;
+
+    uint32_t magic = 0;
+    if (blob->size >= SOMFY_CONFIG_HEADER_SIZE + SOMFY_CONFIG_CRC_SIZE)
+        memcpy(&magic, blob->blob, sizeof(uint32_t));
+
+    somfy_config_t * config = (somfy_config_t *) *cfg;
+    if (magic == SOMFY_CONFIG_MAGIC)
+        result = somfy_config_deserialize_v2(blob, config);
+    else
+        result = somfy_config_deserialize_v1(blob, config);
+
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid config blob: %s", esp_err_to_name(result));
+        somfy_config_free(*cfg);
+        *cfg = NULL;
+    }
+
+    return result;
+}
+
+// Gathers the unit of section next, skipping the empty ones.
+static void somfy_config_parser_enter (somfy_config_parser_t * parser, somfy_config_section_t section) {
+    parser->section = section;
+    parser->filled = 0;
+    switch (section) {
+        case SOMFY_CONFIG_SECTION_HEADER:
+            parser->unit_size = SOMFY_CONFIG_HEADER_SIZE;
+            break;
+        case SOMFY_CONFIG_SECTION_RECORDS:
+            parser->unit_size = parser->record_size;
+            if (parser->count == 0)
+                somfy_config_parser_enter(parser, SOMFY_CONFIG_SECTION_STRINGS);
+            break;
+        case SOMFY_CONFIG_SECTION_STRINGS:
+            parser->unit_size = parser->strings_size;
+            if (parser->strings_size == 0)
+                somfy_config_parser_enter(parser, SOMFY_CONFIG_SECTION_CRC);
+            break;
+        case SOMFY_CONFIG_SECTION_CRC:
+            parser->unit_size = SOMFY_CONFIG_CRC_SIZE;
+            break;
+        case SOMFY_CONFIG_SECTION_DONE:
+            parser->unit_size = 0;
+            break;
+    }
+}
+
+// Handles the unit just gathered.
+static esp_err_t somfy_config_parser_next (somfy_config_parser_t * parser) {
+    switch (parser->section) {
+        case SOMFY_CONFIG_SECTION_HEADER: {
+            esp_err_t result = somfy_config_header_decode(parser->unit, &parser->record_size, &parser->count, &parser->strings_size);
+            if (result != ESP_OK)
+                return result;
+
+            parser->records = calloc(parser->count > 0 ? parser->count : 1, sizeof(somfy_config_remote_t));
+            parser->name_ends = calloc(parser->count > 0 ? parser->count : 1, sizeof(uint32_t));
+            parser->strings = malloc(parser->strings_size > 0 ? parser->strings_size : 1);
+            if (parser->records == NULL || parser->name_ends == NULL || parser->strings == NULL)
+                return ESP_ERR_NO_MEM;
+
+            somfy_config_parser_enter(parser, SOMFY_CONFIG_SECTION_RECORDS);
+            return ESP_OK;
+        }
+        case SOMFY_CONFIG_SECTION_RECORDS: {
+            esp_err_t result = somfy_config_record_decode(parser->unit, parser->strings, parser->strings_size, &parser->records[parser->index], &parser->name_ends[parser->index]);
+            if (result != ESP_OK)
+                return result;
+
+            parser->filled = 0;
+            if (++parser->index == parser->count)
+                somfy_config_parser_enter(parser, SOMFY_CONFIG_SECTION_STRINGS);
+            return ESP_OK;
+        }
+        case SOMFY_CONFIG_SECTION_STRINGS:
+            if (parser->strings[parser->strings_size - 1] != '\0')
+                return ESP_ERR_INVALID_SIZE;
+            for (uint32_t n = 0; n < parser->count; n++) {
+                if (parser->strings[parser->name_ends[n]] != '\0')
+                    return ESP_ERR_INVALID_SIZE;
+            }
+
+            somfy_config_parser_enter(parser, SOMFY_CONFIG_SECTION_CRC);
+            return ESP_OK;
+        case SOMFY_CONFIG_SECTION_CRC: {
+            uint32_t crc;
+            memcpy(&crc, parser->unit, sizeof(uint32_t));
+            if (crc != parser->crc)
+                return ESP_ERR_INVALID_CRC;
+
+            somfy_config_parser_enter(parser, SOMFY_CONFIG_SECTION_DONE);
+            return ESP_OK;
+        }
+        default:
+            return ESP_ERR_INVALID_STATE;
+    }
+}
+
+esp_err_t somfy_config_parser_new (somfy_config_parser_handle_t * handle) {
+    somfy_config_parser_t * parser = calloc(1, sizeof(somfy_config_parser_t));
+    if (parser == NULL)
+        return ESP_ERR_NO_MEM;
+
+    somfy_config_parser_enter(parser, SOMFY_CONFIG_SECTION_HEADER);
+    *handle = parser;
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_parser_feed (somfy_config_parser_handle_t handle, const void * data, size_t size) {
+    somfy_config_parser_t * parser = (somfy_config_parser_t *) handle;
+    const uint8_t * in = (const uint8_t *) data;
+    while (size > 0 && parser->error == ESP_OK) {
+        if (parser->section == SOMFY_CONFIG_SECTION_DONE) {
+            parser->error = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+
+        uint8_t * to = parser->section == SOMFY_CONFIG_SECTION_STRINGS ? (uint8_t *) parser->strings : parser->unit;
+        size_t chunk = parser->unit_size - parser->filled;
+        chunk = chunk < size ? chunk : size;
+        memcpy(to + parser->filled, in, chunk);
+        if (parser->section != SOMFY_CONFIG_SECTION_CRC)
+            parser->crc = esp_crc32_le(parser->crc, in, chunk);
+        parser->filled += chunk;
+        in += chunk;
+        size -= chunk;
+        if (parser->filled == parser->unit_size)
+            parser->error = somfy_config_parser_next(parser);
+    }
+
+    return parser->error;
+}
+
+esp_err_t somfy_config_parser_finish (somfy_config_parser_handle_t handle, somfy_config_handle_t * cfg) {
+    somfy_config_parser_t * parser = (somfy_config_parser_t *) handle;
+    if (parser->error == ESP_OK && parser->section != SOMFY_CONFIG_SECTION_DONE)
+        parser->error = ESP_ERR_INVALID_SIZE;
+    if (parser->error != ESP_OK)
+        return parser->error;
+
+    esp_err_t result = somfy_config_new(cfg);
+    somfy_config_t * config = (somfy_config_t *) *cfg;
+    if (result == ESP_OK && somfy_remote_table_reserve(&config->remotes, parser->count) != ESP_OK) {
+        somfy_config_free(*cfg);
+        result = ESP_ERR_NO_MEM;
+    }
+    if (result != ESP_OK) {
+        *cfg = NULL;
+        return result;
+    }
+
+    somfy_config_adopt(config, parser->records, parser->count, parser->strings);
+    parser->records = NULL;
+    parser->strings = NULL;
+    parser->error = ESP_ERR_INVALID_STATE;
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_parser_free (somfy_config_parser_handle_t handle) {
+    somfy_config_parser_t * parser = (somfy_config_parser_t *) handle;
+    free(parser->records);
+    free(parser->name_ends);
+    free(parser->strings);
+    free(parser);
     return ESP_OK;
 }
 
@@ -146,26 +691,264 @@ esp_err_t somfy_config_blob_free (somfy_config_blob_handle_t handle) {
     return ESP_OK;
 }
 
-esp_err_t somfy_config_increment_rolling_code (somfy_config_handle_t handle, somfy_remote_t remote, somfy_rolling_code_t * rolling_code) {
+esp_err_t somfy_config_get_rolling_code (somfy_config_handle_t handle, somfy_remote_t remote, somfy_rolling_code_t * rolling_code) {
     somfy_config_t * cfg = (somfy_config_t *) handle;
+    esp_err_t result = ESP_ERR_NOT_FOUND;
     MUTEX_TAKE(cfg->remotes_mutex);
-    somfy_config_remote_t * found = NULL;
-    for (list_node_t * node = list_begin(cfg->remotes); node != NULL; node = list_next(node)) {
-        somfy_config_remote_t * cur = list_node(node);
-        if (cur->remote == remote) {
-            found = cur;
-            break;
-        }
+    somfy_config_remote_t * found = somfy_remote_table_find(&cfg->remotes, remote);
+    if (found != NULL) {
+        *rolling_code = found->rolling_code;
+        result = ESP_OK;
+    }
+
+    MUTEX_GIVE(cfg->remotes_mutex);
+    return result;
+}
+
+esp_err_t somfy_config_list_remotes (somfy_config_handle_t handle, somfy_remote_t * remotes, size_t max, size_t * count) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    size_t i = 0;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    for (; i < cfg->remotes.count; i++) {
+        if (i < max)
+            remotes[i] = cfg->remotes.remotes[i]->remote;
+    }
+
+    MUTEX_GIVE(cfg->remotes_mutex);
+    *count = i;
+    return ESP_OK;
+}
+
+static somfy_config_remote_t * somfy_config_find_remote (somfy_config_t * cfg, somfy_remote_t remote) {
+    return somfy_remote_table_find(&cfg->remotes, remote);
+}
+
+esp_err_t somfy_config_find_remote_by_name (somfy_config_handle_t handle, const char * name, somfy_remote_t * remote) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    somfy_config_remote_t * found = somfy_remote_table_find_name(&cfg->remotes, name);
+    if (found != NULL)
+        *remote = found->remote;
+    MUTEX_GIVE(cfg->remotes_mutex);
+    return found != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// Whether remote has needed more codes to hand out. Leased remotes run dry
+// when their block and the next one are used up before another lease
+// arrives. Called with remotes_mutex held.
+static bool somfy_config_code_available (somfy_config_t * cfg, somfy_config_remote_t * remote, uint32_t needed) {
+    if (!cfg->leased)
+        return true;
+
+    uint32_t left = (somfy_rolling_code_t) (remote->reserved_code - remote->rolling_code);
+    if (remote->lease_ready)
+        left += (somfy_rolling_code_t) (remote->lease_last - remote->lease_first) + 1;
+    return needed <= left;
+}
+
+// Moves to the next code, reserving a new block when fewer than one is left
+// or switching to the next leased one when the current one is used up.
+// Called with remotes_mutex held, after somfy_config_code_available.
+static somfy_rolling_code_t somfy_config_next_code (somfy_config_t * cfg, somfy_config_remote_t * remote, somfy_config_reserve_t * reserved) {
+    bool exhausted = remote->rolling_code == remote->reserved_code;
+    *reserved = exhausted ? SOMFY_CONFIG_RESERVE_NOW : SOMFY_CONFIG_RESERVE_NONE;
+    if (exhausted && cfg->leased) {
+        remote->rolling_code = remote->lease_first;
+        remote->reserved_code = remote->lease_last;
+        remote->lease_ready = false;
+        remote->dirty |= SOMFY_CONFIG_DIRTY_CODE;
+    }
+    else
+        remote->rolling_code = remote->rolling_code + 1;
+
+    somfy_rolling_code_t left = remote->reserved_code - remote->rolling_code;
+    if (!cfg->leased && (exhausted || left < SOMFY_CONFIG_CODE_BLOCK)) {
+        // The code handed out is still covered by the persisted reservation
+        // unless it was exhausted, only loaded configs start that way.
+        remote->reserved_code = remote->rolling_code + 2 * SOMFY_CONFIG_CODE_BLOCK;
+        remote->dirty |= SOMFY_CONFIG_DIRTY_CODE;
+        if (!exhausted)
+            *reserved = SOMFY_CONFIG_RESERVE_AHEAD;
     }
 
-    if (found == NULL)
+    if (cfg->leased && !remote->lease_ready && left <= SOMFY_CONFIG_LEASE_LOW_WATER && cfg->lease_hook != NULL)
+        cfg->lease_hook(cfg->lease_arg);
+
+    return remote->rolling_code;
+}
+
+esp_err_t somfy_config_increment_rolling_code (somfy_config_handle_t handle, somfy_remote_t remote, somfy_rolling_code_t * rolling_code, somfy_config_reserve_t * reserved) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    somfy_config_remote_t * found = somfy_config_find_remote(cfg, remote);
+    if (found == NULL) {
+        MUTEX_GIVE(cfg->remotes_mutex);
         return ESP_ERR_NOT_FOUND;
+    }
+
+    if (!somfy_config_code_available(cfg, found, 1)) {
+        MUTEX_GIVE(cfg->remotes_mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    found->rolling_code = found->rolling_code + 1;
+    somfy_config_reserve_t moved;
+    somfy_rolling_code_t code = somfy_config_next_code(cfg, found, &moved);
     if (rolling_code != NULL)
-        *rolling_code = found->rolling_code;
+        *rolling_code = code;
+    if (reserved != NULL)
+        *reserved = moved;
+
+    MUTEX_GIVE(cfg->remotes_mutex);
+
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_increment_rolling_codes (somfy_config_handle_t handle, const somfy_remote_t * remotes, size_t count, somfy_rolling_code_t * rolling_codes, somfy_config_reserve_t * reserved) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    for (size_t i = 0; i < count; i++) {
+        // A remote listed several times needs a code for each entry.
+        uint32_t needed = 1;
+        for (size_t j = 0; j < i; j++) {
+            if (remotes[j] == remotes[i])
+                needed++;
+        }
+
+        somfy_config_remote_t * found = somfy_config_find_remote(cfg, remotes[i]);
+        if (found == NULL || !somfy_config_code_available(cfg, found, needed)) {
+            MUTEX_GIVE(cfg->remotes_mutex);
+            return found == NULL ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        somfy_config_remote_t * found = somfy_config_find_remote(cfg, remotes[i]);
+        somfy_config_reserve_t moved;
+        rolling_codes[i] = somfy_config_next_code(cfg, found, &moved);
+        if (reserved != NULL)
+            reserved[i] = moved;
+    }
+
+    MUTEX_GIVE(cfg->remotes_mutex);
+    return ESP_OK;
+}
+
+bool somfy_profile_equal (const somfy_profile_t * a, const somfy_profile_t * b) {
+    return a->frames == b->frames &&
+        a->first_syncs == b->first_syncs &&
+        a->repeat_syncs == b->repeat_syncs &&
+        a->symbol_us == b->symbol_us &&
+        a->gap_us == b->gap_us;
+}
+
+esp_err_t somfy_config_get_profile (somfy_config_handle_t handle, somfy_remote_t remote, somfy_profile_t * profile) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    somfy_config_remote_t * found = somfy_config_find_remote(cfg, remote);
+    if (found != NULL)
+        *profile = found->profile;
+    MUTEX_GIVE(cfg->remotes_mutex);
+    return found != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t somfy_config_set_profile (somfy_config_handle_t handle, somfy_remote_t remote, const somfy_profile_t * profile) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    if (profile->frames == 0 || profile->symbol_us == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    MUTEX_TAKE(cfg->remotes_mutex);
+    somfy_config_remote_t * found = somfy_config_find_remote(cfg, remote);
+    if (found != NULL) {
+        found->profile = *profile;
+        found->dirty |= SOMFY_CONFIG_DIRTY_META;
+    }
+    MUTEX_GIVE(cfg->remotes_mutex);
+    return found != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t somfy_config_take_dirty (somfy_config_handle_t handle, somfy_config_remote_t * remotes, size_t max, size_t * count) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    size_t i = 0;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    for (uint32_t n = 0; n < cfg->remotes.count && i < max; n++) {
+        somfy_config_remote_t * cur = cfg->remotes.remotes[n];
+        if (cur->dirty == 0)
+            continue;
+
+        remotes[i++] = *cur;
+        cur->dirty = 0;
+    }
+
+    MUTEX_GIVE(cfg->remotes_mutex);
+    *count = i;
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_mark_dirty (somfy_config_handle_t handle, somfy_remote_t remote, uint8_t dirty) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    somfy_config_remote_t * found = somfy_config_find_remote(cfg, remote);
+    if (found != NULL)
+        found->dirty |= dirty;
+    MUTEX_GIVE(cfg->remotes_mutex);
+    return found != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
 
+esp_err_t somfy_config_get_reserved_code (somfy_config_handle_t handle, somfy_remote_t remote, somfy_rolling_code_t * reserved_code) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    somfy_config_remote_t * found = somfy_config_find_remote(cfg, remote);
+    if (found != NULL)
+        *reserved_code = found->reserved_code;
     MUTEX_GIVE(cfg->remotes_mutex);
+    return found != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
 
+esp_err_t somfy_config_set_leased (somfy_config_handle_t handle, somfy_config_lease_hook_t hook, void * arg) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    cfg->leased = true;
+    cfg->lease_hook = hook;
+    cfg->lease_arg = arg;
+    // Codes reserved locally were given by no server, another bridge may
+    // get them: every remote waits for its first lease instead.
+    for (uint32_t n = 0; n < cfg->remotes.count; n++) {
+        somfy_config_remote_t * cur = cfg->remotes.remotes[n];
+        cur->reserved_code = cur->rolling_code;
+        cur->dirty |= SOMFY_CONFIG_DIRTY_CODE;
+    }
+    MUTEX_GIVE(cfg->remotes_mutex);
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+esp_err_t somfy_config_lease_needed (somfy_config_handle_t handle, somfy_remote_t remote, bool * needed, somfy_rolling_code_t * reserved_code) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    somfy_config_remote_t * found = somfy_config_find_remote(cfg, remote);
+    if (found != NULL) {
+        somfy_rolling_code_t left = found->reserved_code - found->rolling_code;
+        *needed = !found->lease_ready && left <= SOMFY_CONFIG_LEASE_LOW_WATER;
+        *reserved_code = found->reserved_code;
+    }
+    MUTEX_GIVE(cfg->remotes_mutex);
+    return found != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t somfy_config_set_lease (somfy_config_handle_t handle, somfy_remote_t remote, somfy_rolling_code_t first, somfy_rolling_code_t last) {
+    somfy_config_t * cfg = (somfy_config_t *) handle;
+    MUTEX_TAKE(cfg->remotes_mutex);
+    somfy_config_remote_t * found = somfy_config_find_remote(cfg, remote);
+    esp_err_t result = found != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+    // Codes must keep moving forward: the block starts past every code this
+    // bridge may have used.
+    if (found != NULL && ((int16_t)(first - found->reserved_code) <= 0 || (int16_t)(last - first) < 0))
+        result = ESP_ERR_INVALID_ARG;
+
+    if (result == ESP_OK) {
+        found->lease_first = first;
+        found->lease_last = last;
+        found->lease_ready = true;
+    }
+    MUTEX_GIVE(cfg->remotes_mutex);
+    return result;
+}
@@ -2,12 +2,57 @@
 #include <nvs.h>
 #include <esp_log.h>
 #include <esp_http_client.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
 #include "somfy_config_nvs.h"
+#include "somfy_config_http.h"
 #include "somfy_config_blob.h"
 
 
 static const char * TAG = "somfy_config_http";
 
+// Bounds how long a dead server holds the replication task.
+#define SOMFY_CONFIG_HTTP_TIMEOUT_MS 5000
+
+#define SOMFY_CONFIG_RETRY_MIN_MS 1000
+
+#define SOMFY_CONFIG_RETRY_MAX_MS 60000
+
+// Remotes whose change can wait for the next post. Beyond that, the whole
+// config is posted instead.
+#define SOMFY_CONFIG_DELTA_SLOTS 16
+
+// A delta record: remote, then reserved code.
+#define SOMFY_CONFIG_DELTA_RECORD_SIZE (sizeof(somfy_remote_t) + sizeof(somfy_rolling_code_t))
+
+#define SOMFY_CONFIG_SNAPSHOT_TYPE "application/octet-stream"
+
+#define SOMFY_CONFIG_DELTA_TYPE "application/vnd.somfy.delta"
+
+// Status the server answers a delta with when it wants the whole config.
+#define SOMFY_CONFIG_HTTP_RESYNC 409
+
+// Snapshots are serialized and written this many bytes at a time.
+#define SOMFY_CONFIG_HTTP_CHUNK 256
+
+typedef struct {
+    somfy_config_handle_t config;
+    char * url;
+    portMUX_TYPE lock;
+    // Guarded by lock.
+    somfy_remote_t changed[SOMFY_CONFIG_DELTA_SLOTS];
+    uint8_t changed_count;
+    bool resync;
+    somfy_config_replicator_stats_t stats;
+    // Only used by the task, client carries the deltas. reconnected is set
+    // by the event handler when a post had to open a new connection.
+    esp_http_client_handle_t client;
+    bool reconnected;
+    TaskHandle_t task;
+} somfy_config_replicator_t;
+
 esp_err_t event_handle(esp_http_client_event_t *event);
 
 esp_err_t somfy_config_blob_http_write(somfy_config_blob_handle_t blob_handle, char *url) {
@@ -16,42 +61,118 @@ esp_err_t somfy_config_blob_http_write(somfy_config_blob_handle_t blob_handle, c
         .url = url,
         .method = HTTP_METHOD_POST,
         .event_handler = event_handle,
+        .timeout_ms = SOMFY_CONFIG_HTTP_TIMEOUT_MS,
     };
 
     esp_http_client_handle_t client = esp_http_client_init(&http_config);
+    if (client == NULL)
+        return ESP_ERR_NO_MEM;
+
     esp_http_client_set_header (client, "Content-Type", "application/octet-stream");
     esp_http_client_set_post_field (client, blob->blob, blob->size);
     esp_err_t err = esp_http_client_perform(client);
 
     if (err == ESP_OK) {
+        int status = esp_http_client_get_status_code(client);
         ESP_LOGI(TAG, "Status = %d, content_length = %d",
-                esp_http_client_get_status_code(client),
+                status,
                 esp_http_client_get_content_length(client));
+        if (status < 200 || status >= 300)
+            err = ESP_FAIL;
     }
 
     esp_http_client_cleanup(client);
+    return err;
+}
+
+// Appends each piece of the body to the blob in user_data.
+static esp_err_t somfy_config_blob_http_event(esp_http_client_event_t * event) {
+    somfy_config_blob_t * blob = (somfy_config_blob_t *) event->user_data;
+    if (event->event_id != HTTP_EVENT_ON_DATA)
+        return ESP_OK;
+
+    void * grown = realloc(blob->blob, blob->size + event->data_len);
+    if (grown == NULL)
+        return ESP_ERR_NO_MEM;
+
+    memcpy((uint8_t *) grown + blob->size, event->data, event->data_len);
+    blob->blob = grown;
+    blob->size += event->data_len;
     return ESP_OK;
 }
 
 esp_err_t somfy_config_blob_http_read(somfy_config_blob_handle_t *handle, char *url) {
+    somfy_config_blob_t * blob = calloc(1, sizeof(somfy_config_blob_t));
+    if (blob == NULL)
+        return ESP_ERR_NO_MEM;
+
     esp_http_client_config_t http_config = {
         .url = url,
         .method = HTTP_METHOD_GET,
-        .event_handler = event_handle,
+        .event_handler = somfy_config_blob_http_event,
+        .user_data = blob,
+        .timeout_ms = SOMFY_CONFIG_HTTP_TIMEOUT_MS,
     };
 
     esp_http_client_handle_t client = esp_http_client_init(&http_config);
+    if (client == NULL) {
+        free(blob);
+        return ESP_ERR_NO_MEM;
+    }
+
     esp_err_t err = esp_http_client_perform(client);
+    if (err == ESP_OK && esp_http_client_get_status_code(client) != 200)
+        err = ESP_FAIL;
 
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Status = %d, content_length = %d",
-                esp_http_client_get_status_code(client),
-                esp_http_client_get_content_length(client));
+    esp_http_client_cleanup(client);
+    if (err != ESP_OK) {
+        somfy_config_blob_free(blob);
+        return err;
     }
 
+    *handle = blob;
+    return ESP_OK;
+}
+
+// Feeds each piece of the body to the parser in user_data.
+static esp_err_t somfy_config_http_parse_event(esp_http_client_event_t * event) {
+    if (event->event_id != HTTP_EVENT_ON_DATA)
+        return ESP_OK;
+    return somfy_config_parser_feed(event->user_data, event->data, event->data_len);
+}
+
+esp_err_t somfy_config_http_read(const char *url, somfy_config_handle_t *cfg) {
+    somfy_config_parser_handle_t parser;
+    esp_err_t err = somfy_config_parser_new(&parser);
+    if (err != ESP_OK)
+        return err;
+
+    esp_http_client_config_t http_config = {
+        .url = url,
+        .method = HTTP_METHOD_GET,
+        .event_handler = somfy_config_http_parse_event,
+        .user_data = parser,
+        .timeout_ms = SOMFY_CONFIG_HTTP_TIMEOUT_MS,
+    };
+
+    esp_http_client_handle_t client = esp_http_client_init(&http_config);
+    if (client == NULL) {
+        somfy_config_parser_free(parser);
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = esp_http_client_perform(client);
+    if (err == ESP_OK && esp_http_client_get_status_code(client) != 200)
+        err = ESP_FAIL;
     esp_http_client_cleanup(client);
 
-    return ESP_OK;
+    // A parse error stops no transfer, it shows here.
+    if (err == ESP_OK)
+        err = somfy_config_parser_finish(parser, cfg);
+    somfy_config_parser_free(parser);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Config not read from %s: %s", url, esp_err_to_name(err));
+    return err;
 }
 
 esp_err_t event_handle(esp_http_client_event_t *event){
@@ -85,4 +206,407 @@ esp_err_t event_handle(esp_http_client_event_t *event){
     }
     return ESP_OK;
 
-}
\ No newline at end of file
+}
+
+static esp_err_t somfy_config_replicator_event(esp_http_client_event_t * event) {
+    somfy_config_replicator_t * replicator = (somfy_config_replicator_t *) event->user_data;
+    if (event->event_id == HTTP_EVENT_ON_CONNECTED) {
+        replicator->reconnected = true;
+        portENTER_CRITICAL(&replicator->lock);
+        replicator->stats.connections++;
+        portEXIT_CRITICAL(&replicator->lock);
+    }
+    return ESP_OK;
+}
+
+// Builds the next body: the changed remotes, or none when the server is out
+// of sync and gets the whole config. Returns false when there is nothing to
+// send.
+static bool somfy_config_replicator_take(somfy_config_replicator_t * replicator, somfy_config_blob_handle_t * body, bool * snapshot) {
+    somfy_remote_t changed[SOMFY_CONFIG_DELTA_SLOTS];
+    portENTER_CRITICAL(&replicator->lock);
+    *snapshot = replicator->resync;
+    uint8_t count = replicator->changed_count;
+    memcpy(changed, replicator->changed, count * sizeof(somfy_remote_t));
+    replicator->changed_count = 0;
+    replicator->resync = false;
+    portEXIT_CRITICAL(&replicator->lock);
+
+    *body = NULL;
+    if (*snapshot)
+        return true;
+    if (count == 0)
+        return false;
+
+    somfy_config_blob_t * blob = calloc(1, sizeof(somfy_config_blob_t));
+    uint8_t * buffer = calloc(1 + count * SOMFY_CONFIG_DELTA_RECORD_SIZE, sizeof(uint8_t));
+    if (blob == NULL || buffer == NULL) {
+        free(blob);
+        free(buffer);
+        portENTER_CRITICAL(&replicator->lock);
+        replicator->resync = true;
+        portEXIT_CRITICAL(&replicator->lock);
+        return false;
+    }
+
+    size_t i = 0;
+    memcpy(buffer + i, &count, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    for (uint8_t j = 0; j < count; j++) {
+        somfy_rolling_code_t code = 0;
+        somfy_config_get_reserved_code(replicator->config, changed[j], &code);
+        memcpy(buffer + i, &changed[j], sizeof(somfy_remote_t));
+        i += sizeof(somfy_remote_t);
+        memcpy(buffer + i, &code, sizeof(somfy_rolling_code_t));
+        i += sizeof(somfy_rolling_code_t);
+    }
+
+    blob->blob = buffer;
+    blob->size = i;
+    *body = blob;
+    return true;
+}
+
+// Posts the whole config on a connection of its own, serialized while
+// written so that it is never held whole.
+static esp_err_t somfy_config_replicator_post_snapshot(somfy_config_replicator_t * replicator, int * status, size_t * sent) {
+    somfy_config_serializer_handle_t serializer;
+    esp_err_t err = somfy_config_serializer_new(replicator->config, &serializer);
+    if (err != ESP_OK)
+        return err;
+
+    esp_http_client_config_t http_config = {
+        .url = replicator->url,
+        .method = HTTP_METHOD_POST,
+        .event_handler = somfy_config_replicator_event,
+        .user_data = replicator,
+        .timeout_ms = SOMFY_CONFIG_HTTP_TIMEOUT_MS,
+    };
+
+    esp_http_client_handle_t client = esp_http_client_init(&http_config);
+    if (client == NULL) {
+        somfy_config_serializer_free(serializer);
+        return ESP_ERR_NO_MEM;
+    }
+
+    char chunk[SOMFY_CONFIG_HTTP_CHUNK];
+    size_t length = 0;
+    *sent = 0;
+    esp_http_client_set_header(client, "Content-Type", SOMFY_CONFIG_SNAPSHOT_TYPE);
+    err = esp_http_client_open(client, somfy_config_serializer_size(serializer));
+    do {
+        if (err == ESP_OK)
+            err = somfy_config_serializer_read(serializer, chunk, sizeof(chunk), &length);
+        if (err == ESP_OK && length > 0 && esp_http_client_write(client, chunk, length) != length)
+            err = ESP_FAIL;
+        *sent += err == ESP_OK ? length : 0;
+    } while (err == ESP_OK && length == sizeof(chunk));
+
+    if (err == ESP_OK && esp_http_client_fetch_headers(client) < 0)
+        err = ESP_FAIL;
+    *status = err == ESP_OK ? esp_http_client_get_status_code(client) : 0;
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    somfy_config_serializer_free(serializer);
+    return err;
+}
+
+// Posts a delta on the keep-alive connection, opening it when needed.
+// reconnected tells whether it went on a connection other than the last.
+static esp_err_t somfy_config_replicator_post_delta(somfy_config_replicator_t * replicator, somfy_config_blob_handle_t body, int * status, bool * reconnected) {
+    somfy_config_blob_t * blob = (somfy_config_blob_t *) body;
+    // The first connection of a new client follows a snapshot: the task
+    // resyncs on start and after each failure, which drops the client.
+    bool fresh = replicator->client == NULL;
+    if (fresh) {
+        esp_http_client_config_t http_config = {
+            .url = replicator->url,
+            .method = HTTP_METHOD_POST,
+            .event_handler = somfy_config_replicator_event,
+            .user_data = replicator,
+            .timeout_ms = SOMFY_CONFIG_HTTP_TIMEOUT_MS,
+        };
+
+        replicator->client = esp_http_client_init(&http_config);
+        if (replicator->client == NULL)
+            return ESP_ERR_NO_MEM;
+    }
+
+    esp_http_client_set_header(replicator->client, "Content-Type", SOMFY_CONFIG_DELTA_TYPE);
+    esp_http_client_set_post_field(replicator->client, blob->blob, blob->size);
+    replicator->reconnected = false;
+    esp_err_t err = esp_http_client_perform(replicator->client);
+    if (err != ESP_OK) {
+        // Start over on a fresh connection.
+        esp_http_client_cleanup(replicator->client);
+        replicator->client = NULL;
+        return err;
+    }
+
+    *status = esp_http_client_get_status_code(replicator->client);
+    *reconnected = replicator->reconnected && !fresh;
+    return ESP_OK;
+}
+
+static esp_err_t somfy_config_replicator_send(somfy_config_replicator_t * replicator, somfy_config_blob_handle_t body, bool snapshot) {
+    int64_t started = esp_timer_get_time();
+    int status = 0;
+    size_t sent = 0;
+    bool reconnected = false;
+    esp_err_t err;
+    if (snapshot)
+        err = somfy_config_replicator_post_snapshot(replicator, &status, &sent);
+    else {
+        err = somfy_config_replicator_post_delta(replicator, body, &status, &reconnected);
+        sent = ((somfy_config_blob_t *) body)->size;
+    }
+    if (err != ESP_OK)
+        return err;
+
+    portENTER_CRITICAL(&replicator->lock);
+    replicator->stats.bytes_sent += sent;
+    // A new connection may reach a server that lost track of us.
+    if ((status == SOMFY_CONFIG_HTTP_RESYNC || reconnected) && !snapshot)
+        replicator->resync = true;
+    else if (status >= 200 && status < 300) {
+        replicator->stats.deltas += snapshot ? 0 : 1;
+        replicator->stats.snapshots += snapshot ? 1 : 0;
+        replicator->stats.last_latency_us = esp_timer_get_time() - started;
+    }
+    portEXIT_CRITICAL(&replicator->lock);
+
+    if (status == SOMFY_CONFIG_HTTP_RESYNC && !snapshot) {
+        ESP_LOGI(TAG, "Server asked for the whole config.");
+        return ESP_OK;
+    }
+
+    return status >= 200 && status < 300 ? ESP_OK : ESP_FAIL;
+}
+
+// Posts the pending changes until there are none left. When a post fails,
+// waits out the backoff and returns false: whatever was lost is covered by
+// the whole config on the next run.
+static bool somfy_config_replicator_run(somfy_config_replicator_t * replicator, uint32_t * backoff_ms) {
+    somfy_config_blob_handle_t body;
+    bool snapshot;
+    while (somfy_config_replicator_take(replicator, &body, &snapshot)) {
+        esp_err_t result = somfy_config_replicator_send(replicator, body, snapshot);
+        if (body != NULL)
+            somfy_config_blob_free(body);
+        if (result == ESP_OK) {
+            *backoff_ms = 0;
+            continue;
+        }
+
+        portENTER_CRITICAL(&replicator->lock);
+        replicator->resync = true;
+        replicator->stats.failed++;
+        portEXIT_CRITICAL(&replicator->lock);
+        *backoff_ms = *backoff_ms == 0 ? SOMFY_CONFIG_RETRY_MIN_MS : *backoff_ms * 2;
+        *backoff_ms = *backoff_ms > SOMFY_CONFIG_RETRY_MAX_MS ? SOMFY_CONFIG_RETRY_MAX_MS : *backoff_ms;
+        ESP_LOGW(TAG, "Config not replicated, retrying in %d ms.", *backoff_ms);
+        vTaskDelay(pdMS_TO_TICKS(*backoff_ms));
+        return false;
+    }
+
+    return true;
+}
+
+static void somfy_config_replicator_task(void * data) {
+    somfy_config_replicator_t * replicator = (somfy_config_replicator_t *) data;
+    uint32_t backoff_ms = 0;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (!somfy_config_replicator_run(replicator, &backoff_ms));
+    }
+}
+
+esp_err_t somfy_config_replicator_new(somfy_config_handle_t cfg, const char * url, somfy_config_replicator_handle_t * handle) {
+    somfy_config_replicator_t * replicator = calloc(1, sizeof(somfy_config_replicator_t));
+    if (replicator == NULL)
+        return ESP_ERR_NO_MEM;
+
+    replicator->config = cfg;
+    replicator->url = strdup(url);
+    replicator->resync = true;
+    vPortCPUInitializeMutex(&replicator->lock);
+    if (replicator->url == NULL ||
+        xTaskCreate(&somfy_config_replicator_task, "somfy_replicator", 4096, replicator, tskIDLE_PRIORITY + 1, &replicator->task) != pdPASS) {
+        free(replicator->url);
+        free(replicator);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // The server gets the whole config first.
+    xTaskNotifyGive(replicator->task);
+    *handle = replicator;
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_replicator_free(somfy_config_replicator_handle_t handle) {
+    somfy_config_replicator_t * replicator = (somfy_config_replicator_t *) handle;
+    vTaskDelete(replicator->task);
+    if (replicator->client != NULL)
+        esp_http_client_cleanup(replicator->client);
+    free(replicator->url);
+    free(replicator);
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_replicator_mark(somfy_config_replicator_handle_t handle, somfy_remote_t remote) {
+    somfy_config_replicator_t * replicator = (somfy_config_replicator_t *) handle;
+    portENTER_CRITICAL(&replicator->lock);
+    replicator->stats.marked++;
+    bool found = false;
+    for (uint8_t i = 0; i < replicator->changed_count && !found; i++)
+        found = replicator->changed[i] == remote;
+
+    if (found)
+        replicator->stats.coalesced++;
+    else if (replicator->changed_count < SOMFY_CONFIG_DELTA_SLOTS)
+        replicator->changed[replicator->changed_count++] = remote;
+    else
+        replicator->resync = true;
+    portEXIT_CRITICAL(&replicator->lock);
+
+    xTaskNotifyGive(replicator->task);
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_replicator_get_stats(somfy_config_replicator_handle_t handle, somfy_config_replicator_stats_t * stats) {
+    somfy_config_replicator_t * replicator = (somfy_config_replicator_t *) handle;
+    portENTER_CRITICAL(&replicator->lock);
+    memcpy(stats, &replicator->stats, sizeof(somfy_config_replicator_stats_t));
+    portEXIT_CRITICAL(&replicator->lock);
+    return ESP_OK;
+}
+
+#define SOMFY_CONFIG_LEASE_CHECK_MS 10000
+
+#define SOMFY_CONFIG_LEASE_REQUEST_SIZE (sizeof(uint32_t) + sizeof(somfy_remote_t) + sizeof(somfy_rolling_code_t))
+
+#define SOMFY_CONFIG_LEASE_RESPONSE_SIZE (2 * sizeof(somfy_rolling_code_t))
+
+typedef struct {
+    somfy_config_handle_t config;
+    char * url;
+    uint32_t bridge;
+    TaskHandle_t task;
+} somfy_config_lease_t;
+
+// Asks the server for the next block of remote.
+static esp_err_t somfy_config_lease_request(somfy_config_lease_t * lease, somfy_remote_t remote, somfy_rolling_code_t reserved_code,
+    somfy_rolling_code_t * first, somfy_rolling_code_t * last) {
+    uint8_t request[SOMFY_CONFIG_LEASE_REQUEST_SIZE];
+    size_t i = 0;
+    memcpy(request + i, &lease->bridge, sizeof(uint32_t));
+    i += sizeof(uint32_t);
+    memcpy(request + i, &remote, sizeof(somfy_remote_t));
+    i += sizeof(somfy_remote_t);
+    memcpy(request + i, &reserved_code, sizeof(somfy_rolling_code_t));
+    i += sizeof(somfy_rolling_code_t);
+
+    esp_http_client_config_t http_config = {
+        .url = lease->url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = SOMFY_CONFIG_HTTP_TIMEOUT_MS,
+    };
+
+    esp_http_client_handle_t client = esp_http_client_init(&http_config);
+    if (client == NULL)
+        return ESP_ERR_NO_MEM;
+
+    uint8_t response[SOMFY_CONFIG_LEASE_RESPONSE_SIZE];
+    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+    esp_err_t err = esp_http_client_open(client, i);
+    if (err == ESP_OK && esp_http_client_write(client, (const char *) request, i) != i)
+        err = ESP_FAIL;
+    if (err == ESP_OK && esp_http_client_fetch_headers(client) < 0)
+        err = ESP_FAIL;
+    if (err == ESP_OK && esp_http_client_get_status_code(client) != 200)
+        err = ESP_FAIL;
+    if (err == ESP_OK && esp_http_client_read(client, (char *) response, sizeof(response)) != sizeof(response))
+        err = ESP_ERR_INVALID_SIZE;
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    if (err != ESP_OK)
+        return err;
+
+    memcpy(first, response, sizeof(somfy_rolling_code_t));
+    memcpy(last, response + sizeof(somfy_rolling_code_t), sizeof(somfy_rolling_code_t));
+    return ESP_OK;
+}
+
+static void somfy_config_lease_renew(somfy_config_lease_t * lease) {
+    size_t count;
+    somfy_config_list_remotes(lease->config, NULL, 0, &count);
+    somfy_remote_t * remotes = calloc(count > 0 ? count : 1, sizeof(somfy_remote_t));
+    if (remotes == NULL)
+        return;
+
+    somfy_config_list_remotes(lease->config, remotes, count, &count);
+    for (size_t i = 0; i < count; i++) {
+        bool needed = false;
+        somfy_rolling_code_t reserved_code, first, last;
+        if (somfy_config_lease_needed(lease->config, remotes[i], &needed, &reserved_code) != ESP_OK || !needed)
+            continue;
+
+        esp_err_t result = somfy_config_lease_request(lease, remotes[i], reserved_code, &first, &last);
+        if (result == ESP_OK)
+            result = somfy_config_set_lease(lease->config, remotes[i], first, last);
+        if (result != ESP_OK)
+            ESP_LOGW(TAG, "No lease for remote %06x: %s", remotes[i] & 0xffffff, esp_err_to_name(result));
+        else
+            ESP_LOGI(TAG, "Leased codes %d to %d for remote %06x.", first, last, remotes[i] & 0xffffff);
+    }
+
+    free(remotes);
+}
+
+// Checks every remote when one runs low, and periodically to retry the
+// leases that failed.
+static void somfy_config_lease_task(void * data) {
+    somfy_config_lease_t * lease = (somfy_config_lease_t *) data;
+    while (1) {
+        somfy_config_lease_renew(lease);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SOMFY_CONFIG_LEASE_CHECK_MS));
+    }
+}
+
+static void somfy_config_lease_wake(void * arg) {
+    somfy_config_lease_t * lease = (somfy_config_lease_t *) arg;
+    xTaskNotifyGive(lease->task);
+}
+
+esp_err_t somfy_config_lease_new(somfy_config_handle_t cfg, const char * url, uint32_t bridge, somfy_config_lease_handle_t * handle) {
+    somfy_config_lease_t * lease = calloc(1, sizeof(somfy_config_lease_t));
+    if (lease == NULL)
+        return ESP_ERR_NO_MEM;
+
+    lease->config = cfg;
+    lease->bridge = bridge;
+    lease->url = strdup(url);
+    if (lease->url == NULL ||
+        xTaskCreate(&somfy_config_lease_task, "somfy_lease", 4096, lease, tskIDLE_PRIORITY + 2, &lease->task) != pdPASS) {
+        free(lease->url);
+        free(lease);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Every remote now waits for its first lease, the task may have checked
+    // them before: wake it up to ask right away.
+    somfy_config_set_leased(cfg, &somfy_config_lease_wake, lease);
+    xTaskNotifyGive(lease->task);
+    *handle = lease;
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_lease_free(somfy_config_lease_handle_t handle) {
+    somfy_config_lease_t * lease = (somfy_config_lease_t *) handle;
+    vTaskDelete(lease->task);
+    free(lease->url);
+    free(lease);
+    return ESP_OK;
+}
@@ -1,25 +1,267 @@
 #include <esp_err.h>
 #include <nvs.h>
 #include <esp_log.h>
+#include <stdio.h>
+#include <string.h>
 #include "somfy_config_nvs.h"
 #include "somfy_config_blob.h"
 
 static const char * TAG = "somfy_config_nvs";
 
+#define SOMFY_NVS_NAMESPACE "somfy-cfg"
+
+#define SOMFY_NVS_LEGACY_KEY "config_data"
+
+#define SOMFY_NVS_REMOTES_KEY "remotes"
+
+// Key names are at most 15 characters: a prefix and the remote in hex.
+#define SOMFY_NVS_KEY_SIZE 16
+
+// NVS stores everything in 32 byte entries, a blob takes an index entry
+// and a data header besides its data.
+#define SOMFY_NVS_ENTRY_SIZE 32
+
+#define SOMFY_NVS_BLOB_SIZE(size) (SOMFY_NVS_ENTRY_SIZE * (2 + ((size) + SOMFY_NVS_ENTRY_SIZE - 1) / SOMFY_NVS_ENTRY_SIZE))
+
+// Remotes written per batch taken from the config.
+#define SOMFY_NVS_BATCH 8
+
+// Name length, name, then frames, syncs, symbol and gap of the profile.
+#define SOMFY_NVS_META_MAX (1 + SOMFY_CONFIG_NAME_MAX + 9)
+
+static void somfy_config_nvs_key (char * key, char prefix, somfy_remote_t remote) {
+    snprintf(key, SOMFY_NVS_KEY_SIZE, "%c%08x", prefix, remote);
+}
+
+static size_t somfy_config_nvs_meta_encode (somfy_config_remote_t * remote, uint8_t * buffer) {
+    size_t i = 0;
+    // Names are at most SOMFY_CONFIG_NAME_MAX long, see somfy_config_remote_new.
+    uint8_t name_len = remote->remote_name != NULL ? strlen(remote->remote_name) : 0;
+    memcpy(buffer + i, &name_len, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    // Unnamed remotes have no name to copy from.
+    if (name_len > 0)
+        memcpy(buffer + i, remote->remote_name, name_len);
+    i += name_len;
+    memcpy(buffer + i, &remote->profile.frames, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    memcpy(buffer + i, &remote->profile.first_syncs, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    memcpy(buffer + i, &remote->profile.repeat_syncs, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    memcpy(buffer + i, &remote->profile.symbol_us, sizeof(uint16_t));
+    i += sizeof(uint16_t);
+    memcpy(buffer + i, &remote->profile.gap_us, sizeof(uint32_t));
+    i += sizeof(uint32_t);
+    return i;
+}
+
+static esp_err_t somfy_config_nvs_meta_decode (somfy_config_remote_t * remote, const uint8_t * buffer, size_t size) {
+    size_t i = 0;
+    uint8_t name_len;
+    memcpy(&name_len, buffer + i, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    if (size != i + name_len + 9)
+        return ESP_ERR_INVALID_SIZE;
+
+    remote->remote_name = calloc(name_len + 1, sizeof(char));
+    memcpy(remote->remote_name, buffer + i, name_len);
+    i += name_len;
+    memcpy(&remote->profile.frames, buffer + i, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    memcpy(&remote->profile.first_syncs, buffer + i, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    memcpy(&remote->profile.repeat_syncs, buffer + i, sizeof(uint8_t));
+    i += sizeof(uint8_t);
+    memcpy(&remote->profile.symbol_us, buffer + i, sizeof(uint16_t));
+    i += sizeof(uint16_t);
+    memcpy(&remote->profile.gap_us, buffer + i, sizeof(uint32_t));
+    // Same fallback as the blob readers for a profile that sends nothing.
+    if (remote->profile.frames == 0 || remote->profile.symbol_us == 0) {
+        const somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+        remote->profile = profile;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t somfy_config_nvs_write_remotes (nvs_handle_t nvs, somfy_config_handle_t cfg, size_t * written) {
+    size_t count;
+    somfy_config_list_remotes(cfg, NULL, 0, &count);
+    somfy_remote_t * remotes = calloc(count > 0 ? count : 1, sizeof(somfy_remote_t));
+    if (remotes == NULL)
+        return ESP_ERR_NO_MEM;
+
+    somfy_config_list_remotes(cfg, remotes, count, &count);
+    esp_err_t result = nvs_set_blob(nvs, SOMFY_NVS_REMOTES_KEY, remotes, count * sizeof(somfy_remote_t));
+    if (result == ESP_OK)
+        *written += SOMFY_NVS_BLOB_SIZE(count * sizeof(somfy_remote_t));
+    free(remotes);
+    return result;
+}
+
+static esp_err_t somfy_config_nvs_write_remote (nvs_handle_t nvs, somfy_config_remote_t * remote, size_t * written) {
+    char key[SOMFY_NVS_KEY_SIZE];
+    esp_err_t result = ESP_OK;
+    if (remote->dirty & SOMFY_CONFIG_DIRTY_META) {
+        uint8_t meta[SOMFY_NVS_META_MAX];
+        size_t size = somfy_config_nvs_meta_encode(remote, meta);
+        somfy_config_nvs_key(key, 'm', remote->remote);
+        result = nvs_set_blob(nvs, key, meta, size);
+        if (result != ESP_OK)
+            return result;
+
+        *written += SOMFY_NVS_BLOB_SIZE(size);
+    }
+
+    if (remote->dirty & SOMFY_CONFIG_DIRTY_CODE) {
+        somfy_config_nvs_key(key, 'c', remote->remote);
+        result = nvs_set_u16(nvs, key, remote->reserved_code);
+        if (result != ESP_OK)
+            return result;
+
+        *written += SOMFY_NVS_ENTRY_SIZE;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_nvs_save (somfy_config_handle_t cfg, size_t * written) {
+    nvs_handle_t nvs;
+    esp_err_t result = nvs_open(SOMFY_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (result != ESP_OK)
+        return result;
+
+    *written = 0;
+    somfy_config_remote_t batch[SOMFY_NVS_BATCH];
+    bool added = false;
+    size_t count;
+    do {
+        somfy_config_take_dirty(cfg, batch, SOMFY_NVS_BATCH, &count);
+        for (size_t i = 0; i < count; i++) {
+            // Name and profile edits leave the list as it is.
+            added |= (batch[i].dirty & SOMFY_CONFIG_DIRTY_LISTED) != 0;
+            esp_err_t written_remote = somfy_config_nvs_write_remote(nvs, &batch[i], written);
+            if (written_remote != ESP_OK) {
+                somfy_config_mark_dirty(cfg, batch[i].remote, batch[i].dirty);
+                result = written_remote;
+            }
+        }
+    } while (count == SOMFY_NVS_BATCH && result == ESP_OK);
+
+    if (added && result == ESP_OK)
+        result = somfy_config_nvs_write_remotes(nvs, cfg, written);
+    if (result == ESP_OK)
+        result = nvs_commit(nvs);
+
+    nvs_close(nvs);
+    if (result != ESP_OK)
+        ESP_LOGE(TAG, "Failed to save config: %s", esp_err_to_name(result));
+    return result;
+}
+
+// Replaces the config_data blob by the keyed layout. The blob is erased
+// only once every remote is saved under its own keys.
+static esp_err_t somfy_config_nvs_migrate (nvs_handle_t nvs, somfy_config_handle_t * cfg) {
+    somfy_config_blob_handle_t blob;
+    if (somfy_config_blob_nvs_read(&blob) != ESP_OK)
+        return ESP_ERR_NOT_FOUND;
+
+    esp_err_t result = somfy_config_deserialize(blob, cfg);
+    somfy_config_blob_free(blob);
+    if (result != ESP_OK)
+        return result;
+
+    size_t written;
+    result = somfy_config_nvs_save(*cfg, &written);
+    if (result != ESP_OK) {
+        somfy_config_free(*cfg);
+        *cfg = NULL;
+        return result;
+    }
+
+    nvs_erase_key(nvs, SOMFY_NVS_LEGACY_KEY);
+    nvs_commit(nvs);
+    ESP_LOGI(TAG, "Migrated config_data to per remote keys (%d bytes).", written);
+    return ESP_OK;
+}
+
+esp_err_t somfy_config_nvs_load (somfy_config_handle_t * cfg) {
+    *cfg = NULL;
+    nvs_handle_t nvs;
+    esp_err_t result = nvs_open(SOMFY_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (result != ESP_OK)
+        return result;
+
+    size_t size = 0;
+    result = nvs_get_blob(nvs, SOMFY_NVS_REMOTES_KEY, NULL, &size);
+    if (result == ESP_ERR_NVS_NOT_FOUND) {
+        result = somfy_config_nvs_migrate(nvs, cfg);
+        nvs_close(nvs);
+        return result;
+    }
+
+    somfy_remote_t * remotes = calloc(size > 0 ? size : 1, sizeof(uint8_t));
+    if (result == ESP_OK && remotes == NULL)
+        result = ESP_ERR_NO_MEM;
+    if (result == ESP_OK)
+        result = nvs_get_blob(nvs, SOMFY_NVS_REMOTES_KEY, remotes, &size);
+    if (result == ESP_OK)
+        result = somfy_config_new(cfg);
+
+    for (size_t i = 0; result == ESP_OK && i < size / sizeof(somfy_remote_t); i++) {
+        char key[SOMFY_NVS_KEY_SIZE];
+        uint8_t meta[SOMFY_NVS_META_MAX];
+        size_t meta_size = sizeof(meta);
+        somfy_rolling_code_t code;
+        somfy_config_nvs_key(key, 'm', remotes[i]);
+        result = nvs_get_blob(nvs, key, meta, &meta_size);
+        somfy_config_nvs_key(key, 'c', remotes[i]);
+        if (result == ESP_OK)
+            result = nvs_get_u16(nvs, key, &code);
+        if (result != ESP_OK)
+            break;
+
+        somfy_config_remote_handle_t handle;
+        somfy_config_remote_new(NULL, remotes[i], code, &handle);
+        somfy_config_remote_t * remote = (somfy_config_remote_t *) handle;
+        result = somfy_config_nvs_meta_decode(remote, meta, meta_size);
+        if (result != ESP_OK) {
+            somfy_config_remote_free(handle);
+            break;
+        }
+
+        remote->dirty = 0;
+        if (somfy_config_add_remote(*cfg, handle) != ESP_OK) {
+            ESP_LOGW(TAG, "Skipping duplicate remote %08x", remotes[i]);
+            somfy_config_remote_free(handle);
+        }
+    }
+
+    free(remotes);
+    nvs_close(nvs);
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to load config: %s", esp_err_to_name(result));
+        if (*cfg != NULL)
+            somfy_config_free(*cfg);
+        *cfg = NULL;
+    }
+    return result;
+}
+
 esp_err_t somfy_config_blob_nvs_write (somfy_config_blob_handle_t handle) {
     somfy_config_blob_t * blob = (somfy_config_blob_t *) handle;
     nvs_handle_t nvs;
-    ESP_ERROR_CHECK (nvs_open("somfy-cfg", NVS_READWRITE, &nvs));
-    nvs_set_blob (nvs, "config_data", blob->blob, blob->size);
+    ESP_ERROR_CHECK (nvs_open(SOMFY_NVS_NAMESPACE, NVS_READWRITE, &nvs));
+    nvs_set_blob (nvs, SOMFY_NVS_LEGACY_KEY, blob->blob, blob->size);
     nvs_close(nvs);
     return ESP_OK;
 }
 
 esp_err_t somfy_config_blob_nvs_read (somfy_config_blob_handle_t * handle) {
     nvs_handle_t nvs;
-    ESP_ERROR_CHECK (nvs_open("somfy-cfg", NVS_READWRITE, &nvs));
+    ESP_ERROR_CHECK (nvs_open(SOMFY_NVS_NAMESPACE, NVS_READWRITE, &nvs));
     size_t size = 0;
-    esp_err_t read = nvs_get_blob(nvs, "config_data", NULL, &size);
+    esp_err_t read = nvs_get_blob(nvs, SOMFY_NVS_LEGACY_KEY, NULL, &size);
     if (read == ESP_ERR_NVS_NOT_FOUND) {
         ESP_LOGW(TAG, "nvs entry not found %s", esp_err_to_name(read));
         *handle = NULL;
@@ -33,7 +275,7 @@ esp_err_t somfy_config_blob_nvs_read (somfy_config_blob_handle_t * handle) {
     blob->size = size;
     blob->blob = calloc(size, sizeof(uint8_t));
 
-    read = nvs_get_blob(nvs, "config_data", blob->blob, &size);
+    read = nvs_get_blob(nvs, SOMFY_NVS_LEGACY_KEY, blob->blob, &size);
     if (read != ESP_OK) {
         ESP_LOGE(TAG, "failed to get config data %s", esp_err_to_name(read));
         abort();
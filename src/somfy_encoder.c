@@ -0,0 +1,123 @@
+#include <string.h>
+#include "esp_attr.h"
+#include "somfy_encoder.h"
+
+static esp_err_t somfy_segment_sync_new(uint8_t sync, uint16_t symbol, pulse_segment_handle_t* segment) {
+  esp_err_t result = pulse_segment_new(2 * sync + 2, segment);
+  if (result != ESP_OK)
+    return result;
+
+  for (int i = 0; i < sync; i++) {
+    pulse_segment_add_pulse(*segment, 4 * symbol, PULSE_HIGH);
+    pulse_segment_add_pulse(*segment, 4 * symbol, PULSE_LOW);
+  }
+
+  pulse_segment_add_pulse(*segment, SOMFY_SOFTWARE_SYNC, PULSE_HIGH);
+  pulse_segment_add_pulse(*segment, symbol, PULSE_LOW);
+  return ESP_OK;
+}
+
+esp_err_t somfy_segments_new(somfy_segments_t* segments, const somfy_profile_t* profile) {
+  memset(segments, 0, sizeof(somfy_segments_t));
+  if (profile->frames == 0 || profile->symbol_us == 0)
+    return ESP_ERR_INVALID_ARG;
+
+  if (pulse_segment_new(2, &segments->wakeup) != ESP_OK ||
+    somfy_segment_sync_new(profile->first_syncs, profile->symbol_us, &segments->first_sync) != ESP_OK ||
+    somfy_segment_sync_new(profile->repeat_syncs, profile->symbol_us, &segments->repeat_sync) != ESP_OK ||
+    pulse_segment_new(1, &segments->gap) != ESP_OK) {
+    somfy_segments_free(segments);
+    return ESP_ERR_NO_MEM;
+  }
+
+  pulse_segment_add_pulse(segments->wakeup, SOMFY_WAKEUP, PULSE_HIGH);
+  pulse_segment_add_pulse(segments->wakeup, SOMFY_SILENCE, PULSE_LOW);
+  pulse_segment_add_pulse(segments->gap, profile->gap_us, PULSE_LOW);
+  segments->frames = profile->frames;
+  segments->symbol_us = profile->symbol_us;
+  return ESP_OK;
+}
+
+void somfy_segments_free(somfy_segments_t* segments) {
+  pulse_segment_handle_t all[] = {
+    segments->wakeup, segments->first_sync, segments->repeat_sync, segments->gap
+  };
+
+  for (int i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+    if (all[i] != NULL)
+      pulse_segment_free(all[i]);
+  }
+
+  memset(segments, 0, sizeof(somfy_segments_t));
+}
+
+void somfy_encoder_init(somfy_encoder_t* encoder, const uint8_t* frame, uint16_t symbol) {
+  memcpy(encoder->frame, frame, SOMFY_FRAME_SIZE);
+  encoder->step = 0;
+  encoder->symbol = symbol;
+}
+
+IRAM_ATTR bool somfy_encoder_next(void* data, pulse_duration_t* duration, pulse_level_t* level) {
+  somfy_encoder_t* encoder = data;
+  if (encoder->step == SOMFY_FRAME_SIZE * 16)
+    return false;
+
+  // Two half symbols per bit: a 1 rises in the middle, a 0 falls.
+  uint8_t bit = (encoder->frame[encoder->step / 16] >> (7 - (encoder->step / 2) % 8)) & 1;
+  uint8_t half = encoder->step % 2;
+  *duration = encoder->symbol;
+  *level = bit == half ? PULSE_HIGH : PULSE_LOW;
+  encoder->step++;
+  return true;
+}
+
+esp_err_t somfy_encoder_write_wakeup(somfy_segments_t* segments, pulse_train_handle_t train) {
+  return pulse_train_add_segment(train, segments->wakeup);
+}
+
+esp_err_t somfy_encoder_write_frames(somfy_segments_t* segments, pulse_train_handle_t train, const uint8_t* frame, uint8_t frames) {
+  somfy_encoder_t encoder;
+  somfy_encoder_init(&encoder, frame, segments->symbol_us);
+
+  esp_err_t result = ESP_OK;
+  for (uint8_t i = 0; i < frames && result == ESP_OK; i++) {
+    // A preempted train stops before a frame, never in the middle of one.
+    pulse_train_add_boundary(train);
+    result = pulse_train_add_segment(train, i == 0 ? segments->first_sync : segments->repeat_sync);
+    if (result == ESP_OK)
+      result = pulse_train_add_generator(train, &somfy_encoder_next, &encoder, sizeof(encoder));
+    if (result == ESP_OK)
+      result = pulse_train_add_segment(train, segments->gap);
+  }
+
+  return result;
+}
+
+esp_err_t somfy_encoder_write(somfy_segments_t* segments, pulse_train_handle_t train, const uint8_t* frame) {
+  esp_err_t result = somfy_encoder_write_wakeup(segments, train);
+  if (result != ESP_OK)
+    return result;
+
+  return somfy_encoder_write_frames(segments, train, frame, segments->frames);
+}
+
+esp_err_t somfy_encoder_write_hold(somfy_segments_t* segments, pulse_train_handle_t train, const uint8_t* frame, uint16_t repeats) {
+  esp_err_t result = somfy_encoder_write_wakeup(segments, train);
+  if (result == ESP_OK)
+    result = somfy_encoder_write_frames(segments, train, frame, 1);
+  if (result != ESP_OK || repeats == 0)
+    return result;
+
+  somfy_encoder_t encoder;
+  somfy_encoder_init(&encoder, frame, segments->symbol_us);
+  pulse_train_loop_begin(train);
+  result = pulse_train_add_segment(train, segments->repeat_sync);
+  if (result == ESP_OK)
+    result = pulse_train_add_generator(train, &somfy_encoder_next, &encoder, sizeof(encoder));
+  if (result == ESP_OK)
+    result = pulse_train_add_segment(train, segments->gap);
+  if (result == ESP_OK)
+    result = pulse_train_loop_end(train, repeats);
+
+  return result;
+}
@@ -0,0 +1,67 @@
+#ifndef __somfy_encoder_h
+#define __somfy_encoder_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pulse.h"
+#include "somfy_config.h"
+
+#define SOMFY_WAKEUP 9415
+
+#define SOMFY_SILENCE 89565
+
+#define SOMFY_SOFTWARE_SYNC 4550
+
+#define SOMFY_FRAME_SIZE 7
+
+// Train entries taken by one frame: sync, data and gap.
+#define SOMFY_ENCODER_FRAME_ENTRIES 3
+
+// Parts every transmission of a profile has in common, built once and
+// shared by all trains: wake-up pulse and silence, hardware syncs of the
+// first and the repeated frames followed by the software sync, and the
+// inter-frame gap. frames and symbol_us are those of the profile.
+typedef struct {
+  pulse_segment_handle_t wakeup;
+  pulse_segment_handle_t first_sync;
+  pulse_segment_handle_t repeat_sync;
+  pulse_segment_handle_t gap;
+  uint8_t frames;
+  uint16_t symbol_us;
+} somfy_segments_t;
+
+// Manchester encoder for the 56 data bits of a frame, MSB first, stepped
+// edge by edge from the transmit interrupt.
+typedef struct {
+  uint8_t frame[SOMFY_FRAME_SIZE];
+  uint8_t step;
+  uint16_t symbol;
+} somfy_encoder_t;
+
+esp_err_t somfy_segments_new (somfy_segments_t * segments, const somfy_profile_t * profile);
+
+void somfy_segments_free (somfy_segments_t * segments);
+
+void somfy_encoder_init (somfy_encoder_t * encoder, const uint8_t * frame, uint16_t symbol);
+
+bool somfy_encoder_next (void * encoder, pulse_duration_t * duration, pulse_level_t * level);
+
+// Chains a transmission of frame into train, as many copies as the profile
+// of segments asks for. Only the data part is specific to the train,
+// everything else is shared.
+esp_err_t somfy_encoder_write (somfy_segments_t * segments, pulse_train_handle_t train, const uint8_t * frame);
+
+// Chains a held button into train: the first frame, then repeats repeat
+// frames played by the controller as a loop, without being rebuilt.
+// PULSE_LOOP_FOREVER repeats until the controller loops are cancelled.
+esp_err_t somfy_encoder_write_hold (somfy_segments_t * segments, pulse_train_handle_t train, const uint8_t * frame, uint16_t repeats);
+
+// Building blocks of a scene: a single wake-up, then the frames of each
+// remote back to back with the copies and timing of its own profile,
+// separated by its inter-frame gap. The frames of a remote take
+// segments->frames * SOMFY_ENCODER_FRAME_ENTRIES entries.
+esp_err_t somfy_encoder_write_wakeup (somfy_segments_t * segments, pulse_train_handle_t train);
+
+esp_err_t somfy_encoder_write_frames (somfy_segments_t * segments, pulse_train_handle_t train, const uint8_t * frame, uint8_t frames);
+
+#endif//__somfy_encoder_h
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include "somfy_remote_table.h"
+
+#define SOMFY_REMOTE_TABLE_MIN_SLOTS 16
+
+typedef struct somfy_remote_table_slot_t {
+  uint32_t key;
+  uint32_t index;
+} somfy_remote_table_slot_t;
+
+// Finalizer of murmur3. Remote ids are mostly sequential and the table is
+// indexed by the low bits of the hash, which a plain multiplication leaves
+// as regular as the ids: every bit of the id goes to every bit of the hash.
+static uint32_t somfy_remote_table_hash_id(somfy_remote_t remote) {
+  uint32_t hash = remote;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+// FNV-1a.
+static uint32_t somfy_remote_table_hash_name(const char* name) {
+  uint32_t hash = 2166136261u;
+  for (const char* c = name; *c != '\0'; c++)
+    hash = (hash ^ (uint8_t) *c) * 16777619u;
+  return hash;
+}
+
+static void somfy_remote_table_insert(somfy_remote_table_slot_t* slots, uint32_t mask, uint32_t key, uint32_t hash, uint32_t index) {
+  uint32_t i = hash & mask;
+  while (slots[i].index != 0)
+    i = (i + 1) & mask;
+  slots[i].key = key;
+  slots[i].index = index + 1;
+}
+
+static void somfy_remote_table_index(somfy_remote_table_t* table, uint32_t index) {
+  somfy_config_remote_t* remote = table->remotes[index];
+  somfy_remote_table_insert(table->by_id, table->mask, remote->remote, somfy_remote_table_hash_id(remote->remote), index);
+  if (remote->remote_name != NULL) {
+    uint32_t hash = somfy_remote_table_hash_name(remote->remote_name);
+    somfy_remote_table_insert(table->by_name, table->mask, hash, hash, index);
+  }
+}
+
+// Doubles the slots and indexes every remote again.
+static esp_err_t somfy_remote_table_grow(somfy_remote_table_t* table) {
+  uint32_t slots = (table->mask + 1) * 2;
+  somfy_remote_table_slot_t* by_id = calloc(slots, sizeof(somfy_remote_table_slot_t));
+  somfy_remote_table_slot_t* by_name = calloc(slots, sizeof(somfy_remote_table_slot_t));
+  somfy_config_remote_t** remotes = realloc(table->remotes, slots / 2 * sizeof(somfy_config_remote_t*));
+  if (by_id == NULL || by_name == NULL || remotes == NULL) {
+    free(by_id);
+    free(by_name);
+    if (remotes != NULL)
+      table->remotes = remotes;
+    return ESP_ERR_NO_MEM;
+  }
+
+  free(table->by_id);
+  free(table->by_name);
+  table->by_id = by_id;
+  table->by_name = by_name;
+  table->remotes = remotes;
+  table->capacity = slots / 2;
+  table->mask = slots - 1;
+  for (uint32_t i = 0; i < table->count; i++)
+    somfy_remote_table_index(table, i);
+  return ESP_OK;
+}
+
+esp_err_t somfy_remote_table_init(somfy_remote_table_t* table) {
+  memset(table, 0, sizeof(somfy_remote_table_t));
+  table->mask = SOMFY_REMOTE_TABLE_MIN_SLOTS / 2 - 1;
+  return somfy_remote_table_grow(table);
+}
+
+esp_err_t somfy_remote_table_reserve(somfy_remote_table_t* table, uint32_t count) {
+  while (table->capacity < count) {
+    if (somfy_remote_table_grow(table) != ESP_OK)
+      return ESP_ERR_NO_MEM;
+  }
+
+  return ESP_OK;
+}
+
+void somfy_remote_table_free(somfy_remote_table_t* table) {
+  free(table->remotes);
+  free(table->by_id);
+  free(table->by_name);
+  memset(table, 0, sizeof(somfy_remote_table_t));
+}
+
+esp_err_t somfy_remote_table_add(somfy_remote_table_t* table, somfy_config_remote_t* remote) {
+  if (somfy_remote_table_find(table, remote->remote) != NULL)
+    return ESP_ERR_INVALID_STATE;
+
+  if (table->count == table->capacity && somfy_remote_table_grow(table) != ESP_OK)
+    return ESP_ERR_NO_MEM;
+
+  table->remotes[table->count] = remote;
+  somfy_remote_table_index(table, table->count);
+  table->count++;
+  return ESP_OK;
+}
+
+somfy_config_remote_t* somfy_remote_table_find(somfy_remote_table_t* table, somfy_remote_t remote) {
+  uint32_t i = somfy_remote_table_hash_id(remote) & table->mask;
+  while (table->by_id[i].index != 0) {
+    if (table->by_id[i].key == remote)
+      return table->remotes[table->by_id[i].index - 1];
+    i = (i + 1) & table->mask;
+  }
+
+  return NULL;
+}
+
+somfy_config_remote_t* somfy_remote_table_find_name(somfy_remote_table_t* table, const char* name) {
+  uint32_t hash = somfy_remote_table_hash_name(name);
+  uint32_t i = hash & table->mask;
+  while (table->by_name[i].index != 0) {
+    somfy_config_remote_t* remote = table->remotes[table->by_name[i].index - 1];
+    if (table->by_name[i].key == hash && strcmp(remote->remote_name, name) == 0)
+      return remote;
+    i = (i + 1) & table->mask;
+  }
+
+  return NULL;
+}
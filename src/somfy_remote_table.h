@@ -0,0 +1,39 @@
+#ifndef __somfy_remote_table_h
+#define __somfy_remote_table_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "somfy_config.h"
+
+// Remotes of a config in insertion order, indexed by id and by name with
+// open addressing. Probes only touch the slot arrays, remotes are read once
+// the slot matches. Remotes are never removed, so there are no tombstones.
+typedef struct {
+  somfy_config_remote_t** remotes;
+  uint32_t count;
+  uint32_t capacity;
+  // Power of two, kept at most half full. A slot holds the index of a
+  // remote plus one, 0 when empty, with the key or its hash alongside.
+  uint32_t mask;
+  struct somfy_remote_table_slot_t* by_id;
+  struct somfy_remote_table_slot_t* by_name;
+} somfy_remote_table_t;
+
+esp_err_t somfy_remote_table_init (somfy_remote_table_t* table);
+
+// Grows the table to hold count remotes without growing again.
+esp_err_t somfy_remote_table_reserve (somfy_remote_table_t* table, uint32_t count);
+
+// Frees the table, not the remotes in it.
+void somfy_remote_table_free (somfy_remote_table_t* table);
+
+// ESP_ERR_INVALID_STATE when the id of remote is already in the table.
+esp_err_t somfy_remote_table_add (somfy_remote_table_t* table, somfy_config_remote_t* remote);
+
+somfy_config_remote_t* somfy_remote_table_find (somfy_remote_table_t* table, somfy_remote_t remote);
+
+// First remote added with that name.
+somfy_config_remote_t* somfy_remote_table_find_name (somfy_remote_table_t* table, const char* name);
+
+#endif//__somfy_remote_table_h
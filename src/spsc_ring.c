@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "spsc_ring.h"
+
+esp_err_t spsc_ring_init(spsc_ring_t* ring, uint32_t capacity) {
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    return ESP_ERR_INVALID_ARG;
+
+  // Interrupt handlers read the slots, so they must not end up in PSRAM.
+  ring->items = heap_caps_calloc(capacity, sizeof(void*), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (ring->items == NULL)
+    return ESP_ERR_NO_MEM;
+
+  ring->mask = capacity - 1;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->overflows, 0);
+  return ESP_OK;
+}
+
+void spsc_ring_free(spsc_ring_t* ring) {
+  free(ring->items);
+  ring->items = NULL;
+}
+
+IRAM_ATTR bool spsc_ring_push(spsc_ring_t* ring, void* item) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail > ring->mask) {
+    // Only the producer writes the counter, a plain increment is enough.
+    uint32_t overflows = atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+    atomic_store_explicit(&ring->overflows, overflows + 1, memory_order_relaxed);
+    return false;
+  }
+
+  ring->items[head & ring->mask] = item;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return true;
+}
+
+bool spsc_ring_pop(spsc_ring_t* ring, void** item) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (head == tail)
+    return false;
+
+  *item = ring->items[tail & ring->mask];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return true;
+}
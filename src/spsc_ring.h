@@ -0,0 +1,33 @@
+#ifndef __spsc_ring_h
+#define __spsc_ring_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+
+// Single producer, single consumer ring of pointers, for events posted by
+// an interrupt handler and drained by a task. Neither side takes a lock:
+// the producer only moves head and the consumer only moves tail.
+typedef struct {
+  void** items;
+  uint32_t mask;
+  atomic_uint head;
+  atomic_uint tail;
+  // Items the producer dropped because the ring was full.
+  atomic_uint overflows;
+} spsc_ring_t;
+
+// capacity must be a power of two.
+esp_err_t spsc_ring_init (spsc_ring_t* ring, uint32_t capacity);
+
+void spsc_ring_free (spsc_ring_t* ring);
+
+// Producer side, safe from an interrupt handler. Returns false and counts
+// an overflow when the ring is full.
+bool spsc_ring_push (spsc_ring_t* ring, void* item);
+
+// Consumer side. Returns false when the ring is empty.
+bool spsc_ring_pop (spsc_ring_t* ring, void** item);
+
+#endif//__spsc_ring_h
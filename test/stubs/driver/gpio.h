@@ -0,0 +1,54 @@
+#ifndef __gpio_h
+#define __gpio_h
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifndef BIT
+#define BIT(nr) (1ULL << (nr))
+#endif
+
+typedef int gpio_num_t;
+
+#define GPIO_NUM_NC -1
+
+typedef enum {
+  GPIO_MODE_DISABLE = 0,
+  GPIO_MODE_INPUT,
+  GPIO_MODE_OUTPUT
+} gpio_mode_t;
+
+typedef enum {
+  GPIO_PULLUP_DISABLE = 0,
+  GPIO_PULLUP_ENABLE
+} gpio_pullup_t;
+
+typedef enum {
+  GPIO_PULLDOWN_DISABLE = 0,
+  GPIO_PULLDOWN_ENABLE
+} gpio_pulldown_t;
+
+typedef enum {
+  GPIO_INTR_DISABLE = 0
+} gpio_int_type_t;
+
+typedef struct {
+  uint64_t pin_bit_mask;
+  gpio_mode_t mode;
+  gpio_pullup_t pull_up_en;
+  gpio_pulldown_t pull_down_en;
+  gpio_int_type_t intr_type;
+} gpio_config_t;
+
+static inline esp_err_t gpio_config(const gpio_config_t* config) {
+  (void) config;
+  return ESP_OK;
+}
+
+static inline esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level) {
+  (void) gpio;
+  (void) level;
+  return ESP_OK;
+}
+
+#endif//__gpio_h
@@ -0,0 +1,212 @@
+#ifndef __rmt_h
+#define __rmt_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+
+typedef int rmt_channel_t;
+
+#define RMT_CHANNEL_MAX 8
+
+typedef enum {
+  RMT_MODE_TX = 0,
+  RMT_MODE_RX
+} rmt_mode_t;
+
+typedef enum {
+  RMT_IDLE_LEVEL_LOW = 0,
+  RMT_IDLE_LEVEL_HIGH
+} rmt_idle_level_t;
+
+typedef struct {
+  bool carrier_en;
+  bool loop_en;
+  rmt_idle_level_t idle_level;
+  bool idle_output_en;
+} rmt_tx_config_t;
+
+typedef struct {
+  rmt_mode_t rmt_mode;
+  rmt_channel_t channel;
+  gpio_num_t gpio_num;
+  uint8_t clk_div;
+  uint8_t mem_block_num;
+  rmt_tx_config_t tx_config;
+} rmt_config_t;
+
+typedef struct {
+  union {
+    struct {
+      uint32_t duration0 : 15;
+      uint32_t level0 : 1;
+      uint32_t duration1 : 15;
+      uint32_t level1 : 1;
+    };
+    uint32_t val;
+  };
+} rmt_item32_t;
+
+typedef void (*rmt_tx_end_fn_t) (rmt_channel_t channel, void* arg);
+
+// Items in one memory block of a channel.
+#define FAKE_RMT_MEM_BLOCK_ITEMS 64
+
+#define FAKE_RMT_MAX_WRITES 2048
+
+#define FAKE_RMT_MAX_ITEMS 131072
+
+// One rmt_write_items call. Items past the memory blocks of the channel are
+// copied by the driver from the buffer of the caller while on air, refills
+// is how many times, changed whether the buffer was written to before the
+// transmission ended. It starts on air at started_us, in esp_timer time,
+// for duration_us.
+typedef struct {
+  rmt_channel_t channel;
+  const rmt_item32_t* buffer;
+  size_t first;
+  int count;
+  int refills;
+  bool changed;
+  int64_t started_us;
+  int64_t duration_us;
+} fake_rmt_write_t;
+
+// The driver of every channel, shared by every module of a test. A
+// transmission stays on air until the test ends it with fake_rmt_end_tx,
+// which calls the registered tx end callback.
+typedef struct {
+  rmt_config_t configs[RMT_CHANNEL_MAX];
+  bool installed[RMT_CHANNEL_MAX];
+  // Write on air per channel, plus one, 0 when idle.
+  size_t on_air[RMT_CHANNEL_MAX];
+  fake_rmt_write_t writes[FAKE_RMT_MAX_WRITES];
+  size_t write_count;
+  rmt_item32_t items[FAKE_RMT_MAX_ITEMS];
+  size_t item_count;
+  rmt_tx_end_fn_t tx_end;
+  void* tx_end_arg;
+} fake_rmt_t;
+
+__attribute__((weak)) fake_rmt_t fake_rmt;
+
+static inline esp_err_t rmt_config(const rmt_config_t* config) {
+  if (config->channel < 0 || config->channel >= RMT_CHANNEL_MAX || config->mem_block_num == 0)
+    return ESP_ERR_INVALID_ARG;
+
+  fake_rmt.configs[config->channel] = *config;
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags) {
+  (void) rx_buf_size;
+  (void) intr_alloc_flags;
+  if (fake_rmt.installed[channel])
+    return ESP_ERR_INVALID_STATE;
+
+  fake_rmt.installed[channel] = true;
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_driver_uninstall(rmt_channel_t channel) {
+  fake_rmt.installed[channel] = false;
+  fake_rmt.on_air[channel] = 0;
+  return ESP_OK;
+}
+
+// Refuses a write while the channel is on air, which the driver would
+// block on.
+static inline esp_err_t rmt_write_items(rmt_channel_t channel, const rmt_item32_t* items, int count, bool wait) {
+  (void) wait;
+  if (!fake_rmt.installed[channel] || fake_rmt.on_air[channel] != 0 || count <= 0)
+    return ESP_ERR_INVALID_STATE;
+  if (fake_rmt.write_count == FAKE_RMT_MAX_WRITES || fake_rmt.item_count + count > FAKE_RMT_MAX_ITEMS)
+    return ESP_ERR_NO_MEM;
+
+  fake_rmt_write_t* write = &fake_rmt.writes[fake_rmt.write_count++];
+  int memory = fake_rmt.configs[channel].mem_block_num * FAKE_RMT_MEM_BLOCK_ITEMS;
+  write->channel = channel;
+  write->buffer = items;
+  write->first = fake_rmt.item_count;
+  write->count = count;
+  // The driver refills half of the memory at a time.
+  write->refills = count > memory ? (count - memory + memory / 2 - 1) / (memory / 2) : 0;
+  write->changed = false;
+  write->started_us = esp_timer_get_time();
+  uint64_t ticks = 0;
+  for (int i = 0; i < count; i++)
+    ticks += items[i].duration0 + items[i].duration1;
+  // Ticks of the 80 MHz clock divided by clk_div.
+  write->duration_us = ticks * fake_rmt.configs[channel].clk_div / 80;
+  memcpy(&fake_rmt.items[fake_rmt.item_count], items, count * sizeof(rmt_item32_t));
+  fake_rmt.item_count += count;
+  fake_rmt.on_air[channel] = fake_rmt.write_count;
+  return ESP_OK;
+}
+
+static inline esp_err_t rmt_tx_stop(rmt_channel_t channel) {
+  fake_rmt.on_air[channel] = 0;
+  return ESP_OK;
+}
+
+static inline void rmt_register_tx_end_callback(rmt_tx_end_fn_t function, void* arg) {
+  fake_rmt.tx_end = function;
+  fake_rmt.tx_end_arg = arg;
+}
+
+// Ends the transmission on air on channel, as the interrupt would.
+static inline void fake_rmt_end_tx(rmt_channel_t channel) {
+  if (fake_rmt.on_air[channel] == 0)
+    return;
+
+  fake_rmt_write_t* write = &fake_rmt.writes[fake_rmt.on_air[channel] - 1];
+  write->changed = memcmp(write->buffer, &fake_rmt.items[write->first], write->count * sizeof(rmt_item32_t)) != 0;
+  fake_rmt.on_air[channel] = 0;
+  if (fake_rmt.tx_end != NULL)
+    fake_rmt.tx_end(channel, fake_rmt.tx_end_arg);
+}
+
+// Forgets the writes logged so far, so that long runs never fill the log.
+// Only while no channel is on air.
+static inline void fake_rmt_clear_log(void) {
+  fake_rmt.write_count = 0;
+  fake_rmt.item_count = 0;
+}
+
+// Channel of the transmission that finishes first, -1 when no channel is
+// on air. end_us is when it finishes, in esp_timer time.
+static inline rmt_channel_t fake_rmt_next(int64_t* end_us) {
+  rmt_channel_t next = -1;
+  for (rmt_channel_t channel = 0; channel < RMT_CHANNEL_MAX; channel++) {
+    if (fake_rmt.on_air[channel] == 0)
+      continue;
+
+    fake_rmt_write_t* write = &fake_rmt.writes[fake_rmt.on_air[channel] - 1];
+    int64_t end = write->started_us + write->duration_us;
+    if (next == -1 || end < *end_us) {
+      next = channel;
+      *end_us = end;
+    }
+  }
+
+  return next;
+}
+
+// Moves the clock to the end of the transmission that finishes first and
+// ends it. Returns its channel, -1 when no channel is on air.
+static inline rmt_channel_t fake_rmt_end_next(void) {
+  int64_t end_us;
+  rmt_channel_t next = fake_rmt_next(&end_us);
+  if (next == -1)
+    return -1;
+
+  if (end_us > fake_time_us)
+    fake_time_us = end_us;
+  fake_rmt_end_tx(next);
+  return next;
+}
+
+#endif//__rmt_h
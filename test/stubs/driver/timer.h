@@ -0,0 +1,108 @@
+#ifndef __timer_h
+#define __timer_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef int timer_group_t;
+
+typedef int timer_idx_t;
+
+typedef enum {
+  TIMER_ALARM_DIS = 0,
+  TIMER_ALARM_EN
+} timer_alarm_t;
+
+typedef enum {
+  TIMER_AUTORELOAD_DIS = 0,
+  TIMER_AUTORELOAD_EN
+} timer_autoreload_t;
+
+typedef enum {
+  TIMER_COUNT_DOWN = 0,
+  TIMER_COUNT_UP
+} timer_count_dir_t;
+
+typedef enum {
+  TIMER_PAUSE = 0,
+  TIMER_START
+} timer_start_t;
+
+typedef struct {
+  timer_alarm_t alarm_en;
+  timer_start_t counter_en;
+  timer_count_dir_t counter_dir;
+  timer_autoreload_t auto_reload;
+  uint32_t divider;
+} timer_config_t;
+
+typedef bool (*timer_isr_t) (void* arg);
+
+static inline esp_err_t timer_init(timer_group_t group, timer_idx_t timer, const timer_config_t* config) {
+  (void) group;
+  (void) timer;
+  (void) config;
+  return ESP_OK;
+}
+
+static inline esp_err_t timer_deinit(timer_group_t group, timer_idx_t timer) {
+  (void) group;
+  (void) timer;
+  return ESP_OK;
+}
+
+static inline esp_err_t timer_isr_callback_add(timer_group_t group, timer_idx_t timer, timer_isr_t isr, void* arg, int flags) {
+  (void) group;
+  (void) timer;
+  (void) isr;
+  (void) arg;
+  (void) flags;
+  return ESP_OK;
+}
+
+static inline esp_err_t timer_isr_callback_remove(timer_group_t group, timer_idx_t timer) {
+  (void) group;
+  (void) timer;
+  return ESP_OK;
+}
+
+static inline esp_err_t timer_set_alarm_value(timer_group_t group, timer_idx_t timer, uint64_t value) {
+  (void) group;
+  (void) timer;
+  (void) value;
+  return ESP_OK;
+}
+
+static inline esp_err_t timer_set_alarm(timer_group_t group, timer_idx_t timer, timer_alarm_t alarm) {
+  (void) group;
+  (void) timer;
+  (void) alarm;
+  return ESP_OK;
+}
+
+static inline esp_err_t timer_start(timer_group_t group, timer_idx_t timer) {
+  (void) group;
+  (void) timer;
+  return ESP_OK;
+}
+
+static inline esp_err_t timer_pause(timer_group_t group, timer_idx_t timer) {
+  (void) group;
+  (void) timer;
+  return ESP_OK;
+}
+
+static inline void timer_group_set_counter_enable_in_isr(timer_group_t group, timer_idx_t timer, timer_start_t enable) {
+  (void) group;
+  (void) timer;
+  (void) enable;
+}
+
+static inline void timer_group_set_alarm_value_in_isr(timer_group_t group, timer_idx_t timer, uint64_t value) {
+  (void) group;
+  (void) timer;
+  (void) value;
+}
+
+#endif//__timer_h
@@ -0,0 +1,7 @@
+#ifndef __esp_attr_h
+#define __esp_attr_h
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif//__esp_attr_h
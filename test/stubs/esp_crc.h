@@ -0,0 +1,17 @@
+#ifndef __esp_crc_h
+#define __esp_crc_h
+
+#include <stdint.h>
+
+// Same result as the ROM CRC-32 of the ESP32, bit by bit.
+static inline uint32_t esp_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+  }
+  return ~crc;
+}
+
+#endif//__esp_crc_h
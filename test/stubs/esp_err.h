@@ -0,0 +1,40 @@
+#ifndef __esp_err_h
+#define __esp_err_h
+
+// Host stand-ins for the ESP-IDF APIs the tested modules use, just enough
+// to run them single threaded in a native test build.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_RESPONSE 0x108
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10a
+
+static inline const char* esp_err_to_name(esp_err_t code) {
+  static char name[16];
+  snprintf(name, sizeof(name), "0x%x", code);
+  return name;
+}
+
+#define ESP_ERROR_CHECK(x) do {                                      \
+  esp_err_t __err = (x);                                             \
+  if (__err != ESP_OK) {                                             \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #x);          \
+    abort();                                                         \
+  }                                                                  \
+} while (0)
+
+#endif//__esp_err_h
@@ -0,0 +1,15 @@
+#ifndef __esp_heap_caps_h
+#define __esp_heap_caps_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+static inline void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  (void) caps;
+  return calloc(n, size);
+}
+
+#endif//__esp_heap_caps_h
@@ -0,0 +1,225 @@
+#ifndef __esp_http_client_h
+#define __esp_http_client_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+
+typedef struct fake_http_client* esp_http_client_handle_t;
+
+typedef enum {
+  HTTP_METHOD_GET = 0,
+  HTTP_METHOD_POST
+} esp_http_client_method_t;
+
+typedef enum {
+  HTTP_EVENT_ERROR = 0,
+  HTTP_EVENT_ON_CONNECTED,
+  HTTP_EVENT_HEADER_SENT,
+  HTTP_EVENT_ON_HEADER,
+  HTTP_EVENT_ON_DATA,
+  HTTP_EVENT_ON_FINISH,
+  HTTP_EVENT_DISCONNECTED
+} esp_http_client_event_id_t;
+
+typedef struct {
+  esp_http_client_event_id_t event_id;
+  esp_http_client_handle_t client;
+  void* data;
+  int data_len;
+  void* user_data;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb) (esp_http_client_event_t* event);
+
+typedef struct {
+  const char* url;
+  esp_http_client_method_t method;
+  http_event_handle_cb event_handler;
+  void* user_data;
+  int timeout_ms;
+} esp_http_client_config_t;
+
+// One server for every client of a test. Requests fail while it is down,
+// and the next failures_left ones, as if it could not be reached. Every
+// request moves the clock by delay_us, answered or not, and by connect_us
+// more when it opens a new connection. A request is answered by answer
+// when set, otherwise with an empty body and status, 200 when 0.
+// drop_connection closes the connection kept alive once, so the next
+// request opens a new one. Requests that reached the server are counted
+// with their body bytes, the content type of the last one is kept.
+#define FAKE_HTTP_RESPONSE_MAX 64
+
+typedef int (*fake_http_answer_t) (const char* content_type, const uint8_t* body, size_t size, uint8_t* response, size_t* response_size);
+
+typedef struct {
+  bool down;
+  uint32_t failures_left;
+  int64_t delay_us;
+  int64_t connect_us;
+  int status;
+  bool drop_connection;
+  fake_http_answer_t answer;
+  uint32_t requests;
+  uint32_t refused;
+  uint32_t connections;
+  uint64_t bytes;
+  char content_type[64];
+} fake_http_t;
+
+static fake_http_t fake_http;
+
+struct fake_http_client {
+  esp_http_client_config_t config;
+  char content_type[64];
+  bool connected;
+  const char* post_field;
+  int post_length;
+  uint8_t* request;
+  size_t request_size;
+  int status;
+  uint8_t response[FAKE_HTTP_RESPONSE_MAX];
+  size_t response_size;
+  size_t response_read;
+};
+
+static inline void fake_http_reset(void) {
+  memset(&fake_http, 0, sizeof(fake_http));
+}
+
+static inline void fake_http_event(esp_http_client_handle_t client, esp_http_client_event_id_t id, void* data, int length) {
+  if (client->config.event_handler == NULL)
+    return;
+
+  esp_http_client_event_t event = { id, client, data, length, client->config.user_data };
+  client->config.event_handler(&event);
+}
+
+// Connects client unless its connection is still alive. False when the
+// server is not reached.
+static inline bool fake_http_connect(esp_http_client_handle_t client) {
+  fake_time_us += fake_http.delay_us;
+  if (fake_http.down || fake_http.failures_left > 0) {
+    if (fake_http.failures_left > 0)
+      fake_http.failures_left--;
+    fake_http.refused++;
+    client->connected = false;
+    fake_http_event(client, HTTP_EVENT_ERROR, NULL, 0);
+    return false;
+  }
+
+  if (fake_http.drop_connection) {
+    fake_http.drop_connection = false;
+    client->connected = false;
+  }
+
+  if (!client->connected) {
+    fake_time_us += fake_http.connect_us;
+    client->connected = true;
+    fake_http.connections++;
+    fake_http_event(client, HTTP_EVENT_ON_CONNECTED, NULL, 0);
+  }
+  return true;
+}
+
+// Has the server answer the request written on client.
+static inline void fake_http_answer(esp_http_client_handle_t client, const uint8_t* body, size_t size) {
+  fake_http.requests++;
+  fake_http.bytes += size;
+  strncpy(fake_http.content_type, client->content_type, sizeof(fake_http.content_type) - 1);
+  client->response_size = 0;
+  client->response_read = 0;
+  if (fake_http.answer != NULL)
+    client->status = fake_http.answer(client->content_type, body, size, client->response, &client->response_size);
+  else
+    client->status = fake_http.status != 0 ? fake_http.status : 200;
+}
+
+static inline esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config) {
+  esp_http_client_handle_t client = calloc(1, sizeof(struct fake_http_client));
+  if (client != NULL)
+    client->config = *config;
+  return client;
+}
+
+static inline esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+  free(client->request);
+  free(client);
+  return ESP_OK;
+}
+
+static inline esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value) {
+  if (strcmp(key, "Content-Type") == 0)
+    strncpy(client->content_type, value, sizeof(client->content_type) - 1);
+  return ESP_OK;
+}
+
+static inline esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int length) {
+  client->post_field = data;
+  client->post_length = length;
+  return ESP_OK;
+}
+
+static inline esp_err_t esp_http_client_perform(esp_http_client_handle_t client) {
+  if (!fake_http_connect(client))
+    return ESP_FAIL;
+
+  const uint8_t* body = (const uint8_t*) client->post_field;
+  fake_http_answer(client, body, client->config.method == HTTP_METHOD_POST ? client->post_length : 0);
+  if (client->response_size > 0)
+    fake_http_event(client, HTTP_EVENT_ON_DATA, client->response, client->response_size);
+  fake_http_event(client, HTTP_EVENT_ON_FINISH, NULL, 0);
+  return ESP_OK;
+}
+
+static inline int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+  return client->status;
+}
+
+static inline int esp_http_client_get_content_length(esp_http_client_handle_t client) {
+  return client->response_size;
+}
+
+static inline bool esp_http_client_is_chunked_response(esp_http_client_handle_t client) {
+  (void) client;
+  return false;
+}
+
+static inline esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+  (void) write_len;
+  client->request_size = 0;
+  return fake_http_connect(client) ? ESP_OK : ESP_FAIL;
+}
+
+static inline int esp_http_client_write(esp_http_client_handle_t client, const char* buffer, int len) {
+  uint8_t* grown = realloc(client->request, client->request_size + len);
+  if (grown == NULL)
+    return -1;
+
+  memcpy(grown + client->request_size, buffer, len);
+  client->request = grown;
+  client->request_size += len;
+  return len;
+}
+
+static inline int esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+  fake_http_answer(client, client->request, client->request_size);
+  return client->response_size;
+}
+
+static inline int esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len) {
+  size_t left = client->response_size - client->response_read;
+  size_t length = (size_t) len < left ? (size_t) len : left;
+  memcpy(buffer, client->response + client->response_read, length);
+  client->response_read += length;
+  return length;
+}
+
+static inline esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+  client->connected = false;
+  return ESP_OK;
+}
+
+#endif//__esp_http_client_h
@@ -0,0 +1,48 @@
+#ifndef __esp_timer_h
+#define __esp_timer_h
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+// The clock only moves when a test sets fake_time_us, the same clock for
+// every module of the test.
+__attribute__((weak)) int64_t fake_time_us;
+
+typedef struct esp_timer* esp_timer_handle_t;
+
+typedef void (*esp_timer_cb_t) (void* arg);
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+static inline int64_t esp_timer_get_time(void) {
+  return fake_time_us;
+}
+
+static inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* timer) {
+  (void) args;
+  *timer = (esp_timer_handle_t) malloc(1);
+  return ESP_OK;
+}
+
+static inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  (void) timer;
+  (void) timeout_us;
+  return ESP_OK;
+}
+
+static inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  (void) timer;
+  return ESP_OK;
+}
+
+static inline esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  free(timer);
+  return ESP_OK;
+}
+
+#endif//__esp_timer_h
@@ -0,0 +1,78 @@
+#ifndef __queue_h
+#define __queue_h
+
+#include "freertos/FreeRTOS.h"
+
+// A plain FIFO of copied items. Nothing ever blocks: a full queue refuses
+// the item and an empty one returns nothing, whatever the wait.
+typedef struct {
+  uint8_t* items;
+  UBaseType_t length;
+  UBaseType_t size;
+  UBaseType_t first;
+  UBaseType_t count;
+} fake_queue_t;
+
+typedef fake_queue_t* QueueHandle_t;
+
+#define queueSEND_TO_BACK 0
+#define queueSEND_TO_FRONT 1
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size) {
+  fake_queue_t* queue = calloc(1, sizeof(fake_queue_t));
+  queue->items = calloc(length > 0 ? length : 1, size > 0 ? size : 1);
+  queue->length = length;
+  queue->size = size;
+  return queue;
+}
+
+static inline void vQueueDelete(QueueHandle_t queue) {
+  free(queue->items);
+  free(queue);
+}
+
+static inline BaseType_t xQueueGenericSend(QueueHandle_t queue, const void* item, TickType_t wait, BaseType_t position) {
+  (void) wait;
+  if (queue->count == queue->length)
+    return pdFALSE;
+
+  UBaseType_t index;
+  if (position == queueSEND_TO_FRONT) {
+    queue->first = (queue->first + queue->length - 1) % queue->length;
+    index = queue->first;
+  }
+  else
+    index = (queue->first + queue->count) % queue->length;
+
+  memcpy(queue->items + index * queue->size, item, queue->size);
+  queue->count++;
+  return pdTRUE;
+}
+
+#define xQueueSend(queue, item, wait) xQueueGenericSend((queue), (item), (wait), queueSEND_TO_BACK)
+#define xQueueSendToBack(queue, item, wait) xQueueGenericSend((queue), (item), (wait), queueSEND_TO_BACK)
+#define xQueueSendToFront(queue, item, wait) xQueueGenericSend((queue), (item), (wait), queueSEND_TO_FRONT)
+
+static inline BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t wait) {
+  (void) wait;
+  if (queue->count == 0)
+    return pdFALSE;
+
+  memcpy(item, queue->items + queue->first * queue->size, queue->size);
+  return pdTRUE;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait) {
+  if (xQueuePeek(queue, item, wait) != pdTRUE)
+    return pdFALSE;
+
+  queue->first = (queue->first + 1) % queue->length;
+  queue->count--;
+  return pdTRUE;
+}
+
+static inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  return queue->count;
+}
+
+#endif//__queue_h
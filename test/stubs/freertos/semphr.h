@@ -0,0 +1,27 @@
+#ifndef __semphr_h
+#define __semphr_h
+
+#include "freertos/queue.h"
+
+typedef void* SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  return malloc(1);
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+  (void) semaphore;
+  (void) wait;
+  return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  (void) semaphore;
+  return pdTRUE;
+}
+
+static inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  free(semaphore);
+}
+
+#endif//__semphr_h
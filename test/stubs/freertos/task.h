@@ -0,0 +1,74 @@
+#ifndef __task_h
+#define __task_h
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+// Tasks are never run: a test drives the code they would call itself.
+typedef void* TaskHandle_t;
+
+// Bits set by notifications to any task, shared by every module of a test.
+__attribute__((weak)) uint32_t fake_task_notified;
+
+typedef void (*TaskFunction_t) (void* data);
+
+typedef enum {
+  eNoAction = 0,
+  eSetBits,
+  eIncrement,
+  eSetValueWithOverwrite,
+  eSetValueWithoutOverwrite
+} eNotifyAction;
+
+static inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack, void* data, UBaseType_t priority, TaskHandle_t* task) {
+  (void) function;
+  (void) name;
+  (void) stack;
+  (void) data;
+  (void) priority;
+  if (task != NULL)
+    *task = malloc(1);
+  return pdPASS;
+}
+
+static inline void vTaskDelete(TaskHandle_t task) {
+  free(task);
+}
+
+static inline BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  (void) task;
+  if (action == eSetBits)
+    fake_task_notified |= value;
+  return pdPASS;
+}
+
+static inline BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t* woken) {
+  (void) woken;
+  return xTaskNotify(task, value, action);
+}
+
+static inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  (void) task;
+  return pdPASS;
+}
+
+static inline BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t* value, TickType_t wait) {
+  (void) clear_on_entry;
+  (void) clear_on_exit;
+  (void) wait;
+  *value = 0;
+  return pdFALSE;
+}
+
+// Nothing else runs meanwhile, the delay only moves the clock.
+static inline void vTaskDelay(TickType_t ticks) {
+  fake_time_us += (int64_t) ticks * portTICK_PERIOD_MS * 1000;
+}
+
+static inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+  (void) clear;
+  (void) wait;
+  return 0;
+}
+
+#endif//__task_h
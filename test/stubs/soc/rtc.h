@@ -0,0 +1,10 @@
+#ifndef __rtc_h
+#define __rtc_h
+
+#include <stdint.h>
+
+static inline uint32_t rtc_clk_apb_freq_get(void) {
+  return 80000000;
+}
+
+#endif//__rtc_h
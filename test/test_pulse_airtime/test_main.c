@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <unity.h>
+#include "pulse_airtime.h"
+
+// 1% duty cycle over a one second window: 10 ms of budget.
+#define DUTY_PERMILLE 10
+#define WINDOW_MS 1000
+#define CAPACITY_US 10000
+
+static pulse_airtime_t airtime;
+
+void setUp(void) {
+  pulse_airtime_init(&airtime, DUTY_PERMILLE, WINDOW_MS, 0);
+}
+
+void tearDown(void) {
+}
+
+static void test_disabled_governor_never_holds_back(void) {
+  pulse_airtime_init(&airtime, 0, WINDOW_MS, 0);
+  pulse_airtime_charge(&airtime, 1000000, 0);
+  TEST_ASSERT_EQUAL_INT64(5, pulse_airtime_ready_at(&airtime, 1000000, 1000000, 5));
+}
+
+static void test_full_bucket_then_waits_for_refill(void) {
+  TEST_ASSERT_EQUAL_INT64(0, pulse_airtime_ready_at(&airtime, 0, CAPACITY_US, 0));
+  pulse_airtime_charge(&airtime, CAPACITY_US, 0);
+  // 1 ms of budget takes 100 ms at 1%.
+  TEST_ASSERT_EQUAL_INT64(100000, pulse_airtime_ready_at(&airtime, 0, 1000, 0));
+  TEST_ASSERT_EQUAL_INT64(100000, pulse_airtime_ready_at(&airtime, 0, 1000, 100000));
+}
+
+static void test_pending_airtime_waits_its_turn(void) {
+  pulse_airtime_charge(&airtime, CAPACITY_US - 2000, 0);
+  TEST_ASSERT_EQUAL_INT64(0, pulse_airtime_ready_at(&airtime, 1000, 1000, 0));
+  TEST_ASSERT_EQUAL_INT64(100000, pulse_airtime_ready_at(&airtime, 2000, 1000, 0));
+}
+
+static void test_train_longer_than_budget_waits_for_full_bucket(void) {
+  pulse_airtime_charge(&airtime, CAPACITY_US, 0);
+  TEST_ASSERT_EQUAL_INT64(WINDOW_MS * 1000, pulse_airtime_ready_at(&airtime, 0, 5 * CAPACITY_US, 0));
+}
+
+// At 1%, checks less than 100 us apart earn less than a microsecond each,
+// which must still add up.
+static void test_frequent_checks_refill_at_duty_cycle(void) {
+  pulse_airtime_charge(&airtime, CAPACITY_US, 0);
+  int64_t now = 0;
+  while (now < 500000) {
+    now += 1 + rand() % 99;
+    pulse_airtime_ready_at(&airtime, 0, 1, now);
+  }
+
+  TEST_ASSERT_EQUAL_INT64(now * DUTY_PERMILLE / 1000, airtime.tokens_us);
+}
+
+// The time returned is when the budget is actually there, never earlier.
+static void test_ready_at_is_exact(void) {
+  srand(14);
+  for (int round = 0; round < 1000; round++) {
+    pulse_airtime_init(&airtime, 1 + rand() % 999, WINDOW_MS, 0);
+    pulse_airtime_charge(&airtime, airtime.capacity_us, 0);
+    int64_t now = rand() % 1000;
+    int64_t needed = 1 + rand() % airtime.capacity_us;
+    int64_t ready = pulse_airtime_ready_at(&airtime, 0, needed, now);
+    TEST_ASSERT_GREATER_OR_EQUAL(now, ready);
+    if (ready > now) {
+      pulse_airtime_t early = airtime;
+      TEST_ASSERT_GREATER_THAN(ready - 1, pulse_airtime_ready_at(&early, 0, needed, ready - 1));
+    }
+    TEST_ASSERT_EQUAL_INT64(ready, pulse_airtime_ready_at(&airtime, 0, needed, ready));
+  }
+}
+
+// Sends trains as soon as they are ready, checking at random short
+// intervals: the transmitter ends up on air at the duty cycle, give or take
+// one window of budget and one train.
+static void test_long_run_stays_at_duty_cycle(void) {
+  srand(10);
+  int64_t now = 0;
+  int64_t sent = 0;
+  while (now < 600 * 1000000LL) {
+    int64_t train = 500 + rand() % 2000;
+    int64_t ready = pulse_airtime_ready_at(&airtime, 0, train, now);
+    while (now < ready) {
+      now += 1 + rand() % 150;
+      pulse_airtime_ready_at(&airtime, 0, train, now);
+    }
+
+    pulse_airtime_charge(&airtime, train, now);
+    sent += train;
+  }
+
+  int64_t allowed = now * DUTY_PERMILLE / 1000 + CAPACITY_US;
+  TEST_ASSERT_LESS_OR_EQUAL(allowed, sent);
+  TEST_ASSERT_GREATER_OR_EQUAL(allowed - CAPACITY_US - 2500, sent);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_disabled_governor_never_holds_back);
+  RUN_TEST(test_full_bucket_then_waits_for_refill);
+  RUN_TEST(test_pending_airtime_waits_its_turn);
+  RUN_TEST(test_train_longer_than_budget_waits_for_full_bucket);
+  RUN_TEST(test_frequent_checks_refill_at_duty_cycle);
+  RUN_TEST(test_ready_at_is_exact);
+  RUN_TEST(test_long_run_stays_at_duty_cycle);
+  return UNITY_END();
+}
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+#include "pulse_backend.h"
+#include "pulse_rmt.h"
+#include "somfy_encoder.c"
+
+#define MAX_CHANNELS 4
+
+#define QUEUE_SIZE 3
+
+// Commands of the workload, each one a DOWN burst.
+#define COMMANDS 48
+
+static const uint8_t frame[SOMFY_FRAME_SIZE] = { 0xA7, 0x4B, 0x16, 0x58, 0x4F, 0x4F, 0x4F };
+
+static pulse_ctl_t* ctl;
+
+static somfy_segments_t segments;
+
+void setUp(void) {
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  fake_time_us = 1000000;
+  const somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_segments_new(&segments, &profile));
+}
+
+void tearDown(void) {
+  somfy_segments_free(&segments);
+}
+
+static void controller_run(void) {
+  while (fake_task_notified != 0) {
+    uint32_t events = fake_task_notified;
+    fake_task_notified = 0;
+    pulse_ctl_handle(ctl, events);
+  }
+}
+
+// A controller with one RMT channel per output. The controller task never
+// runs, the test initializes its channels and plays the events it would
+// receive.
+static void ctl_new(uint8_t count) {
+  pulse_ctl_config_t cfg = {
+    .backend = PULSE_BACKEND_RMT,
+    .max_queue_size = QUEUE_SIZE,
+    .rmt_mem_block_num = 1,
+    .max_segments = 64,
+    .channel_count = count,
+  };
+  for (uint8_t i = 0; i < count; i++)
+    cfg.channels[i].rmt_channel = i;
+  ctl = pulse_ctl_new(&cfg);
+  for (uint8_t i = 0; i < count; i++)
+    TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(&ctl->channels[i]));
+}
+
+static void ctl_free(void) {
+  pulse_ctl_free(ctl);
+  uint32_t events = fake_task_notified;
+  fake_task_notified = 0;
+  TEST_ASSERT_FALSE(pulse_ctl_handle(ctl, events));
+  ctl = NULL;
+}
+
+static uint32_t completed(uint8_t count) {
+  uint32_t trains = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    pulse_channel_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, pulse_ctl_get_channel_stats(ctl, i, &stats));
+    trains += stats.trains;
+  }
+  return trains;
+}
+
+// Plays the workload on count channels, the commands sent to whichever
+// channel frees up first and as many kept waiting as the queues hold.
+// Returns how long it took.
+static int64_t workload_run(uint8_t count) {
+  fake_rmt_clear_log();
+  ctl_new(count);
+  int64_t started = fake_time_us;
+  uint32_t sent = 0;
+  while (completed(count) < COMMANDS) {
+    while (sent < COMMANDS && sent - completed(count) < count * (1 + QUEUE_SIZE)) {
+      pulse_train_handle_t train;
+      TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+      TEST_ASSERT_EQUAL(ESP_OK, somfy_encoder_write(&segments, train, frame));
+      TEST_ASSERT_EQUAL(ESP_OK, pulse_train_send(train));
+      sent++;
+      // The controller task takes the train right away if a channel is
+      // free, as it runs above the senders.
+      controller_run();
+    }
+
+    TEST_ASSERT_TRUE(fake_rmt_end_next() >= 0);
+    controller_run();
+  }
+
+  int64_t elapsed = fake_time_us - started;
+  printf("%d channels: %d commands in %lld ms, %.2f commands/s, per channel", count, COMMANDS,
+    (long long) (elapsed / 1000), COMMANDS * 1e6 / elapsed);
+  for (uint8_t i = 0; i < count; i++) {
+    pulse_channel_stats_t stats;
+    pulse_ctl_get_channel_stats(ctl, i, &stats);
+    printf(" %u trains %u%%", stats.trains, stats.utilization);
+    TEST_ASSERT_EQUAL(COMMANDS / count, stats.trains);
+    TEST_ASSERT_EQUAL(0, stats.queued);
+  }
+  printf("\n");
+  ctl_free();
+  return elapsed;
+}
+
+// Each channel plays its own train, so the workload takes as many times
+// less as there are channels.
+static void test_throughput_scales_with_channels(void) {
+  int64_t single = workload_run(1);
+  for (uint8_t count = 2; count <= MAX_CHANNELS; count *= 2) {
+    int64_t elapsed = workload_run(count);
+    TEST_ASSERT_EQUAL(single / count, elapsed);
+  }
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_throughput_scales_with_channels);
+  return UNITY_END();
+}
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <unity.h>
+#include "pulse_backend.h"
+#include "pulse_i2s.h"
+
+#define MAX_WORDS 4096
+
+static pulse_ctl_handle_t ctl;
+
+void setUp(void) {
+  if (ctl != NULL)
+    return;
+
+  pulse_ctl_config_t cfg = {
+    .backend = PULSE_BACKEND_I2S,
+    .max_queue_size = 1,
+    .max_pulses = 1024,
+  };
+  ctl = pulse_ctl_new(&cfg);
+}
+
+void tearDown(void) {
+}
+
+static pulse_train_t* train_new(void) {
+  pulse_train_handle_t train;
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+  return train;
+}
+
+static size_t render(pulse_train_t* train, uint32_t sample_us, uint16_t* words, size_t chunk) {
+  pulse_i2s_renderer_t renderer;
+  pulse_i2s_renderer_init(&renderer, train, sample_us);
+  size_t count = 0;
+  size_t rendered;
+  while ((rendered = pulse_i2s_render(&renderer, words + count, chunk)) > 0) {
+    count += rendered;
+    TEST_ASSERT_LESS_OR_EQUAL(MAX_WORDS, count);
+  }
+
+  return count;
+}
+
+static bool sample(const uint16_t* words, size_t index) {
+  return (words[index / 16] >> (15 - index % 16)) & 1;
+}
+
+static void test_renders_msb_first_one_bit_per_sample(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_add_pulse(train, 40, PULSE_HIGH);
+  pulse_train_add_pulse(train, 120, PULSE_LOW);
+  pulse_train_add_pulse(train, 80, PULSE_HIGH);
+
+  uint16_t words[MAX_WORDS];
+  TEST_ASSERT_EQUAL(2, render(train, 10, words, MAX_WORDS));
+  TEST_ASSERT_EQUAL_HEX16(0xf000, words[0]);
+  TEST_ASSERT_EQUAL_HEX16(0xff00, words[1]);
+  pulse_train_free(train);
+}
+
+static void test_stops_at_end_of_train_on_word_boundary(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_add_pulse(train, 160, PULSE_HIGH);
+
+  uint16_t words[MAX_WORDS];
+  pulse_i2s_renderer_t renderer;
+  pulse_i2s_renderer_init(&renderer, train, 10);
+  TEST_ASSERT_EQUAL(1, pulse_i2s_render(&renderer, words, MAX_WORDS));
+  TEST_ASSERT_EQUAL_HEX16(0xffff, words[0]);
+  TEST_ASSERT_EQUAL(0, pulse_i2s_render(&renderer, words, MAX_WORDS));
+  pulse_train_free(train);
+}
+
+static void test_drops_pulses_shorter_than_half_a_sample(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_add_pulse(train, 100, PULSE_HIGH);
+  pulse_train_add_pulse(train, 4, PULSE_LOW);
+  pulse_train_add_pulse(train, 100, PULSE_HIGH);
+
+  uint16_t words[MAX_WORDS];
+  TEST_ASSERT_EQUAL(2, render(train, 10, words, MAX_WORDS));
+  TEST_ASSERT_EQUAL_HEX16(0xffff, words[0]);
+  TEST_ASSERT_EQUAL_HEX16(0xf000, words[1]);
+  pulse_train_free(train);
+}
+
+// Every edge lands on the sample nearest to its exact time, however many
+// pulses of a length that is not a whole number of samples come before it.
+static void test_edges_do_not_drift(void) {
+  srand(2);
+  for (int round = 0; round < 50; round++) {
+    pulse_train_t* train = train_new();
+    uint32_t sample_us = 1 + rand() % 20;
+    int count = 1 + rand() % 1000;
+    uint64_t edges[1000];
+    uint64_t time_us = 0;
+    for (int i = 0; i < count; i++) {
+      pulse_duration_t duration = sample_us / 2 + 1 + rand() % (4 * sample_us);
+      pulse_train_add_pulse(train, duration, i % 2 == 0 ? PULSE_HIGH : PULSE_LOW);
+      time_us += duration;
+      edges[i] = (time_us + sample_us / 2) / sample_us;
+    }
+
+    uint16_t words[MAX_WORDS];
+    size_t words_count = render(train, sample_us, words, 1 + rand() % 64);
+    TEST_ASSERT_EQUAL((edges[count - 1] + 15) / 16, words_count);
+    int pulse = 0;
+    for (uint64_t s = 0; s < words_count * 16; s++) {
+      while (pulse < count && s >= edges[pulse])
+        pulse++;
+      bool high = pulse < count && pulse % 2 == 0;
+      TEST_ASSERT_EQUAL(high, sample(words, s));
+    }
+    pulse_train_free(train);
+  }
+}
+
+// Rendering in small buffers gives the same bitstream as in one go.
+static void test_chunked_render_matches_single_render(void) {
+  pulse_train_t* train = train_new();
+  for (int i = 0; i < 200; i++)
+    pulse_train_add_pulse(train, 7 + i % 13, i % 2 == 0 ? PULSE_HIGH : PULSE_LOW);
+
+  uint16_t whole[MAX_WORDS];
+  uint16_t chunked[MAX_WORDS];
+  size_t count = render(train, 3, whole, MAX_WORDS);
+  TEST_ASSERT_EQUAL(count, render(train, 3, chunked, 1));
+  TEST_ASSERT_EQUAL_MEMORY(whole, chunked, count * sizeof(uint16_t));
+  pulse_train_free(train);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_renders_msb_first_one_bit_per_sample);
+  RUN_TEST(test_stops_at_end_of_train_on_word_boundary);
+  RUN_TEST(test_drops_pulses_shorter_than_half_a_sample);
+  RUN_TEST(test_edges_do_not_drift);
+  RUN_TEST(test_chunked_render_matches_single_render);
+  return UNITY_END();
+}
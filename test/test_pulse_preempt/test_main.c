@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+#include "pulse_backend.h"
+#include "pulse_rmt.h"
+#include "somfy_encoder.c"
+
+// STOP pressed at as many moments spread over the DOWN burst.
+#define PRESSES 50
+
+static const uint8_t down[SOMFY_FRAME_SIZE] = { 0xA7, 0x4B, 0x16, 0x58, 0x4F, 0x4F, 0x4F };
+
+static const uint8_t stop[SOMFY_FRAME_SIZE] = { 0xA7, 0x1B, 0x16, 0x59, 0x4F, 0x4F, 0x4F };
+
+static pulse_ctl_t* ctl;
+
+static pulse_channel_t* channel;
+
+static somfy_segments_t segments;
+
+// STOP presses, press to first edge of the STOP and DOWN frames started
+// after the press.
+typedef struct {
+  uint32_t presses;
+  int64_t total_us;
+  int64_t max_us;
+  uint32_t late_frames;
+} stop_latency_t;
+
+void setUp(void) {
+  if (ctl == NULL) {
+    pulse_ctl_config_t cfg = {
+      .backend = PULSE_BACKEND_RMT,
+      .max_queue_size = 3,
+      .rmt_channel = 0,
+      .rmt_mem_block_num = 1,
+      .max_segments = 64,
+    };
+    ctl = pulse_ctl_new(&cfg);
+    const somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_segments_new(&segments, &profile));
+  }
+
+  // The controller task never runs, the tests initialize its channel and
+  // play the events it would receive.
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  fake_time_us = 1000000;
+  channel = &ctl->channels[0];
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(channel));
+}
+
+static void controller_run(void) {
+  while (fake_task_notified != 0) {
+    uint32_t events = fake_task_notified;
+    fake_task_notified = 0;
+    pulse_ctl_handle(ctl, events);
+  }
+}
+
+// Plays the trains on air up to until, when the clock is left.
+static void air_run(int64_t until) {
+  controller_run();
+  int64_t end_us;
+  while (fake_rmt_next(&end_us) >= 0 && end_us <= until) {
+    fake_rmt_end_next();
+    controller_run();
+  }
+
+  fake_time_us = until;
+}
+
+// Plays every train on air and queued to its end.
+static void air_drain(void) {
+  controller_run();
+  while (fake_rmt_end_next() >= 0)
+    controller_run();
+}
+
+void tearDown(void) {
+  air_drain();
+  pulse_backend_rmt.deinit(channel);
+}
+
+static pulse_train_t* send(const uint8_t* frame, pulse_priority_t priority) {
+  pulse_train_handle_t train;
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_encoder_write(&segments, train, frame));
+  pulse_train_set_origin(train, fake_time_us);
+  pulse_train_set_priority(train, priority);
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_train_send(train));
+  controller_run();
+  return train;
+}
+
+// Sends DOWN, then STOP offset_us into it, and plays both to their end.
+static void press(int64_t offset_us, pulse_priority_t priority, stop_latency_t* latency) {
+  fake_rmt_clear_log();
+  send(down, PULSE_PRIORITY_NORMAL);
+  int64_t pressed = fake_time_us + offset_us;
+  air_run(pressed);
+  pulse_train_t* train = send(stop, priority);
+
+  // Every write left of DOWN plays before STOP's first one.
+  while (channel->current != train) {
+    latency->late_frames += fake_rmt.writes[fake_rmt.write_count - 1].started_us > pressed ? 1 : 0;
+    TEST_ASSERT_TRUE(fake_rmt_end_next() >= 0);
+    controller_run();
+  }
+
+  // STOP starts once the frame on air when pressed is over, never within.
+  fake_rmt_write_t* first = &fake_rmt.writes[fake_rmt.write_count - 1];
+  TEST_ASSERT_EQUAL(first[-1].started_us + first[-1].duration_us, first->started_us);
+  int64_t delay = first->started_us - pressed;
+  latency->presses++;
+  latency->total_us += delay;
+  latency->max_us = delay > latency->max_us ? delay : latency->max_us;
+
+  pulse_ctl_stats_t stats;
+  pulse_ctl_get_stats(ctl, &stats);
+  TEST_ASSERT_EQUAL(delay, stats.last_start_latency_us);
+  air_drain();
+}
+
+// Time on air of every write of the log.
+static int64_t logged_airtime(void) {
+  int64_t airtime = 0;
+  for (size_t i = 0; i < fake_rmt.write_count; i++)
+    airtime += fake_rmt.writes[i].duration_us;
+  return airtime;
+}
+
+// Plays DOWN alone: its whole airtime, and its longest write, as the
+// longest STOP may wait for when urgent.
+static void measure_down(int64_t* burst_us, int64_t* frame_us) {
+  fake_rmt_clear_log();
+  send(down, PULSE_PRIORITY_NORMAL);
+  air_drain();
+  *burst_us = logged_airtime();
+  *frame_us = 0;
+  for (size_t i = 0; i < fake_rmt.write_count; i++)
+    *frame_us = fake_rmt.writes[i].duration_us > *frame_us ? fake_rmt.writes[i].duration_us : *frame_us;
+}
+
+static void run_presses(pulse_priority_t priority, int64_t burst_us, stop_latency_t* latency) {
+  memset(latency, 0, sizeof(stop_latency_t));
+  for (int i = 0; i < PRESSES; i++)
+    press(burst_us * i / PRESSES, priority, latency);
+}
+
+static void print_latency(const char* name, stop_latency_t* latency) {
+  printf("  %s: STOP first edge %lld us mean and %lld us max after press, %u DOWN frames started after it\n",
+    name, (long long) (latency->total_us / latency->presses), (long long) latency->max_us, latency->late_frames);
+}
+
+// STOP cuts DOWN short after the frame on air, instead of waiting for the
+// whole burst behind it.
+static void test_stop_latency_against_queued_stop(void) {
+  int64_t burst_us, frame_us;
+  measure_down(&burst_us, &frame_us);
+  stop_latency_t queued, urgent;
+  run_presses(PULSE_PRIORITY_NORMAL, burst_us, &queued);
+  pulse_ctl_stats_t stats;
+  pulse_ctl_get_stats(ctl, &stats);
+  uint32_t preempted = stats.trains_preempted;
+  run_presses(PULSE_PRIORITY_URGENT, burst_us, &urgent);
+  pulse_ctl_get_stats(ctl, &stats);
+
+  printf("DOWN burst of %lld us, longest frame %lld us, STOP pressed %d times over it:\n",
+    (long long) burst_us, (long long) frame_us, PRESSES);
+  print_latency("queued", &queued);
+  print_latency("urgent", &urgent);
+  TEST_ASSERT_EQUAL(PRESSES, stats.trains_preempted - preempted);
+  TEST_ASSERT_EQUAL(0, urgent.late_frames);
+  TEST_ASSERT_TRUE(urgent.max_us <= frame_us);
+  TEST_ASSERT_LESS_THAN(queued.total_us / 2, urgent.total_us);
+
+  // Every train was freed, preempted ones included.
+  TEST_ASSERT_EQUAL(0, stats.pool_in_use);
+}
+
+// A preempted DOWN is charged only for the frames it sent.
+static void test_preempted_burst_charged_for_its_airtime(void) {
+  int64_t burst_us, frame_us;
+  measure_down(&burst_us, &frame_us);
+  pulse_ctl_stats_t before, after;
+  pulse_ctl_get_stats(ctl, &before);
+  fake_rmt_clear_log();
+  stop_latency_t latency = { 0 };
+  press(burst_us / 3, PULSE_PRIORITY_URGENT, &latency);
+  pulse_ctl_get_stats(ctl, &after);
+  printf("Airtime charged for DOWN preempted a third in, then STOP: %lld us, %lld us on air.\n",
+    (long long) (after.airtime_us - before.airtime_us), (long long) logged_airtime());
+  TEST_ASSERT_EQUAL(logged_airtime(), after.airtime_us - before.airtime_us);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_stop_latency_against_queued_stop);
+  RUN_TEST(test_preempted_burst_charged_for_its_airtime);
+  return UNITY_END();
+}
@@ -0,0 +1,340 @@
+#include <stdlib.h>
+#include <unity.h>
+#include "pulse_rmt.h"
+
+static pulse_ctl_handle_t ctl;
+
+static pulse_channel_t* channel;
+
+void setUp(void) {
+  if (ctl == NULL) {
+    pulse_ctl_config_t cfg = {
+      .backend = PULSE_BACKEND_RMT,
+      .max_queue_size = 1,
+      .max_pulses = 512,
+      .rmt_channel = 2,
+    };
+    ctl = pulse_ctl_new(&cfg);
+  }
+
+  // The controller task never runs, the tests initialize the channel it
+  // would and play the events it would receive.
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  channel = &((pulse_ctl_t*) ctl)->channels[0];
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(channel));
+}
+
+void tearDown(void) {
+  pulse_backend_rmt.deinit(channel);
+  channel->current = NULL;
+}
+
+static pulse_train_t* train_new(void) {
+  pulse_train_handle_t train;
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+  return train;
+}
+
+static size_t encode(pulse_train_t* train, rmt_item32_t* items, size_t capacity) {
+  pulse_rmt_encoder_t encoder;
+  pulse_rmt_encoder_init(&encoder, items, capacity);
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_rmt_encode(train, &encoder));
+  return encoder.count;
+}
+
+static void test_pairs_pulses_and_ends_odd_count_in_last_item(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_add_pulse(train, 100, PULSE_HIGH);
+  pulse_train_add_pulse(train, 200, PULSE_LOW);
+  pulse_train_add_pulse(train, 300, PULSE_HIGH);
+
+  rmt_item32_t items[4];
+  TEST_ASSERT_EQUAL(2, encode(train, items, 4));
+  TEST_ASSERT_EQUAL(100, items[0].duration0);
+  TEST_ASSERT_EQUAL(1, items[0].level0);
+  TEST_ASSERT_EQUAL(200, items[0].duration1);
+  TEST_ASSERT_EQUAL(0, items[0].level1);
+  TEST_ASSERT_EQUAL(300, items[1].duration0);
+  TEST_ASSERT_EQUAL(1, items[1].level0);
+  TEST_ASSERT_EQUAL(0, items[1].duration1);
+  pulse_train_free(train);
+}
+
+static void test_appends_end_marker_after_full_item(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_add_pulse(train, 100, PULSE_HIGH);
+  pulse_train_add_pulse(train, 200, PULSE_LOW);
+
+  rmt_item32_t items[4];
+  TEST_ASSERT_EQUAL(2, encode(train, items, 4));
+  TEST_ASSERT_EQUAL(200, items[0].duration1);
+  TEST_ASSERT_EQUAL_UINT32(0, items[1].val);
+  pulse_train_free(train);
+}
+
+static void test_splits_long_pulses_at_same_level(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_add_pulse(train, 2 * PULSE_RMT_MAX_DURATION + 5, PULSE_HIGH);
+  pulse_train_add_pulse(train, 10, PULSE_LOW);
+
+  rmt_item32_t items[4];
+  TEST_ASSERT_EQUAL(3, encode(train, items, 4));
+  TEST_ASSERT_EQUAL(PULSE_RMT_MAX_DURATION, items[0].duration0);
+  TEST_ASSERT_EQUAL(PULSE_RMT_MAX_DURATION, items[0].duration1);
+  TEST_ASSERT_EQUAL(5, items[1].duration0);
+  TEST_ASSERT_EQUAL(1, items[0].level0);
+  TEST_ASSERT_EQUAL(1, items[0].level1);
+  TEST_ASSERT_EQUAL(1, items[1].level0);
+  TEST_ASSERT_EQUAL(10, items[1].duration1);
+  TEST_ASSERT_EQUAL(0, items[1].level1);
+  TEST_ASSERT_EQUAL_UINT32(0, items[2].val);
+  pulse_train_free(train);
+}
+
+static void test_split_pulse_of_exact_multiple_leaves_no_empty_half(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_add_pulse(train, PULSE_RMT_MAX_DURATION, PULSE_HIGH);
+  pulse_train_add_pulse(train, 2 * PULSE_RMT_MAX_DURATION, PULSE_LOW);
+
+  rmt_item32_t items[4];
+  TEST_ASSERT_EQUAL(pulse_rmt_items_needed(train), encode(train, items, 4));
+  TEST_ASSERT_EQUAL(PULSE_RMT_MAX_DURATION, items[0].duration1);
+  TEST_ASSERT_EQUAL(PULSE_RMT_MAX_DURATION, items[1].duration0);
+  TEST_ASSERT_EQUAL(0, items[1].level0);
+  TEST_ASSERT_EQUAL(0, items[1].duration1);
+  pulse_train_free(train);
+}
+
+static void test_encoder_refuses_to_overflow(void) {
+  rmt_item32_t items[2];
+  pulse_rmt_encoder_t encoder;
+  pulse_rmt_encoder_init(&encoder, items, 2);
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_rmt_encoder_add(&encoder, 3 * PULSE_RMT_MAX_DURATION, PULSE_HIGH));
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_rmt_encoder_add(&encoder, 1, PULSE_LOW));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, pulse_rmt_encoder_end(&encoder));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, pulse_rmt_encoder_add(&encoder, 1, PULSE_HIGH));
+}
+
+// Whatever the pulse lengths, the items needed are exactly those encoded,
+// and counting them leaves the train where it was.
+static void test_items_needed_matches_encoding(void) {
+  srand(1);
+  rmt_item32_t items[1024];
+  for (int round = 0; round < 200; round++) {
+    pulse_train_t* train = train_new();
+    int count = 1 + rand() % 64;
+    for (int i = 0; i < count; i++) {
+      pulse_duration_t duration = rand() % 4 == 0 ? 1 + rand() % (5 * PULSE_RMT_MAX_DURATION) : 1 + rand() % 2000;
+      pulse_train_add_pulse(train, duration, i % 2 == 0 ? PULSE_HIGH : PULSE_LOW);
+    }
+
+    size_t needed = pulse_rmt_items_needed(train);
+    TEST_ASSERT_EQUAL(0, train->cursor.entry);
+    TEST_ASSERT_EQUAL(0, train->cursor.next);
+    TEST_ASSERT_LESS_OR_EQUAL(1024, needed);
+    TEST_ASSERT_EQUAL(needed, encode(train, items, needed));
+    pulse_train_free(train);
+  }
+}
+
+// A split train is encoded one pass at a time, up to its next boundary.
+static void test_items_needed_stops_at_boundary_of_split_train(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_add_pulse(train, 100, PULSE_HIGH);
+  pulse_train_add_pulse(train, 100, PULSE_LOW);
+  pulse_train_add_pulse(train, 100, PULSE_HIGH);
+  pulse_train_add_boundary(train);
+  for (int i = 0; i < 6; i++)
+    pulse_train_add_pulse(train, 100, i % 2 == 0 ? PULSE_HIGH : PULSE_LOW);
+  train->split = true;
+
+  rmt_item32_t items[8];
+  TEST_ASSERT_EQUAL(2, pulse_rmt_items_needed(train));
+  TEST_ASSERT_EQUAL(2, encode(train, items, 8));
+  TEST_ASSERT_FALSE(train->cursor.finished);
+  TEST_ASSERT_EQUAL(4, pulse_rmt_items_needed(train));
+  TEST_ASSERT_EQUAL(4, encode(train, items, 8));
+  TEST_ASSERT_TRUE(train->cursor.finished);
+  pulse_train_free(train);
+}
+
+// Starts train on the channel, as the controller task does.
+static void start(pulse_train_t* train) {
+  train->split = pulse_backend_rmt.split;
+  pulse_train_rewind(train);
+  channel->current = train;
+  pulse_backend_rmt.start(channel);
+}
+
+// A frame of count pulses of duration, from high, after a boundary.
+static void add_frame(pulse_train_t* train, int count, pulse_duration_t duration) {
+  pulse_train_add_boundary(train);
+  for (int i = 0; i < count; i++)
+    TEST_ASSERT_EQUAL(ESP_OK, pulse_train_add_pulse(train, duration, i % 2 == 0 ? PULSE_HIGH : PULSE_LOW));
+}
+
+// Items of the last write, which must hold count pulses of duration and
+// the end marker.
+static void assert_written(size_t write, int count, pulse_duration_t duration) {
+  TEST_ASSERT_EQUAL(write + 1, fake_rmt.write_count);
+  fake_rmt_write_t* written = &fake_rmt.writes[write];
+  TEST_ASSERT_EQUAL(2, written->channel);
+  TEST_ASSERT_EQUAL(count / 2 + 1, written->count);
+  rmt_item32_t* items = &fake_rmt.items[written->first];
+  for (int i = 0; i < count / 2; i++) {
+    TEST_ASSERT_EQUAL(duration, items[i].duration0);
+    TEST_ASSERT_EQUAL(1, items[i].level0);
+    TEST_ASSERT_EQUAL(duration, items[i].duration1);
+    TEST_ASSERT_EQUAL(0, items[i].level1);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, items[count / 2].val);
+}
+
+static void test_init_configures_rmt_channel(void) {
+  rmt_config_t* config = &fake_rmt.configs[2];
+  TEST_ASSERT_TRUE(fake_rmt.installed[2]);
+  TEST_ASSERT_EQUAL(RMT_MODE_TX, config->rmt_mode);
+  TEST_ASSERT_EQUAL(80, config->clk_div);
+  TEST_ASSERT_EQUAL(1, config->mem_block_num);
+  TEST_ASSERT_EQUAL(RMT_IDLE_LEVEL_LOW, config->tx_config.idle_level);
+  TEST_ASSERT_TRUE(config->tx_config.idle_output_en);
+  TEST_ASSERT_NOT_NULL(fake_rmt.tx_end);
+
+  // An RMT channel has a single owner.
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, pulse_backend_rmt.init(channel));
+}
+
+static void test_train_done_when_its_only_pass_ends(void) {
+  pulse_train_t* train = train_new();
+  add_frame(train, 4, 100);
+  start(train);
+  assert_written(0, 4, 100);
+  TEST_ASSERT_EQUAL_UINT32(0, fake_task_notified);
+
+  fake_rmt_end_tx(2);
+  TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_TRAIN_DONE(0), fake_task_notified);
+  pulse_train_free(train);
+}
+
+// Each frame is its own write, the next one only once the RMT reports the
+// previous one done, and only the last one ends the train.
+static void test_frames_go_out_one_pass_each(void) {
+  pulse_train_t* train = train_new();
+  for (int frame = 0; frame < 3; frame++)
+    add_frame(train, 6, 100 * (frame + 1));
+  start(train);
+
+  for (int frame = 0; frame < 3; frame++) {
+    assert_written(frame, 6, 100 * (frame + 1));
+    TEST_ASSERT_EQUAL_UINT32(0, fake_task_notified);
+    fake_rmt_end_tx(2);
+    if (frame < 2) {
+      TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_PASS_DONE(0), fake_task_notified);
+      fake_task_notified = 0;
+      pulse_backend_rmt.resume(channel);
+    }
+  }
+
+  TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_TRAIN_DONE(0), fake_task_notified);
+  pulse_train_free(train);
+}
+
+// Passes longer than the channel memory are refilled by the driver from the
+// item buffer while on air, which must not change until the pass ends, even
+// when the next pass needs a larger one.
+static void test_long_passes_refill_from_an_intact_buffer(void) {
+  pulse_train_t* train = train_new();
+  add_frame(train, 200, 100);
+  add_frame(train, 300, 200);
+  start(train);
+
+  assert_written(0, 200, 100);
+  TEST_ASSERT_EQUAL(2, fake_rmt.writes[0].refills);
+  fake_rmt_end_tx(2);
+  TEST_ASSERT_FALSE(fake_rmt.writes[0].changed);
+
+  pulse_backend_rmt.resume(channel);
+  assert_written(1, 300, 200);
+  TEST_ASSERT_EQUAL(3, fake_rmt.writes[1].refills);
+  fake_rmt_end_tx(2);
+  TEST_ASSERT_FALSE(fake_rmt.writes[1].changed);
+  TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_PASS_DONE(0) | PULSE_EVENT_TRAIN_DONE(0), fake_task_notified);
+  pulse_train_free(train);
+}
+
+// A train preempted while a frame is on air ends at the next boundary,
+// without writing anything more.
+static void test_preempted_train_ends_after_the_frame_on_air(void) {
+  pulse_train_t* train = train_new();
+  for (int frame = 0; frame < 3; frame++)
+    add_frame(train, 6, 100);
+  start(train);
+  train->preempted = true;
+
+  fake_rmt_end_tx(2);
+  TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_PASS_DONE(0), fake_task_notified);
+  fake_task_notified = 0;
+  pulse_backend_rmt.resume(channel);
+  TEST_ASSERT_EQUAL(1, fake_rmt.write_count);
+  TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_TRAIN_DONE(0), fake_task_notified);
+  pulse_train_free(train);
+}
+
+// Cancelling the loop of another tag leaves a held train looping, its own
+// tag ends it. The iteration already written when the loop is cancelled
+// still goes out.
+static void test_loop_ends_when_its_tag_is_cancelled(void) {
+  pulse_train_t* train = train_new();
+  pulse_train_t* other = train_new();
+  pulse_train_set_tag(train, 7);
+  pulse_train_set_tag(other, 8);
+  pulse_train_loop_begin(train);
+  add_frame(train, 4, 100);
+  pulse_train_loop_end(train, PULSE_LOOP_FOREVER);
+  start(train);
+
+  for (int pass = 0; pass < 3; pass++) {
+    fake_rmt_end_tx(2);
+    TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_PASS_DONE(0), fake_task_notified);
+    fake_task_notified = 0;
+    pulse_backend_rmt.resume(channel);
+  }
+
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_ctl_cancel_loop(ctl, 8));
+  TEST_ASSERT_TRUE(other->loop_cancelled);
+  fake_rmt_end_tx(2);
+  TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_PASS_DONE(0), fake_task_notified);
+  fake_task_notified = 0;
+  pulse_backend_rmt.resume(channel);
+  TEST_ASSERT_EQUAL(5, fake_rmt.write_count);
+
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_ctl_cancel_loop(ctl, 7));
+  fake_rmt_end_tx(2);
+  TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_PASS_DONE(0), fake_task_notified);
+  fake_task_notified = 0;
+  pulse_backend_rmt.resume(channel);
+  fake_rmt_end_tx(2);
+  TEST_ASSERT_EQUAL(6, fake_rmt.write_count);
+  TEST_ASSERT_EQUAL_HEX32(PULSE_EVENT_TRAIN_DONE(0), fake_task_notified);
+  pulse_train_free(train);
+  pulse_train_free(other);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_pairs_pulses_and_ends_odd_count_in_last_item);
+  RUN_TEST(test_appends_end_marker_after_full_item);
+  RUN_TEST(test_splits_long_pulses_at_same_level);
+  RUN_TEST(test_split_pulse_of_exact_multiple_leaves_no_empty_half);
+  RUN_TEST(test_encoder_refuses_to_overflow);
+  RUN_TEST(test_items_needed_matches_encoding);
+  RUN_TEST(test_items_needed_stops_at_boundary_of_split_train);
+  RUN_TEST(test_init_configures_rmt_channel);
+  RUN_TEST(test_train_done_when_its_only_pass_ends);
+  RUN_TEST(test_frames_go_out_one_pass_each);
+  RUN_TEST(test_long_passes_refill_from_an_intact_buffer);
+  RUN_TEST(test_preempted_train_ends_after_the_frame_on_air);
+  RUN_TEST(test_loop_ends_when_its_tag_is_cancelled);
+  return UNITY_END();
+}
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+#include "pulse_backend.h"
+#include "pulse_rmt.h"
+#include "somfy_encoder.c"
+
+#define MAX_BURST 8
+
+// Idle time between bursts, a minute.
+#define IDLE_US (60 * 1000000LL)
+
+static const uint8_t frame[SOMFY_FRAME_SIZE] = { 0xA7, 0x4B, 0x16, 0x58, 0x4F, 0x4F, 0x4F };
+
+static pulse_ctl_t* ctl;
+
+static pulse_channel_t* channel;
+
+static somfy_segments_t segments;
+
+void setUp(void) {
+  if (ctl == NULL) {
+    pulse_ctl_config_t cfg = {
+      .backend = PULSE_BACKEND_RMT,
+      .max_queue_size = MAX_BURST,
+      .rmt_channel = 0,
+      .rmt_mem_block_num = 1,
+      .max_segments = 64,
+    };
+    ctl = pulse_ctl_new(&cfg);
+    const somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_segments_new(&segments, &profile));
+  }
+
+  // The controller task never runs, the tests initialize its channel and
+  // play the events it would receive: it wakes up once per batch of them.
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  fake_time_us = 1000000;
+  channel = &ctl->channels[0];
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(channel));
+}
+
+void tearDown(void) {
+  pulse_backend_rmt.deinit(channel);
+}
+
+static void controller_run(void) {
+  while (fake_task_notified != 0) {
+    uint32_t events = fake_task_notified;
+    fake_task_notified = 0;
+    pulse_ctl_handle(ctl, events);
+  }
+}
+
+static uint32_t wakeups(void) {
+  pulse_ctl_stats_t stats;
+  pulse_ctl_get_stats(ctl, &stats);
+  return stats.task_wakeups;
+}
+
+// Queues count commands at once, before the controller task gets to run,
+// and plays them. started_us is when each one started after being queued.
+static void burst(int count, int64_t* started_us) {
+  fake_rmt_clear_log();
+  int64_t queued = fake_time_us;
+  pulse_train_t* trains[MAX_BURST];
+  for (int i = 0; i < count; i++) {
+    pulse_train_handle_t train;
+    TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_encoder_write(&segments, train, frame));
+    pulse_train_set_origin(train, queued);
+    TEST_ASSERT_EQUAL(ESP_OK, pulse_train_send(train));
+    trains[i] = train;
+  }
+
+  int next = 0;
+  controller_run();
+  do {
+    if (next < count && channel->current == trains[next])
+      started_us[next++] = fake_rmt.writes[fake_rmt.write_count - 1].started_us - queued;
+    if (fake_rmt_end_next() >= 0)
+      controller_run();
+  } while (channel->current != NULL);
+  TEST_ASSERT_EQUAL(count, next);
+}
+
+// The task wakes up for nothing but the work queued and the passes ending:
+// once for the burst, then once per RMT write. Each command starts as soon
+// as the one before it ends.
+static void test_wakeups_and_start_latency_per_burst(void) {
+  for (int count = 1; count <= MAX_BURST; count *= 2) {
+    int64_t started_us[MAX_BURST];
+    uint32_t before = wakeups();
+    burst(count, started_us);
+    uint32_t woken = wakeups() - before;
+    printf("Burst of %d: %u wake-ups for %u RMT writes, queued to start", count, woken, (unsigned) fake_rmt.write_count);
+    for (int i = 0; i < count; i++)
+      printf(" %lld", (long long) started_us[i]);
+    printf(" us\n");
+
+    TEST_ASSERT_EQUAL(1 + fake_rmt.write_count, woken);
+    TEST_ASSERT_EQUAL(0, started_us[0]);
+    fake_rmt_write_t* last = &fake_rmt.writes[fake_rmt.write_count - 1];
+    int64_t command_us = (last->started_us + last->duration_us - fake_rmt.writes[0].started_us) / count;
+    for (int i = 1; i < count; i++)
+      TEST_ASSERT_EQUAL(i * command_us, started_us[i]);
+  }
+}
+
+// Nothing wakes the task up while nothing is queued or on air.
+static void test_no_wakeup_while_idle(void) {
+  int64_t started_us[1];
+  burst(1, started_us);
+  uint32_t before = wakeups();
+  fake_time_us += IDLE_US;
+  controller_run();
+  printf("Idle for %lld s: %u wake-ups.\n", (long long) (IDLE_US / 1000000), wakeups() - before);
+  TEST_ASSERT_EQUAL(0, fake_task_notified);
+  TEST_ASSERT_EQUAL(before, wakeups());
+
+  // The next command starts at once.
+  burst(1, started_us);
+  TEST_ASSERT_EQUAL(0, started_us[0]);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_wakeups_and_start_latency_per_burst);
+  RUN_TEST(test_no_wakeup_while_idle);
+  return UNITY_END();
+}
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#define TAG somfy_config_nvs_tag
+#include "somfy_config_nvs.c"
+#undef TAG
+#define TAG somfy_config_http_tag
+#include "somfy_config_http.c"
+#undef TAG
+#include "somfy_remote_table.c"
+
+#define REMOTE(n) (0x100000 + (n))
+
+#define URL "http://config.test/config"
+
+// Opening a connection, and a request on an open one.
+#define CONNECT_US 30000
+
+#define REQUEST_US 20000
+
+// Code changes replicated one at a time.
+#define UPDATES 100
+
+static const size_t sizes[] = { 1, 8, 32 };
+
+static somfy_config_handle_t config;
+
+static somfy_config_replicator_t * replicator;
+
+static uint32_t backoff_ms;
+
+void setUp(void) {
+    fake_http_reset();
+    fake_time_us = 1000000;
+    fake_http.connect_us = CONNECT_US;
+    fake_http.delay_us = REQUEST_US;
+    backoff_ms = 0;
+    config = NULL;
+    replicator = NULL;
+}
+
+void tearDown(void) {
+    if (replicator != NULL)
+        somfy_config_replicator_free(replicator);
+    if (config != NULL)
+        somfy_config_free(config);
+    replicator = NULL;
+    config = NULL;
+}
+
+// A config of count named remotes and its replicator, which has posted the
+// whole config once.
+static void config_new(size_t count) {
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&config));
+    for (size_t n = 0; n < count; n++) {
+        char name[24];
+        snprintf(name, sizeof(name), "Bedroom blind %u", (unsigned) n);
+        somfy_config_remote_handle_t remote;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(name, REMOTE(n), 0, &remote));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+    }
+
+    somfy_config_replicator_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_replicator_new(config, URL, &handle));
+    replicator = handle;
+    // The replication task never runs, the test plays its wake-ups.
+    TEST_ASSERT_TRUE(somfy_config_replicator_run(replicator, &backoff_ms));
+}
+
+// Reserves a new block for remote and replicates the change. Returns the
+// bytes of the post.
+static uint64_t update(somfy_remote_t remote) {
+    somfy_config_reserve_t reserved = SOMFY_CONFIG_RESERVE_NONE;
+    while (reserved == SOMFY_CONFIG_RESERVE_NONE)
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(config, remote, NULL, &reserved));
+
+    uint64_t bytes = fake_http.bytes;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_replicator_mark(replicator, remote));
+    TEST_ASSERT_TRUE(somfy_config_replicator_run(replicator, &backoff_ms));
+    return fake_http.bytes - bytes;
+}
+
+// A change goes as one record whatever the size of the config, where the
+// whole config was posted each time before.
+static void test_delta_bytes_against_snapshot(void) {
+    printf("Bytes on the wire per code change:\n");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        config_new(sizes[i]);
+        uint64_t snapshot = fake_http.bytes;
+        uint64_t delta = update(REMOTE(0));
+        printf("  %2u remotes: %u bytes as a delta, %u bytes as a snapshot\n", (unsigned) sizes[i],
+            (unsigned) delta, (unsigned) snapshot);
+
+        somfy_config_blob_handle_t blob;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(config, &blob));
+        TEST_ASSERT_EQUAL(((somfy_config_blob_t *) blob)->size, snapshot);
+        somfy_config_blob_free(blob);
+        TEST_ASSERT_EQUAL(1 + SOMFY_CONFIG_DELTA_RECORD_SIZE, delta);
+        tearDown();
+        setUp();
+    }
+}
+
+// Updates share a single connection, only the first one opens it. Posting
+// the whole config on a connection of its own, as before, pays for a new
+// connection and the whole config every time.
+static void test_update_latency_with_keep_alive(void) {
+    config_new(8);
+    uint32_t connections = fake_http.connections;
+    int64_t total = 0, max = 0;
+    for (int i = 0; i < UPDATES; i++) {
+        update(REMOTE(i % 8));
+        somfy_config_replicator_stats_t stats;
+        somfy_config_replicator_get_stats(replicator, &stats);
+        total += stats.last_latency_us;
+        max = stats.last_latency_us > max ? stats.last_latency_us : max;
+    }
+    uint32_t kept = fake_http.connections - connections;
+
+    connections = fake_http.connections;
+    int64_t started = fake_time_us;
+    for (int i = 0; i < UPDATES; i++) {
+        somfy_config_blob_handle_t blob;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(config, &blob));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_blob_http_write(blob, URL));
+        somfy_config_blob_free(blob);
+    }
+    int64_t whole = fake_time_us - started;
+    uint32_t opened = fake_http.connections - connections;
+
+    printf("%d updates: %lld us mean and %lld us max over %u connection as deltas, "
+        "%lld us mean over %u connections as whole configs.\n", UPDATES, (long long) (total / UPDATES),
+        (long long) max, kept, (long long) (whole / UPDATES), opened);
+    TEST_ASSERT_EQUAL_UINT32(1, kept);
+    TEST_ASSERT_EQUAL(CONNECT_US + REQUEST_US, max);
+    TEST_ASSERT_EQUAL(CONNECT_US + UPDATES * REQUEST_US, total);
+    TEST_ASSERT_EQUAL_UINT32(UPDATES, opened);
+    TEST_ASSERT_EQUAL(UPDATES * (CONNECT_US + REQUEST_US), whole);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_delta_bytes_against_snapshot);
+    RUN_TEST(test_update_latency_with_keep_alive);
+    return UNITY_END();
+}
@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+
+// Every allocation of the config modules goes through these, which keep
+// the size in front of the block to track the heap in use.
+typedef struct {
+    uint32_t allocations;
+    uint32_t blocks;
+    size_t in_use;
+    size_t peak;
+} heap_t;
+
+static heap_t heap;
+
+static void * heap_track(size_t * block, size_t size) {
+    if (block == NULL)
+        return NULL;
+
+    *block = size;
+    heap.allocations++;
+    heap.blocks++;
+    heap.in_use += size;
+    heap.peak = heap.in_use > heap.peak ? heap.in_use : heap.peak;
+    return block + 2;
+}
+
+static void * heap_malloc(size_t size) {
+    return heap_track(malloc(size + 2 * sizeof(size_t)), size);
+}
+
+static void * heap_calloc(size_t count, size_t size) {
+    return heap_track(calloc(1, count * size + 2 * sizeof(size_t)), count * size);
+}
+
+static void heap_free(void * data) {
+    if (data == NULL)
+        return;
+
+    size_t * block = (size_t *) data - 2;
+    heap.blocks--;
+    heap.in_use -= *block;
+    free(block);
+}
+
+static void * heap_realloc(void * data, size_t size) {
+    if (data == NULL)
+        return heap_malloc(size);
+
+    size_t * block = (size_t *) data - 2;
+    size_t old = *block;
+    block = realloc(block, size + 2 * sizeof(size_t));
+    if (block == NULL)
+        return NULL;
+
+    heap.blocks--;
+    heap.in_use -= old;
+    return heap_track(block, size);
+}
+
+#define malloc heap_malloc
+#define calloc heap_calloc
+#define realloc heap_realloc
+#define free heap_free
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#include "somfy_remote_table.c"
+
+#define REMOTES 1000
+
+#define REMOTE(n) (0x100000 + 7 * (n))
+
+// Loads timed per format, the median is kept.
+#define RUNS 51
+
+// Heap used by the loads of a blob, and their host time.
+typedef struct {
+    uint32_t allocations;
+    size_t peak;
+    size_t kept;
+    uint32_t blocks;
+    double ns[RUNS];
+} load_t;
+
+static somfy_config_blob_handle_t v1, v2;
+
+static void remote_name(char * name, size_t size, int n) {
+    snprintf(name, size, "Bedroom blind %d", n);
+}
+
+// The same remotes in the format written before v2: count, then remote 4,
+// reserved code 2, name length 1 and name per remote, then the profiles.
+static somfy_config_blob_handle_t blob_v1_new(void) {
+    size_t size = 1 + sizeof(uint32_t) + 1 + REMOTES * (7 + SOMFY_CONFIG_PROFILE_SIZE + 24);
+    somfy_config_blob_t * blob = calloc(1, sizeof(somfy_config_blob_t));
+    uint8_t * buffer = calloc(size, sizeof(uint8_t));
+    size_t i = 0;
+    uint32_t count = REMOTES;
+    buffer[i++] = SOMFY_CONFIG_WIDE_COUNT;
+    memcpy(buffer + i, &count, sizeof(uint32_t));
+    i += sizeof(uint32_t);
+    for (int n = 0; n < REMOTES; n++) {
+        somfy_remote_t remote = REMOTE(n);
+        somfy_rolling_code_t code = n;
+        char name[24];
+        remote_name(name, sizeof(name), n);
+        uint8_t name_len = strlen(name);
+        memcpy(buffer + i, &remote, sizeof(somfy_remote_t));
+        i += sizeof(somfy_remote_t);
+        memcpy(buffer + i, &code, sizeof(somfy_rolling_code_t));
+        i += sizeof(somfy_rolling_code_t);
+        buffer[i++] = name_len;
+        memcpy(buffer + i, name, name_len);
+        i += name_len;
+    }
+
+    buffer[i++] = SOMFY_CONFIG_PROFILES_SECTION;
+    for (int n = 0; n < REMOTES; n++) {
+        const somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+        buffer[i++] = profile.frames;
+        buffer[i++] = profile.first_syncs;
+        buffer[i++] = profile.repeat_syncs;
+        memcpy(buffer + i, &profile.symbol_us, sizeof(uint16_t));
+        i += sizeof(uint16_t);
+        memcpy(buffer + i, &profile.gap_us, sizeof(uint32_t));
+        i += sizeof(uint32_t);
+    }
+
+    blob->blob = buffer;
+    blob->size = i;
+    return blob;
+}
+
+// A copy of blob, as read from flash before each load.
+static somfy_config_blob_handle_t blob_copy(somfy_config_blob_handle_t handle) {
+    somfy_config_blob_t * blob = (somfy_config_blob_t *) handle;
+    somfy_config_blob_t * copy = calloc(1, sizeof(somfy_config_blob_t));
+    copy->blob = malloc(blob->size);
+    memcpy(copy->blob, blob->blob, blob->size);
+    copy->size = blob->size;
+    return copy;
+}
+
+void setUp(void) {
+    somfy_config_handle_t cfg;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&cfg));
+    for (int n = 0; n < REMOTES; n++) {
+        char name[24];
+        remote_name(name, sizeof(name), n);
+        somfy_config_remote_handle_t remote;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(name, REMOTE(n), n, &remote));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(cfg, remote));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(cfg, &v2));
+    somfy_config_free(cfg);
+    v1 = blob_v1_new();
+}
+
+void tearDown(void) {
+    somfy_config_blob_free(v1);
+    somfy_config_blob_free(v2);
+}
+
+static int compare_ns(const void * a, const void * b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+// Loads blob RUNS times. The heap is counted from the blob read from
+// flash, freed once loaded, to the config loaded. Each block also costs the
+// heap a header of its own, not counted in the bytes.
+static void load_run(somfy_config_blob_handle_t blob, load_t * load) {
+    memset(load, 0, sizeof(load_t));
+    for (int i = 0; i < RUNS; i++) {
+        heap_t before = heap;
+        heap.peak = heap.in_use;
+        somfy_config_blob_handle_t copy = blob_copy(blob);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        somfy_config_handle_t cfg;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_deserialize(copy, &cfg));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        somfy_config_blob_free(copy);
+
+        load->ns[i] = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        load->allocations = heap.allocations - before.allocations;
+        load->peak = heap.peak - before.in_use;
+        load->kept = heap.in_use - before.in_use;
+        load->blocks = heap.blocks - before.blocks;
+
+        size_t count;
+        somfy_config_list_remotes(cfg, NULL, 0, &count);
+        TEST_ASSERT_EQUAL(REMOTES, count);
+        somfy_remote_t remote;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_find_remote_by_name(cfg, "Bedroom blind 999", &remote));
+        TEST_ASSERT_EQUAL(REMOTE(999), remote);
+        somfy_config_free(cfg);
+        TEST_ASSERT_EQUAL(before.in_use, heap.in_use);
+    }
+    qsort(load->ns, RUNS, sizeof(double), compare_ns);
+}
+
+static void print_load(const char * name, somfy_config_blob_handle_t blob, load_t * load) {
+    printf("  %s: %u byte blob, %.0f us median, %u allocations, %u bytes peak, %u bytes kept in %u blocks\n",
+        name, (unsigned) ((somfy_config_blob_t *) blob)->size, load->ns[RUNS / 2] / 1000, load->allocations,
+        (unsigned) load->peak, (unsigned) load->kept, load->blocks);
+}
+
+// v1 allocates each remote and each name. v2 allocates the records and
+// the names once each, besides the index of the table growing by doubling,
+// and keeps nothing else of the blob: the same bytes in a few blocks.
+static void test_load_v2_against_v1(void) {
+    load_t old, new;
+    load_run(v1, &old);
+    load_run(v2, &new);
+    printf("Loading %d remotes:\n", REMOTES);
+    print_load("v1", v1, &old);
+    print_load("v2", v2, &new);
+    printf("  v2 takes %.2fx the time, %.2fx the bytes and %.3fx the blocks of v1.\n", new.ns[RUNS / 2] / old.ns[RUNS / 2],
+        (double) new.kept / old.kept, (double) new.blocks / old.blocks);
+
+    TEST_ASSERT_GREATER_OR_EQUAL(2 * REMOTES, old.allocations);
+    TEST_ASSERT_LESS_THAN(REMOTES / 10, new.allocations);
+    TEST_ASSERT_LESS_THAN(REMOTES / 100, new.blocks);
+    TEST_ASSERT_TRUE(new.kept <= old.kept);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_load_v2_against_v1);
+    return UNITY_END();
+}
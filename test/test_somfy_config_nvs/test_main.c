@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <unity.h>
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#define TAG somfy_config_nvs_tag
+#include "somfy_config_nvs.c"
+#undef TAG
+#include "somfy_remote_table.c"
+
+#define REMOTES 4
+
+#define REMOTE(n) (0x100000 + (n))
+
+static somfy_config_handle_t config;
+
+void setUp(void) {
+    fake_nvs_erase_all();
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&config));
+    for (int n = 0; n < REMOTES; n++) {
+        char name[8];
+        snprintf(name, sizeof(name), "r%d", n);
+        somfy_config_remote_handle_t remote;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(name, REMOTE(n), 100 * n, &remote));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+    }
+
+    size_t written;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+}
+
+void tearDown(void) {
+    if (config != NULL)
+        somfy_config_free(config);
+    config = NULL;
+}
+
+// Restarts from what the flash holds.
+static void restart(void) {
+    somfy_config_free(config);
+    fake_nvs_power_left = -1;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_load(&config));
+}
+
+static void test_first_save_writes_every_key_once(void) {
+    // Name and profile, code, per remote, then the list of remotes.
+    TEST_ASSERT_EQUAL_UINT32(2 * REMOTES + 1, fake_nvs_writes);
+
+    size_t written;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+    TEST_ASSERT_EQUAL_UINT32(2 * REMOTES + 1, fake_nvs_writes);
+    TEST_ASSERT_EQUAL(0, written);
+}
+
+static void test_load_returns_saved_remotes(void) {
+    restart();
+    size_t count;
+    somfy_config_list_remotes(config, NULL, 0, &count);
+    TEST_ASSERT_EQUAL(REMOTES, count);
+    for (int n = 0; n < REMOTES; n++) {
+        somfy_rolling_code_t code;
+        somfy_remote_t remote;
+        char name[8];
+        snprintf(name, sizeof(name), "r%d", n);
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_get_rolling_code(config, REMOTE(n), &code));
+        TEST_ASSERT_EQUAL(100 * n, code);
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_find_remote_by_name(config, name, &remote));
+        TEST_ASSERT_EQUAL_HEX32(REMOTE(n), remote);
+    }
+}
+
+// The reservation stays between one and two blocks ahead of the code
+// handed out, and moves once per block.
+static void test_reserves_a_block_ahead(void) {
+    restart();
+    int reservations = 0;
+    for (int i = 0; i < 1000; i++) {
+        somfy_rolling_code_t code, reserved_code;
+        somfy_config_reserve_t reserved;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(config, REMOTE(0), &code, &reserved));
+        TEST_ASSERT_EQUAL(i + 1, code);
+        // Only the first code after a restart is past the stored reservation.
+        TEST_ASSERT_EQUAL(i == 0, reserved == SOMFY_CONFIG_RESERVE_NOW);
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_get_reserved_code(config, REMOTE(0), &reserved_code));
+        TEST_ASSERT_GREATER_OR_EQUAL(SOMFY_CONFIG_CODE_BLOCK, (somfy_rolling_code_t) (reserved_code - code));
+        TEST_ASSERT_LESS_OR_EQUAL(2 * SOMFY_CONFIG_CODE_BLOCK, (somfy_rolling_code_t) (reserved_code - code));
+        reservations += reserved != SOMFY_CONFIG_RESERVE_NONE;
+    }
+
+    TEST_ASSERT_EQUAL(1 + (1000 - 1) / (SOMFY_CONFIG_CODE_BLOCK + 1), reservations);
+}
+
+// Each reservation rewrites the code of its remote only, one NVS entry.
+static void test_reservation_writes_one_entry(void) {
+    restart();
+    uint32_t writes = fake_nvs_writes;
+    int reservations = 0;
+    for (int i = 0; i < 1000; i++) {
+        somfy_rolling_code_t code;
+        somfy_config_reserve_t reserved;
+        somfy_config_increment_rolling_code(config, REMOTE(i % REMOTES), &code, &reserved);
+        if (reserved == SOMFY_CONFIG_RESERVE_NONE)
+            continue;
+
+        size_t written;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+        TEST_ASSERT_EQUAL(SOMFY_NVS_ENTRY_SIZE, written);
+        reservations++;
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(writes + reservations, fake_nvs_writes);
+    TEST_ASSERT_LESS_OR_EQUAL(REMOTES * (1 + 250 / SOMFY_CONFIG_CODE_BLOCK), reservations);
+}
+
+// Presses the remotes as the controller does: a reservation owed before
+// sending is saved first, one saved in the background may not have been
+// when the power goes. The first code of each remote after a restart is
+// past every code sent before, and at most two blocks past the last one
+// handed out.
+static void test_restart_resumes_past_every_code_sent(void) {
+    srand(17);
+    somfy_rolling_code_t sent[REMOTES];
+    somfy_rolling_code_t allocated[REMOTES];
+    for (int n = 0; n < REMOTES; n++) {
+        sent[n] = 100 * n;
+        allocated[n] = 100 * n;
+    }
+
+    for (int round = 0; round < 500; round++) {
+        restart();
+        bool owed = false;
+        fake_nvs_power_left = rand() % 4;
+        int presses = rand() % 200;
+        for (int i = 0; i < presses; i++) {
+            size_t written;
+            if (owed && somfy_config_nvs_save(config, &written) != ESP_OK)
+                break;
+            owed = false;
+
+            int n = rand() % REMOTES;
+            somfy_rolling_code_t code;
+            somfy_config_reserve_t reserved;
+            somfy_config_increment_rolling_code(config, REMOTE(n), &code, &reserved);
+            allocated[n] = code;
+            if (reserved == SOMFY_CONFIG_RESERVE_NOW && somfy_config_nvs_save(config, &written) != ESP_OK)
+                break;
+
+            sent[n] = code;
+            owed = reserved == SOMFY_CONFIG_RESERVE_AHEAD;
+            if (owed && rand() % 2 == 0)
+                owed = somfy_config_nvs_save(config, &written) != ESP_OK;
+        }
+
+        restart();
+        for (int n = 0; n < REMOTES; n++) {
+            somfy_rolling_code_t code;
+            somfy_config_reserve_t reserved;
+            somfy_config_increment_rolling_code(config, REMOTE(n), &code, &reserved);
+            TEST_ASSERT_EQUAL(SOMFY_CONFIG_RESERVE_NOW, reserved);
+            TEST_ASSERT_GREATER_THAN(0, (int16_t) (code - sent[n]));
+            TEST_ASSERT_LESS_OR_EQUAL(2 * SOMFY_CONFIG_CODE_BLOCK + 1, (int16_t) (code - allocated[n]));
+            sent[n] = code;
+            allocated[n] = code;
+        }
+
+        size_t written;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+    }
+}
+
+// A new profile rewrites the remote's name and profile only, a new
+// remote the list as well.
+static void test_list_written_only_when_a_remote_is_added(void) {
+    somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+    profile.frames = 5;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_set_profile(config, REMOTE(2), &profile));
+    uint32_t writes = fake_nvs_writes;
+    size_t written;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+    TEST_ASSERT_EQUAL_UINT32(writes + 1, fake_nvs_writes);
+
+    somfy_config_remote_handle_t remote;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new("new", REMOTE(REMOTES), 0, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+    TEST_ASSERT_EQUAL_UINT32(writes + 4, fake_nvs_writes);
+
+    restart();
+    size_t count;
+    somfy_config_list_remotes(config, NULL, 0, &count);
+    TEST_ASSERT_EQUAL(REMOTES + 1, count);
+    somfy_profile_t loaded;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_get_profile(config, REMOTE(2), &loaded));
+    TEST_ASSERT_TRUE(somfy_profile_equal(&profile, &loaded));
+}
+
+// A stored profile that sends nothing loads as the default one.
+static void test_invalid_profile_loads_as_default(void) {
+    somfy_config_remote_t * remote = somfy_remote_table_find(&((somfy_config_t *) config)->remotes, REMOTE(1));
+    somfy_profile_t profile = remote->profile;
+    for (int field = 0; field < 2; field++) {
+        remote->profile = profile;
+        if (field == 0)
+            remote->profile.frames = 0;
+        else
+            remote->profile.symbol_us = 0;
+
+        uint8_t meta[SOMFY_NVS_META_MAX];
+        char key[SOMFY_NVS_KEY_SIZE];
+        size_t size = somfy_config_nvs_meta_encode(remote, meta);
+        somfy_config_nvs_key(key, 'm', REMOTE(1));
+        TEST_ASSERT_EQUAL(ESP_OK, nvs_set_blob(0, key, meta, size));
+
+        restart();
+        somfy_profile_t loaded;
+        const somfy_profile_t expected = SOMFY_PROFILE_DEFAULT;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_get_profile(config, REMOTE(1), &loaded));
+        TEST_ASSERT_TRUE(somfy_profile_equal(&expected, &loaded));
+        remote = somfy_remote_table_find(&((somfy_config_t *) config)->remotes, REMOTE(1));
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_save_writes_every_key_once);
+    RUN_TEST(test_load_returns_saved_remotes);
+    RUN_TEST(test_reserves_a_block_ahead);
+    RUN_TEST(test_reservation_writes_one_entry);
+    RUN_TEST(test_restart_resumes_past_every_code_sent);
+    RUN_TEST(test_list_written_only_when_a_remote_is_added);
+    RUN_TEST(test_invalid_profile_loads_as_default);
+    return UNITY_END();
+}
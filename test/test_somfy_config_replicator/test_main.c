@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+#include "pulse_backend.h"
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_tag
+#include "somfy.c"
+#undef TAG
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#define TAG somfy_config_nvs_tag
+#include "somfy_config_nvs.c"
+#undef TAG
+#define TAG somfy_config_http_tag
+#include "somfy_config_http.c"
+#undef TAG
+#include "somfy_remote_table.c"
+#include "somfy_encoder.c"
+
+#define REMOTES 8
+
+#define REMOTE(n) (0x100000 + (n))
+
+// Runs of the replication task while the server fails, enough to reach
+// the longest backoff.
+#define OUTAGE_RUNS 10
+
+// Round trip of a post, and of a post to a slow server.
+#define HTTP_US 40000
+
+#define SLOW_HTTP_US 2000000
+
+#define PRESSES 200
+
+// Between two presses, the background tasks get to run.
+#define IDLE_US 1000000
+
+static const somfy_button_t buttons[] = { BUTTON_UP, BUTTON_DOWN, BUTTON_STOP };
+
+static somfy_config_handle_t config;
+
+static somfy_ctl_t* ctl;
+
+static pulse_ctl_t* pulse;
+
+static somfy_config_replicator_t* replicator;
+
+static uint32_t backoff_ms;
+
+void setUp(void) {
+  fake_nvs_erase_all();
+  fake_http_reset();
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  fake_time_us = IDLE_US;
+  fake_http.delay_us = HTTP_US;
+  backoff_ms = 0;
+
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&config));
+  for (int n = 0; n < REMOTES; n++) {
+    somfy_config_remote_handle_t remote;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(NULL, REMOTE(n), 0, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+  }
+
+  pulse_ctl_config_t pulse_cfg = {
+    .max_queue_size = 3,
+    .backend = PULSE_BACKEND_RMT,
+    .rmt_channel = 0,
+    .rmt_mem_block_num = 1,
+    .max_segments = 64,
+  };
+  somfy_ctl_handle_t handle;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_init(config, &pulse_cfg, &handle));
+  ctl = handle;
+  pulse = ctl->pulse_ctl;
+  replicator = ctl->replicator;
+
+  // The tasks never run, the test initializes the controller's channel and
+  // plays what each task would do once woken up.
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(&pulse->channels[0]));
+}
+
+void tearDown(void) {
+  somfy_ctl_free(ctl);
+  TEST_ASSERT_FALSE(pulse_ctl_handle(pulse, fake_task_notified));
+  fake_task_notified = 0;
+  somfy_config_free(config);
+}
+
+static void controller_run(void) {
+  while (fake_task_notified != 0) {
+    uint32_t events = fake_task_notified;
+    fake_task_notified = 0;
+    pulse_ctl_handle(pulse, events);
+  }
+}
+
+// One run of the replication task, as after each notification. Returns
+// whether everything pending reached the server.
+static bool replicator_run(void) {
+  return somfy_config_replicator_run(replicator, &backoff_ms);
+}
+
+// Presses button of remote and plays the scheduler and controller tasks.
+// Returns the press to first edge.
+static int64_t press(somfy_remote_t remote, somfy_button_t button) {
+  somfy_command_t command = { .remote = remote, .button = button };
+  size_t first = fake_rmt.write_count;
+  int64_t pressed = fake_time_us;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_send_command(ctl, &command));
+  somfy_scheduler_run(ctl);
+  controller_run();
+  TEST_ASSERT_GREATER_THAN(first, fake_rmt.write_count);
+  int64_t latency = fake_rmt.writes[first].started_us - pressed;
+
+  while (fake_rmt_end_next() >= 0)
+    controller_run();
+  fake_rmt_clear_log();
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_persist_run(ctl));
+  return latency;
+}
+
+// While the server cannot be reached, each run waits twice as long as the
+// one before, up to a minute. The first run once it is back posts the
+// whole config, then changes go as deltas again.
+static void test_backoff_while_server_down(void) {
+  fake_http.down = true;
+  printf("Server down, retried after");
+  uint32_t expected = SOMFY_CONFIG_RETRY_MIN_MS;
+  for (int i = 0; i < OUTAGE_RUNS; i++) {
+    int64_t started = fake_time_us;
+    TEST_ASSERT_FALSE(replicator_run());
+    printf(" %u", backoff_ms);
+    TEST_ASSERT_EQUAL_UINT32(expected, backoff_ms);
+    TEST_ASSERT_EQUAL(HTTP_US + backoff_ms * 1000LL, fake_time_us - started);
+    expected = expected * 2 > SOMFY_CONFIG_RETRY_MAX_MS ? SOMFY_CONFIG_RETRY_MAX_MS : expected * 2;
+  }
+  printf(" ms\n");
+  TEST_ASSERT_EQUAL_UINT32(SOMFY_CONFIG_RETRY_MAX_MS, backoff_ms);
+
+  fake_http.down = false;
+  TEST_ASSERT_TRUE(replicator_run());
+  TEST_ASSERT_EQUAL_UINT32(0, backoff_ms);
+  TEST_ASSERT_EQUAL_STRING(SOMFY_CONFIG_SNAPSHOT_TYPE, fake_http.content_type);
+  TEST_ASSERT_EQUAL(somfy_config_replicator_mark(replicator, REMOTE(0)), ESP_OK);
+  TEST_ASSERT_TRUE(replicator_run());
+  TEST_ASSERT_EQUAL_STRING(SOMFY_CONFIG_DELTA_TYPE, fake_http.content_type);
+
+  somfy_config_replicator_stats_t stats;
+  somfy_config_replicator_get_stats(replicator, &stats);
+  TEST_ASSERT_EQUAL(OUTAGE_RUNS, stats.failed);
+  TEST_ASSERT_EQUAL(1, stats.snapshots);
+  TEST_ASSERT_EQUAL(1, stats.deltas);
+}
+
+// Changes made while the server answers errors are not posted one by one
+// once it recovers: a single snapshot covers them.
+static void test_failing_server_resyncs_after_recovery(void) {
+  TEST_ASSERT_TRUE(replicator_run());
+  fake_http.status = 500;
+  for (int n = 0; n < REMOTES; n++) {
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_replicator_mark(replicator, REMOTE(n)));
+    TEST_ASSERT_FALSE(replicator_run());
+  }
+
+  uint32_t requests = fake_http.requests;
+  fake_http.status = 0;
+  TEST_ASSERT_TRUE(replicator_run());
+  somfy_config_replicator_stats_t stats;
+  somfy_config_replicator_get_stats(replicator, &stats);
+  printf("Server failing for %d changes: %u failed posts, then %u post once back.\n", REMOTES, stats.failed,
+    fake_http.requests - requests);
+  TEST_ASSERT_EQUAL(REMOTES, stats.failed);
+  TEST_ASSERT_EQUAL(requests + 1, fake_http.requests);
+  TEST_ASSERT_EQUAL_STRING(SOMFY_CONFIG_SNAPSHOT_TYPE, fake_http.content_type);
+  TEST_ASSERT_EQUAL(2, stats.snapshots);
+  TEST_ASSERT_EQUAL(0, stats.deltas);
+}
+
+// The changes made during a slow post go out together in the next one.
+static void test_slow_server_batches_changes(void) {
+  TEST_ASSERT_TRUE(replicator_run());
+  fake_http.delay_us = SLOW_HTTP_US;
+  uint64_t bytes = fake_http.bytes;
+  for (int n = 0; n < REMOTES; n++)
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_replicator_mark(replicator, REMOTE(n)));
+  int64_t started = fake_time_us;
+  TEST_ASSERT_TRUE(replicator_run());
+
+  somfy_config_replicator_stats_t stats;
+  somfy_config_replicator_get_stats(replicator, &stats);
+  printf("Slow server: %d changes in %u delta of %u bytes, %lld ms.\n", REMOTES, stats.deltas,
+    (unsigned) (fake_http.bytes - bytes), (long long) (fake_time_us - started) / 1000);
+  TEST_ASSERT_EQUAL(1, stats.deltas);
+  TEST_ASSERT_EQUAL(1 + REMOTES * SOMFY_CONFIG_DELTA_RECORD_SIZE, fake_http.bytes - bytes);
+  TEST_ASSERT_EQUAL(SLOW_HTTP_US, fake_time_us - started);
+}
+
+// Presses and their total press to first edge, with the replication task
+// running between them against a server that is down, slow or up.
+static int64_t trace_run(bool down, int64_t delay_us) {
+  fake_http.down = down;
+  fake_http.delay_us = delay_us;
+  srand(20);
+  int64_t total = 0;
+  for (int i = 0; i < PRESSES; i++) {
+    total += press(REMOTE(rand() % REMOTES), buttons[rand() % 3]);
+    replicator_run();
+    fake_time_us += IDLE_US;
+  }
+  return total;
+}
+
+// The server is never on the press path: presses take as long whatever
+// state it is in.
+static void test_press_latency_unaffected(void) {
+  int64_t up = trace_run(false, HTTP_US);
+  tearDown();
+  setUp();
+  int64_t slow = trace_run(false, SLOW_HTTP_US);
+  tearDown();
+  setUp();
+  int64_t down = trace_run(true, HTTP_US);
+  somfy_config_replicator_stats_t stats;
+  somfy_config_replicator_get_stats(replicator, &stats);
+  printf("Press to first edge over %d presses: %lld us server up, %lld us slow, %lld us down (%u failed posts).\n",
+    PRESSES, (long long) up, (long long) slow, (long long) down, stats.failed);
+  TEST_ASSERT_EQUAL(up, slow);
+  TEST_ASSERT_EQUAL(up, down);
+  TEST_ASSERT_EQUAL(PRESSES, stats.failed);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_backoff_while_server_down);
+  RUN_TEST(test_failing_server_resyncs_after_recovery);
+  RUN_TEST(test_slow_server_batches_changes);
+  RUN_TEST(test_press_latency_unaffected);
+  return UNITY_END();
+}
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <unity.h>
+#include "esp_crc.h"
+#include "somfy_config.c"
+#include "somfy_remote_table.c"
+
+#define ROUNDS 200
+
+static somfy_config_handle_t config;
+static somfy_config_blob_handle_t blob;
+
+static uint8_t * streamed;
+static size_t streamed_size;
+
+// Config of count remotes with random names, codes and some profiles.
+static somfy_config_handle_t random_config(int count) {
+    somfy_config_handle_t cfg;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&cfg));
+    char name[SOMFY_CONFIG_NAME_MAX + 1];
+    for (int n = 0; n < count; n++) {
+        int len = rand() % (n == 0 ? SOMFY_CONFIG_NAME_MAX + 1 : 20);
+        for (int c = 0; c < len; c++)
+            name[c] = 'a' + rand() % 26;
+        name[len] = '\0';
+
+        somfy_config_remote_handle_t remote;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(name, 0x100000 + 7 * n, rand() & 0xffff, &remote));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(cfg, remote));
+        if (rand() % 3 == 0) {
+            somfy_profile_t profile = { 1 + rand() % 5, rand() % 4, rand() % 9, 500 + rand() % 200, 10000 + rand() % 30000 };
+            TEST_ASSERT_EQUAL(ESP_OK, somfy_config_set_profile(cfg, 0x100000 + 7 * n, &profile));
+        }
+    }
+
+    return cfg;
+}
+
+// Reads the whole config through a serializer, size bytes at most at a
+// time, as a random size between 1 and size.
+static void stream_out(somfy_config_handle_t cfg, size_t size) {
+    somfy_config_serializer_handle_t serializer;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serializer_new(cfg, &serializer));
+    size_t total = somfy_config_serializer_size(serializer);
+    streamed = realloc(streamed, total + size);
+    streamed_size = 0;
+
+    size_t length;
+    do {
+        size_t want = 1 + rand() % size;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serializer_read(serializer, streamed + streamed_size, want, &length));
+        // Short reads only at the end.
+        TEST_ASSERT_TRUE(length == want || streamed_size + length == total);
+        streamed_size += length;
+    } while (length > 0);
+
+    TEST_ASSERT_EQUAL(total, streamed_size);
+    somfy_config_serializer_free(serializer);
+}
+
+// Feeds data to a parser in chunks of random sizes, up to size.
+static esp_err_t stream_in(const uint8_t * data, size_t data_size, size_t size, somfy_config_handle_t * cfg) {
+    somfy_config_parser_handle_t parser;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_parser_new(&parser));
+    esp_err_t result = ESP_OK;
+    for (size_t i = 0; i < data_size && result == ESP_OK;) {
+        size_t chunk = 1 + rand() % size;
+        if (chunk > data_size - i)
+            chunk = data_size - i;
+        result = somfy_config_parser_feed(parser, data + i, chunk);
+        i += chunk;
+    }
+
+    *cfg = NULL;
+    if (result == ESP_OK)
+        result = somfy_config_parser_finish(parser, cfg);
+    somfy_config_parser_free(parser);
+    return result;
+}
+
+// Whether loaded resumes from the reserved codes of cfg, with its names and
+// profiles.
+static void assert_loaded(somfy_config_handle_t cfg, somfy_config_handle_t loaded) {
+    size_t count, loaded_count;
+    somfy_config_list_remotes(cfg, NULL, 0, &count);
+    somfy_config_list_remotes(loaded, NULL, 0, &loaded_count);
+    TEST_ASSERT_EQUAL(count, loaded_count);
+
+    somfy_remote_t * remotes = calloc(count + 1, sizeof(somfy_remote_t));
+    somfy_config_list_remotes(cfg, remotes, count, &count);
+    for (size_t n = 0; n < count; n++) {
+        somfy_rolling_code_t reserved, code;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_get_reserved_code(cfg, remotes[n], &reserved));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_get_rolling_code(loaded, remotes[n], &code));
+        TEST_ASSERT_EQUAL(reserved, code);
+
+        somfy_profile_t profile, loaded_profile;
+        somfy_config_get_profile(cfg, remotes[n], &profile);
+        somfy_config_get_profile(loaded, remotes[n], &loaded_profile);
+        TEST_ASSERT_TRUE(somfy_profile_equal(&profile, &loaded_profile));
+
+        somfy_config_remote_t * remote = somfy_remote_table_find(&((somfy_config_t *) cfg)->remotes, remotes[n]);
+        somfy_config_remote_t * loaded_remote = somfy_remote_table_find(&((somfy_config_t *) loaded)->remotes, remotes[n]);
+        TEST_ASSERT_EQUAL_STRING(remote->remote_name, loaded_remote->remote_name);
+    }
+
+    free(remotes);
+}
+
+void setUp(void) {
+    config = NULL;
+    blob = NULL;
+}
+
+void tearDown(void) {
+    if (blob != NULL)
+        somfy_config_blob_free(blob);
+    if (config != NULL)
+        somfy_config_free(config);
+    free(streamed);
+    streamed = NULL;
+}
+
+static void test_serializer_matches_blob(void) {
+    srand(25);
+    for (int round = 0; round < ROUNDS; round++) {
+        config = random_config(rand() % (round < 20 ? 4 : 300));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(config, &blob));
+        somfy_config_blob_t * one_shot = (somfy_config_blob_t *) blob;
+
+        stream_out(config, round % 2 == 0 ? 64 : 3);
+        TEST_ASSERT_EQUAL(one_shot->size, streamed_size);
+        TEST_ASSERT_EQUAL_MEMORY(one_shot->blob, streamed, streamed_size);
+
+        somfy_config_blob_free(blob);
+        somfy_config_free(config);
+        blob = NULL;
+        config = NULL;
+    }
+}
+
+static void test_parser_round_trips(void) {
+    srand(26);
+    for (int round = 0; round < ROUNDS; round++) {
+        config = random_config(rand() % (round < 20 ? 4 : 300));
+        stream_out(config, 64);
+
+        somfy_config_handle_t loaded;
+        TEST_ASSERT_EQUAL(ESP_OK, stream_in(streamed, streamed_size, rand() % 4 == 0 ? 500 : 9, &loaded));
+        assert_loaded(config, loaded);
+        somfy_config_free(loaded);
+
+        // The blob loads the same in one go, the config taking its buffer.
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(config, &blob));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_deserialize(blob, &loaded));
+        TEST_ASSERT_NULL(((somfy_config_blob_t *) blob)->blob);
+        assert_loaded(config, loaded);
+        somfy_config_free(loaded);
+
+        somfy_config_blob_free(blob);
+        somfy_config_free(config);
+        blob = NULL;
+        config = NULL;
+    }
+}
+
+static void test_parser_rejects_damaged_blobs(void) {
+    srand(27);
+    for (int round = 0; round < ROUNDS; round++) {
+        config = random_config(1 + rand() % 50);
+        stream_out(config, 64);
+        somfy_config_handle_t loaded;
+
+        size_t at = rand() % streamed_size;
+        uint8_t bit = 1 << (rand() % 8);
+        streamed[at] ^= bit;
+        TEST_ASSERT_NOT_EQUAL(ESP_OK, stream_in(streamed, streamed_size, 17, &loaded));
+        TEST_ASSERT_NULL(loaded);
+        streamed[at] ^= bit;
+
+        size_t cut = 1 + rand() % 3;
+        TEST_ASSERT_NOT_EQUAL(ESP_OK, stream_in(streamed, streamed_size - cut, 17, &loaded));
+        TEST_ASSERT_NULL(loaded);
+
+        // Bytes past the CRC.
+        somfy_config_parser_handle_t parser;
+        somfy_config_parser_new(&parser);
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_parser_feed(parser, streamed, streamed_size));
+        TEST_ASSERT_NOT_EQUAL(ESP_OK, somfy_config_parser_feed(parser, "x", 1));
+        somfy_config_parser_free(parser);
+
+        somfy_config_free(config);
+        config = NULL;
+    }
+}
+
+// A name length one short puts the last letter of the name where its NUL
+// should be, with a CRC that matches.
+static void test_rejects_name_without_terminator(void) {
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&config));
+    somfy_config_remote_handle_t remote;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new("abc", 1, 5, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new("de", 2, 5, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(config, &blob));
+
+    somfy_config_blob_t * damaged = (somfy_config_blob_t *) blob;
+    uint8_t * bytes = damaged->blob;
+    bytes[SOMFY_CONFIG_HEADER_SIZE + 6] = 2;
+    uint32_t crc = esp_crc32_le(0, bytes, damaged->size - SOMFY_CONFIG_CRC_SIZE);
+    memcpy(bytes + damaged->size - SOMFY_CONFIG_CRC_SIZE, &crc, sizeof(uint32_t));
+
+    somfy_config_handle_t loaded;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, stream_in(bytes, damaged->size, 5, &loaded));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, somfy_config_deserialize(blob, &loaded));
+}
+
+// A count of records beyond the 32 bit sizes of the format is refused from
+// the header, before anything is allocated for them.
+static void test_rejects_count_past_format_sizes(void) {
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&config));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(config, &blob));
+    uint8_t header[SOMFY_CONFIG_HEADER_SIZE];
+    memcpy(header, ((somfy_config_blob_t *) blob)->blob, SOMFY_CONFIG_HEADER_SIZE);
+    uint32_t count = UINT32_MAX / header[5] + 1;
+    uint32_t strings_size = 1;
+    memcpy(header + 8, &count, sizeof(uint32_t));
+    memcpy(header + 12, &strings_size, sizeof(uint32_t));
+
+    somfy_config_parser_handle_t parser;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_parser_new(&parser));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, somfy_config_parser_feed(parser, header, sizeof(header)));
+    somfy_config_parser_free(parser);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_serializer_matches_blob);
+    RUN_TEST(test_parser_round_trips);
+    RUN_TEST(test_parser_rejects_damaged_blobs);
+    RUN_TEST(test_rejects_name_without_terminator);
+    RUN_TEST(test_rejects_count_past_format_sizes);
+    return UNITY_END();
+}
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#define TAG somfy_config_nvs_tag
+#include "somfy_config_nvs.c"
+#undef TAG
+#include "somfy_remote_table.c"
+
+#define REMOTE(n) (0x100000 + (n))
+
+// Codes handed out per config size, to random remotes.
+#define PRESSES 1000
+
+static const size_t sizes[] = { 1, 4, 8, 16, 24 };
+
+static somfy_config_handle_t config;
+
+// Flash bytes used by the saves a workload needed, with the keyed layout and
+// with the whole config_data blob rewritten each time.
+typedef struct {
+    uint32_t saves;
+    size_t keyed_bytes;
+    size_t keyed_max;
+    size_t legacy_bytes;
+} writes_t;
+
+void setUp(void) {
+    fake_nvs_erase_all();
+    config = NULL;
+}
+
+void tearDown(void) {
+    if (config != NULL)
+        somfy_config_free(config);
+    config = NULL;
+}
+
+// A config of count named remotes, saved whole once.
+static void config_new(size_t count) {
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&config));
+    for (size_t n = 0; n < count; n++) {
+        char name[24];
+        snprintf(name, sizeof(name), "Bedroom blind %u", (unsigned) n);
+        somfy_config_remote_handle_t remote;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(name, REMOTE(n), 0, &remote));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+    }
+
+    size_t written;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+}
+
+// What the legacy layout used for a save: the whole config serialized
+// under config_data.
+static size_t legacy_save_bytes(void) {
+    somfy_config_blob_handle_t blob;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(config, &blob));
+    size_t size = ((somfy_config_blob_t *) blob)->size;
+    somfy_config_blob_free(blob);
+    return SOMFY_NVS_BLOB_SIZE(size);
+}
+
+// Hands out codes to random remotes, saving each time a reservation moves,
+// as the persist task does.
+static void workload_run(size_t count, writes_t * writes) {
+    memset(writes, 0, sizeof(writes_t));
+    config_new(count);
+    srand(18);
+    for (int i = 0; i < PRESSES; i++) {
+        somfy_config_reserve_t reserved;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(config, REMOTE(rand() % count), NULL, &reserved));
+        if (reserved == SOMFY_CONFIG_RESERVE_NONE)
+            continue;
+
+        uint32_t before = fake_nvs_writes;
+        size_t written;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+        // A reservation moved rewrites the code of its remote alone.
+        TEST_ASSERT_EQUAL_UINT32(before + 1, fake_nvs_writes);
+        writes->saves++;
+        writes->keyed_bytes += written;
+        writes->keyed_max = written > writes->keyed_max ? written : writes->keyed_max;
+        writes->legacy_bytes += legacy_save_bytes();
+    }
+
+    somfy_config_free(config);
+    config = NULL;
+}
+
+// A code change writes a single NVS entry whatever the size of the config,
+// where the legacy layout rewrote every remote, names included.
+static void test_code_change_writes_one_entry(void) {
+    printf("%d codes handed out, saves as reservations move:\n", PRESSES);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        writes_t writes;
+        workload_run(sizes[i], &writes);
+        printf("  %2u remotes: %u saves, %u bytes per save keyed, %u bytes per save as a whole blob, %.1fx\n",
+            (unsigned) sizes[i], writes.saves, (unsigned) (writes.keyed_bytes / writes.saves),
+            (unsigned) (writes.legacy_bytes / writes.saves), (double) writes.legacy_bytes / writes.keyed_bytes);
+
+        TEST_ASSERT_GREATER_THAN(0, writes.saves);
+        TEST_ASSERT_EQUAL(SOMFY_NVS_ENTRY_SIZE, writes.keyed_max);
+        TEST_ASSERT_EQUAL(writes.saves * SOMFY_NVS_ENTRY_SIZE, writes.keyed_bytes);
+        TEST_ASSERT_GREATER_THAN(writes.keyed_bytes, writes.legacy_bytes);
+    }
+}
+
+// Adding a remote writes its own keys and the list of remotes, the other
+// remotes are left alone.
+static void test_added_remote_writes_its_keys(void) {
+    config_new(8);
+    somfy_config_remote_handle_t remote;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new("Kitchen", REMOTE(8), 0, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+    uint32_t before = fake_nvs_writes;
+    size_t written;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(config, &written));
+    printf("Remote added to 8: %u entries, %u bytes keyed, %u bytes as a whole blob.\n",
+        fake_nvs_writes - before, (unsigned) written, (unsigned) legacy_save_bytes());
+    TEST_ASSERT_EQUAL_UINT32(before + 3, fake_nvs_writes);
+    TEST_ASSERT_LESS_THAN(legacy_save_bytes(), written);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_code_change_writes_one_entry);
+    RUN_TEST(test_added_remote_writes_its_keys);
+    return UNITY_END();
+}
@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <unity.h>
+#include "pulse_backend.h"
+#include "somfy_encoder.c"
+
+#define MAX_EDGES 4096
+
+#define SYMBOL 640
+
+// Pulses merged by level, as they come out of the pin.
+typedef struct {
+  pulse_duration_t durations[MAX_EDGES];
+  pulse_level_t levels[MAX_EDGES];
+  size_t count;
+} edges_t;
+
+static pulse_ctl_handle_t ctl;
+
+static somfy_segments_t segments;
+
+static edges_t expected;
+
+static edges_t actual;
+
+void setUp(void) {
+  if (ctl == NULL) {
+    pulse_ctl_config_t cfg = {
+      .backend = PULSE_BACKEND_RMT,
+      .max_queue_size = 1,
+      .max_pulses = 1024,
+      .max_segments = 64,
+    };
+    ctl = pulse_ctl_new(&cfg);
+    const somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_segments_new(&segments, &profile));
+  }
+
+  memset(&expected, 0, sizeof(expected));
+  memset(&actual, 0, sizeof(actual));
+}
+
+void tearDown(void) {
+}
+
+static void edge_add(edges_t* edges, pulse_duration_t duration, pulse_level_t level) {
+  if (edges->count > 0 && edges->levels[edges->count - 1] == level) {
+    edges->durations[edges->count - 1] += duration;
+    return;
+  }
+
+  TEST_ASSERT_LESS_THAN(MAX_EDGES, edges->count);
+  edges->durations[edges->count] = duration;
+  edges->levels[edges->count] = level;
+  edges->count++;
+}
+
+// The frame writer the encoder replaced, kept as the reference: wake-up
+// and silence before the first frame, two hardware syncs for the first
+// frame and seven for the following ones, then the software sync, the 56
+// Manchester data bits MSB first and the inter-frame gap.
+static void reference_frame_write(edges_t* edges, const uint8_t* frame, uint8_t sync) {
+  if (sync == 2) {
+    edge_add(edges, 9415, PULSE_HIGH);
+    edge_add(edges, 89565, PULSE_LOW);
+  }
+
+  for (int i = 0; i < sync; i++) {
+    edge_add(edges, 4 * SYMBOL, PULSE_HIGH);
+    edge_add(edges, 4 * SYMBOL, PULSE_LOW);
+  }
+
+  edge_add(edges, 4550, PULSE_HIGH);
+  edge_add(edges, SYMBOL, PULSE_LOW);
+
+  for (uint8_t i = 0; i < 56; i++) {
+    if (((frame[i / 8] >> (7 - (i % 8))) & 1) == 1) {
+      edge_add(edges, SYMBOL, PULSE_LOW);
+      edge_add(edges, SYMBOL, PULSE_HIGH);
+    }
+    else {
+      edge_add(edges, SYMBOL, PULSE_HIGH);
+      edge_add(edges, SYMBOL, PULSE_LOW);
+    }
+  }
+
+  edge_add(edges, 30415, PULSE_LOW);
+}
+
+// Frame bytes as somfy_frame_build lays them out: key, button and
+// checksum, rolling code and remote, each byte obfuscated with the
+// previous one.
+static void frame_of(uint8_t* frame, uint8_t button, somfy_rolling_code_t code, somfy_remote_t remote) {
+  frame[0] = 0xA7;
+  frame[1] = button << 4;
+  frame[2] = code >> 8;
+  frame[3] = code;
+  frame[4] = remote >> 16;
+  frame[5] = remote >> 8;
+  frame[6] = remote;
+
+  uint8_t checksum = 0;
+  for (int i = 0; i < SOMFY_FRAME_SIZE; i++)
+    checksum = checksum ^ frame[i] ^ (frame[i] >> 4);
+  frame[1] |= checksum & 0xf;
+  for (int i = 1; i < SOMFY_FRAME_SIZE; i++)
+    frame[i] ^= frame[i - 1];
+}
+
+// Plays train as a backend would, merging the pulses into edges.
+static void play(pulse_train_t* train) {
+  pulse_duration_t duration;
+  pulse_level_t level;
+  train->split = false;
+  pulse_train_rewind(train);
+  while (pulse_train_next(train, &duration, &level))
+    edge_add(&actual, duration, level);
+}
+
+static void assert_same_edges(void) {
+  TEST_ASSERT_EQUAL(expected.count, actual.count);
+  for (size_t i = 0; i < expected.count; i++) {
+    TEST_ASSERT_EQUAL(expected.levels[i], actual.levels[i]);
+    TEST_ASSERT_EQUAL_UINT32(expected.durations[i], actual.durations[i]);
+  }
+}
+
+static const uint8_t buttons[] = { BUTTON_STOP, BUTTON_UP, BUTTON_DOWN, BUTTON_PROG };
+
+static const somfy_rolling_code_t codes[] = { 0, 1, 0x00ff, 0x0100, 0x5a5a, 0x8000, 0xfffe, 0xffff };
+
+static const somfy_remote_t remotes[] = { 0x000000, 0x100000, 0x123456, 0xffffff };
+
+// A command is the wake-up and three frames, as the original burst.
+static void test_command_matches_reference_writer(void) {
+  for (size_t b = 0; b < sizeof(buttons); b++) {
+    for (size_t c = 0; c < sizeof(codes) / sizeof(codes[0]); c++) {
+      for (size_t r = 0; r < sizeof(remotes) / sizeof(remotes[0]); r++) {
+        uint8_t frame[SOMFY_FRAME_SIZE];
+        frame_of(frame, buttons[b], codes[c], remotes[r]);
+        expected.count = 0;
+        actual.count = 0;
+        reference_frame_write(&expected, frame, 2);
+        reference_frame_write(&expected, frame, 7);
+        reference_frame_write(&expected, frame, 7);
+
+        pulse_train_handle_t train;
+        TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_encoder_write(&segments, train, frame));
+        play(train);
+        pulse_train_free(train);
+        assert_same_edges();
+      }
+    }
+  }
+}
+
+// A held button is the first frame, then repeat frames from the loop.
+static void test_hold_matches_reference_repeat_frames(void) {
+  uint16_t repeats[] = { 0, 1, 5, 20 };
+  for (size_t i = 0; i < sizeof(repeats) / sizeof(repeats[0]); i++) {
+    uint8_t frame[SOMFY_FRAME_SIZE];
+    frame_of(frame, BUTTON_DOWN, 0x1234 + i, 0x123456);
+    expected.count = 0;
+    actual.count = 0;
+    reference_frame_write(&expected, frame, 2);
+    for (uint16_t n = 0; n < repeats[i]; n++)
+      reference_frame_write(&expected, frame, 7);
+
+    pulse_train_handle_t train;
+    TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_encoder_write_hold(&segments, train, frame, repeats[i]));
+    play(train);
+    pulse_train_free(train);
+    assert_same_edges();
+  }
+}
+
+// Random frames, replayed twice from the same train: the generator state
+// is restored on rewind.
+static void test_random_frames_replay_identically(void) {
+  srand(4);
+  for (int round = 0; round < 200; round++) {
+    uint8_t frame[SOMFY_FRAME_SIZE];
+    for (int i = 0; i < SOMFY_FRAME_SIZE; i++)
+      frame[i] = rand();
+    expected.count = 0;
+    actual.count = 0;
+    reference_frame_write(&expected, frame, 2);
+    reference_frame_write(&expected, frame, 7);
+    reference_frame_write(&expected, frame, 7);
+
+    pulse_train_handle_t train;
+    TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_encoder_write(&segments, train, frame));
+    play(train);
+    assert_same_edges();
+    actual.count = 0;
+    play(train);
+    pulse_train_free(train);
+    assert_same_edges();
+  }
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_command_matches_reference_writer);
+  RUN_TEST(test_hold_matches_reference_repeat_frames);
+  RUN_TEST(test_random_frames_replay_identically);
+  return UNITY_END();
+}
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <unity.h>
+#include "somfy_config.c"
+#include "somfy_remote_table.c"
+
+#define BRIDGES 3
+
+#define REMOTES 4
+
+#define REMOTE(n) (0x100000 + (n))
+
+// Codes per block given by the reference server.
+#define LEASE_BLOCK 24
+
+// Reference lease server, as specified in somfy_config_http.h: it posts
+// bridge (4 bytes), remote (4 bytes) and the last code the bridge may have
+// used (2 bytes), and answers the first and last code (2 bytes each) of a
+// block that starts past it and was given to no other bridge.
+typedef struct {
+    somfy_remote_t remote;
+    somfy_rolling_code_t next;
+    bool used;
+} lease_server_remote_t;
+
+static lease_server_remote_t lease_server[REMOTES];
+
+static void lease_server_answer(const uint8_t * request, size_t size, uint8_t * response) {
+    TEST_ASSERT_EQUAL(sizeof(uint32_t) + sizeof(somfy_remote_t) + sizeof(somfy_rolling_code_t), size);
+    somfy_remote_t remote;
+    somfy_rolling_code_t reserved_code;
+    memcpy(&remote, request + 4, sizeof(somfy_remote_t));
+    memcpy(&reserved_code, request + 8, sizeof(somfy_rolling_code_t));
+
+    lease_server_remote_t * found = NULL;
+    for (int n = 0; n < REMOTES && found == NULL; n++) {
+        if (!lease_server[n].used || lease_server[n].remote == remote)
+            found = &lease_server[n];
+    }
+    TEST_ASSERT_NOT_NULL(found);
+    if (!found->used || (int16_t) (reserved_code - found->next) >= 0)
+        found->next = reserved_code + 1;
+    found->used = true;
+    found->remote = remote;
+
+    somfy_rolling_code_t first = found->next;
+    somfy_rolling_code_t last = first + LEASE_BLOCK - 1;
+    found->next = last + 1;
+    memcpy(response, &first, sizeof(somfy_rolling_code_t));
+    memcpy(response + 2, &last, sizeof(somfy_rolling_code_t));
+}
+
+typedef struct {
+    uint32_t id;
+    somfy_config_handle_t config;
+    bool woken;
+} bridge_t;
+
+static bridge_t bridges[BRIDGES];
+
+static void bridge_wake(void * arg) {
+    ((bridge_t *) arg)->woken = true;
+}
+
+// What the lease task of a bridge does once woken up.
+static void bridge_renew(bridge_t * bridge) {
+    bridge->woken = false;
+    for (int n = 0; n < REMOTES; n++) {
+        bool needed;
+        somfy_rolling_code_t reserved_code;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_lease_needed(bridge->config, REMOTE(n), &needed, &reserved_code));
+        if (!needed)
+            continue;
+
+        uint8_t request[10];
+        uint8_t response[4];
+        somfy_remote_t remote = REMOTE(n);
+        memcpy(request, &bridge->id, sizeof(uint32_t));
+        memcpy(request + 4, &remote, sizeof(somfy_remote_t));
+        memcpy(request + 8, &reserved_code, sizeof(somfy_rolling_code_t));
+        lease_server_answer(request, sizeof(request), response);
+
+        somfy_rolling_code_t first, last;
+        memcpy(&first, response, sizeof(somfy_rolling_code_t));
+        memcpy(&last, response + 2, sizeof(somfy_rolling_code_t));
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_set_lease(bridge->config, REMOTE(n), first, last));
+    }
+}
+
+void setUp(void) {
+    memset(lease_server, 0, sizeof(lease_server));
+    for (int b = 0; b < BRIDGES; b++) {
+        bridge_t * bridge = &bridges[b];
+        bridge->id = b + 1;
+        bridge->woken = false;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&bridge->config));
+        for (int n = 0; n < REMOTES; n++) {
+            somfy_config_remote_handle_t remote;
+            // Each bridge starts from its own local code.
+            TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(NULL, REMOTE(n), 10 * b, &remote));
+            TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(bridge->config, remote));
+        }
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_set_leased(bridge->config, &bridge_wake, bridge));
+    }
+}
+
+void tearDown(void) {
+    for (int b = 0; b < BRIDGES; b++)
+        somfy_config_free(bridges[b].config);
+}
+
+static void test_no_code_before_first_lease(void) {
+    somfy_rolling_code_t code;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, somfy_config_increment_rolling_code(bridges[0].config, REMOTE(0), &code, NULL));
+    bridge_renew(&bridges[0]);
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(bridges[0].config, REMOTE(0), &code, NULL));
+    TEST_ASSERT_EQUAL(1, code);
+}
+
+static void test_refuses_lease_behind_used_codes(void) {
+    bridge_renew(&bridges[0]);
+    somfy_rolling_code_t code;
+    somfy_config_increment_rolling_code(bridges[0].config, REMOTE(0), &code, NULL);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, somfy_config_set_lease(bridges[0].config, REMOTE(0), code, code + 10));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, somfy_config_set_lease(bridges[0].config, REMOTE(0), code + 10, code + 9));
+}
+
+static void test_asks_next_block_before_running_dry(void) {
+    bridge_t * bridge = &bridges[0];
+    bridge_renew(bridge);
+    for (int i = 0; i < LEASE_BLOCK - SOMFY_CONFIG_LEASE_LOW_WATER - 1; i++) {
+        somfy_rolling_code_t code;
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(bridge->config, REMOTE(0), &code, NULL));
+        TEST_ASSERT_FALSE(bridge->woken);
+    }
+
+    somfy_rolling_code_t code;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(bridge->config, REMOTE(0), &code, NULL));
+    TEST_ASSERT_TRUE(bridge->woken);
+}
+
+// A group listing a remote twice with a single code left in its block and
+// no next block gets nothing, then a code per entry once leased again.
+static void test_group_needs_a_code_per_entry(void) {
+    bridge_t * bridge = &bridges[0];
+    bridge_renew(bridge);
+    somfy_rolling_code_t code;
+    for (int i = 0; i < LEASE_BLOCK - 1; i++)
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(bridge->config, REMOTE(0), &code, NULL));
+    TEST_ASSERT_EQUAL(LEASE_BLOCK - 1, code);
+
+    somfy_remote_t remotes[] = { REMOTE(1), REMOTE(0), REMOTE(0) };
+    somfy_rolling_code_t codes[3];
+    bridge_renew(bridge);
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_codes(bridge->config, remotes, 3, codes, NULL));
+    TEST_ASSERT_EQUAL(LEASE_BLOCK, codes[1]);
+    TEST_ASSERT_EQUAL(LEASE_BLOCK + 1, codes[2]);
+
+    for (int i = 0; i < LEASE_BLOCK - 2; i++)
+        TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(bridge->config, REMOTE(0), &code, NULL));
+    TEST_ASSERT_EQUAL(2 * LEASE_BLOCK - 1, code);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, somfy_config_increment_rolling_codes(bridge->config, remotes, 3, codes, NULL));
+
+    // Nothing moved, the last code of the block is still there.
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(bridge->config, REMOTE(0), &code, NULL));
+    TEST_ASSERT_EQUAL(2 * LEASE_BLOCK, code);
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_increment_rolling_code(bridge->config, REMOTE(1), &code, NULL));
+    TEST_ASSERT_EQUAL(2, code);
+}
+
+// Bridges press the same remotes in random order, and only renew their
+// leases some of the times they are woken up. No code is ever sent twice,
+// and every bridge keeps moving forward.
+static void test_bridges_never_share_a_code(void) {
+    static uint8_t sent[REMOTES][65536 / 8];
+    somfy_rolling_code_t last[BRIDGES][REMOTES];
+    bool started[BRIDGES][REMOTES];
+    memset(sent, 0, sizeof(sent));
+    memset(started, 0, sizeof(started));
+    srand(22);
+
+    uint32_t codes = 0;
+    uint32_t dry = 0;
+    for (int i = 0; i < 200000; i++) {
+        int b = rand() % BRIDGES;
+        int n = rand() % REMOTES;
+        bridge_t * bridge = &bridges[b];
+        if (bridge->woken && rand() % 4 == 0)
+            bridge_renew(bridge);
+
+        somfy_rolling_code_t code;
+        somfy_config_reserve_t reserved;
+        esp_err_t result = somfy_config_increment_rolling_code(bridge->config, REMOTE(n), &code, &reserved);
+        if (result == ESP_ERR_INVALID_STATE) {
+            dry++;
+            bridge_renew(bridge);
+            continue;
+        }
+
+        TEST_ASSERT_EQUAL(ESP_OK, result);
+        TEST_ASSERT_FALSE(sent[n][code / 8] & (1 << (code % 8)));
+        sent[n][code / 8] |= 1 << (code % 8);
+        if (started[b][n])
+            TEST_ASSERT_GREATER_THAN(0, (int16_t) (code - last[b][n]));
+        last[b][n] = code;
+        started[b][n] = true;
+        codes++;
+        // The codes of a remote wrap around after 65536 presses, stop well
+        // before so that every code is only expected once.
+        if (codes == 40000)
+            break;
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(40000, codes);
+    TEST_ASSERT_GREATER_THAN(0, dry);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_no_code_before_first_lease);
+    RUN_TEST(test_refuses_lease_behind_used_codes);
+    RUN_TEST(test_asks_next_block_before_running_dry);
+    RUN_TEST(test_group_needs_a_code_per_entry);
+    RUN_TEST(test_bridges_never_share_a_code);
+    return UNITY_END();
+}
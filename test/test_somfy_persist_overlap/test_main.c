@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+#include "pulse_backend.h"
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_tag
+#include "somfy.c"
+#undef TAG
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#define TAG somfy_config_nvs_tag
+#include "somfy_config_nvs.c"
+#undef TAG
+#define TAG somfy_config_http_tag
+#include "somfy_config_http.c"
+#undef TAG
+#include "somfy_remote_table.c"
+#include "somfy_encoder.c"
+
+#define REMOTES 8
+
+#define REMOTE(n) (0x100000 + (n))
+
+#define PRESSES 400
+
+// Flash time of one NVS entry written, erases included.
+#define FLASH_WRITE_US 3000
+
+// Round trip of a post to the config server.
+#define HTTP_US 40000
+
+// Between two presses, the background tasks get to run.
+#define IDLE_US 1000000
+
+static const somfy_button_t buttons[] = { BUTTON_UP, BUTTON_DOWN, BUTTON_STOP };
+
+static somfy_config_handle_t config;
+
+static somfy_ctl_t* ctl;
+
+static pulse_ctl_t* pulse;
+
+// Press to first edge of the presses of a trace, the serial saves before
+// it, command posted to code allocated, and the saves made while on air with
+// their reservation to durable.
+typedef struct {
+  uint32_t presses;
+  int64_t total_us;
+  int64_t max_us;
+  int64_t allocate_us;
+  int64_t serial_us;
+  uint32_t saves;
+  int64_t save_us;
+} latency_t;
+
+// Starts from the config saved by an earlier run: the first code of every
+// remote needs its reservation saved before it is sent.
+void setUp(void) {
+  fake_nvs_erase_all();
+  fake_http_reset();
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  fake_time_us = IDLE_US;
+
+  somfy_config_handle_t saved;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&saved));
+  for (int n = 0; n < REMOTES; n++) {
+    somfy_config_remote_handle_t remote;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(NULL, REMOTE(n), 100 * n, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(saved, remote));
+  }
+  size_t written;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(saved, &written));
+  somfy_config_free(saved);
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_load(&config));
+  fake_nvs_write_us = FLASH_WRITE_US;
+  fake_http.delay_us = HTTP_US;
+
+  pulse_ctl_config_t pulse_cfg = {
+    .max_queue_size = 3,
+    .backend = PULSE_BACKEND_RMT,
+    .rmt_channel = 0,
+    .rmt_mem_block_num = 1,
+    .max_segments = 64,
+  };
+  somfy_ctl_handle_t handle;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_init(config, &pulse_cfg, &handle));
+  ctl = handle;
+  pulse = ctl->pulse_ctl;
+
+  // The tasks never run, the test initializes the controller's channel and
+  // plays what each task would do once woken up.
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(&pulse->channels[0]));
+}
+
+void tearDown(void) {
+  somfy_ctl_free(ctl);
+  TEST_ASSERT_FALSE(pulse_ctl_handle(pulse, fake_task_notified));
+  fake_task_notified = 0;
+  somfy_config_free(config);
+}
+
+static void controller_run(void) {
+  while (fake_task_notified != 0) {
+    uint32_t events = fake_task_notified;
+    fake_task_notified = 0;
+    pulse_ctl_handle(pulse, events);
+  }
+}
+
+// Reservation of remote as flash holds it.
+static somfy_rolling_code_t durable_code(somfy_remote_t remote) {
+  char key[SOMFY_NVS_KEY_SIZE];
+  somfy_config_nvs_key(key, 'c', remote);
+  fake_nvs_entry_t* entry = fake_nvs_find(key);
+  TEST_ASSERT_NOT_NULL(entry);
+  somfy_rolling_code_t code;
+  memcpy(&code, entry->value, sizeof(code));
+  return code;
+}
+
+// The stages of the serial path this replaced, before the train could be
+// queued: the whole config written to flash, then posted to the server.
+static void serial_save(void) {
+  somfy_config_blob_handle_t blob;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_serialize(config, &blob));
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_blob_nvs_write(blob));
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_blob_http_write(blob, SOMFY_CONFIG_URL));
+  somfy_config_blob_free(blob);
+}
+
+// Presses button of remote and plays the scheduler and controller tasks
+// until the frame is on air. The persist task saves the new reservation
+// while the train plays, serial saves it before the train is queued.
+static void press(somfy_remote_t remote, somfy_button_t button, bool serial, latency_t* latency) {
+  somfy_command_t command = { .remote = remote, .button = button };
+  size_t first = fake_rmt.write_count;
+  int64_t pressed = fake_time_us;
+  if (serial)
+    serial_save();
+  latency->serial_us += fake_time_us - pressed;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_send_command(ctl, &command));
+  somfy_scheduler_run(ctl);
+  controller_run();
+
+  TEST_ASSERT_GREATER_THAN(first, fake_rmt.write_count);
+  int64_t edge = fake_rmt.writes[first].started_us - pressed;
+  latency->presses++;
+  latency->total_us += edge;
+  latency->max_us = edge > latency->max_us ? edge : latency->max_us;
+  latency->allocate_us += ctl->stats.allocate_latency_us;
+
+  // The code on air is never past what flash holds.
+  somfy_rolling_code_t code;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_get_rolling_code(config, remote, &code));
+  TEST_ASSERT_TRUE(code <= durable_code(remote));
+
+  // The persist task runs while the train is on air.
+  uint32_t writes = fake_nvs_writes;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_persist_run(ctl));
+  if (fake_nvs_writes > writes) {
+    latency->saves++;
+    latency->save_us += ctl->stats.persist_latency_us;
+  }
+  while (fake_rmt_end_next() >= 0)
+    controller_run();
+  fake_rmt_clear_log();
+  fake_time_us += IDLE_US;
+}
+
+static void trace_run(bool serial, latency_t* latency) {
+  memset(latency, 0, sizeof(latency_t));
+  srand(19);
+  for (int i = 0; i < PRESSES; i++)
+    press(REMOTE(rand() % REMOTES), buttons[rand() % 3], serial, latency);
+}
+
+static void print_latency(const char* name, latency_t* latency) {
+  printf("  %s: press to first edge %lld us mean, %lld us max; serial saves %lld us, post to code allocated %lld us mean\n",
+    name, (long long) (latency->total_us / latency->presses), (long long) latency->max_us,
+    (long long) (latency->serial_us / latency->presses), (long long) (latency->allocate_us / latency->presses));
+  if (latency->saves > 0)
+    printf("    %u saves while on air, reservation to durable %lld us mean\n",
+      latency->saves, (long long) (latency->save_us / latency->saves));
+}
+
+// Only a press past the saved reservation waits for flash, the first of
+// each remote after boot here. Every later save overlaps with the train.
+static void test_saves_overlap_with_transmission(void) {
+  latency_t latency;
+  trace_run(false, &latency);
+  printf("%d presses on %d remotes, NVS writes of %d us:\n", PRESSES, REMOTES, FLASH_WRITE_US);
+  print_latency("pipelined", &latency);
+
+  // REMOTES presses waited for a single NVS write, the others for nothing.
+  TEST_ASSERT_EQUAL(REMOTES * FLASH_WRITE_US, latency.total_us);
+  TEST_ASSERT_EQUAL(FLASH_WRITE_US, latency.max_us);
+  TEST_ASSERT_GREATER_THAN(0, latency.saves);
+}
+
+// The serial path waited for flash and the server on every press.
+static void test_press_latency_against_serial_save(void) {
+  latency_t serial, pipelined;
+  trace_run(true, &serial);
+  int64_t serial_saves = fake_http.requests;
+  tearDown();
+  setUp();
+  trace_run(false, &pipelined);
+  printf("%d presses on %d remotes, NVS writes of %d us, posts of %d us:\n", PRESSES, REMOTES,
+    FLASH_WRITE_US, HTTP_US);
+  print_latency("serial", &serial);
+  print_latency("pipelined", &pipelined);
+
+  TEST_ASSERT_EQUAL(PRESSES, serial_saves);
+  TEST_ASSERT_TRUE(serial.total_us >= PRESSES * (int64_t) (FLASH_WRITE_US + HTTP_US));
+  TEST_ASSERT_LESS_THAN(serial.total_us / 100, pipelined.total_us);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_saves_overlap_with_transmission);
+  RUN_TEST(test_press_latency_against_serial_save);
+  return UNITY_END();
+}
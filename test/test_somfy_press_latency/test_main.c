@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unity.h>
+#include "pulse_backend.h"
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_tag
+#include "somfy.c"
+#undef TAG
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#define TAG somfy_config_nvs_tag
+#include "somfy_config_nvs.c"
+#undef TAG
+#define TAG somfy_config_http_tag
+#include "somfy_config_http.c"
+#undef TAG
+#include "somfy_remote_table.c"
+#include "somfy_encoder.c"
+
+// As many remotes as the cache has entries.
+#define REMOTES 8
+
+#define REMOTE(n) (0x100000 + (n))
+
+#define PRESSES 4000
+
+// Flash time of one NVS entry written, erases included.
+#define FLASH_WRITE_US 3000
+
+// Between two presses, the background tasks get to run.
+#define IDLE_US 1000000
+
+static const somfy_button_t buttons[] = { BUTTON_UP, BUTTON_DOWN, BUTTON_STOP };
+
+static somfy_config_handle_t config;
+
+static somfy_ctl_t* ctl;
+
+static pulse_ctl_t* pulse;
+
+// Presses of one kind, with their press to first edge on the simulated
+// clock, their host time up to that edge, and the NVS entries written
+// before it.
+typedef struct {
+  uint32_t presses;
+  int64_t total_us;
+  int64_t max_us;
+  double host_ns[PRESSES];
+  uint32_t flash_writes;
+} latency_t;
+
+typedef struct {
+  latency_t hits;
+  latency_t misses;
+} trace_t;
+
+// Starts from the config saved by an earlier run: the first code of every
+// remote needs its reservation saved before it is sent.
+static void boot(void) {
+  fake_nvs_erase_all();
+  fake_http_reset();
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  fake_time_us = IDLE_US;
+
+  somfy_config_handle_t saved;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&saved));
+  for (int n = 0; n < REMOTES; n++) {
+    somfy_config_remote_handle_t remote;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(NULL, REMOTE(n), 100 * n, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(saved, remote));
+  }
+  size_t written;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_save(saved, &written));
+  somfy_config_free(saved);
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_nvs_load(&config));
+  fake_nvs_write_us = FLASH_WRITE_US;
+
+  pulse_ctl_config_t pulse_cfg = {
+    .max_queue_size = 3,
+    .backend = PULSE_BACKEND_RMT,
+    .rmt_channel = 0,
+    .rmt_mem_block_num = 1,
+    .max_segments = 64,
+  };
+  somfy_ctl_handle_t handle;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_init(config, &pulse_cfg, &handle));
+  ctl = handle;
+  pulse = ctl->pulse_ctl;
+
+  // The controller task never runs, the test initializes its channel and
+  // plays the events it would receive.
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(&pulse->channels[0]));
+}
+
+static void shutdown(void) {
+  somfy_ctl_free(ctl);
+  TEST_ASSERT_FALSE(pulse_ctl_handle(pulse, fake_task_notified));
+  fake_task_notified = 0;
+  somfy_config_free(config);
+}
+
+// Runs the controller task until it has nothing left to do.
+static void controller_run(void) {
+  while (fake_task_notified != 0) {
+    uint32_t events = fake_task_notified;
+    fake_task_notified = 0;
+    pulse_ctl_handle(pulse, events);
+  }
+}
+
+// Plays every train on air and queued to its end.
+static void air_run(void) {
+  controller_run();
+  while (fake_rmt_end_next() >= 0)
+    controller_run();
+  fake_rmt_clear_log();
+}
+
+// What the lower priority tasks do once the train is over: the persist
+// task saves the reservation moved by the press, then the precompute task
+// builds the next frames, which may move it again.
+static void idle(bool precompute) {
+  air_run();
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_persist_run(ctl));
+  if (precompute) {
+    somfy_frame_cache_fill(ctl);
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_persist_run(ctl));
+  }
+  fake_time_us += IDLE_US;
+}
+
+// Presses button of remote and runs the scheduler task, then the
+// controller task, until the frame is on air.
+static void press(somfy_remote_t remote, somfy_button_t button, trace_t* trace) {
+  somfy_command_t command = { .remote = remote, .button = button };
+  uint32_t hits = ctl->stats.cache_hits;
+  uint32_t writes = fake_nvs_writes;
+  size_t first = fake_rmt.write_count;
+  int64_t pressed = fake_time_us;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_send_command(ctl, &command));
+  somfy_scheduler_run(ctl);
+  controller_run();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  TEST_ASSERT_GREATER_THAN(first, fake_rmt.write_count);
+  int64_t latency = fake_rmt.writes[first].started_us - pressed;
+  latency_t* kind = ctl->stats.cache_hits > hits ? &trace->hits : &trace->misses;
+  kind->presses++;
+  kind->total_us += latency;
+  kind->max_us = latency > kind->max_us ? latency : kind->max_us;
+  kind->host_ns[kind->presses - 1] = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  kind->flash_writes += fake_nvs_writes - writes;
+
+  // The controller sees the same press to first edge.
+  pulse_ctl_stats_t stats;
+  pulse_ctl_get_stats(pulse, &stats);
+  TEST_ASSERT_EQUAL(latency, stats.last_start_latency_us);
+}
+
+// The same random presses after each boot, with the background tasks idle
+// between presses.
+static void trace_run(bool precompute, trace_t* trace) {
+  memset(trace, 0, sizeof(trace_t));
+  boot();
+  srand(6);
+  for (int i = 0; i < PRESSES; i++) {
+    press(REMOTE(rand() % REMOTES), buttons[rand() % 3], trace);
+    idle(precompute);
+  }
+
+  somfy_ctl_stats_t stats;
+  somfy_ctl_get_stats(ctl, &stats);
+  printf("Cache stats: %u hits, %u misses, last hit queued %lld us and last miss %lld us after press.\n",
+    stats.cache_hits, stats.cache_misses, (long long) stats.hit_latency_us, (long long) stats.miss_latency_us);
+  TEST_ASSERT_EQUAL(PRESSES, stats.commands_executed);
+  TEST_ASSERT_EQUAL(trace->hits.presses, stats.cache_hits);
+  shutdown();
+}
+
+static int compare_ns(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return x < y ? -1 : x > y;
+}
+
+// Median host time of the presses, less sensitive to the host than a mean.
+static double median_ns(latency_t* latency) {
+  qsort(latency->host_ns, latency->presses, sizeof(double), compare_ns);
+  return latency->host_ns[latency->presses / 2];
+}
+
+static void print_latency(const char* name, latency_t* latency) {
+  if (latency->presses == 0) {
+    printf("  %s: none\n", name);
+    return;
+  }
+
+  printf("  %s: %u presses, press to first edge %lld us mean and %lld us max, %.0f ns median on the host, "
+    "%.2f NVS writes before the edge\n", name, latency->presses,
+    (long long) (latency->total_us / latency->presses), (long long) latency->max_us,
+    median_ns(latency), (double) latency->flash_writes / latency->presses);
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// Only the first press of each remote after boot builds its frame, and
+// waits for the reservation the loaded config needs. Every later one is
+// served from the cache, without touching flash.
+static void test_presses_after_the_first_hit_the_cache(void) {
+  static trace_t trace;
+  trace_run(true, &trace);
+  printf("Precomputed while idle:\n");
+  print_latency("hits", &trace.hits);
+  print_latency("misses", &trace.misses);
+
+  TEST_ASSERT_EQUAL(REMOTES, trace.misses.presses);
+  TEST_ASSERT_EQUAL(PRESSES - REMOTES, trace.hits.presses);
+  TEST_ASSERT_EQUAL(0, trace.hits.flash_writes);
+  TEST_ASSERT_EQUAL(0, trace.hits.max_us);
+  TEST_ASSERT_GREATER_THAN(0, trace.misses.max_us);
+}
+
+// Without the precompute task, every press allocates its code and builds
+// its frame before the train is queued. The reservations are saved in the
+// background either way: the simulated latency is the same, what a hit
+// saves is the host time of the allocation and the build, a few percent of
+// the press path here.
+static void test_press_latency_against_no_cache(void) {
+  static trace_t cached, built;
+  trace_run(true, &cached);
+  trace_run(false, &built);
+  printf("Never precomputed:\n");
+  print_latency("misses", &built.misses);
+
+  TEST_ASSERT_EQUAL(0, built.hits.presses);
+  TEST_ASSERT_EQUAL(PRESSES, built.misses.presses);
+  int64_t cached_us = cached.hits.total_us + cached.misses.total_us;
+  double hit_ns = median_ns(&cached.hits);
+  double built_ns = median_ns(&built.misses);
+  printf("Press to first edge over %d presses: %lld us simulated with the cache, %lld us without; "
+    "%.0f ns against %.0f ns median on the host.\n",
+    PRESSES, (long long) cached_us, (long long) built.misses.total_us, hit_ns, built_ns);
+  TEST_ASSERT_TRUE(cached_us <= built.misses.total_us);
+  TEST_ASSERT_EQUAL(cached.misses.flash_writes, built.misses.flash_writes);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_presses_after_the_first_hit_the_cache);
+  RUN_TEST(test_press_latency_against_no_cache);
+  return UNITY_END();
+}
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+#include "pulse_backend.h"
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_tag
+#include "somfy.c"
+#undef TAG
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#define TAG somfy_config_nvs_tag
+#include "somfy_config_nvs.c"
+#undef TAG
+#define TAG somfy_config_http_tag
+#include "somfy_config_http.c"
+#undef TAG
+#include "somfy_remote_table.c"
+#include "somfy_encoder.c"
+
+#define REMOTES 4
+
+#define REMOTE(n) (0x100000 + (n))
+
+// Requests of the workload, each one sent by a client that retries it.
+#define REQUESTS 100
+
+// When the client sends each request again after the first time, all
+// within SOMFY_REQUEST_WINDOW_US.
+static const int64_t retries_us[] = { 500000, 2000000, 6000000 };
+
+#define RETRIES (sizeof(retries_us) / sizeof(retries_us[0]))
+
+static const somfy_button_t buttons[] = { BUTTON_UP, BUTTON_DOWN, BUTTON_STOP };
+
+static somfy_config_handle_t config;
+
+static somfy_ctl_t* ctl;
+
+static pulse_ctl_t* pulse;
+
+// What the commands posted cost: trains put on air, rolling codes used,
+// NVS entries written and remotes handed to the replicator.
+typedef struct {
+  uint32_t posted;
+  uint32_t trains;
+  uint32_t codes;
+  uint32_t flash_writes;
+  uint32_t replicated;
+} cost_t;
+
+void setUp(void) {
+  fake_nvs_erase_all();
+  fake_http_reset();
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  fake_time_us = 1000000;
+
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&config));
+  for (int n = 0; n < REMOTES; n++) {
+    somfy_config_remote_handle_t remote;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(NULL, REMOTE(n), 0, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+  }
+
+  pulse_ctl_config_t pulse_cfg = {
+    .max_queue_size = 3,
+    .backend = PULSE_BACKEND_RMT,
+    .rmt_channel = 0,
+    .rmt_mem_block_num = 1,
+    .max_segments = 64,
+  };
+  somfy_ctl_handle_t handle;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_init(config, &pulse_cfg, &handle));
+  ctl = handle;
+  pulse = ctl->pulse_ctl;
+
+  // The tasks never run, the test initializes the controller's channel and
+  // plays what each task would do once woken up.
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(&pulse->channels[0]));
+}
+
+void tearDown(void) {
+  somfy_ctl_free(ctl);
+  TEST_ASSERT_FALSE(pulse_ctl_handle(pulse, fake_task_notified));
+  fake_task_notified = 0;
+  somfy_config_free(config);
+}
+
+static void controller_run(void) {
+  while (fake_task_notified != 0) {
+    uint32_t events = fake_task_notified;
+    fake_task_notified = 0;
+    pulse_ctl_handle(pulse, events);
+  }
+}
+
+static uint32_t codes_used(void) {
+  uint32_t codes = 0;
+  for (int n = 0; n < REMOTES; n++) {
+    somfy_rolling_code_t code;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_get_rolling_code(config, REMOTE(n), &code));
+    codes += code;
+  }
+  return codes;
+}
+
+static void cost_read(cost_t* cost) {
+  somfy_ctl_stats_t stats;
+  somfy_ctl_get_stats(ctl, &stats);
+  cost->trains = stats.commands_executed;
+  cost->codes = codes_used();
+  cost->flash_writes = fake_nvs_writes;
+  cost->replicated = stats.replication.marked;
+}
+
+// Posts command at the time it is due, then lets the scheduler, controller
+// and persist tasks finish with it.
+static void post(somfy_command_t* command, int64_t at_us, cost_t* cost) {
+  fake_time_us = at_us > fake_time_us ? at_us : fake_time_us;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_send_command(ctl, command));
+  cost->posted++;
+  somfy_scheduler_run(ctl);
+  controller_run();
+  while (fake_rmt_end_next() >= 0)
+    controller_run();
+  fake_rmt_clear_log();
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_persist_run(ctl));
+}
+
+// Each request posted once, then as many times again as the client
+// retries it, ids telling whether it carries its request ID. Requests are
+// a minute apart, their retries come before the next one.
+static void workload_run(bool ids, cost_t* cost) {
+  cost_t before;
+  cost_read(&before);
+  memset(cost, 0, sizeof(cost_t));
+  srand(16);
+  int64_t start = fake_time_us;
+  for (int i = 0; i < REQUESTS; i++) {
+    somfy_command_t command = {
+      .remote = REMOTE(rand() % REMOTES),
+      .button = buttons[rand() % 3],
+      .request_id = ids ? 1000 + i : 0,
+    };
+    int64_t at = start + i * 60000000LL;
+    post(&command, at, cost);
+    for (int j = 0; j < RETRIES; j++)
+      post(&command, at + retries_us[j], cost);
+  }
+
+  cost_t after;
+  cost_read(&after);
+  cost->trains = after.trains - before.trains;
+  cost->codes = after.codes - before.codes;
+  cost->flash_writes = after.flash_writes - before.flash_writes;
+  cost->replicated = after.replicated - before.replicated;
+}
+
+static void print_cost(const char* name, cost_t* cost) {
+  printf("  %s: %u commands posted, %u trains, %u rolling codes, %u NVS writes, %u remotes replicated\n",
+    name, cost->posted, cost->trains, cost->codes, cost->flash_writes, cost->replicated);
+}
+
+// A client retrying each request three times within the window costs the
+// radio and the rolling codes as much as a client sending it once, and
+// reserves fewer blocks of codes in flash and on the server.
+static void test_retries_within_window_are_not_sent(void) {
+  cost_t anonymous, identified;
+  workload_run(false, &anonymous);
+  somfy_ctl_stats_t stats;
+  somfy_ctl_get_stats(ctl, &stats);
+  uint32_t duplicates = stats.commands_duplicate;
+  workload_run(true, &identified);
+  somfy_ctl_get_stats(ctl, &stats);
+
+  printf("%d requests, each retried %d times within %lld s:\n", REQUESTS, (int) RETRIES,
+    (long long) (SOMFY_REQUEST_WINDOW_US / 1000000));
+  print_cost("without request IDs", &anonymous);
+  print_cost("with request IDs", &identified);
+  printf("  %u duplicates suppressed.\n", stats.commands_duplicate - duplicates);
+
+  TEST_ASSERT_EQUAL(0, duplicates);
+  TEST_ASSERT_EQUAL(REQUESTS * RETRIES, stats.commands_duplicate);
+  TEST_ASSERT_EQUAL(REQUESTS * (1 + RETRIES), anonymous.trains);
+  TEST_ASSERT_EQUAL(REQUESTS, identified.trains);
+  TEST_ASSERT_EQUAL(anonymous.codes, identified.codes * (1 + RETRIES));
+  // Codes are reserved in blocks: flash and the server see a fraction of
+  // the codes used, fewer codes still mean fewer blocks.
+  TEST_ASSERT_LESS_THAN(anonymous.flash_writes, identified.flash_writes);
+  TEST_ASSERT_LESS_THAN(anonymous.replicated, identified.replicated);
+}
+
+// Past the window, the same request ID is a new command.
+static void test_request_sent_again_after_window(void) {
+  cost_t cost = { 0 };
+  somfy_command_t command = { .remote = REMOTE(0), .button = BUTTON_UP, .request_id = 7 };
+  int64_t start = fake_time_us;
+  post(&command, start, &cost);
+  post(&command, start + SOMFY_REQUEST_WINDOW_US - 1, &cost);
+  post(&command, start + SOMFY_REQUEST_WINDOW_US, &cost);
+
+  somfy_ctl_stats_t stats;
+  somfy_ctl_get_stats(ctl, &stats);
+  TEST_ASSERT_EQUAL(1, stats.commands_duplicate);
+  TEST_ASSERT_EQUAL(2, stats.commands_executed);
+}
+
+// The IDs of the last 16 requests accepted are remembered, an older one
+// is forgotten even within the window.
+static void test_recent_requests_are_bounded(void) {
+  cost_t cost = { 0 };
+  for (uint32_t id = 1; id <= SOMFY_RECENT_REQUESTS + 1; id++) {
+    somfy_command_t command = { .remote = REMOTE(id % REMOTES), .button = BUTTON_UP, .request_id = id };
+    post(&command, fake_time_us, &cost);
+  }
+
+  somfy_command_t newest = { .remote = REMOTE(1), .button = BUTTON_UP, .request_id = SOMFY_RECENT_REQUESTS + 1 };
+  somfy_command_t oldest = { .remote = REMOTE(1), .button = BUTTON_UP, .request_id = 1 };
+  post(&newest, fake_time_us, &cost);
+  post(&oldest, fake_time_us, &cost);
+
+  somfy_ctl_stats_t stats;
+  somfy_ctl_get_stats(ctl, &stats);
+  TEST_ASSERT_EQUAL(1, stats.commands_duplicate);
+  TEST_ASSERT_EQUAL(SOMFY_RECENT_REQUESTS + 2, stats.commands_executed);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_retries_within_window_are_not_sent);
+  RUN_TEST(test_request_sent_again_after_window);
+  RUN_TEST(test_recent_requests_are_bounded);
+  return UNITY_END();
+}
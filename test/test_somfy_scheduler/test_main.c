@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unity.h>
+#include "pulse_backend.h"
+
+// The modules are built into the test, each with its own TAG.
+#define TAG somfy_tag
+#include "somfy.c"
+#undef TAG
+#define TAG somfy_config_tag
+#include "somfy_config.c"
+#undef TAG
+#define TAG somfy_config_nvs_tag
+#include "somfy_config_nvs.c"
+#undef TAG
+#define TAG somfy_config_http_tag
+#include "somfy_config_http.c"
+#undef TAG
+#include "somfy_remote_table.c"
+#include "somfy_encoder.c"
+
+#define REMOTES 24
+
+#define REMOTE(n) (0x100000 + (n))
+
+#define QUEUE_SIZE 3
+
+#define MAX_SENT 1024
+
+// A press of button on remote, at_us into the trace.
+typedef struct {
+  int64_t at_us;
+  int remote;
+  somfy_button_t button;
+} trace_press_t;
+
+// A train put on air: the remote and button of its frame, and when.
+typedef struct {
+  somfy_remote_t remote;
+  somfy_button_t button;
+  int64_t started_us;
+} sent_t;
+
+static somfy_config_handle_t config;
+
+static somfy_ctl_t* ctl;
+
+static pulse_ctl_t* pulse;
+
+static sent_t sent[MAX_SENT];
+
+static size_t sent_count;
+
+static pulse_train_t* on_air;
+
+void setUp(void) {
+  fake_nvs_erase_all();
+  fake_http_reset();
+  memset(&fake_rmt, 0, sizeof(fake_rmt));
+  fake_task_notified = 0;
+  fake_time_us = 1000000;
+  sent_count = 0;
+  on_air = NULL;
+
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_config_new(&config));
+  for (int n = 0; n < REMOTES; n++) {
+    somfy_config_remote_handle_t remote;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_remote_new(NULL, REMOTE(n), 0, &remote));
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_config_add_remote(config, remote));
+  }
+
+  pulse_ctl_config_t pulse_cfg = {
+    .max_queue_size = QUEUE_SIZE,
+    .backend = PULSE_BACKEND_RMT,
+    .rmt_channel = 0,
+    .rmt_mem_block_num = 1,
+    .max_segments = 64,
+  };
+  somfy_ctl_handle_t handle;
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_ctl_init(config, &pulse_cfg, &handle));
+  ctl = handle;
+  pulse = ctl->pulse_ctl;
+
+  // The tasks never run, the test plays what they would do: the controller
+  // initializes its channel and handles the events it receives, the
+  // scheduler sends commands until it would block on the controller.
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_backend_rmt.init(&pulse->channels[0]));
+}
+
+static void air_drain(void);
+
+void tearDown(void) {
+  air_drain();
+  somfy_ctl_free(ctl);
+  TEST_ASSERT_FALSE(pulse_ctl_handle(pulse, fake_task_notified));
+  fake_task_notified = 0;
+  somfy_config_free(config);
+}
+
+// Remote and button of the first frame of train, undoing the obfuscation.
+static void sent_record(pulse_train_t* train) {
+  TEST_ASSERT_LESS_THAN(MAX_SENT, sent_count);
+  const uint8_t* frame = ((somfy_encoder_t*) train->entries[2].state)->frame;
+  uint8_t clear[SOMFY_FRAME_SIZE];
+  clear[0] = frame[0];
+  for (int i = 1; i < SOMFY_FRAME_SIZE; i++)
+    clear[i] = frame[i] ^ frame[i - 1];
+
+  sent_t* record = &sent[sent_count++];
+  record->remote = clear[4] << 16 | clear[5] << 8 | clear[6];
+  record->button = clear[1] >> 4;
+  record->started_us = fake_time_us;
+  TEST_ASSERT_EQUAL(record->remote, train->tag);
+}
+
+static void controller_run(void) {
+  while (fake_task_notified != 0) {
+    uint32_t events = fake_task_notified;
+    fake_task_notified = 0;
+    pulse_ctl_handle(pulse, events);
+    pulse_train_t* current = pulse->channels[0].current;
+    if (current != NULL && current != on_air)
+      sent_record(current);
+    on_air = current;
+  }
+}
+
+// Whether pulse_train_init and pulse_train_send would return at once.
+static bool controller_has_room(void) {
+  pulse_ctl_stats_t stats;
+  pulse_channel_stats_t channel;
+  pulse_ctl_get_stats(pulse, &stats);
+  pulse_ctl_get_channel_stats(pulse, 0, &channel);
+  return stats.pool_in_use < stats.pool_size && channel.queued < QUEUE_SIZE;
+}
+
+// The scheduler task runs above the callers, the controller task above it.
+static void scheduler_run(void) {
+  while (controller_has_room() && somfy_scheduler_step(ctl))
+    controller_run();
+  somfy_persist_run(ctl);
+}
+
+// Plays the trains on air up to until, the scheduler sending commands as
+// room frees up.
+static void air_run(int64_t until) {
+  controller_run();
+  int64_t end_us;
+  while (fake_rmt_next(&end_us) >= 0 && end_us <= until) {
+    fake_rmt_end_next();
+    controller_run();
+    scheduler_run();
+  }
+
+  fake_time_us = until;
+}
+
+// Plays every train on air and every command pending to its end.
+static void air_drain(void) {
+  controller_run();
+  scheduler_run();
+  while (fake_rmt_end_next() >= 0) {
+    controller_run();
+    scheduler_run();
+  }
+}
+
+// Replays the presses of trace, then plays everything they queued. No
+// caller ever waits for the transmitter.
+static void trace_run(const trace_press_t* trace, size_t count, uint32_t* refused) {
+  int64_t start = fake_time_us;
+  *refused = 0;
+  for (size_t i = 0; i < count; i++) {
+    air_run(start + trace[i].at_us);
+    somfy_command_t command = { .remote = REMOTE(trace[i].remote), .button = trace[i].button };
+    int64_t posted = fake_time_us;
+    esp_err_t result = somfy_ctl_send_command(ctl, &command);
+    TEST_ASSERT_EQUAL(posted, fake_time_us);
+    TEST_ASSERT_TRUE(result == ESP_OK || result == ESP_ERR_NO_MEM);
+    *refused += result == ESP_ERR_NO_MEM ? 1 : 0;
+    scheduler_run();
+  }
+
+  air_drain();
+}
+
+// Every remote gets the last command pressed for it, and the commands add
+// up: each one was sent, replaced by a newer one, or refused.
+static void assert_trace(const trace_press_t* trace, size_t count, uint32_t refused, somfy_ctl_stats_t* stats) {
+  somfy_ctl_get_stats(ctl, stats);
+  TEST_ASSERT_EQUAL(count, stats->commands_executed + stats->commands_coalesced + stats->commands_dropped);
+  TEST_ASSERT_EQUAL(refused, stats->commands_dropped);
+  TEST_ASSERT_EQUAL(0, stats->commands_failed);
+  TEST_ASSERT_EQUAL(stats->commands_executed, sent_count);
+
+  for (int n = 0; n < REMOTES; n++) {
+    somfy_button_t last_pressed = 0, last_sent = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (trace[i].remote == n)
+        last_pressed = trace[i].button;
+    }
+    for (size_t i = 0; i < sent_count; i++) {
+      if (sent[i].remote == REMOTE(n))
+        last_sent = sent[i].button;
+    }
+    if (refused == 0)
+      TEST_ASSERT_EQUAL(last_pressed, last_sent);
+  }
+}
+
+static void print_trace(const char* name, size_t count, somfy_ctl_stats_t* stats) {
+  printf("%s: %u presses, %u sent, %u coalesced, %u dropped, first to last start %lld ms.\n", name, (unsigned) count,
+    stats->commands_executed, stats->commands_coalesced, stats->commands_dropped,
+    (long long) (sent[sent_count - 1].started_us - sent[0].started_us) / 1000);
+}
+
+// A scene flaps six blinds UP, DOWN and UP within a second, while the
+// first bursts are on air: the presses still pending are replaced, and
+// every blind ends UP.
+static void test_scene_flapping_is_coalesced(void) {
+  trace_press_t trace[18];
+  for (int n = 0; n < 6; n++) {
+    trace[n] = (trace_press_t) { n * 50000, n, BUTTON_UP };
+    trace[6 + n] = (trace_press_t) { 300000 + n * 50000, n, BUTTON_DOWN };
+    trace[12 + n] = (trace_press_t) { 600000 + n * 50000, n, BUTTON_UP };
+  }
+
+  uint32_t refused;
+  somfy_ctl_stats_t stats;
+  trace_run(trace, 18, &refused);
+  assert_trace(trace, 18, refused, &stats);
+  print_trace("Scene flapping", 18, &stats);
+  TEST_ASSERT_GREATER_THAN(0, stats.commands_coalesced);
+  TEST_ASSERT_LESS_THAN(18, stats.commands_executed);
+}
+
+// STOP pressed while other remotes wait goes out ahead of every command
+// still pending, and once it reaches the controller cuts the burst on air
+// short after its frame. Only the trains already handed to the controller
+// hold it back.
+static void test_stop_goes_first(void) {
+  trace_press_t trace[9];
+  for (int n = 0; n < 8; n++)
+    trace[n] = (trace_press_t) { n * 1000, n, BUTTON_DOWN };
+  trace[8] = (trace_press_t) { 200000, 8, BUTTON_STOP };
+
+  uint32_t refused;
+  somfy_ctl_stats_t stats;
+  int64_t pressed = fake_time_us + trace[8].at_us;
+  trace_run(trace, 9, &refused);
+  assert_trace(trace, 9, refused, &stats);
+
+  size_t stop = 0;
+  while (sent[stop].button != BUTTON_STOP)
+    stop++;
+  int64_t delay = sent[stop].started_us - pressed;
+  print_trace("STOP behind eight DOWN", 9, &stats);
+  printf("  STOP sent %u of 9, %lld ms after press, ahead of %u DOWN pressed before it.\n",
+    (unsigned) stop + 1, (long long) delay / 1000, (unsigned) (sent_count - stop - 1));
+  TEST_ASSERT_EQUAL(REMOTE(8), sent[stop].remote);
+  TEST_ASSERT_LESS_THAN(8, stop);
+  for (size_t i = stop + 1; i < sent_count; i++)
+    TEST_ASSERT_EQUAL(BUTTON_DOWN, sent[i].button);
+  // The DOWN on air when pressed, then a frame of the next one at most.
+  TEST_ASSERT_LESS_THAN(503000 + 143000, delay);
+}
+
+// More remotes pressed at once than the scheduler has slots: the extra ones
+// are refused at once, and counted.
+static void test_overload_is_refused_without_blocking(void) {
+  trace_press_t trace[REMOTES];
+  for (int n = 0; n < REMOTES; n++)
+    trace[n] = (trace_press_t) { n * 100, n, BUTTON_UP };
+
+  uint32_t refused;
+  somfy_ctl_stats_t stats;
+  trace_run(trace, REMOTES, &refused);
+  assert_trace(trace, REMOTES, refused, &stats);
+  print_trace("Overload", REMOTES, &stats);
+  TEST_ASSERT_GREATER_THAN(0, stats.commands_dropped);
+}
+
+// Random bursts of presses on a few remotes, STOP among them.
+static void test_random_bursts(void) {
+  static const somfy_button_t buttons[] = { BUTTON_UP, BUTTON_DOWN, BUTTON_STOP };
+  trace_press_t trace[300];
+  int64_t at = 0;
+  srand(12);
+  for (int i = 0; i < 300; i++) {
+    // Bursts of presses a few ms apart, seconds apart from each other.
+    at += rand() % 8 == 0 ? 2000000 + rand() % 3000000 : rand() % 200000;
+    trace[i] = (trace_press_t) { at, rand() % 6, buttons[rand() % 3] };
+  }
+
+  uint32_t refused;
+  somfy_ctl_stats_t stats;
+  trace_run(trace, 300, &refused);
+  assert_trace(trace, 300, refused, &stats);
+  print_trace("Random bursts", 300, &stats);
+  TEST_ASSERT_EQUAL(0, refused);
+  TEST_ASSERT_GREATER_THAN(0, stats.commands_coalesced);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_scene_flapping_is_coalesced);
+  RUN_TEST(test_stop_goes_first);
+  RUN_TEST(test_overload_is_refused_without_blocking);
+  RUN_TEST(test_random_bursts);
+  return UNITY_END();
+}
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unity.h>
+#include "pulse_backend.h"
+#include "somfy_encoder.c"
+
+// Commands built for each timing.
+#define BUILDS 2000
+
+#define SYMBOL 640
+
+static pulse_ctl_handle_t ctl;
+
+static somfy_segments_t segments;
+
+static const uint8_t frame[SOMFY_FRAME_SIZE] = { 0xA7, 0x2B, 0x16, 0x58, 0x4F, 0x4F, 0x4F };
+
+void setUp(void) {
+  if (ctl == NULL) {
+    pulse_ctl_config_t cfg = {
+      .backend = PULSE_BACKEND_RMT,
+      .max_queue_size = 1,
+      .max_pulses = 512,
+      .max_segments = 64,
+    };
+    ctl = pulse_ctl_new(&cfg);
+    const somfy_profile_t profile = SOMFY_PROFILE_DEFAULT;
+    TEST_ASSERT_EQUAL(ESP_OK, somfy_segments_new(&segments, &profile));
+  }
+}
+
+void tearDown(void) {
+}
+
+// The frame writer before segments, called once per frame with the number
+// of hardware syncs: every pulse of the command went into the train.
+static void reference_frame_write(pulse_train_handle_t train, const uint8_t* data, uint8_t sync) {
+  if (sync == 2) {
+    pulse_train_add_pulse(train, 9415, PULSE_HIGH);
+    pulse_train_add_pulse(train, 89565, PULSE_LOW);
+  }
+
+  for (int i = 0; i < sync; i++) {
+    pulse_train_add_pulse(train, 4 * SYMBOL, PULSE_HIGH);
+    pulse_train_add_pulse(train, 4 * SYMBOL, PULSE_LOW);
+  }
+
+  pulse_train_add_pulse(train, 4550, PULSE_HIGH);
+  pulse_train_add_pulse(train, SYMBOL, PULSE_LOW);
+  for (uint8_t i = 0; i < 56; i++) {
+    bool one = ((data[i / 8] >> (7 - (i % 8))) & 1) == 1;
+    pulse_train_add_pulse(train, SYMBOL, one ? PULSE_LOW : PULSE_HIGH);
+    pulse_train_add_pulse(train, SYMBOL, one ? PULSE_HIGH : PULSE_LOW);
+  }
+
+  pulse_train_add_pulse(train, 30415, PULSE_LOW);
+}
+
+static void reference_write(pulse_train_handle_t train) {
+  reference_frame_write(train, frame, 2);
+  reference_frame_write(train, frame, 7);
+  reference_frame_write(train, frame, 7);
+}
+
+static void encoder_write(pulse_train_handle_t train) {
+  TEST_ASSERT_EQUAL(ESP_OK, somfy_encoder_write(&segments, train, frame));
+}
+
+// Bytes a train holds for one command: its own pulses and its entries.
+static size_t train_bytes(pulse_train_t* train) {
+  return train->count * sizeof(pulse_t) + train->entry_count * sizeof(pulse_entry_t);
+}
+
+static size_t segment_bytes(pulse_segment_handle_t segment) {
+  return ((pulse_segment_t*) segment)->count * sizeof(pulse_t);
+}
+
+// Host time per command built with write, in nanoseconds.
+static double build_ns(void (*write)(pulse_train_handle_t)) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BUILDS; i++) {
+    pulse_train_handle_t train;
+    TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &train));
+    write(train);
+    pulse_train_free(train);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / BUILDS;
+}
+
+// Only the data of each frame is built per command, the rest is shared
+// segments referenced by the train.
+static void test_command_memory(void) {
+  pulse_train_handle_t reference, encoded;
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &reference));
+  TEST_ASSERT_EQUAL(ESP_OK, pulse_train_init(ctl, &encoded));
+  reference_write(reference);
+  encoder_write(encoded);
+  pulse_train_t* before = reference;
+  pulse_train_t* after = encoded;
+  TEST_ASSERT_FALSE(before->overflow);
+  TEST_ASSERT_FALSE(after->overflow);
+
+  size_t shared = segment_bytes(segments.wakeup) + segment_bytes(segments.first_sync) +
+    segment_bytes(segments.repeat_sync) + segment_bytes(segments.gap);
+  printf("Command train: %zu bytes in %u pulses before, %zu bytes in %u pulses and %u entries with segments, "
+    "%zu bytes of segments shared by every train.\n",
+    train_bytes(before), before->count, train_bytes(after), after->count, after->entry_count, shared);
+
+  TEST_ASSERT_EQUAL(0, after->count);
+  TEST_ASSERT_LESS_THAN(train_bytes(before) / 2, train_bytes(after));
+  pulse_train_free(reference);
+  pulse_train_free(encoded);
+}
+
+static void test_command_build_time(void) {
+  double before = build_ns(reference_write);
+  double after = build_ns(encoder_write);
+  printf("Command build: %.0f ns before, %.0f ns with segments, on the host.\n", before, after);
+  TEST_ASSERT_LESS_THAN(before, after);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_command_memory);
+  RUN_TEST(test_command_build_time);
+  return UNITY_END();
+}
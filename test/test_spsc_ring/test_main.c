@@ -0,0 +1,95 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <unity.h>
+#include "spsc_ring.c"
+
+#define ITEMS 1000000
+
+static spsc_ring_t ring;
+
+void setUp(void) {
+  TEST_ASSERT_EQUAL(ESP_OK, spsc_ring_init(&ring, 8));
+}
+
+void tearDown(void) {
+  spsc_ring_free(&ring);
+}
+
+static void test_refuses_capacity_not_power_of_two(void) {
+  spsc_ring_t other;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, spsc_ring_init(&other, 0));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, spsc_ring_init(&other, 6));
+}
+
+static void test_counts_items_dropped_when_full(void) {
+  void* item;
+  TEST_ASSERT_FALSE(spsc_ring_pop(&ring, &item));
+  for (uintptr_t i = 1; i <= 8; i++)
+    TEST_ASSERT_TRUE(spsc_ring_push(&ring, (void*) i));
+  TEST_ASSERT_FALSE(spsc_ring_push(&ring, (void*) 9));
+  TEST_ASSERT_FALSE(spsc_ring_push(&ring, (void*) 10));
+  TEST_ASSERT_EQUAL(2, atomic_load(&ring.overflows));
+
+  for (uintptr_t i = 1; i <= 8; i++) {
+    TEST_ASSERT_TRUE(spsc_ring_pop(&ring, &item));
+    TEST_ASSERT_EQUAL(i, (uintptr_t) item);
+  }
+  TEST_ASSERT_FALSE(spsc_ring_pop(&ring, &item));
+}
+
+static void test_wraps_around(void) {
+  void* item;
+  for (uintptr_t i = 1; i <= 100; i++) {
+    TEST_ASSERT_TRUE(spsc_ring_push(&ring, (void*) i));
+    TEST_ASSERT_TRUE(spsc_ring_push(&ring, (void*) (i + 1000)));
+    TEST_ASSERT_TRUE(spsc_ring_pop(&ring, &item));
+    TEST_ASSERT_EQUAL(i, (uintptr_t) item);
+    TEST_ASSERT_TRUE(spsc_ring_pop(&ring, &item));
+    TEST_ASSERT_EQUAL(i + 1000, (uintptr_t) item);
+  }
+}
+
+static atomic_bool producing;
+
+static void* produce(void* data) {
+  (void) data;
+  for (uintptr_t i = 1; i <= ITEMS; i++)
+    spsc_ring_push(&ring, (void*) i);
+  atomic_store(&producing, false);
+  return NULL;
+}
+
+// The producer never waits, so some items are dropped. Every other one
+// reaches the consumer once, in order.
+static void test_keeps_order_under_contention(void) {
+  pthread_t producer;
+  atomic_store(&producing, true);
+  TEST_ASSERT_EQUAL(0, pthread_create(&producer, NULL, &produce, NULL));
+
+  uint32_t received = 0;
+  uintptr_t last = 0;
+  void* item;
+  while (true) {
+    bool done = !atomic_load(&producing);
+    if (spsc_ring_pop(&ring, &item)) {
+      TEST_ASSERT_GREATER_THAN(last, (uintptr_t) item);
+      last = (uintptr_t) item;
+      received++;
+    }
+    else if (done)
+      break;
+  }
+
+  pthread_join(producer, NULL);
+  TEST_ASSERT_EQUAL_UINT32(ITEMS, received + atomic_load(&ring.overflows));
+  TEST_ASSERT_GREATER_THAN(0, received);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_refuses_capacity_not_power_of_two);
+  RUN_TEST(test_counts_items_dropped_when_full);
+  RUN_TEST(test_wraps_around);
+  RUN_TEST(test_keeps_order_under_contention);
+  return UNITY_END();
+}